@@ -0,0 +1,176 @@
+// Benchmark where compute simulates 1M bodies and culls them to the screen, writing the survivors as quads
+//  which are drawn by the following frame. With async scheduling the compute of a frame overlaps the
+//  rasterization of the previous one, the frame time of each scheduling mode is reported
+
+#include "engine/headless.hpp"
+#include "engine/compute.hpp"
+#include "engine/resource/screenQuad.hpp"
+#include "engine/vulkan/shader.hpp"
+#include "engine/math/random.hpp"
+
+#include <chrono>
+#include <iostream>
+
+constexpr uint32_t bodyCount = 1'000'000, frameCount = 500, warmupFrames = 20;
+constexpr uint32_t width = 1920, height = 1080;
+
+// Moves the bodies, then appends the quads of the ones on screen to the frame's half of the quad buffer
+static const char* simulateShader = R"(
+#version 450
+layout(local_size_x = 256) in;
+
+struct Body { vec2 position, velocity; };
+struct Quad { vec2 position, size; vec4 uvs; uint color; float rotation; uint layer, padding; };
+struct Draw { uint vertexCount, instanceCount, firstVertex, firstInstance; };
+
+layout(std430, binding = 0) buffer Bodies { Body bodies[]; };
+layout(std430, binding = 1) buffer Quads { Quad quads[]; };
+layout(std430, binding = 2) buffer Draws { Draw draws[]; };
+layout(push_constant) uniform Constants { vec2 screen; float deltaTime; uint count, parity; } constants;
+
+const float quadSize = 4;
+
+void main(){
+    uint i = gl_GlobalInvocationID.x;
+    if(i >= constants.count) return;
+
+    // Bodies drift through a region twice the size of the screen (centered on it), wrapping at its edges
+    Body body = bodies[i];
+    vec2 margin = constants.screen / 2;
+    body.position = mod(body.position + body.velocity * constants.deltaTime + margin, constants.screen * 2) - margin;
+    bodies[i] = body;
+
+    // Only the bodies which overlap the screen are drawn
+    vec2 extent = vec2(quadSize / 2);
+    if(any(lessThan(body.position + extent, vec2(0))) || any(greaterThan(body.position - extent, constants.screen))) return;
+    uint slot = atomicAdd(draws[constants.parity].instanceCount, 1);
+    vec4 color = vec4(fract(i * 0.618034), 0.5, 1, 1);
+    quads[constants.parity * constants.count + slot] = Quad(body.position, vec2(quadSize), vec4(0, 0, 1, 1), packUnorm4x8(color), atan(body.velocity.y, body.velocity.x), 0, 0);
+}
+)";
+
+static const char* fragmentShader = R"(
+#version 450
+layout(location = 1) in vec4 tint;
+layout(location = 0) out vec4 color;
+
+void main(){
+    color = tint;
+}
+)";
+
+struct Body {
+    glm::vec2 position, velocity;
+};
+
+struct Constants {
+    glm::vec2 screen;
+    float deltaTime;
+    uint32_t count, parity;
+};
+
+/// Renders <frameCount> frames with the simulation scheduled as requested, returns the average frame time (in ms)
+double run(vpp::Instance& instance, HeadlessState& state, Resource::Ref<GraphicsMaterial> quadMaterial, ComputeState::Scheduling scheduling, uint64_t& frame){
+    ComputeState compute(instance, state.sharedDevice(), scheduling);
+    std::cout << (compute.isAsync() ? "async" : "graphics") << " queue: " << std::flush;
+
+    // The quads and draws are double buffered (one half per image) so compute can write one while the other is drawn
+    vpp::SubBuffer bodies = compute.createStorageBuffer(bodyCount * sizeof(Body));
+    vpp::SubBuffer quads = compute.createStorageBuffer(2 * bodyCount * sizeof(ScreenQuad), false, vk::BufferUsageBits::vertexBuffer);
+    vpp::SubBuffer draws = compute.createStorageBuffer(2 * sizeof(vk::DrawIndirectCommand), false, vk::BufferUsageBits::indirectBuffer);
+
+    Random random;
+    std::vector<Body> initial(bodyCount);
+    for(Body& body: initial){
+        body.position = {random.generate<float>(-0.5f * width, 1.5f * width), random.generate<float>(-0.5f * height, 1.5f * height)};
+        body.velocity = {random.generate<float>(-120, 120), random.generate<float>(-120, 120)};
+    }
+    // Handed to the compute queue's family (and acquired by the first dispatch)
+    compute.upload(bodies, initial);
+
+    vpp::TrDsLayout layout = {state.device(), {
+        ComputeState::storageBufferLayoutBinding(0),
+        ComputeState::storageBufferLayoutBinding(1),
+        ComputeState::storageBufferLayoutBinding(2)}};
+    vpp::TrDs descriptors = state.device().descriptorAllocator().alloc(layout);
+    compute.bindStorageBuffer(descriptors, 0, bodies);
+    compute.bindStorageBuffer(descriptors, 1, quads);
+    compute.bindStorageBuffer(descriptors, 2, draws);
+
+    GLSLShaderModule module(state.device(), str(simulateShader), vk::ShaderStageBits::compute);
+    vk::PushConstantRange range {vk::ShaderStageBits::compute, 0, sizeof(Constants)};
+    Resource::Ref<ComputeMaterial> simulate = ComputeMaterial::create(compute, module.createStageInfo(), nytl::make_span(layout.vkHandle()), nytl::make_span(range));
+
+    // Each dispatch fills the half of the buffers the frame's image draws
+    uint32_t parity = 0;
+    compute.bindCustomCommandRecordingSteps([&](vpp::CommandBuffer& cb, uint8_t){
+        // The previous dispatch must be done moving the bodies
+        ComputeState::recordComputeBarrier(cb);
+        // Reset the draw (the frame which last read it is finished, see the dependencies below)
+        vk::DrawIndirectCommand draw {4, 0, 0, 0};
+        vk::cmdUpdateBuffer(cb, draws.buffer(), draws.offset() + parity * sizeof(draw), sizeof(draw), &draw);
+        vk::MemoryBarrier reset {vk::AccessBits::transferWrite, vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite};
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, vk::PipelineStageBits::computeShader, {}, nytl::make_span(reset), {}, {});
+
+        Constants constants {{width, height}, 1 / 60.f, bodyCount, parity};
+        vk::cmdPushConstants(cb, simulate->getLayout(), vk::ShaderStageBits::compute, 0, sizeof(constants), &constants);
+        simulate->recordDispatch(cb, ComputeMaterial::groupCount(bodyCount, 256), 1, 1, nytl::make_span(descriptors.vkHandle()));
+    });
+
+    // Headless images are used in order, so image i draws the half written for it
+    state.bindCustomCommandRecordingSteps([&](vpp::CommandBuffer& cb, uint8_t i){
+        if(state.inDepthPrepass() || state.inGBufferPass()) return;
+        vk::cmdBindPipeline(cb, vk::PipelineBindPoint::graphics, quadMaterial->getPipeline());
+        ScreenQuad::pushScreenSize(cb, *quadMaterial, state.swapchainExtent());
+        vk::cmdBindVertexBuffers(cb, /*firstBinding*/ 0, 1, quads.buffer(), quads.offset() + vk::DeviceSize(i) * bodyCount * sizeof(ScreenQuad));
+        vk::cmdDrawIndirect(cb, draws.buffer(), draws.offset() + i * sizeof(vk::DrawIndirectCommand), 1, sizeof(vk::DrawIndirectCommand));
+    });
+    // The quads compute released are acquired before the frame's image draws them
+    state.bindCustomFrameRecordingSteps([&](vpp::CommandBuffer& cb, uint32_t, uint32_t){ compute.recordAcquires(cb); });
+    state.rerecordCommandBuffers();
+
+    // Compute only waits for the frame before last (which read the half it writes), so it overlaps the previous frame,
+    //  while every frame waits for the dispatch which wrote its half
+    compute.addDependency(state, vk::PipelineStageBits::transfer | vk::PipelineStageBits::computeShader, /*lag*/ 1);
+    state.addDependency(compute, vk::PipelineStageBits::drawIndirect | vk::PipelineStageBits::vertexInput);
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t f = 0; f < warmupFrames + frameCount; f++, frame++){
+        // Start timing once the pipelines are warm
+        if(f == warmupFrames){
+            state.device().waitIdle();
+            start = std::chrono::steady_clock::now();
+        }
+
+        parity = frame % 2;
+        compute.rerecordCommandBuffers();
+        compute.releaseToGraphics(vpp::BufferSpan(quads, bodyCount * sizeof(ScreenQuad), parity * bodyCount * sizeof(ScreenQuad)), vk::PipelineStageBits::vertexInput, vk::AccessBits::vertexAttributeRead);
+        compute.releaseToGraphics(vpp::BufferSpan(draws, sizeof(vk::DrawIndirectCommand), parity * sizeof(vk::DrawIndirectCommand)), vk::PipelineStageBits::drawIndirect, vk::AccessBits::indirectCommandRead);
+        compute.dispatch();
+        state.mainLoop(frame);
+    }
+    state.device().waitIdle();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frameCount;
+
+    // The next run brings its own compute state
+    state.clearDependencies();
+    state.bindCustomFrameRecordingSteps({});
+    return ms;
+}
+
+int main(){
+    vpp::Instance instance = createHeadlessInstance("Async Compute Benchmark", VK_MAKE_VERSION(0, 0, 1));
+    // Two images, so that the frame's image matches the half of the buffers compute wrote for it
+    HeadlessState state(instance, width, height, vk::Format::r8g8b8a8Unorm, /*imageCount*/ 2);
+    if(!state.device().timelineSemaphores){
+        std::cout << "Ordering compute against rendering requires timeline semaphores, which the device doesn't support" << std::endl;
+        return 0;
+    }
+    Resource::Ref<GraphicsMaterial> quadMaterial = ScreenQuad::createMaterial(state, fragmentShader);
+
+    uint64_t frame = 0;
+    double serialized = run(instance, state, quadMaterial, ComputeState::Scheduling::Graphics, frame);
+    std::cout << serialized << "ms per frame" << std::endl;
+    double async = run(instance, state, quadMaterial, ComputeState::Scheduling::Async, frame);
+    std::cout << async << "ms per frame (" << (serialized / async) << "x)" << std::endl;
+}
@@ -0,0 +1,66 @@
+// Benchmark which draws 100k sprites a frame (spread over two pages) into an offscreen image
+//  and reports the CPU frame time and the GPU time of the render pass
+
+#include "engine/headless.hpp"
+#include "engine/spriteBatch.hpp"
+#include "engine/math/random.hpp"
+
+#include <iostream>
+
+constexpr uint32_t spriteCount = 100'000, frameCount = 500;
+constexpr uint32_t width = 1920, height = 1080;
+
+/// Creates a page holding a checkerboard in each of its two layers
+Resource::Ref<Texture> createPage(VulkanState& state, glm::u8vec4 color){
+    constexpr uint32_t size = 64, layers = 2;
+    std::vector<glm::u8vec4> pixels(size * size * layers);
+    for(uint32_t layer = 0; layer < layers; layer++)
+        for(uint32_t y = 0; y < size; y++)
+            for(uint32_t x = 0; x < size; x++)
+                pixels[(layer * size + y) * size + x] = ((x / 8 + y / 8 + layer) % 2) ? color : glm::u8vec4(255);
+
+    auto page = Texture::create(state);
+    page->setData(vk::Format::r8g8b8a8Unorm, {size, size}, {(const std::byte*) pixels.data(), pixels.size() * sizeof(pixels[0])}, /*levels*/ 1, layers);
+    page->upload(true);
+    return page;
+}
+
+int main(){
+    vpp::Instance instance = createHeadlessInstance("Sprite Benchmark", VK_MAKE_VERSION(0, 0, 1));
+    HeadlessState state(instance, width, height);
+    GPUProfiler* profiler = state.enableGPUProfiling();
+
+    SpriteBatch sprites(state, spriteCount);
+    Resource::Ref<Texture> red = createPage(state, {255, 0, 0, 255}), blue = createPage(state, {0, 0, 255, 255});
+    uint32_t pages[] = {sprites.addPage(red), sprites.addPage(blue)};
+
+    // Give every sprite a random starting point and velocity
+    Random random;
+    std::vector<glm::vec2> positions(spriteCount), velocities(spriteCount);
+    for(uint32_t i = 0; i < spriteCount; i++){
+        positions[i] = {random.generate<float>(0, width), random.generate<float>(0, height)};
+        velocities[i] = {random.generate<float>(-2, 2), random.generate<float>(-2, 2)};
+    }
+
+    state.bindCustomCommandRecordingSteps([&](vpp::CommandBuffer& cb, uint8_t i){ sprites.record(cb, i); });
+    state.bindCustomMainLoopSteps([&](VulkanState&, uint32_t i){ sprites.update(i); });
+    state.rerecordCommandBuffers();
+
+    for(uint64_t frame = 0; frame < frameCount; frame++){
+        // Move the sprites and submit them again
+        sprites.clear();
+        for(uint32_t i = 0; i < spriteCount; i++){
+            positions[i] = glm::mod(positions[i] + velocities[i], glm::vec2(width, height));
+            sprites.draw(pages[i % 2], positions[i], {16, 24}, {0, 0, 1, 1}, /*layer*/ (i / 2) % 2, glm::vec4(1), frame * 0.01f);
+        }
+        state.mainLoop(frame);
+    }
+    state.device().waitIdle();
+
+    FramePacer::Stats cpu = state.getFramePacer().stats();
+    GPUProfiler::Stats gpu = profiler->stats("render pass");
+    const SpriteBatch::Stats& batch = sprites.frameStats();
+    std::cout << batch.sprites << " sprites in " << batch.draws << " draws (" << batch.dropped << " dropped)\n"
+        << "CPU frame: " << cpu.avg << "ms avg, " << cpu.p99 << "ms p99\n"
+        << "GPU render pass: " << gpu.avg << "ms avg, " << gpu.max << "ms max" << std::endl;
+}
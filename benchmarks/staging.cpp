@@ -0,0 +1,54 @@
+// Benchmark which measures how many uploads per second the device's upload engine (and its staging ring)
+//  can push through, for upload sizes from 64B to 64MB
+
+#include "engine/headless.hpp"
+#include "engine/vulkan/upload.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+constexpr vk::DeviceSize minSize = 64, maxSize = 64 * 1024 * 1024;
+// Every size uploads (at least) this many bytes, split over at most <maxUploads> uploads
+constexpr vk::DeviceSize bytesPerSize = 512 * 1024 * 1024;
+constexpr uint64_t maxUploads = 20'000;
+
+int main(){
+    vpp::Instance instance = createHeadlessInstance("Staging Benchmark", VK_MAKE_VERSION(0, 0, 1));
+    HeadlessState state(instance, 64, 64);
+    UploadEngine& engine = state.device().uploadEngine();
+
+    // Every upload lands somewhere in a buffer as large as the largest upload
+    vpp::SubBuffer destination = {state.device().bufferAllocator(), maxSize, vk::BufferUsageBits::transferDst | vk::BufferUsageBits::vertexBuffer, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+    std::vector<std::byte> data(maxSize, std::byte(0x5A));
+
+    std::cout << std::setw(10) << "size" << std::setw(12) << "uploads" << std::setw(16) << "uploads/s" << std::setw(12) << "MB/s"
+        << std::setw(14) << "submissions" << std::setw(8) << "wraps" << "\n";
+
+    uint64_t frame = 0;
+    for(vk::DeviceSize size = minSize; size <= maxSize; size *= 4){
+        uint64_t count = std::min<uint64_t>(maxUploads, std::max<vk::DeviceSize>(bytesPerSize / size, 4));
+        uint64_t startSubmissions = engine.stats().second;
+        uint64_t startWraps = engine.stagingRing().stats().second;
+
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < count; i++){
+            vk::DeviceSize offset = (i * size) % maxSize;
+            engine.upload(vpp::BufferSpan(destination, size, offset), {data.data(), size});
+        }
+        // Time until the copies have finished on the GPU
+        engine.wait(engine.flush());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        uint64_t endSubmissions = engine.stats().second;
+        std::cout << std::setw(10) << size << std::setw(12) << count << std::setw(16) << uint64_t(count / seconds)
+            << std::setw(12) << uint64_t(count * size / seconds / (1024 * 1024)) << std::setw(14) << endSubmissions - startSubmissions
+            << std::setw(8) << engine.stagingRing().stats().second - startWraps << "\n";
+
+        // Render a frame so the uploaded buffers are acquired by the graphics queue (and the staging space is collected)
+        state.mainLoop(frame++);
+        engine.collect();
+    }
+    state.device().waitIdle();
+    std::cout << std::flush;
+}
@@ -0,0 +1,215 @@
+#include "compute.hpp"
+#include "engine/util/profiler.hpp"
+
+#include <cstring>
+
+/// Creates a compute state which submits to the device's compute queue.
+///     If no device info is provided a device is picked automatically.
+ComputeState::ComputeState(vpp::Instance& instance, DeviceCreateInfo deviceInfo, Scheduling scheduling){
+    if(deviceInfo.valid == DeviceCreateInfo::YES){
+        dlg_info("State " + str(id()) + ": Creating compute state from specified device");
+        _device = std::make_unique<VulkDevice>(instance, deviceInfo.device, deviceInfo.info);
+    } else if(deviceInfo.valid == DeviceCreateInfo::SHARED){
+        dlg_info("State " + str(id()) + ": Creating compute state on shared device " + str(deviceInfo.shared->id()));
+        _device = deviceInfo.shared;
+    } else {
+        dlg_info("State " + str(id()) + ": Creating compute state, picking 'best' device.");
+        _device = createDevice(instance);
+    }
+
+    // Overlapping rendering requires a queue from another family (and timeline semaphores to order the work)
+    if(scheduling == Scheduling::Async){
+        queue = device().dedicatedComputeQueue();
+        if(queue && !device().timelineSemaphores) queue = nullptr;
+        if(!queue) dlg_info("State " + str(id()) + ": No dedicated compute queue (or no timeline semaphores), compute work will be scheduled on the graphics queue");
+    }
+    if(!queue) queue = device().presentQueueExcept();
+    createTimeline();
+
+    commandPool = vpp::CommandPool(device(), {(vk::CommandPoolCreateBits) VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, queue->family()});
+
+    buffer.commandBuffer = {commandPool, vk::CommandBufferLevel::primary};
+    acquireCommandBuffer = {commandPool, vk::CommandBufferLevel::primary};
+    releaseCommandBuffer = {commandPool, vk::CommandBufferLevel::primary};
+    // Mark the fence as signaled so that we will bypass it on the first dispatch
+    buffer.fence = {device(), {vk::FenceCreateBits::signaled}};
+}
+
+/// Function which records the custom command recording steps into the state's command buffer
+bool ComputeState::rerecordCommandBuffers(){
+    PROFILE_SCOPE("record compute");
+    // Can't rerecord the commands while they are running
+    wait();
+
+    vk::beginCommandBuffer(buffer.commandBuffer, {});
+    if(customCommandRecordingSteps) customCommandRecordingSteps(buffer.commandBuffer, 0);
+    vk::endCommandBuffer(buffer.commandBuffer);
+    return true;
+}
+
+/// Submits the pre-recorded commands (waiting for the previous submission to finish first.)
+void ComputeState::dispatch(bool waitForCompletion){
+    PROFILE_SCOPE("dispatch");
+    wait();
+
+    UploadEngine& uploads = device().uploadEngine();
+    std::vector<vk::CommandBuffer> commandBuffers;
+    // Buffers uploaded on the transfer queue need to be acquired before they are used
+    //  (only the ones handed to our family, see <upload>; any queue from the family can acquire them)
+    if(uploads.hasPendingAcquires(queue->family())){
+        vk::beginCommandBuffer(acquireCommandBuffer, {vk::CommandBufferUsageBits::oneTimeSubmit});
+        uploads.recordAcquires(acquireCommandBuffer, queue->family());
+        vk::endCommandBuffer(acquireCommandBuffer);
+        commandBuffers.push_back(acquireCommandBuffer.vkHandle());
+    }
+    commandBuffers.push_back(buffer.commandBuffer.vkHandle());
+
+    // Hand any buffers rendering needs over to the graphics queue family
+    if(!pendingReleases.empty()){
+        std::vector<vk::BufferMemoryBarrier> barriers;
+        vk::PipelineStageFlags dstStages = vk::PipelineStageBits::bottomOfPipe;
+        for(Release& release: pendingReleases){
+            vk::BufferMemoryBarrier barrier = release.barrier;
+            // The destination access is ignored by the release half of an ownership transfer
+            if(barrier.srcQueueFamilyIndex != barrier.dstQueueFamilyIndex) barrier.dstAccessMask = {};
+            // Within the same family the barrier must cover the stages which will read the buffer
+            else dstStages |= release.dstStage;
+            barriers.push_back(barrier);
+        }
+
+        vk::beginCommandBuffer(releaseCommandBuffer, {vk::CommandBufferUsageBits::oneTimeSubmit});
+        vk::cmdPipelineBarrier(releaseCommandBuffer, vk::PipelineStageBits::computeShader, dstStages, {}, {}, barriers, {});
+        vk::endCommandBuffer(releaseCommandBuffer);
+        commandBuffers.push_back(releaseCommandBuffer.vkHandle());
+    }
+
+    std::vector<vk::Semaphore> waitSemaphores;
+    std::vector<vk::PipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues;
+    // Wait for any uploads which the GPU hasn't finished yet
+    vk::Semaphore uploadSemaphore = uploads.semaphore();
+    uint64_t uploadValue = uploads.submittedValue();
+    if(uploadSemaphore && uploadValue > uploads.completedValue()){
+        waitSemaphores.push_back(uploadSemaphore);
+        waitStages.push_back(vk::PipelineStageBits::allCommands);
+        waitValues.push_back(uploadValue);
+    }
+    // Wait for the states we depend on (ex the frame which last read our buffers)
+    addDependencyWaits(waitSemaphores, waitStages, waitValues);
+
+    // Advance our timeline once the work finishes
+    uint64_t submission = submissions + 1;
+    vk::Semaphore signalSemaphore = timeline.vkHandle();
+    vk::TimelineSemaphoreSubmitInfo timelineInfo;
+    timelineInfo.waitSemaphoreValueCount = waitValues.size();
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = (signalSemaphore ? 1 : 0);
+    timelineInfo.pSignalSemaphoreValues = &submission;
+
+    vk::SubmitInfo submit {(uint32_t) waitSemaphores.size(), waitSemaphores.data(), waitStages.data(),
+        (uint32_t) commandBuffers.size(), commandBuffers.data(), (uint32_t) (signalSemaphore ? 1 : 0), &signalSemaphore};
+    // Only timeline semaphores are waited on, so the values are only needed if there are any
+    if(!waitSemaphores.empty() || signalSemaphore) submit.pNext = &timelineInfo;
+
+    vk::resetFences(device().vkHandle(), nytl::make_span(buffer.fence.vkHandle()));
+    vk::queueSubmit(queue->vkHandle(), nytl::make_span(submit), buffer.fence.vkHandle());
+    submissions = submission;
+
+    // The graphics queue family now needs to acquire the released buffers
+    pendingAcquires.insert(pendingAcquires.end(), pendingReleases.begin(), pendingReleases.end());
+    pendingReleases.clear();
+
+    if(waitForCompletion) wait();
+}
+
+/// Queues a copy of the data into a buffer read by the compute work on the device's upload engine.
+void ComputeState::upload(vpp::BufferSpan buffer, nytl::span<const std::byte> data, vk::AccessFlags dstAccess){
+    device().uploadEngine().upload(buffer, data, vk::PipelineStageBits::computeShader, dstAccess, queue->family());
+}
+
+/// Queues a buffer written by the compute work to be handed to the graphics queue family at the end of the next dispatch.
+void ComputeState::releaseToGraphics(vpp::BufferSpan span, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess){
+    uint32_t srcFamily = queue->family(), dstFamily = device().presentQueueExcept()->family();
+    // When the families match the barrier is just a memory barrier
+    if(srcFamily == dstFamily) srcFamily = dstFamily = VK_QUEUE_FAMILY_IGNORED;
+
+    vk::BufferMemoryBarrier barrier {vk::AccessBits::shaderWrite, dstAccess, srcFamily, dstFamily, span.buffer(), span.offset(), span.size()};
+    pendingReleases.push_back({barrier, dstStage});
+}
+
+/// Records the acquire half of the ownership transfers into a command buffer which will run on the graphics queue family
+void ComputeState::recordAcquires(vk::CommandBuffer cb){
+    if(pendingAcquires.empty()) return;
+
+    std::vector<vk::BufferMemoryBarrier> barriers;
+    vk::PipelineStageFlags dstStages = {};
+    for(Release& acquire: pendingAcquires){
+        // Queue family transfers were already made visible by the semaphore wait, only the acquire is needed
+        //  (same family barriers were already recorded in full by the release)
+        if(acquire.barrier.srcQueueFamilyIndex == acquire.barrier.dstQueueFamilyIndex) continue;
+        vk::BufferMemoryBarrier barrier = acquire.barrier;
+        barrier.srcAccessMask = {};
+        barriers.push_back(barrier);
+        dstStages |= acquire.dstStage;
+    }
+    pendingAcquires.clear();
+
+    if(!barriers.empty()) vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::topOfPipe, dstStages, {}, {}, barriers, {});
+}
+
+/// Function to be called by the main loop every frame, runs any custom main loop steps and dispatches the work
+bool ComputeState::mainLoop(uint64_t frame){
+    if(customMainLoopSteps) customMainLoopSteps(*this, 0);
+    dispatch();
+    return true;
+}
+
+/// Creates a storage buffer, which can also be copied to and from.
+vpp::SubBuffer ComputeState::createStorageBuffer(vk::DeviceSize size, bool hostVisible, vk::BufferUsageFlags extraUsage) const {
+    vk::BufferUsageFlags usage = vk::BufferUsageBits::storageBuffer | vk::BufferUsageBits::transferSrc | vk::BufferUsageBits::transferDst | extraUsage;
+    if(hostVisible) return {device().bufferAllocator(), size, usage, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+    return {device().bufferAllocator(), size, usage, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+}
+
+/// Points the binding in the descriptor set at the storage buffer
+void ComputeState::bindStorageBuffer(vk::DescriptorSet set, uint32_t binding, const vpp::SubBuffer& storage) const {
+    vk::DescriptorBufferInfo bufferInfo {storage.buffer(), storage.offset(), storage.size()};
+    vk::WriteDescriptorSet write {set, binding, /*firstArrayElem*/ 0, 1, vk::DescriptorType::storageBuffer, /*imgInfo*/ nullptr, &bufferInfo};
+    vk::updateDescriptorSets(device(), nytl::make_span(write), {});
+}
+
+/// Reads the contents of a storage buffer back to the CPU (waits for the last dispatch to finish first)
+std::vector<std::byte> ComputeState::readStorageBuffer(const vpp::SubBuffer& storage){
+    wait();
+
+    // Host visible buffers can be read directly
+    if(storage.memory().mappable()){
+        vpp::MemoryMapView map = storage.memoryMap();
+        return {map.ptr(), map.ptr() + storage.size()};
+    }
+
+    // Otherwise copy it into a host visible buffer first
+    vpp::SubBuffer readback = {device().bufferAllocator(), storage.size(), vk::BufferUsageBits::transferDst, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+    vpp::CommandBuffer cb = {commandPool, vk::CommandBufferLevel::primary};
+    vk::beginCommandBuffer(cb, {vk::CommandBufferUsageBits::oneTimeSubmit});
+    vk::BufferCopy region {storage.offset(), readback.offset(), storage.size()};
+    vk::cmdCopyBuffer(cb, storage.buffer(), readback.buffer(), nytl::make_span(region));
+    // Make the copy visible to the host
+    vk::MemoryBarrier barrier {vk::AccessBits::transferWrite, vk::AccessBits::hostRead};
+    vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, vk::PipelineStageBits::host, {}, nytl::make_span(barrier), {}, {});
+    vk::endCommandBuffer(cb);
+
+    vpp::Fence fence(device());
+    vk::SubmitInfo submit {0, nullptr, nullptr, 1, &cb.vkHandle(), 0, nullptr};
+    vk::queueSubmit(queue->vkHandle(), nytl::make_span(submit), fence);
+    device().waitForFence(fence, UINT64_MAX, /*reset*/ false);
+
+    vpp::MemoryMapView map = readback.memoryMap();
+    return {map.ptr(), map.ptr() + storage.size()};
+}
+
+/// Records a barrier which makes the writes of the previous dispatches visible to the following commands
+void ComputeState::recordComputeBarrier(vk::CommandBuffer cb, vk::PipelineStageFlags dstStages, vk::AccessFlags dstAccess){
+    vk::MemoryBarrier barrier {vk::AccessBits::shaderWrite, dstAccess};
+    vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::computeShader, dstStages, {}, nytl::make_span(barrier), {}, {});
+}
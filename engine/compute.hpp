@@ -0,0 +1,112 @@
+#pragma once
+
+#include "vulkan/common.hpp"
+#include "vulkan/state.hpp"
+
+/// VulkanState which runs compute work instead of rendering.
+///     The custom command recording steps are recorded once (ex with ComputeMaterial::recordDispatch)
+///     and the recording is resubmitted every time the state is dispatched (or its mainLoop is called.)
+///     Can share a device with graphics states, so that the buffers it writes can be rendered from.
+///     With async scheduling work is submitted to a dedicated compute queue so that it overlaps
+///     rendering; dependencies between the states are expressed with addDependency (timeline semaphores)
+///     and buffers handed to rendering are transferred between the queue families with releaseToGraphics
+///     (buffers compute reads should be uploaded with upload, so that they are handed to its family.)
+class ComputeState: public VulkanState {
+public:
+    // Where compute work is submitted
+    enum class Scheduling {
+        // On the graphics queue (serialized with rendering)
+        Graphics,
+        // On a dedicated compute queue if there is one (and timeline semaphores are supported), otherwise on the graphics queue
+        Async
+    };
+
+protected:
+    // A buffer being handed to the graphics queue family
+    struct Release {
+        vk::BufferMemoryBarrier barrier;
+        vk::PipelineStageFlags dstStage;
+    };
+
+    // Queue the work is submitted to
+    const vpp::Queue* queue = nullptr;
+    // The pre-recorded commands (and the fence signaled when their last submission finishes)
+    StateBuffer buffer;
+    // Command buffers which acquire any uploaded buffers before, and release buffers to graphics after, the pre-recorded commands
+    vpp::CommandBuffer acquireCommandBuffer, releaseCommandBuffer;
+    // The number of dispatches which have been submitted
+    uint64_t submissions = 0;
+
+    // Buffers which will be released to graphics by the next dispatch
+    std::vector<Release> pendingReleases;
+    // Buffers which have been released and must be acquired by the graphics queue family
+    std::vector<Release> pendingAcquires;
+
+public:
+    /// Creates a compute state which submits to the device's compute queue.
+    ///     If no device info is provided a device is picked automatically.
+    ComputeState(vpp::Instance&, DeviceCreateInfo deviceInfo = {}, Scheduling scheduling = Scheduling::Async);
+    // The device may outlive the state (if it is shared), so make sure our work isn't still running
+    virtual ~ComputeState() { if(_device) wait(); }
+
+    /// Returns the queue the work is submitted to
+    const vpp::Queue& getQueue() const { return *queue; }
+    /// Returns true if work is submitted to a different queue family than rendering
+    bool isAsync() const { return queue->family() != device().presentQueueExcept()->family(); }
+    /// Returns the number of dispatches which have been submitted
+    uint64_t submittedValue() const override { return submissions; }
+
+    /// Queues a copy of the data into a buffer read by the compute work on the device's upload engine.
+    ///     Ownership is handed to this state's queue family and acquired by the next dispatch (which waits for the copy.)
+    ///     NOTE: uploads made through the upload engine directly are handed to the graphics queue family,
+    ///     so an async state must not read them
+    void upload(vpp::BufferSpan buffer, nytl::span<const std::byte> data, vk::AccessFlags dstAccess = vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite);
+    template <typename T>
+    void upload(vpp::BufferSpan buffer, const std::vector<T>& data, vk::AccessFlags dstAccess = vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite)
+    { upload(buffer, {(const std::byte*) data.data(), data.size() * sizeof(T)}, dstAccess); }
+
+    /// Queues a buffer written by the compute work to be handed to the graphics queue family at the end of the next dispatch.
+    ///     (the memory barrier is recorded even when the families match.) The graphics state must wait on this state
+    ///     (see addDependency) and call recordAcquires in the submission which uses the buffer
+    ///     NOTE: the buffer's contents are discarded when compute uses it again, so it should be fully rewritten every dispatch
+    void releaseToGraphics(vpp::BufferSpan buffer, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess);
+    /// Returns true if there are released buffers the graphics queue family needs to acquire
+    bool hasPendingAcquires() const { return !pendingAcquires.empty(); }
+    /// Records the acquire half of the ownership transfers into a command buffer which will run on the graphics queue family
+    void recordAcquires(vk::CommandBuffer cb);
+
+    /// Function which records the custom command recording steps into the state's command buffer
+    virtual bool rerecordCommandBuffers();
+    /// Submits the pre-recorded commands (waiting for the previous submission to finish first.)
+    ///     If flagged to wait, waits for the work to finish
+    void dispatch(bool wait = false);
+    /// Returns true if the last dispatch has finished
+    bool finished() const { return vk::getFenceStatus(device().vkHandle(), buffer.fence.vkHandle()) == vk::Result::success; }
+    /// Waits for the last dispatch to finish
+    void wait() const { device().waitForFence(buffer.fence.vkHandle(), UINT64_MAX, /*reset*/ false); }
+    /// Function to be called by the main loop every frame, runs any custom main loop steps and dispatches the work
+    virtual bool mainLoop(uint64_t frame);
+
+    /// Creates a storage buffer, which can also be copied to and from.
+    ///     Host visible buffers can be mapped directly, otherwise the buffer is placed in device local memory
+    vpp::SubBuffer createStorageBuffer(vk::DeviceSize size, bool hostVisible = false, vk::BufferUsageFlags extraUsage = {}) const;
+    /// Returns the layout binding of a storage buffer accessible by compute shaders
+    static vk::DescriptorSetLayoutBinding storageBufferLayoutBinding(uint32_t binding = 0, uint32_t count = 1) {
+        return {binding, vk::DescriptorType::storageBuffer, count, vk::ShaderStageBits::compute, nullptr};
+    }
+    /// Points the binding in the descriptor set at the storage buffer
+    void bindStorageBuffer(vk::DescriptorSet set, uint32_t binding, const vpp::SubBuffer& storage) const;
+    /// Reads the contents of a storage buffer back to the CPU (waits for the last dispatch to finish first)
+    std::vector<std::byte> readStorageBuffer(const vpp::SubBuffer& storage);
+    template <typename T>
+    std::vector<T> readStorageBuffer(const vpp::SubBuffer& storage){
+        std::vector<std::byte> bytes = readStorageBuffer(storage);
+        std::vector<T> out(bytes.size() / sizeof(T));
+        std::memcpy(out.data(), bytes.data(), out.size() * sizeof(T));
+        return out;
+    }
+
+    /// Records a barrier which makes the writes of the previous dispatches visible to the following commands
+    static void recordComputeBarrier(vk::CommandBuffer cb, vk::PipelineStageFlags dstStages = vk::PipelineStageBits::computeShader,
+        vk::AccessFlags dstAccess = vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite);
+};
@@ -0,0 +1,187 @@
+#include "headless.hpp"
+#include "engine/util/profiler.hpp"
+
+/// Creates a headless state rendering to <imageCount> images of the specified size and format.
+///     If no device info is provided a device is picked automatically.
+HeadlessState::HeadlessState(vpp::Instance& instance, uint32_t width, uint32_t height, vk::Format _format, uint32_t _imageCount, DeviceCreateInfo deviceInfo)
+  : extent{width, height}, format(_format), imageCount(_imageCount) {
+    if(imageCount == 0) throw std::invalid_argument("State " + str(id()) + ": At least one offscreen image is required.");
+
+    // Create the device (there is no surface it needs to present to)
+    if(deviceInfo.valid == DeviceCreateInfo::YES){
+        dlg_info("State " + str(id()) + ": Creating headless state from specified device");
+        _device = std::make_unique<VulkDevice>(instance, deviceInfo.device, deviceInfo.info);
+    } else if(deviceInfo.valid == DeviceCreateInfo::SHARED){
+        dlg_info("State " + str(id()) + ": Creating headless state on shared device " + str(deviceInfo.shared->id()));
+        _device = deviceInfo.shared;
+    } else {
+        dlg_info("State " + str(id()) + ": Creating headless state, picking 'best' device.");
+        _device = createDevice(instance);
+    }
+
+    // Create a command pool for this state, from the queue with support for both graphics and transfer
+    commandPool = vpp::CommandPool(device(), {(vk::CommandPoolCreateBits) VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, device().presentQueueExcept()->family()});
+
+    // Once rendered the images are ready to be copied back to the CPU
+    targetFinalLayout = vk::ImageLayout::transferSrcOptimal;
+    // Create a renderpass with a single color attachment which will be drawn to the offscreen images
+    GraphicsState::createGraphicsRenderPass({vk::ImageLayout::colorAttachmentOptimal});
+
+    // Create the objects we need to render each frame
+    recreateImages();
+    GraphicsState::recreateRenderBuffers();
+}
+
+/// Returns the images which are rendered to (one render buffer is created for each)
+std::vector<vk::Image> HeadlessState::targetImages(){
+    std::vector<vk::Image> out;
+    for(vpp::Image& image: images) out.push_back(image.vkHandle());
+    return out;
+}
+
+/// (Re)creates the offscreen images
+void HeadlessState::recreateImages(){
+    // Make sure none of the old images are still being rendered to
+    waitForFrames();
+
+    vk::ImageCreateInfo info;
+    info.imageType = vk::ImageType::e2d;
+    info.format = format;
+    info.extent = {extent.width, extent.height, 1};
+    info.mipLevels = 1;
+    info.arrayLayers = 1;
+    info.samples = vk::SampleCountBits::e1;
+    info.tiling = vk::ImageTiling::optimal;
+    info.usage = vk::ImageUsageBits::colorAttachment | vk::ImageUsageBits::transferSrc;
+    info.initialLayout = vk::ImageLayout::undefined;
+
+    images.clear();
+    images.reserve(imageCount);
+    for(uint32_t i = 0; i < imageCount; i++)
+        images.emplace_back(device().devMemAllocator(), info, (unsigned int) vk::MemoryPropertyBits::deviceLocal);
+
+    // The readback buffers need to match the new size
+    readbackBuffers.clear();
+    readbackCommandBuffers.clear();
+}
+
+/// Changes the size of the offscreen images.
+///     Command buffers must be rerecorded after resizing
+void HeadlessState::resize(uint32_t width, uint32_t height){
+    dlg_info("State " + str(id()) + ": Resizing offscreen images");
+    extent = {width, height};
+    recreateImages();
+    GraphicsState::recreateRenderBuffers();
+}
+
+/// Enables (or disables) copying every rendered image into host visible memory.
+///     Command buffers must be rerecorded when this is changed
+void HeadlessState::enableReadback(bool enable){
+    readbackRequested = enable;
+    if(!enable){
+        // The readback copies are submitted with the frames
+        waitForFrames();
+        readbackBuffers.clear();
+        readbackCommandBuffers.clear();
+    }
+}
+
+/// Records the commands which copy each image into its readback buffer
+void HeadlessState::recordReadbackCommandBuffers(){
+    // Readback assumes 4 bytes per pixel
+    vk::DeviceSize size = vk::DeviceSize(extent.width) * extent.height * 4;
+    // The old readback copies (and the buffers they write) may still be executing in submitted frames
+    if(!readbackCommandBuffers.empty()) waitForFrames();
+
+    readbackBuffers.resize(renderBuffers.size());
+    readbackCommandBuffers.resize(renderBuffers.size());
+    repeat(renderBuffers.size(), i){
+        if(readbackBuffers[i].size() != size)
+            readbackBuffers[i] = {device().bufferAllocator(), size, vk::BufferUsageBits::transferDst, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+        // The buffers are allocated from the state's pool (the old ones are freed as they are replaced)
+        readbackCommandBuffers[i] = {commandPool, vk::CommandBufferLevel::primary};
+
+        vpp::CommandBuffer& cb = readbackCommandBuffers[i];
+        vk::beginCommandBuffer(cb, {});
+
+        // Make sure rendering has finished writing to the image before it is copied
+        vk::ImageMemoryBarrier rendered;
+        rendered.srcAccessMask = vk::AccessBits::colorAttachmentWrite;
+        rendered.dstAccessMask = vk::AccessBits::transferRead;
+        rendered.oldLayout = rendered.newLayout = vk::ImageLayout::transferSrcOptimal;
+        rendered.srcQueueFamilyIndex = rendered.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        rendered.image = renderBuffers[i].image;
+        rendered.subresourceRange = {vk::ImageAspectBits::color, 0, 1, 0, 1};
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::colorAttachmentOutput, vk::PipelineStageBits::transfer, {}, {}, {}, nytl::make_span(rendered));
+
+        vk::BufferImageCopy region;
+        region.bufferOffset = readbackBuffers[i].offset();
+        region.imageSubresource = {vk::ImageAspectBits::color, 0, 0, 1};
+        region.imageExtent = {extent.width, extent.height, 1};
+        vk::cmdCopyImageToBuffer(cb, renderBuffers[i].image, vk::ImageLayout::transferSrcOptimal, readbackBuffers[i].buffer(), nytl::make_span(region));
+
+        // Make the copy visible to the host once the frame's fence signals
+        vk::BufferMemoryBarrier copied;
+        copied.srcAccessMask = vk::AccessBits::transferWrite;
+        copied.dstAccessMask = vk::AccessBits::hostRead;
+        copied.srcQueueFamilyIndex = copied.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        copied.buffer = readbackBuffers[i].buffer();
+        copied.offset = readbackBuffers[i].offset();
+        copied.size = size;
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, vk::PipelineStageBits::host, {}, {}, nytl::make_span(copied), {});
+
+        vk::endCommandBuffer(cb);
+    }
+}
+
+/// Waits for the specified image to finish rendering and returns its pixels (rows are tightly packed)
+std::vector<std::byte> HeadlessState::readback(uint32_t image){
+    if(!readbackRequested || image >= readbackBuffers.size())
+        throw std::runtime_error("State " + str(id()) + ": Readback isn't enabled (or the command buffers haven't been rerecorded.)");
+
+    // Wait for the frame rendering to the image to finish
+    if(renderBuffers[image].inFlight) device().waitForFence(renderBuffers[image].inFlight, UINT64_MAX, /*reset*/ false);
+
+    vpp::MemoryMapView map = readbackBuffers[image].memoryMap();
+    return {map.ptr(), map.ptr() + readbackBuffers[image].size()};
+}
+
+/// Function which records to the command buffers (and the readback commands)
+bool HeadlessState::rerecordCommandBuffers(){
+    if(!GraphicsState::rerecordCommandBuffers()) return false;
+    if(readbackRequested) recordReadbackCommandBuffers();
+    return true;
+}
+
+/// Function to be called by the main loop every frame.
+///     Renders the next image in the ring
+bool HeadlessState::mainLoop(uint64_t frame){
+    {
+        PROFILE_SCOPE("pace");
+        // Wait until the next frame should start (if the frame rate is limited)
+        framePacer.wait();
+    }
+    PROFILE_FRAME();
+    // Objects owned by this frame
+    uint32_t f = frame % frames.size();
+    FrameData& current = frames[f];
+
+    // Wait for the last submission using this frame's objects to finish
+    device().waitForFence(current.fence.vkHandle(), UINT64_MAX, /*reset*/ false);
+    frameFinished(current);
+
+    // There is no swapchain to acquire from, just cycle through the images
+    uint32_t i = frame % renderBuffers.size();
+    // Wait for any previous frame still rendering to this image to finish
+    waitForImage(current, i);
+
+    if(customMainLoopSteps) customMainLoopSteps(*this, i);
+
+    // Render the image (and copy it back to the CPU if requested)
+    std::vector<vk::CommandBuffer> extra;
+    if(readbackRequested && i < readbackCommandBuffers.size()) extra.push_back(readbackCommandBuffers[i].vkHandle());
+    submitFrame(current, f, i, extra);
+    lastImage = i;
+
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "vulkan/common.hpp"
+#include "vulkan/state.hpp"
+
+/// GraphicsState which renders into a ring of offscreen images instead of a window's swapchain.
+///     Follows the same mainLoop/rerecordCommandBuffers contract as a Window, but needs neither
+///     GLFW nor a surface (so it can run on display-less machines and software drivers like lavapipe.)
+///     The rendered images can optionally be read back to the CPU.
+class HeadlessState: public GraphicsState {
+protected:
+    // Size and format of the offscreen images
+    vk::Extent2D extent;
+    vk::Format format;
+    // The ring of images which are rendered to
+    uint32_t imageCount;
+    std::vector<vpp::Image> images;
+
+    // Host visible copies of each image (and the commands which copy into them) when readback is enabled
+    bool readbackRequested = false;
+    std::vector<vpp::SubBuffer> readbackBuffers;
+    std::vector<vpp::CommandBuffer> readbackCommandBuffers;
+    // The image which was most recently submitted
+    uint32_t lastImage = 0;
+
+protected:
+    /// Returns the images which are rendered to (one render buffer is created for each)
+    std::vector<vk::Image> targetImages() override;
+    /// (Re)creates the offscreen images
+    void recreateImages();
+    /// Records the commands which copy each image into its readback buffer
+    void recordReadbackCommandBuffers();
+
+public:
+    /// Creates a headless state rendering to <imageCount> images of the specified size and format.
+    ///     If no device info is provided a device is picked automatically.
+    ///     NOTE: readback assumes a format with 4 bytes per pixel
+    HeadlessState(vpp::Instance&, uint32_t width = 800, uint32_t height = 600, vk::Format format = vk::Format::r8g8b8a8Unorm, uint32_t imageCount = 3, DeviceCreateInfo deviceInfo = {});
+
+    /// Gets the width and height of the offscreen images
+    vk::Extent2D swapchainExtent(vk::PhysicalDevice pd = {}, bool ignoreCache = false) override { return extent; }
+    /// Gets the format of the offscreen images
+    vk::SurfaceFormatKHR swapchainFormat(vk::PhysicalDevice pd = {}, bool ignoreCache = false) override { return {format, vk::ColorSpaceKHR::srgbNonlinear}; }
+
+    /// Changes the size of the offscreen images.
+    ///     Command buffers must be rerecorded after resizing
+    void resize(uint32_t width, uint32_t height);
+
+    /// Enables (or disables) copying every rendered image into host visible memory.
+    ///     Command buffers must be rerecorded when this is changed
+    void enableReadback(bool enable = true);
+    /// Returns true if rendered images are copied back to the CPU
+    bool readbackEnabled() const { return readbackRequested; }
+    /// Waits for the specified image to finish rendering and returns its pixels (rows are tightly packed)
+    std::vector<std::byte> readback(uint32_t image);
+    /// Waits for the most recently submitted image to finish rendering and returns its pixels
+    std::vector<std::byte> readback() { return readback(lastImage); }
+
+    /// Function which records to the command buffers (and the readback commands)
+    virtual bool rerecordCommandBuffers();
+    /// Function to be called by the main loop every frame.
+    ///     Renders the next image in the ring
+    virtual bool mainLoop(uint64_t frame);
+};
@@ -12,6 +12,18 @@ std::vector<Resource::Upload> Resource::waitUploads(std::vector<Resource::Upload
     return {};
 }
 
+std::vector<Resource::Upload> Resource::upload(bool wait){
+    // Submit everything this resource needs in a single batch
+    UploadBatch batch;
+    upload(batch);
+    std::vector<Resource::Upload> runningUploads = batch.flush();
+
+    // If we should wait for this upload to finish, do so
+    if(wait) return waitUploads(runningUploads);
+    // If we shouldn't wait for the uploads, return references to each of them
+    return runningUploads;
+}
+
 Resource::Ref<Resource> Resource::create(const str name) {
     // Create memory for the resource
     Resource* _new = new Resource(Resource::Type::Null);
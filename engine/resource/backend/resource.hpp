@@ -2,6 +2,7 @@
 #define __RESOURCE_BACKEND_H__
 
 #include "engine/vulkan/common.hpp"
+#include "engine/vulkan/upload.hpp"
 #include "engine/util/string.hpp"
 
 #include <fstream>
@@ -13,28 +14,11 @@ class Resource: public nytl::NonMovable {
 friend class Ref;
 friend class ResourceManager;
 public:
-    // Struct representing data being uploaded to the cpu
-    struct Upload {
-        // ID in a device's submission queue representing this upload
-        uint32_t waitID = UINT32_MAX;
-        // The command buffer handle representing the upload
-        vpp::CommandBuffer commandBuffer;
-        // The queue which was used to create this upload
-        vpp::QueueSubmitter& queueSubmitter;
-
-        Upload(uint32_t id, vpp::CommandBuffer&& cb, vpp::QueueSubmitter& submit): waitID(id), commandBuffer(std::move(cb)), queueSubmitter(submit) {}
-        /// Move constructor marks the other upload as invalid
-        Upload(Upload&& other) : waitID(other.waitID), commandBuffer(std::move(other.commandBuffer)), queueSubmitter(other.queueSubmitter){ other.waitID = UINT32_MAX; }
-        /// When this object goes out of scope, make sure upload has finished
-        ~Upload() { if (waitID != UINT32_MAX) wait(); }
-
-        /// Wait for the upload represented by this object to finish and mark
-        ///     it as invalidated
-        void wait() { queueSubmitter.wait(waitID); waitID = UINT32_MAX; }
-    };
+    // Handle representing data being uploaded to the gpu
+    using Upload = UploadTicket;
 public:
     // Enum which provides reflection on what kind of reference this is.
-    enum Type {Null = 0, Mesh, Material, GraphicsMaterial};
+    enum Type {Null = 0, Mesh, Material, GraphicsMaterial, ComputeMaterial, Texture, Font, ParticleSystem, LightList};
     /// Function which converts a resource type into a str
     static str type2str(Type type){
         switch(type){
@@ -42,6 +26,11 @@ public:
         case Mesh: return "Mesh";
         case Material: return "Material";
         case GraphicsMaterial: return "GraphicsMaterial";
+        case ComputeMaterial: return "ComputeMaterial";
+        case Texture: return "Texture";
+        case Font: return "Font";
+        case ParticleSystem: return "ParticleSystem";
+        case LightList: return "LightList";
         }
     }
 
@@ -103,15 +92,17 @@ public:
     Resource(Type _type) : type(_type) {};
     virtual ~Resource() { refs = 0; conditionalReset(); }
 
-    /// Returns the name of the resource
-    FORCE_INLINE const str getName(bool stripState = true) const { return (stripState ? name.split<str>("~")[0] : name); }
+    /// Returns the name of the resource (optionally without the device it belongs to)
+    FORCE_INLINE const str getName(bool stripDevice = true) const { return (stripDevice ? name.split<str>("~")[0] : name); }
 
 // Function which must be overriden in derived classes
 public:
     /// Function which cleans up after this resource
     virtual void reset() {};
+    /// Function which queues all of the data which this reference may need to send to the gpu in the batch
+    virtual void upload(UploadBatch&) {};
     /// Function which uploads all of the data which this reference may need to send to the gpu
-    virtual std::vector<Upload> upload(bool wait = true) { return {}; };
+    std::vector<Upload> upload(bool wait = true);
     /// Function which waits for any currently running uploads to finish
     static std::vector<Upload> waitUploads(std::vector<Upload>& runningUploads);
 
@@ -42,15 +42,21 @@ public:
         return ptr->second;
     }
 
+    /// Attaches the device the state renders with to the name (if it isn't already attached)
+    static str deviceName(VulkanState& state, str name){
+        if(!name.contains("~D")) name += "~D" + str(state.device().id());
+        return name;
+    }
+
     /// Begins managing an existing resource
-    ///     (tracks seperate instances for unique states).
+    ///     (tracks seperate instances for unique devices, states sharing a device share resources).
     ///     NOTE: Insures that the name stored in the managed resource matches its name in the table
     template<class T>
     Resource::Ref<T> add(VulkanState& state, str name, Resource& ref) {
         // Create the resource name if nessicary
         if(name.size() == 0) name = createName(ref.type);
-        // Attach the state name if nessicary
-        if(!name.contains("~S")) name += "~S" + str(state.id());
+        // Attach the device name if nessicary
+        name = deviceName(state, name);
 
         // Call the add function now that proper name has been created
         return add<T>(name, ref);
@@ -93,11 +99,11 @@ public:
     FORCE_INLINE Resource::Ref<Resource> operator[] (const str&& name) { return get<Resource>(name, false); }
 
     /// Gets a reference to the specified resource
-    ///     (Specific to the provided state)
+    ///     (Specific to the device the provided state renders with)
     template<class T>
     Resource::Ref<T> get(VulkanState& state, str name, bool createIfNeeded = false){
-        // Attach the state name if nessicary
-        if(!name.contains("~S")) name += "~S" + str(state.id());
+        // Attach the device name if nessicary
+        name = deviceName(state, name);
 
         // If the resource is not already loaded
         if(!loaded(name)){
@@ -109,14 +115,12 @@ public:
     }
 
     /// Upload all of the data any of the resources may need to upload to the GPU
-    ///     (trys to do so in as parallelized a manor as possible)
+    ///     (the copies of every resource are batched into a single submission per device)
     std::vector<Resource::Upload> upload(bool wait = true){
-        std::vector<Resource::Upload> runningUploads;
-        for(auto& resource: loadedResources){
-            std::vector<Resource::Upload> merge = resource.second->upload(false);
-            for (Resource::Upload& upload: merge)
-                runningUploads.emplace_back(std::move(upload));
-        }
+        UploadBatch batch;
+        for(auto& resource: loadedResources)
+            resource.second->upload(batch);
+        std::vector<Resource::Upload> runningUploads = batch.flush();
 
         // If we should wait for the running uploads, do so
         if(wait) return Resource::waitUploads(runningUploads);
@@ -0,0 +1,385 @@
+#include "font.hpp"
+#include "engine/vulkan/sampler.hpp"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+// The atlas holds the coverage of each texel
+static const char* fragmentShader = R"(
+#version 450
+layout(set = 0, binding = 0) uniform sampler2DArray atlas;
+
+layout(location = 0) in vec3 uv;
+layout(location = 1) in vec4 tint;
+layout(location = 0) out vec4 color;
+
+void main(){
+    color = vec4(tint.rgb, tint.a * texture(atlas, uv).r);
+}
+)";
+
+Font::Font(GraphicsState& state) : Resource(Resource::Type::Font), device(state.sharedDevice()) {
+    if(FT_Init_FreeType(&library)) throw std::runtime_error("Failed to initialize FreeType.");
+
+    // Create the atlas, every layer is packed before moving on to the next
+    vk::ImageCreateInfo imageInfo {{}, vk::ImageType::e2d, vk::Format::r8Unorm, {atlasSize, atlasSize, 1},
+        /*levels*/ 1, atlasLayers, vk::SampleCountBits::e1, vk::ImageTiling::optimal, vk::ImageUsageBits::sampled | vk::ImageUsageBits::transferDst,
+        vk::SharingMode::exclusive, 0, nullptr, vk::ImageLayout::undefined};
+    atlas = {device->devMemAllocator(), imageInfo, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+    atlasView = {*device, {/*flags*/ {}, atlas, vk::ImageViewType::e2dArray, vk::Format::r8Unorm,
+        {vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity},
+        {vk::ImageAspectBits::color, 0, 1, 0, atlasLayers}}};
+
+    atlasLayout = {*device, {{0, vk::DescriptorType::combinedImageSampler, 1, vk::ShaderStageBits::fragment, nullptr}}};
+    atlasDescriptors = device->descriptorAllocator().alloc(atlasLayout);
+    vk::DescriptorImageInfo imageDescriptor {device->samplerCache().get(vk::Filter::linear, vk::SamplerAddressMode::clampToEdge), atlasView, vk::ImageLayout::shaderReadOnlyOptimal};
+    vk::WriteDescriptorSet write {atlasDescriptors, 0, 0, 1, vk::DescriptorType::combinedImageSampler, &imageDescriptor, nullptr, nullptr};
+    vk::updateDescriptorSets(*device, nytl::make_span(write), {});
+
+    material = ScreenQuad::createMaterial(state, fragmentShader, nytl::make_span(atlasLayout.vkHandle()));
+}
+
+Font::~Font(){
+    if(face) FT_Done_Face(face);
+    if(library) FT_Done_FreeType(library);
+}
+
+Resource::Ref<Font> Font::create(GraphicsState& state, const str name){
+    // Create memory for the resource
+    Font* _new = new Font(state);
+    // Add a reference to the resource's memory to the ResourceManager and return a reference
+    return ResourceManager::singleton()->add<Font>(state, name, *_new);
+}
+
+/// Loads a font file FreeType understands (ex TTF or OTF) whose glyphs are rasterized <pixelHeight> pixels tall
+Resource::Ref<Font> Font::load(GraphicsState& state, std::istream& file, uint32_t pixelHeight, const str name){
+    // FreeType reads from the data for as long as the face exists
+    std::vector<std::byte> data;
+    std::transform(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>(), std::back_inserter(data), [](char c){ return std::byte(c); });
+    if(data.empty()) throw std::runtime_error("Failed to read font file.");
+
+    auto out = create(state, name);
+    out->fontData = std::move(data);
+    if(FT_New_Memory_Face(out->library, (const FT_Byte*) out->fontData.data(), out->fontData.size(), 0, &out->face)
+      || FT_Set_Pixel_Sizes(out->face, 0, pixelHeight))
+        throw std::runtime_error("Failed to load font '" + out->getName() + "'.");
+
+    // Metrics are stored in 26.6 fixed point
+    out->ascender = out->face->size->metrics.ascender / 64.f;
+    out->lineHeight = out->face->size->metrics.height / 64.f;
+    return out;
+}
+
+/// Finds room for a glyph in the atlas, returns false if it is full
+bool Font::pack(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y, uint32_t& layer){
+    // Glyphs are separated by a pixel so that filtering doesn't bleed between them
+    constexpr uint32_t padding = 1;
+    if(width + 2 * padding > atlasSize || height + 2 * padding > atlasSize) return false;
+
+    // Start a new shelf when the current one is out of room, and a new layer when there is no room for another shelf
+    if(packCursor.x + width + padding > atlasSize){
+        packCursor = {padding, packCursor.y + shelfHeight + padding};
+        shelfHeight = 0;
+    }
+    if(packCursor.y + height + padding > atlasSize){
+        if(packLayer + 1 >= atlasLayers) return false;
+        packLayer++;
+        packCursor = glm::uvec2(padding);
+        shelfHeight = 0;
+    }
+
+    x = packCursor.x;
+    y = packCursor.y;
+    layer = packLayer;
+    packCursor.x += width + padding;
+    shelfHeight = std::max(shelfHeight, height);
+    return true;
+}
+
+/// Returns the glyph of a (unicode) code point, rasterizing it if it hasn't been rasterized yet
+const Font::Glyph& Font::glyph(uint32_t codepoint){
+    if(auto found = glyphs.find(codepoint); found != glyphs.end()) return found->second;
+    if(!face) throw std::runtime_error("Font '" + getName() + "' has no font file loaded.");
+
+    Glyph& out = glyphs[codepoint];
+    out.index = FT_Get_Char_Index(face, codepoint);
+    if(FT_Load_Glyph(face, out.index, FT_LOAD_RENDER)){
+        dlg_warn("Failed to rasterize code point " + str(codepoint) + " in font '" + getName() + "'.");
+        return out;
+    }
+
+    FT_GlyphSlot slot = face->glyph;
+    const FT_Bitmap& bitmap = slot->bitmap;
+    out.advance = slot->advance.x / 64.f;
+    out.bearing = {slot->bitmap_left, slot->bitmap_top};
+    // Whitespace has nothing to draw
+    if(bitmap.width == 0 || bitmap.rows == 0) return out;
+
+    uint32_t x, y, layer;
+    if(!pack(bitmap.width, bitmap.rows, x, y, layer)){
+        dlg_error("The glyph atlas of font '" + getName() + "' is full, code point " + str(codepoint) + " won't be drawn.");
+        return out;
+    }
+    out.size = {bitmap.width, bitmap.rows};
+    out.uvs = glm::vec4(x, y, x + bitmap.width, y + bitmap.rows) / float(atlasSize);
+    out.layer = layer;
+
+    // Copy the (tightly packed) coverage into the pending pixels, buffer to image copies must start at multiples of 4
+    size_t offset = (pendingPixels.size() + 3) & ~size_t(3);
+    pendingPixels.resize(offset + bitmap.width * bitmap.rows);
+    for(uint32_t row = 0; row < bitmap.rows; row++)
+        std::memcpy(pendingPixels.data() + offset + row * bitmap.width, bitmap.buffer + row * bitmap.pitch, bitmap.width);
+    pendingGlyphs.push_back({offset, x, y, bitmap.width, bitmap.rows, layer});
+    return out;
+}
+
+/// Decodes the next code point of a UTF-8 string (invalid bytes are replaced with U+FFFD)
+uint32_t Font::decodeUTF8(const std::string& text, size_t& i){
+    uint8_t lead = text[i++];
+    if(lead < 0x80) return lead;
+
+    uint32_t length = (lead >= 0xF0) ? 3 : (lead >= 0xE0) ? 2 : (lead >= 0xC0) ? 1 : 0;
+    if(length == 0) return 0xFFFD;
+    uint32_t codepoint = lead & (0x3F >> length);
+    for(uint32_t j = 0; j < length; j++, i++){
+        if(i >= text.size() || (uint8_t(text[i]) & 0xC0) != 0x80) return 0xFFFD;
+        codepoint = (codepoint << 6) | (uint8_t(text[i]) & 0x3F);
+    }
+    return codepoint;
+}
+
+/// Returns the layout of a (UTF-8) string, shaping it if it isn't cached
+std::shared_ptr<const Font::Run> Font::shape(const std::string& text){
+    if(auto found = runs.find(text); found != runs.end()) return found->second;
+    if(!face) throw std::runtime_error("Font '" + getName() + "' has no font file loaded.");
+
+    auto run = std::make_shared<Run>();
+    bool kerning = FT_HAS_KERNING(face);
+    // The pen starts on the baseline of the first line
+    glm::vec2 pen = {0, ascender};
+    uint32_t previous = 0;
+    for(size_t i = 0; i < text.size(); ){
+        uint32_t codepoint = decodeUTF8(text, i);
+        if(codepoint == '\n'){
+            pen = {0, pen.y + lineHeight};
+            previous = 0;
+            continue;
+        }
+
+        const Glyph& g = glyph(codepoint);
+        if(kerning && previous && g.index){
+            FT_Vector delta;
+            if(!FT_Get_Kerning(face, previous, g.index, FT_KERNING_DEFAULT, &delta)) pen.x += delta.x / 64.f;
+        }
+        if(g.size.x > 0) run->quads.push_back({pen + glm::vec2(g.bearing.x, -g.bearing.y), g.size, g.uvs, g.layer});
+
+        pen.x += g.advance;
+        run->size.x = std::max(run->size.x, pen.x);
+        previous = g.index;
+    }
+    run->size.y = pen.y - ascender + lineHeight;
+
+    runs.emplace(text, run);
+    return run;
+}
+
+/// Forgets the shaped strings which no labels are using
+void Font::trimCache(){
+    for(auto it = runs.begin(); it != runs.end(); )
+        if(it->second.use_count() == 1) it = runs.erase(it);
+        else ++it;
+}
+
+/// Adds a label drawing the text with its top left corner at <position>, returning its ID
+uint32_t Font::addLabel(const std::string& text, glm::vec2 position, glm::vec4 color, float scale){
+    labels.emplace(nextLabel, Label{shape(text), position, color, scale});
+    labelsDirty = true;
+    return nextLabel++;
+}
+
+/// Changes the text of a label
+void Font::setLabelText(uint32_t label, const std::string& text){
+    Label& l = labels.at(label);
+    std::shared_ptr<const Run> run = shape(text);
+    if(run == l.run) return;
+    l.run = run;
+    labelsDirty = true;
+}
+
+/// Moves a label
+void Font::setLabelPosition(uint32_t label, glm::vec2 position){
+    labels.at(label).position = position;
+    labelsDirty = true;
+}
+
+/// Changes the color of a label
+void Font::setLabelColor(uint32_t label, glm::vec4 color){
+    labels.at(label).color = color;
+    labelsDirty = true;
+}
+
+/// Removes a label
+void Font::removeLabel(uint32_t label){
+    if(labels.erase(label)) labelsDirty = true;
+}
+
+/// Records copying the glyphs rasterized since the last call into the atlas, and the labels into the glyph buffer if they changed.
+void Font::recordUploads(vpp::CommandBuffer& cb, uint32_t frame){
+    bool atlasChanged = !atlasInitialized || !pendingGlyphs.empty();
+    if(!atlasChanged && !labelsDirty) return;
+
+    // Gather the glyphs of every label (quads are positioned by their centers)
+    std::vector<GlyphInstance> instances;
+    if(labelsDirty){
+        for(auto& [id, label]: labels){
+            uint32_t color = ScreenQuad::packColor(label.color);
+            for(const Quad& quad: label.run->quads)
+                instances.push_back({label.position + (quad.offset + quad.size / 2.f) * label.scale, quad.size * label.scale, quad.uvs, color, /*rotation*/ 0, quad.layer});
+        }
+        glyphCount = instances.size();
+
+        // Replace the buffer if the glyphs don't fit, the command buffers keep drawing the old one (which doesn't change anymore) until they are rerecorded
+        if(glyphCount > glyphCapacity){
+            if(glyphBuffer.size()) retiredBuffers.push_back({std::move(glyphBuffer), bufferGeneration});
+            glyphCapacity = std::max<uint32_t>(64, glyphCapacity);
+            while(glyphCapacity < glyphCount) glyphCapacity *= 2;
+            glyphBuffer = {device->bufferAllocator(), sizeof(vk::DrawIndirectCommand) + glyphCapacity * sizeof(GlyphInstance),
+                vk::BufferUsageBits::vertexBuffer | vk::BufferUsageBits::indirectBuffer | vk::BufferUsageBits::transferDst, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+            bufferGeneration++;
+        }
+    }
+    // The labels follow the pending pixels in the staging buffer (buffer to image copies must start at multiples of 4)
+    size_t labelOffset = (pendingPixels.size() + 3) & ~size_t(3);
+    size_t labelBytes = (labelsDirty && glyphBuffer.size()) ? sizeof(vk::DrawIndirectCommand) + instances.size() * sizeof(GlyphInstance) : 0;
+    labelsDirty = false;
+
+    // The frame's previous staging buffer is no longer in use (its fence has signaled)
+    if(staging.size() <= frame) staging.resize(frame + 1);
+    vpp::SubBuffer& buffer = staging[frame];
+    if(!pendingGlyphs.empty() || labelBytes){
+        if(buffer.size() < labelOffset + labelBytes)
+            buffer = {device->bufferAllocator(), labelOffset + labelBytes, vk::BufferUsageBits::transferSrc, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+        vpp::MemoryMapView map = buffer.memoryMap();
+        std::memcpy(map.ptr(), pendingPixels.data(), pendingPixels.size());
+        if(labelBytes){
+            vk::DrawIndirectCommand draw {/*vertexCount*/ 4, /*instanceCount*/ glyphCount, /*firstVertex*/ 0, /*firstInstance*/ 0};
+            std::memcpy(map.ptr() + labelOffset, &draw, sizeof(draw));
+            std::memcpy(map.ptr() + labelOffset + sizeof(draw), instances.data(), instances.size() * sizeof(GlyphInstance));
+        }
+    }
+
+    if(atlasChanged){
+        vk::ImageSubresourceRange range {vk::ImageAspectBits::color, 0, 1, 0, atlasLayers};
+
+        // The atlas is only sampled by fragment shaders, earlier frames must be done reading it before it is written
+        vk::ImageMemoryBarrier barrier;
+        barrier.image = atlas;
+        barrier.subresourceRange = range;
+        barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.oldLayout = atlasInitialized ? vk::ImageLayout::shaderReadOnlyOptimal : vk::ImageLayout::undefined;
+        barrier.newLayout = vk::ImageLayout::transferDstOptimal;
+        barrier.srcAccessMask = {};
+        barrier.dstAccessMask = vk::AccessBits::transferWrite;
+        vk::cmdPipelineBarrier(cb, atlasInitialized ? vk::PipelineStageBits::fragmentShader : vk::PipelineStageBits::topOfPipe,
+            vk::PipelineStageBits::transfer, {}, {}, {}, nytl::make_span(barrier));
+
+        if(!pendingGlyphs.empty()){
+            std::vector<vk::BufferImageCopy> copies;
+            copies.reserve(pendingGlyphs.size());
+            for(const PendingGlyph& glyph: pendingGlyphs)
+                copies.push_back({buffer.offset() + glyph.offset, /*rowLength*/ 0, /*imageHeight*/ 0, {vk::ImageAspectBits::color, 0, glyph.layer, 1},
+                    {int32_t(glyph.x), int32_t(glyph.y), 0}, {glyph.width, glyph.height, 1}});
+            vk::cmdCopyBufferToImage(cb, buffer.buffer(), atlas, vk::ImageLayout::transferDstOptimal, copies);
+
+            pendingGlyphs.clear();
+            pendingPixels.clear();
+        }
+
+        barrier.oldLayout = vk::ImageLayout::transferDstOptimal;
+        barrier.newLayout = vk::ImageLayout::shaderReadOnlyOptimal;
+        barrier.srcAccessMask = vk::AccessBits::transferWrite;
+        barrier.dstAccessMask = vk::AccessBits::shaderRead;
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, vk::PipelineStageBits::fragmentShader, {}, {}, {}, nytl::make_span(barrier));
+        atlasInitialized = true;
+    }
+
+    if(labelBytes){
+        // Earlier frames (on the same queue) must be done drawing from the glyph buffer before it is rewritten in place
+        vk::BufferMemoryBarrier barrier;
+        barrier.srcAccessMask = vk::AccessBits::indirectCommandRead | vk::AccessBits::vertexAttributeRead;
+        barrier.dstAccessMask = vk::AccessBits::transferWrite;
+        barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = glyphBuffer.buffer();
+        barrier.offset = glyphBuffer.offset();
+        barrier.size = labelBytes;
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::drawIndirect | vk::PipelineStageBits::vertexInput, vk::PipelineStageBits::transfer, {}, {}, nytl::make_span(barrier), {});
+
+        vk::BufferCopy region {buffer.offset() + labelOffset, glyphBuffer.offset(), labelBytes};
+        vk::cmdCopyBuffer(cb, buffer.buffer(), glyphBuffer.buffer(), nytl::make_span(region));
+
+        barrier.srcAccessMask = vk::AccessBits::transferWrite;
+        barrier.dstAccessMask = vk::AccessBits::indirectCommandRead | vk::AccessBits::vertexAttributeRead;
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, vk::PipelineStageBits::drawIndirect | vk::PipelineStageBits::vertexInput, {}, {}, nytl::make_span(barrier), {});
+    }
+}
+
+/// Function which records the commands needed to render the labels to the provided command buffer.
+void Font::rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer, const GraphicsState& target) const {
+    if(!material->compatible(target)) throw std::invalid_argument("Font '" + getName() + "' can only be rendered by states on its device whose render pass is compatible with the one it was created for.");
+    // The state's frames still in flight keep drawing from the buffer it was recorded with before
+    auto [recorded, added] = targets.try_emplace(target.id(), Target{bufferGeneration, {}});
+    if(!added && recorded->second.generation != bufferGeneration){
+        recorded->second.inFlight.emplace_back(recorded->second.generation, target.submittedValue());
+        recorded->second.generation = bufferGeneration;
+    }
+    collectRetired(&target);
+    if(target.inDepthPrepass() || target.inGBufferPass() || !glyphBuffer.size()) return;
+
+    // Time how long the GPU spends drawing text
+    GPUProfiler::Scope scope(target.getGPUProfiler(), renderCommandBuffer, "text " + getName());
+    vk::cmdBindPipeline(renderCommandBuffer, vk::PipelineBindPoint::graphics, material->getPipeline());
+    // The extent is cached by the state, querying it doesn't change anything
+    ScreenQuad::pushScreenSize(renderCommandBuffer, *material, const_cast<GraphicsState&>(target).swapchainExtent());
+    vk::cmdBindDescriptorSets(renderCommandBuffer, vk::PipelineBindPoint::graphics, material->getLayout(), 0, nytl::make_span(atlasDescriptors.vkHandle()), /*dynamicOffsets*/ {});
+    vk::cmdBindVertexBuffers(renderCommandBuffer, /*firstBinding*/ 0, 1, glyphBuffer.buffer(), glyphBuffer.offset() + sizeof(vk::DrawIndirectCommand));
+
+    // Every glyph of every label is drawn by a single indirect draw (whose instance count is rewritten with the labels)
+    vk::cmdDrawIndirect(renderCommandBuffer, glyphBuffer.buffer(), glyphBuffer.offset(), 1, sizeof(vk::DrawIndirectCommand));
+}
+
+/// Returns true if the glyph buffer was replaced (the labels outgrew it) since the state's command buffers were recorded.
+bool Font::needsRerecord(const GraphicsState& target) const {
+    collectRetired(&target);
+    auto recorded = targets.find(target.id());
+    return recorded != targets.end() && recorded->second.generation != bufferGeneration;
+}
+
+/// Stops tracking a state which no longer draws the font, once its frames have finished
+void Font::removeTarget(const GraphicsState& target) const {
+    targets.erase(target.id());
+    collectRetired();
+}
+
+/// Forgets the glyph buffers the state's finished frames drew from, then frees the retired buffers no state draws from anymore
+void Font::collectRetired(const GraphicsState* target) const {
+    if(target){
+        auto recorded = targets.find(target->id());
+        if(recorded != targets.end()){
+            auto& inFlight = recorded->second.inFlight;
+            inFlight.erase(std::remove_if(inFlight.begin(), inFlight.end(), [&](auto& use){ return use.second <= target->completedValue(); }), inFlight.end());
+        }
+    }
+
+    retiredBuffers.erase(std::remove_if(retiredBuffers.begin(), retiredBuffers.end(), [&](RetiredBuffer& retired){
+        for(auto& [id, recorded]: targets){
+            if(recorded.generation == retired.generation) return false;
+            for(auto& [generation, value]: recorded.inFlight)
+                if(generation == retired.generation) return false;
+        }
+        return true;
+    }), retiredBuffers.end());
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "engine/vulkan/state.hpp"
+#include "engine/math/math.hpp"
+
+#include "material.hpp"
+#include "screenQuad.hpp"
+
+#include <unordered_map>
+#include <map>
+#include <memory>
+
+// FreeType (only the handles are needed here)
+typedef struct FT_LibraryRec_* FT_Library;
+typedef struct FT_FaceRec_* FT_Face;
+
+/// Font which draws text labels in 2D on top of a GraphicsState's color subpass.
+///     Glyphs are rasterized (coverage) by FreeType the first time they are needed and packed into an atlas
+///     (a 2D array image in the GPU.) Strings are shaped once and cached by their contents, so labels sharing text
+///     share their layout. Every label's glyphs are written into a single instance buffer which is drawn with
+///     one indirect draw from the pre-recorded command buffers (see <rerecordCommandBuffer>), so labels which
+///     don't change cost nothing on the CPU once they have been laid out and uploaded.
+///     Newly rasterized glyphs and changed labels are copied into the atlas and instance buffer by the frame's commands
+///     (see <recordUploads>), the command buffers only need to be rerecorded when the labels outgrow the buffer
+class Font: public Resource {
+public:
+    // A rasterized glyph
+    struct Glyph {
+        // FreeType's index of the glyph (used for kerning)
+        uint32_t index = 0;
+        // Size of the glyph's bitmap, and its offset from the pen position (y is up), in pixels
+        glm::vec2 size = glm::vec2(0), bearing = glm::vec2(0);
+        // How far the pen moves after the glyph
+        float advance = 0;
+        // The region of the atlas's layer the glyph was packed into (min uv, max uv)
+        glm::vec4 uvs = glm::vec4(0);
+        uint32_t layer = 0;
+    };
+
+    // A glyph positioned within a shaped string
+    struct Quad {
+        // Offset of the top left of the quad from the label's position, and its size (in pixels)
+        glm::vec2 offset, size;
+        glm::vec4 uvs;
+        uint32_t layer;
+    };
+
+    // A shaped string
+    struct Run {
+        std::vector<Quad> quads;
+        // The size of the text's bounding box (in pixels)
+        glm::vec2 size = glm::vec2(0);
+    };
+
+    // A glyph as it is stored in the instance buffer
+    using GlyphInstance = ScreenQuad;
+
+    // A string drawn at a position on the screen
+    struct Label {
+        std::shared_ptr<const Run> run;
+        glm::vec2 position;
+        glm::vec4 color;
+        float scale;
+    };
+
+protected:
+    // A glyph waiting to be copied into the atlas
+    struct PendingGlyph {
+        size_t offset;
+        uint32_t x, y, width, height, layer;
+    };
+
+    // The device the atlas was created on (kept alive as long as the font exists)
+    std::shared_ptr<VulkDevice> device;
+
+    // FreeType face (and the data it reads from)
+    FT_Library library = nullptr;
+    FT_Face face = nullptr;
+    std::vector<std::byte> fontData;
+    float ascender = 0, lineHeight = 0;
+
+    // Atlas the glyphs are packed into (shelf by shelf, layer by layer)
+    vpp::Image atlas;
+    vpp::ImageView atlasView;
+    uint32_t packLayer = 0, shelfHeight = 0;
+    glm::uvec2 packCursor = glm::uvec2(1);
+    // True once the atlas has been transitioned out of the undefined layout
+    bool atlasInitialized = false;
+    std::unordered_map<uint32_t, Glyph> glyphs;
+    // Rasterized glyphs waiting to be copied into the atlas (and their pixels)
+    std::vector<PendingGlyph> pendingGlyphs;
+    std::vector<std::byte> pendingPixels;
+    // Host visible buffers the pending pixels are staged in, one per frame in flight
+    std::vector<vpp::SubBuffer> staging;
+
+    // Strings which have been shaped (keyed by their contents)
+    std::unordered_map<std::string, std::shared_ptr<const Run>> runs;
+    std::map<uint32_t, Label> labels;
+    uint32_t nextLabel = 0;
+    // True if the labels have changed since they were last copied into the glyph buffer
+    bool labelsDirty = false;
+
+    vpp::TrDsLayout atlasLayout;
+    vpp::TrDs atlasDescriptors;
+    Resource::Ref<GraphicsMaterial> material;
+    // Buffer holding the indirect draw followed by every label's glyphs (rewritten in place by the frame's commands),
+    //  the number of glyphs it has room for, and the number of glyphs in it
+    vpp::SubBuffer glyphBuffer;
+    uint32_t glyphCapacity = 0, glyphCount = 0;
+    // A glyph buffer the labels outgrew, which command buffers recorded before it was replaced still draw from
+    struct RetiredBuffer {
+        vpp::SubBuffer buffer;
+        uint32_t generation;
+    };
+    // The glyph buffer a state's command buffers draw from: the generation they were recorded with, and the older generations
+    //  its frames in flight may still draw from (until the state's frame with the paired value finishes)
+    struct Target {
+        uint32_t generation;
+        std::vector<std::pair<uint32_t, uint64_t>> inFlight;
+    };
+    // Retired glyph buffers are kept until no state draws from them
+    mutable std::vector<RetiredBuffer> retiredBuffers;
+    // Incremented whenever the glyph buffer is replaced
+    uint32_t bufferGeneration = 0;
+    // The states which have recorded the font (by ID)
+    mutable std::unordered_map<uint16_t, Target> targets;
+
+public:
+    // Size of each layer of the atlas (in pixels) and the number of layers
+    static constexpr uint32_t atlasSize = 1024, atlasLayers = 4;
+
+    Font(GraphicsState&);
+    virtual ~Font();
+
+    /// Returns the glyph of a (unicode) code point, rasterizing it if it hasn't been rasterized yet
+    const Glyph& glyph(uint32_t codepoint);
+    /// Returns the layout of a (UTF-8) string, shaping it if it isn't cached
+    std::shared_ptr<const Run> shape(const std::string& text);
+    /// Forgets the shaped strings which no labels are using
+    void trimCache();
+    /// Returns the distance between the lines of text (in pixels)
+    float getLineHeight() const { return lineHeight; }
+
+    /// Adds a label drawing the text with its top left corner at <position>, returning its ID
+    uint32_t addLabel(const std::string& text, glm::vec2 position, glm::vec4 color = glm::vec4(1), float scale = 1);
+    /// Changes the text of a label
+    void setLabelText(uint32_t label, const std::string& text);
+    /// Moves a label
+    void setLabelPosition(uint32_t label, glm::vec2 position);
+    /// Changes the color of a label
+    void setLabelColor(uint32_t label, glm::vec4 color);
+    /// Removes a label
+    void removeLabel(uint32_t label);
+    /// Returns a label
+    const Label& getLabel(uint32_t label) const { return labels.at(label); }
+
+    /// Returns true if the glyph buffer was replaced (the labels outgrew it) since the state's command buffers were recorded.
+    ///     Until they are rerecorded they keep drawing the labels as they were before the buffer was replaced
+    bool needsRerecord(const GraphicsState& target) const;
+    /// Stops tracking a state which no longer draws the font, once its frames have finished (ex when it is destroyed before the font),
+    ///     so that the glyph buffers only it drew from can be freed
+    void removeTarget(const GraphicsState& target) const;
+
+    /// Records copying the glyphs rasterized since the last call into the atlas, and the labels into the glyph buffer if they changed.
+    ///     Must be called from the state's custom frame recording steps (with the frame's index) every frame text is drawn
+    void recordUploads(vpp::CommandBuffer& cb, uint32_t frame);
+    /// Function which records the commands needed to render the labels to the provided command buffer.
+    ///     Must be recorded in the color subpass (nothing is recorded during the depth prepass or G-buffer subpass.)
+    ///     <target> is the state being recorded (its render pass must be compatible with the one the font was created for),
+    ///     every state drawing the font must be rerecorded when it needs to be (see <needsRerecord>)
+    void rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer, const GraphicsState& target) const;
+
+public:
+    static Ref<Font> create(GraphicsState&, const str name = "");
+
+    static Ref<Font> load(std::istream& file) { throw StateNotProvidedException("A GraphicsState must be provided when loading a font."); }
+    FORCE_INLINE static Ref<Font> load(std::istream&& file) { return load(file); }
+    /// Loads a font file FreeType understands (ex TTF or OTF) whose glyphs are rasterized <pixelHeight> pixels tall
+    static Ref<Font> load(GraphicsState&, std::istream& file, uint32_t pixelHeight = 32, const str name = "");
+    FORCE_INLINE static Ref<Font> load(GraphicsState& state, std::istream&& file, uint32_t pixelHeight = 32, const str name = "") { return load(state, file, pixelHeight, name); }
+
+protected:
+    /// Finds room for a glyph in the atlas, returns false if it is full
+    bool pack(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y, uint32_t& layer);
+    /// Decodes the next code point of a UTF-8 string (invalid bytes are replaced with U+FFFD)
+    static uint32_t decodeUTF8(const std::string& text, size_t& i);
+    /// Forgets the glyph buffers the state's finished frames drew from, then frees the retired buffers no state draws from anymore
+    void collectRetired(const GraphicsState* target = nullptr) const;
+};
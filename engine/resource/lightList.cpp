@@ -0,0 +1,230 @@
+#include "lightList.hpp"
+#include "engine/vulkan/shader.hpp"
+#include "engine/compute.hpp"
+
+#include <cmath>
+#include <cstring>
+
+// Gathers the lights touching each froxel, every invocation handles one froxel
+//  (lights are transformed into view space once per work group and shared)
+static const char* binShader = R"(
+#version 450
+#define GROUP_SIZE 64
+layout(local_size_x = GROUP_SIZE) in;
+
+struct Light { vec4 position; vec4 color; vec4 direction; vec4 params; };
+layout(std430, set = 0, binding = 0) readonly buffer Lights { Light lights[]; };
+layout(std430, set = 0, binding = 1) writeonly buffer Counts { uint counts[]; };
+layout(std430, set = 0, binding = 2) writeonly buffer Indices { uint indices[]; };
+layout(std140, set = 0, binding = 3) uniform Uniforms {
+    mat4 view, inverseProjection;
+    vec2 screenSize;
+    float zNear, zFar;
+    uvec4 grid;
+    uint lightCount;
+} clusters;
+
+// Position and range, and direction and cosine of the outer cone angle (0 for point lights) of each light in view space
+shared vec4 sharedPositions[GROUP_SIZE];
+shared vec4 sharedDirections[GROUP_SIZE];
+
+// Returns the view space point at <depth> along the ray through a point on the screen (in NDC)
+vec3 viewRay(vec2 ndc, float depth){
+    vec4 p = clusters.inverseProjection * vec4(ndc, 0.5, 1);
+    p.xyz /= p.w;
+    return p.xyz * (depth / -p.z);
+}
+
+void main(){
+    uvec3 grid = clusters.grid.xyz;
+    uint cluster = gl_GlobalInvocationID.x;
+    bool active = cluster < grid.x * grid.y * grid.z;
+    uvec3 id = uvec3(cluster % grid.x, (cluster / grid.x) % grid.y, cluster / (grid.x * grid.y));
+
+    // Bounds of the froxel in view space (depth slices are exponential, so froxels stay roughly cubic)
+    float sliceNear = clusters.zNear * pow(clusters.zFar / clusters.zNear, float(id.z) / grid.z);
+    float sliceFar = clusters.zNear * pow(clusters.zFar / clusters.zNear, float(id.z + 1) / grid.z);
+    vec2 ndcMin = vec2(id.xy) / vec2(grid.xy) * 2 - 1, ndcMax = vec2(id.xy + 1) / vec2(grid.xy) * 2 - 1;
+    vec3 boundsMin = vec3(1e30), boundsMax = vec3(-1e30);
+    for(uint c = 0; c < 4; c++){
+        vec2 ndc = mix(ndcMin, ndcMax, vec2(c & 1, c >> 1));
+        vec3 a = viewRay(ndc, sliceNear), b = viewRay(ndc, sliceFar);
+        boundsMin = min(boundsMin, min(a, b));
+        boundsMax = max(boundsMax, max(a, b));
+    }
+    vec3 center = (boundsMin + boundsMax) / 2;
+    float radius = length(boundsMax - center);
+
+    uint count = 0;
+    for(uint first = 0; first < clusters.lightCount; first += GROUP_SIZE){
+        uint l = first + gl_LocalInvocationIndex;
+        if(l < clusters.lightCount){
+            Light light = lights[l];
+            sharedPositions[gl_LocalInvocationIndex] = vec4((clusters.view * vec4(light.position.xyz, 1)).xyz, light.position.w);
+            sharedDirections[gl_LocalInvocationIndex] = light.params.y > 0 ? vec4(normalize(mat3(clusters.view) * light.direction.xyz), light.direction.w) : vec4(0);
+        }
+        barrier();
+
+        uint batch = min(uint(GROUP_SIZE), clusters.lightCount - first);
+        for(uint j = 0; active && j < batch && count < clusters.grid.w; j++){
+            vec4 position = sharedPositions[j];
+            // Sphere against the froxel's box
+            vec3 offset = clamp(position.xyz, boundsMin, boundsMax) - position.xyz;
+            if(dot(offset, offset) > position.w * position.w) continue;
+
+            // Cone against the froxel's bounding sphere
+            vec4 direction = sharedDirections[j];
+            if(direction != vec4(0)){
+                vec3 v = center - position.xyz;
+                float along = dot(v, direction.xyz);
+                float sinAngle = sqrt(max(1 - direction.w * direction.w, 0));
+                float closest = direction.w * sqrt(max(dot(v, v) - along * along, 0)) - along * sinAngle;
+                if(closest > radius || along < -radius) continue;
+            }
+            indices[cluster * clusters.grid.w + count++] = first + j;
+        }
+        barrier();
+    }
+    if(active) counts[cluster] = count;
+}
+)";
+
+// Declarations read by fragment shaders (SET is replaced with the set the lights are bound to)
+static const char* fragmentDeclarations = R"(
+struct Light { vec4 position; vec4 color; vec4 direction; vec4 params; };
+layout(std430, set = SET, binding = 0) readonly buffer ClusterLights { Light clusterLights[]; };
+layout(std430, set = SET, binding = 1) readonly buffer ClusterCounts { uint clusterLightCounts[]; };
+layout(std430, set = SET, binding = 2) readonly buffer ClusterIndices { uint clusterLightIndices[]; };
+layout(std140, set = SET, binding = 3) uniform ClusterUniforms {
+    mat4 view, inverseProjection;
+    vec2 screenSize;
+    float zNear, zFar;
+    uvec4 grid;
+    uint lightCount;
+} clusters;
+
+// Returns the diffuse lighting of a surface from the lights in its froxel
+vec3 clusteredLighting(vec3 worldPosition, vec3 normal, vec3 albedo){
+    float depth = max(-(clusters.view * vec4(worldPosition, 1)).z, clusters.zNear);
+    uint slice = uint(clamp(log(depth / clusters.zNear) / log(clusters.zFar / clusters.zNear) * clusters.grid.z, 0, float(clusters.grid.z - 1)));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusters.screenSize * vec2(clusters.grid.xy)), clusters.grid.xy - 1);
+    uint cluster = (slice * clusters.grid.y + tile.y) * clusters.grid.x + tile.x;
+
+    vec3 lighting = vec3(0);
+    uint count = clusterLightCounts[cluster];
+    for(uint i = 0; i < count; i++){
+        Light light = clusterLights[clusterLightIndices[cluster * clusters.grid.w + i]];
+        vec3 toLight = light.position.xyz - worldPosition;
+        float lightDistance = length(toLight);
+        vec3 direction = toLight / max(lightDistance, 1e-4);
+
+        // Inverse square falloff, smoothly reaching zero at the light's range
+        float falloff = clamp(1 - pow(lightDistance / light.position.w, 4), 0, 1);
+        float attenuation = falloff * falloff / (lightDistance * lightDistance + 1);
+        if(light.params.y > 0) attenuation *= smoothstep(light.direction.w, light.params.x, dot(-direction, normalize(light.direction.xyz)));
+        lighting += light.color.rgb * light.color.a * attenuation * max(dot(normal, direction), 0);
+    }
+    return albedo * lighting;
+}
+)";
+
+LightList::LightList(GraphicsState& _state, uint32_t _capacity, glm::uvec3 _grid, uint32_t maxLightsPerCluster)
+  : Resource(Resource::Type::LightList), state(_state), device(_state.sharedDevice()), capacity(_capacity), grid(_grid, maxLightsPerCluster) {
+    vk::ShaderStageFlags stages = vk::ShaderStageBits::compute | vk::ShaderStageBits::fragment;
+    layout = {*device, {
+        {0, vk::DescriptorType::storageBuffer, 1, stages, nullptr},
+        {1, vk::DescriptorType::storageBuffer, 1, stages, nullptr},
+        {2, vk::DescriptorType::storageBuffer, 1, stages, nullptr},
+        {3, vk::DescriptorType::uniformBuffer, 1, stages, nullptr}}};
+
+    GLSLShaderModule shader(*device, str(binShader), vk::ShaderStageBits::compute);
+    binMaterial = ComputeMaterial::create(state, shader.createStageInfo(), nytl::make_span(layout.vkHandle()));
+}
+
+Resource::Ref<LightList> LightList::create(GraphicsState& state, uint32_t capacity, glm::uvec3 grid, uint32_t maxLightsPerCluster, const str name){
+    // Create memory for the resource
+    LightList* _new = new LightList(state, capacity, grid, maxLightsPerCluster);
+    // Add a reference to the resource's memory to the ResourceManager and return a reference
+    return ResourceManager::singleton()->add<LightList>(state, name, *_new);
+}
+
+/// Adds a point light, returning its index
+uint32_t LightList::addPointLight(glm::vec3 position, glm::vec3 color, float intensity, float range){
+    lights.push_back({glm::vec4(position, range), glm::vec4(color, intensity), glm::vec4(0, 0, -1, -1), glm::vec4(-1, 0, 0, 0)});
+    return lights.size() - 1;
+}
+
+/// Adds a spot light (the angles are the half angles of the cone in radians), returning its index
+uint32_t LightList::addSpotLight(glm::vec3 position, glm::vec3 direction, glm::vec3 color, float intensity, float range, float innerAngle, float outerAngle){
+    lights.push_back({glm::vec4(position, range), glm::vec4(color, intensity), glm::vec4(glm::normalize(direction), std::cos(outerAngle)), glm::vec4(std::cos(innerAngle), 1, 0, 0)});
+    return lights.size() - 1;
+}
+
+/// Sets the camera the froxels are built from (the projection should map depth to [0, 1]), <zNear> and <zFar> bound the depth slices
+void LightList::setCamera(const glm::mat4& _view, const glm::mat4& _projection, float _zNear, float _zFar){
+    view = _view;
+    projection = _projection;
+    zNear = _zNear;
+    zFar = _zFar;
+}
+
+/// Creates the buffers and descriptors of any images which don't have them yet
+void LightList::createImages(){
+    uint32_t clusters = grid.x * grid.y * grid.z;
+    while(images.size() < state.renderBuffers.size()){
+        Image& image = images.emplace_back();
+        vpp::BufferAllocator& ba = device->bufferAllocator();
+        // Written by the CPU every frame, so they live in host visible memory which stays mapped
+        image.lights = {ba, capacity * sizeof(Light), vk::BufferUsageBits::storageBuffer, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+        image.uniforms = {ba, sizeof(Uniforms), vk::BufferUsageBits::uniformBuffer, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+        image.lightMap = image.lights.memoryMap();
+        image.uniformMap = image.uniforms.memoryMap();
+        // Written by the binning and read by fragment shaders
+        image.counts = {ba, clusters * sizeof(uint32_t), vk::BufferUsageBits::storageBuffer, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+        image.indices = {ba, vk::DeviceSize(clusters) * grid.w * sizeof(uint32_t), vk::BufferUsageBits::storageBuffer, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+
+        image.descriptors = device->descriptorAllocator().alloc(layout);
+        const vpp::SubBuffer* buffers[] = {&image.lights, &image.counts, &image.indices, &image.uniforms};
+        vk::DescriptorBufferInfo bufferInfos[4];
+        vk::WriteDescriptorSet writes[4];
+        for(uint32_t b = 0; b < 4; b++){
+            bufferInfos[b] = {buffers[b]->buffer(), buffers[b]->offset(), buffers[b]->size()};
+            writes[b] = {image.descriptors, b, /*firstArrayElem*/ 0, 1, (b == 3 ? vk::DescriptorType::uniformBuffer : vk::DescriptorType::storageBuffer), /*imgInfo*/ nullptr, &bufferInfos[b]};
+        }
+        vk::updateDescriptorSets(*device, writes, {});
+    }
+}
+
+/// Writes the lights and records binning them into the froxels.
+void LightList::bin(vpp::CommandBuffer& cb, uint32_t i){
+    createImages();
+    Image& image = images[i];
+
+    // The image's previous frame has finished, so its buffers can be overwritten
+    uint32_t count = std::min<uint32_t>(lights.size(), capacity);
+    if(count < lights.size()) dlg_warn("Light list '" + getName() + "' capacity (" + str(capacity) + ") exceeded, " + str(lights.size() - count) + " lights ignored.");
+    std::memcpy(image.lightMap.ptr(), lights.data(), count * sizeof(Light));
+
+    vk::Extent2D extent = state.swapchainExtent();
+    Uniforms uniforms {view, glm::inverse(projection), {extent.width, extent.height}, zNear, zFar, grid, count};
+    std::memcpy(image.uniformMap.ptr(), &uniforms, sizeof(uniforms));
+
+    uint32_t clusters = grid.x * grid.y * grid.z;
+    binMaterial->recordDispatch(cb, ComputeMaterial::groupCount(clusters, 64), 1, 1, nytl::make_span(image.descriptors.vkHandle()));
+    // The froxels are read by the image's fragment shaders
+    ComputeState::recordComputeBarrier(cb, vk::PipelineStageBits::fragmentShader, vk::AccessBits::shaderRead);
+}
+
+/// Records binding the image's lights as descriptor set <set> of the pipeline layout
+void LightList::bind(vk::CommandBuffer cb, uint32_t i, vk::PipelineLayout pipelineLayout, uint32_t set){
+    createImages();
+    vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::graphics, pipelineLayout, set, nytl::make_span(images[i].descriptors.vkHandle()), /*dynamicOffsets*/ {});
+}
+
+/// Returns the GLSL declaring the lights (as descriptor set <set>) and the clusteredLighting function
+str LightList::glsl(uint32_t set){
+    std::string out = fragmentDeclarations;
+    for(size_t found = out.find("SET"); found != std::string::npos; found = out.find("SET", found))
+        out.replace(found, 3, std::to_string(set));
+    return out;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "engine/vulkan/state.hpp"
+#include "engine/math/math.hpp"
+
+#include "material.hpp"
+
+/// List of the (point and spot) lights in a scene, binned into clusters for forward shading.
+///     The view frustum is split into a grid of froxels (screen space tiles, sliced exponentially in depth.)
+///     Every frame the lights are copied to the GPU and a compute shader gathers the lights touching each froxel.
+///     Fragment shaders then look up their froxel and only shade with its lights (see <glsl>), so the cost of a
+///     fragment depends on the lights near it rather than the number of lights in the scene.
+///     The binning is recorded into the frame's command buffer (see <bin>), on the graphics queue
+class LightList: public Resource {
+public:
+    // A light as it is stored in the light buffer
+    struct Light {
+        // Position (in world space) and the distance the light reaches
+        glm::vec4 position;
+        // Color and intensity
+        glm::vec4 color;
+        // Direction the light points (spot lights), and the cosine of the outer edge of its cone
+        glm::vec4 direction;
+        // The cosine of the inner edge of the cone, and the type of the light (0 = point, 1 = spot)
+        glm::vec4 params;
+    };
+
+protected:
+    // Uniforms describing the grid (std140)
+    struct Uniforms {
+        glm::mat4 view, inverseProjection;
+        glm::vec2 screenSize;
+        float zNear, zFar;
+        // The number of froxels along each axis, and the largest number of lights each froxel holds
+        glm::uvec4 grid;
+        uint32_t lightCount;
+    };
+
+    // Data tracked for each render buffer
+    struct Image {
+        // The lights and uniforms (written by the CPU every frame)
+        vpp::SubBuffer lights, uniforms;
+        vpp::MemoryMapView lightMap, uniformMap;
+        // The number of lights in each froxel and their indices (written by the binning)
+        vpp::SubBuffer counts, indices;
+        vpp::TrDs descriptors;
+    };
+
+    // Reference to the vulkan state the lights were created with
+    GraphicsState& state;
+    // The device the buffers were created on (kept alive as long as the list exists)
+    std::shared_ptr<VulkDevice> device;
+    uint32_t capacity;
+    glm::uvec4 grid;
+
+    std::vector<Light> lights;
+    glm::mat4 view = glm::mat4(1), projection = glm::mat4(1);
+    float zNear = 0.1, zFar = 100;
+
+    vpp::TrDsLayout layout;
+    Resource::Ref<ComputeMaterial> binMaterial;
+    std::vector<Image> images;
+
+public:
+    /// Creates a list holding up to <capacity> lights, binned into <grid> froxels (x, y, depth slices)
+    ///     with room for up to <maxLightsPerCluster> lights in each
+    LightList(GraphicsState&, uint32_t capacity, glm::uvec3 grid, uint32_t maxLightsPerCluster);
+
+    /// Adds a point light, returning its index
+    uint32_t addPointLight(glm::vec3 position, glm::vec3 color, float intensity, float range);
+    /// Adds a spot light (the angles are the half angles of the cone in radians), returning its index
+    uint32_t addSpotLight(glm::vec3 position, glm::vec3 direction, glm::vec3 color, float intensity, float range, float innerAngle, float outerAngle);
+    /// Returns a light so that it can be changed (ex moved), changes are applied from the next frame
+    Light& operator[](uint32_t light) { return lights.at(light); }
+    /// Removes a light, the index of every light after it is reduced by one
+    void removeLight(uint32_t light) { lights.erase(lights.begin() + light); }
+    /// Removes every light
+    void clear() { lights.clear(); }
+    /// Returns the number of lights
+    uint32_t size() const { return lights.size(); }
+    /// Returns the largest number of lights the list can hold
+    uint32_t getCapacity() const { return capacity; }
+
+    /// Sets the camera the froxels are built from (the projection should map depth to [0, 1]), <zNear> and <zFar> bound the depth slices
+    void setCamera(const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar);
+
+    /// Writes the lights and records binning them into the froxels.
+    ///     Must be called from the state's custom frame recording steps (with the frame's image) every frame
+    void bin(vpp::CommandBuffer& cb, uint32_t image);
+
+    /// Returns the layout of the descriptor set fragment shaders read the lights through
+    const vpp::TrDsLayout& getLayout() const { return layout; }
+    /// Records binding the image's lights as descriptor set <set> of the pipeline layout
+    void bind(vk::CommandBuffer cb, uint32_t image, vk::PipelineLayout pipelineLayout, uint32_t set = 0);
+    /// Returns the GLSL declaring the lights (as descriptor set <set>) and the function
+    ///     vec3 clusteredLighting(vec3 worldPosition, vec3 normal, vec3 albedo), to be placed after a fragment shader's #version
+    static str glsl(uint32_t set = 0);
+
+public:
+    /// Creates a list holding up to <capacity> lights
+    static Ref<LightList> create(GraphicsState&, uint32_t capacity = 1024, glm::uvec3 grid = {16, 9, 24}, uint32_t maxLightsPerCluster = 128, const str name = "");
+
+    static Ref<LightList> load(std::istream& file) { throw StateNotProvidedException("A GraphicsState must be provided when creating a light list."); }
+    FORCE_INLINE static Ref<LightList> load(std::istream&& file) { return load(file); }
+    static Ref<LightList> load(GraphicsState&, std::istream& file) { throw std::runtime_error("Light lists can't be loaded yet!"); }
+    FORCE_INLINE static Ref<LightList> load(GraphicsState& state, std::istream&& file) { return load(state, file); }
+
+protected:
+    /// Creates the buffers and descriptors of any images which don't have them yet
+    void createImages();
+};
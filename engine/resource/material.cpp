@@ -7,6 +7,13 @@ Resource::Ref<Material> Material::create(VulkanState& state, const str name){
     return ResourceManager::singleton()->add<Material>(state, name, *_new);
 }
 
+Resource::Ref<ComputeMaterial> ComputeMaterial::create(VulkanState& state, const str name){
+    // Create memory for the resource
+    ComputeMaterial* _new = new ComputeMaterial(state);
+    // Add a reference to the resource's memory to the ResourceManager and return a reference
+    return ResourceManager::singleton()->add<ComputeMaterial>(state, name, *_new);
+}
+
 Resource::Ref<GraphicsMaterial> GraphicsMaterial::create(GraphicsState& state, const str name){
     // Create memory for the resource
     GraphicsMaterial* _new = new GraphicsMaterial(state);
@@ -16,21 +23,125 @@ Resource::Ref<GraphicsMaterial> GraphicsMaterial::create(GraphicsState& state, c
 
 /// Creates the pipeline create info for this material which can then be modified and eventually finalized
 GraphicsMaterial::CreateInfo GraphicsMaterial::begin(vpp::ShaderProgram&& program, nytl::Span<const vk::DescriptorSetLayout> uniforms, nytl::Span<const vk::PushConstantRange> constants) {
-    GraphicsState& gState = reinterpret_cast<GraphicsState&>(state);
+    layout = {*device, uniforms, constants};
+    CreateInfo out {renderPass, layout, std::move(program), renderPassLayout.colorSubpass()};
+
+    // Test against (and write to) the depth buffer if there is one
+    if(renderPassLayout.depthFormat != vk::Format::undefined){
+        out.depthStencil.depthTestEnable = true;
+        // When shading is deferred depth is read only in the lighting subpass
+        //  (<finalize> disables writes for materials whose depth is written by the prepass)
+        out.depthStencil.depthWriteEnable = renderPassLayout.gBufferFormats.empty();
+        // Only fragments which survived the prepass are shaded
+        out.depthStencil.depthCompareOp = (renderPassLayout.depthPrepass ? vk::CompareOp::lessOrEqual : vk::CompareOp::less);
+        out.depthStencil.depthBoundsTestEnable = false;
+        out.depthStencil.stencilTestEnable = false;
+    }
+    return out;
+}
+
+/// Creates the pipeline create info for a material which writes the G-buffer, it can then be modified and eventually finalized
+GraphicsMaterial::CreateInfo GraphicsMaterial::beginGBuffer(vpp::ShaderProgram&& program, nytl::Span<const vk::DescriptorSetLayout> uniforms, nytl::Span<const vk::PushConstantRange> constants) {
+    if(renderPassLayout.gBufferFormats.empty()) throw std::runtime_error("Graphics material '" + getName() + "' can't write a G-buffer, the state's shading isn't deferred.");
 
-    layout = {gState.device(), uniforms, constants};
-    return {gState.renderPass, layout, std::move(program)};
+    layout = {*device, uniforms, constants};
+    CreateInfo out {renderPass, layout, std::move(program), renderPassLayout.gBufferSubpass()};
+
+    // Depth is written here unless the prepass already wrote it (see <finalize>)
+    out.depthStencil.depthTestEnable = true;
+    out.depthStencil.depthWriteEnable = true;
+    out.depthStencil.depthCompareOp = (renderPassLayout.depthPrepass ? vk::CompareOp::lessOrEqual : vk::CompareOp::less);
+    out.depthStencil.depthBoundsTestEnable = false;
+    out.depthStencil.stencilTestEnable = false;
+
+    // Every G-buffer attachment is overwritten
+    vk::PipelineColorBlendAttachmentState blend {};
+    blend.blendEnable = false;
+    blend.colorWriteMask = vk::ColorComponentBits::r | vk::ColorComponentBits::g | vk::ColorComponentBits::b | vk::ColorComponentBits::a;
+    gBufferBlend.assign(renderPassLayout.gBufferFormats.size(), blend);
+    out.blend.attachmentCount = gBufferBlend.size();
+    out.blend.pAttachments = gBufferBlend.data();
+    return out;
 }
 
 /// Binds the Provided Graphics Pipeline Info and creates the internal Pipeline
-void GraphicsMaterial::finalize(GraphicsMaterial::CreateInfo& info){
+void GraphicsMaterial::finalize(GraphicsMaterial::CreateInfo& info, bool depthPrepass){
     // Determines if the internal layout is different from the one provided
     bool rebindLayout = info.info().layout != layout.vkHandle();
 
+    // Materials drawn in the prepass already wrote their depth there, materials which opt out of it still write their own
+    bool prepassed = depthPrepass && renderPassLayout.depthPrepass;
+    vk::GraphicsPipelineCreateInfo main = info.info();
+    vk::PipelineDepthStencilStateCreateInfo mainDepth;
+    if(prepassed && main.pDepthStencilState){
+        mainDepth = *main.pDepthStencilState;
+        mainDepth.depthWriteEnable = false;
+        main.pDepthStencilState = &mainDepth;
+    }
+
     // TODO: caching
     // Creates the pipeline
-    pipeline = {state.device(), info.info()};
+    pipeline = {*device, main};
+    subpass = main.subpass;
+
+    // Create a copy of the pipeline which only writes depth in the prepass
+    if(prepassed){
+        vk::GraphicsPipelineCreateInfo prepass = info.info();
+        prepass.subpass = 0;
+
+        // Only the vertex stage is needed to determine depth
+        std::vector<vk::PipelineShaderStageCreateInfo> stages;
+        for(uint32_t i = 0; i < prepass.stageCount; i++)
+            if(prepass.pStages[i].stage == vk::ShaderStageBits::vertex) stages.push_back(prepass.pStages[i]);
+        prepass.stageCount = stages.size();
+        prepass.pStages = stages.data();
+
+        vk::PipelineDepthStencilStateCreateInfo depth = *prepass.pDepthStencilState;
+        depth.depthTestEnable = depth.depthWriteEnable = true;
+        depth.depthCompareOp = vk::CompareOp::less;
+        prepass.pDepthStencilState = &depth;
+
+        // The prepass doesn't have any color attachments
+        vk::PipelineColorBlendStateCreateInfo blend = *prepass.pColorBlendState;
+        blend.attachmentCount = 0;
+        blend.pAttachments = nullptr;
+        prepass.pColorBlendState = &blend;
+
+        depthPrepassPipeline = {*device, prepass};
+    } else depthPrepassPipeline = {};
 
     // Stores the provided layout (if necessary)
-    if(rebindLayout) layout = {state.device(), info.info().layout};
+    if(rebindLayout) layout = {*device, info.info().layout};
+}
+
+
+/// Creates the layout and pipeline from the compute shader stage, uniforms, and constants
+void ComputeMaterial::finalize(const vpp::ShaderProgram::StageInfo& stage, nytl::Span<const vk::DescriptorSetLayout> uniforms, nytl::Span<const vk::PushConstantRange> constants){
+    if(stage.stage != vk::ShaderStageBits::compute) throw std::invalid_argument("Compute material '" + getName() + "' requires a compute shader.");
+
+    layout = {*device, uniforms, constants};
+
+    vk::ComputePipelineCreateInfo info;
+    info.stage = {/*flags*/ {}, stage.stage, stage.module, stage.entry.c_str(), stage.specialization};
+    info.layout = layout;
+    // TODO: caching
+    pipeline = {*device, info};
+}
+
+/// Records binding the pipeline (and descriptor sets) and dispatching the specified number of work groups
+void ComputeMaterial::recordDispatch(vk::CommandBuffer cb, uint32_t x, uint32_t y, uint32_t z, nytl::Span<const vk::DescriptorSet> descriptorSets) const {
+    if(!valid()) throw vk::VulkanError(vk::Result::errorInitializationFailed, "Can't dispatch compute material: '" + getName() + "' is invalid.");
+
+    vk::cmdBindPipeline(cb, vk::PipelineBindPoint::compute, pipeline);
+    if(!descriptorSets.empty()) vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::compute, layout, 0, descriptorSets, /*dynamicOffsets*/ {});
+    vk::cmdDispatch(cb, x, y, z);
+}
+
+/// Records binding the pipeline (and descriptor sets) and dispatching work groups whose parameters are read from the buffer
+void ComputeMaterial::recordDispatchIndirect(vk::CommandBuffer cb, vpp::BufferSpan parameters, nytl::Span<const vk::DescriptorSet> descriptorSets) const {
+    if(!valid()) throw vk::VulkanError(vk::Result::errorInitializationFailed, "Can't dispatch compute material: '" + getName() + "' is invalid.");
+
+    vk::cmdBindPipeline(cb, vk::PipelineBindPoint::compute, pipeline);
+    if(!descriptorSets.empty()) vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::compute, layout, 0, descriptorSets, /*dynamicOffsets*/ {});
+    vk::cmdDispatchIndirect(cb, parameters.buffer(), parameters.offset());
 }
@@ -37,15 +37,28 @@ public:
         }
     };
 protected:
-    VulkanState& state;
+    // The device the pipelines were created on (kept alive as long as the material exists)
+    std::shared_ptr<VulkDevice> device;
     vpp::PipelineLayout layout;
     vpp::Pipeline pipeline;
+    // Pipeline which only writes depth, used in the depth prepass (if the state has one)
+    vpp::Pipeline depthPrepassPipeline;
+    // Subpass the pipeline renders in, and the layout of the render pass it was created for (compute pipelines don't render in one)
+    uint32_t subpass = 0;
+    GraphicsState::RenderPassLayout renderPassLayout;
 
 public:
-    Material(VulkanState& _state) : Resource(Resource::Type::Material), state(_state) {}
+    Material(VulkanState& state) : Resource(Resource::Type::Material), device(state.sharedDevice()) {}
 
     const vpp::Pipeline& getPipeline() const { return pipeline; }
     //vpp::Pipeline& getPipeline() { return pipeline; }
+    /// Returns the pipeline used in the depth prepass (invalid if the material doesn't take part in it)
+    const vpp::Pipeline& getDepthPrepassPipeline() const { return depthPrepassPipeline; }
+    /// Returns the subpass the material's pipeline renders in
+    uint32_t getSubpass() const { return subpass; }
+    /// Returns true if the material's pipelines can be used in the target's render pass
+    ///     (it uses the device the material was created on, and its render pass has the same layout)
+    bool compatible(const GraphicsState& target) const { return &target.device() == device.get() && target.getRenderPassLayout() == renderPassLayout; }
 
     // TODO: Needs to be exposed?
     const vpp::PipelineLayout& getLayout() const { return layout; }
@@ -68,16 +81,37 @@ public:
 // Add GraphicsPipelineInfo to this namespace
 using CreateInfo = vpp::GraphicsPipelineInfo;
 
+protected:
+    // Blend states of the G-buffer attachments (referenced by the CreateInfo until the material is finalized)
+    std::vector<vk::PipelineColorBlendAttachmentState> gBufferBlend;
+    // The render pass of the state the material was created with, the pipelines are created for it.
+    //  Only used while they are created (the state must still exist), drawing only checks the layout (see <compatible>)
+    vk::RenderPass renderPass;
+
 public:
-    GraphicsMaterial(GraphicsState& gstate) : Material(gstate) { type = Resource::Type::GraphicsMaterial; };
+    /// Creates a material whose pipelines are created for the state's current render pass
+    ///     (it must be recreated if the state's render pass is, ex when depth is enabled)
+    GraphicsMaterial(GraphicsState& gstate) : Material(gstate), renderPass(gstate.renderPass.vkHandle()) {
+        type = Resource::Type::GraphicsMaterial;
+        renderPassLayout = gstate.getRenderPassLayout();
+    };
 
     /// Creates the CreateInfo for this material which can then be externally modified and eventually finalized.
+    ///     If the state has depth enabled, depth testing and writing are enabled (materials which take part
+    ///         in the prepass only test against the depth it wrote, see <finalize>)
     ///     NOTE: When messing with the members of the CreateInfo struct, don't overwrite the whole struct,
     ///         instead modify the individual elements which need tweaking
     CreateInfo begin(vpp::ShaderProgram&& program, nytl::Span<const vk::DescriptorSetLayout> uniformLayouts = {}, nytl::Span<const vk::PushConstantRange> constantRanges = {});
-    /// Binds the CreateInfo and creates the internal Pipeline object
-    void finalize(CreateInfo&);
-    FORCE_INLINE void finalize(CreateInfo&& info) { finalize(info); }
+    /// Creates the CreateInfo for a material which writes the G-buffer of a state with deferred shading (see GraphicsState::enableDeferredShading.)
+    ///     Its fragment shader has an output for each G-buffer attachment (which are written without blending);
+    ///     materials created with <begin> render in the lighting subpass, testing against (but not writing) depth
+    CreateInfo beginGBuffer(vpp::ShaderProgram&& program, nytl::Span<const vk::DescriptorSetLayout> uniformLayouts = {}, nytl::Span<const vk::PushConstantRange> constantRanges = {});
+    /// Binds the CreateInfo and creates the internal Pipeline object.
+    ///     If the state has a depth prepass, a matching pipeline with only the vertex stage is
+    ///     created for it as well (unless <depthPrepass> is false, ex for transparent materials) and the main
+    ///     pipeline stops writing depth. Materials which opt out of the prepass keep whatever depth writes the CreateInfo has
+    void finalize(CreateInfo&, bool depthPrepass = true);
+    FORCE_INLINE void finalize(CreateInfo&& info, bool depthPrepass = true) { finalize(info, depthPrepass); }
 
 public:
     /// Creates an empty material, useful for the beginning of the creation process
@@ -96,3 +130,33 @@ public:
     static Ref<GraphicsMaterial> load(GraphicsState&, std::istream& file);
     FORCE_INLINE static Ref<GraphicsMaterial> load(GraphicsState& state, std::istream&& file) { return load(state, file); }
 };
+
+/// Override of material with utilities built in for creating a Compute pipeline
+///     (compute pipelines don't depend on a render pass, so any state's device can be used)
+class ComputeMaterial : public Material {
+public:
+    ComputeMaterial(VulkanState& state) : Material(state) { type = Resource::Type::ComputeMaterial; };
+
+    /// Creates the layout and pipeline from the compute shader stage, uniforms, and constants
+    void finalize(const vpp::ShaderProgram::StageInfo& stage, nytl::Span<const vk::DescriptorSetLayout> uniformLayouts = {}, nytl::Span<const vk::PushConstantRange> constantRanges = {});
+
+    /// Records binding the pipeline (and descriptor sets) and dispatching the specified number of work groups
+    void recordDispatch(vk::CommandBuffer cb, uint32_t groupsX, uint32_t groupsY = 1, uint32_t groupsZ = 1, nytl::Span<const vk::DescriptorSet> descriptorSets = {}) const;
+    /// Records binding the pipeline (and descriptor sets) and dispatching work groups whose parameters are read from the buffer
+    void recordDispatchIndirect(vk::CommandBuffer cb, vpp::BufferSpan parameters, nytl::Span<const vk::DescriptorSet> descriptorSets = {}) const;
+    /// Returns the number of work groups needed to cover <invocations> with groups of <groupSize>
+    static uint32_t groupCount(uint32_t invocations, uint32_t groupSize) { return (invocations + groupSize - 1) / groupSize; }
+
+public:
+    /// Creates an empty material, useful for the beginning of the creation process
+    static Ref<ComputeMaterial> create(VulkanState&, const str name = "");
+    /// Creates the pipeline from the provided shader stage, uniforms, and constants
+    static Ref<ComputeMaterial> create(VulkanState& state, const vpp::ShaderProgram::StageInfo& stage, nytl::Span<const vk::DescriptorSetLayout> uniformLayouts = {}, nytl::Span<const vk::PushConstantRange> constantRanges = {}, const str name = ""){
+        auto out = create(state, name); out->finalize(stage, uniformLayouts, constantRanges); return out;
+    }
+
+    static Ref<Material> load(std::istream& file) { throw StateNotProvidedException("A VulkanState must be provided when creating a material."); }
+    FORCE_INLINE static Ref<Material> load(std::istream&& file) { return load(file); }
+    static Ref<ComputeMaterial> load(VulkanState&, std::istream& file) { throw std::runtime_error("Compute materials can't be loaded yet!"); }
+    FORCE_INLINE static Ref<ComputeMaterial> load(VulkanState& state, std::istream&& file) { return load(state, file); }
+};
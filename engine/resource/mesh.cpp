@@ -6,7 +6,7 @@
 
 template <typename it, typename bit>
 _Mesh<it, bit>::_Mesh(GraphicsState& _state)
-  : Resource(Resource::Type::Mesh), state(_state) {}
+  : Resource(Resource::Type::Mesh), device(_state.sharedDevice()) {}
 
 template <typename it, typename bit>
 Resource::Ref<_Mesh<it, bit>> _Mesh<it, bit>::create(GraphicsState& state, str name){
@@ -18,25 +18,36 @@ Resource::Ref<_Mesh<it, bit>> _Mesh<it, bit>::create(GraphicsState& state, str n
 
 template <typename indexType, typename bit>
 Resource::Ref<_Mesh<indexType, bit>> _Mesh<indexType, bit>::create(GraphicsState& state, std::vector<Vertex>& vertices, std::vector<indexType>& indices, str name){
+    // Copy the data into the gpu buffers on the transfer queue
+    //  (frames wait for the copies to finish on the GPU, so there is no need to block here)
+    UploadBatch batch;
+    auto out = create(state, vertices, indices, batch, name);
+    batch.engine(*out->device).flush();
+
+    return out;
+}
+
+template <typename indexType, typename bit>
+Resource::Ref<_Mesh<indexType, bit>> _Mesh<indexType, bit>::create(GraphicsState& state, std::vector<Vertex>& vertices, std::vector<indexType>& indices, UploadBatch& batch, str name){
     // Allocate memory for a new mesh
     auto out = create(state, name);
 
     // Set the number of indecies
     out->indexCount = indices.size();
+    // Calculate the bounds of the vertices (used for culling)
+    for(Vertex& vertex: vertices){
+        out->boundsMin = glm::min(out->boundsMin, vertex.position);
+        out->boundsMax = glm::max(out->boundsMax, vertex.position);
+    }
 
     // Create the buffers
-    vpp::BufferAllocator& ba = state.device().bufferAllocator();
+    vpp::BufferAllocator& ba = out->device->bufferAllocator();
     out->vertexBuffer = {ba, vertices.size() * sizeof(vertices[0]), vk::BufferUsageBits::vertexBuffer | vk::BufferUsageBits::transferDst, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
     out->indexBuffer = {ba, indices.size() * sizeof(indices[0]), vk::BufferUsageBits::indexBuffer | vk::BufferUsageBits::transferDst, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
 
-    // Begin copying the data into the gpu buffers
-    vpp::CommandBuffer vertCB = state.commandPool.allocate(), indexCB = state.commandPool.allocate();
-    uint32_t vid = state.fillStaging(out->vertexBuffer, vertices, /*wait*/ false, vertCB);
-    uint32_t iid = state.fillStaging(out->indexBuffer, indices, /*wait*/ false, indexCB);
-
-    // Wait for the vertex and index buffers to both have their data copied
-    state.device().queueSubmitter().wait(vid);
-    state.device().queueSubmitter().wait(iid);
+    // Queue copying the data into the gpu buffers
+    batch.upload(*out->device, out->vertexBuffer, vertices);
+    batch.upload(*out->device, out->indexBuffer, indices, vk::PipelineStageBits::vertexInput, vk::AccessBits::indexRead);
 
     return out;
 }
@@ -57,10 +68,7 @@ typename Material::Instance& _Mesh<it, bit>::addInstance(glm::mat4 transform, Re
 }
 
 template <typename it, typename bit>
-std::vector<Resource::Upload> _Mesh<it, bit>::uploadInstanceBuffers(bool wait){
-    std::vector<Resource::Upload> runningUploads;
-    runningUploads.reserve(instances.size());
-
+void _Mesh<it, bit>::uploadInstanceBuffers(UploadBatch& batch){
     // For each unique material in instances map
     for(std::pair<const Ref<class Material>, std::pair<vpp::SubBuffer, std::vector<Material::Instance>>>& instanceData: instances){
         // Reference the stored data elements
@@ -68,13 +76,19 @@ std::vector<Resource::Upload> _Mesh<it, bit>::uploadInstanceBuffers(bool wait){
         vpp::SubBuffer& buffer = instanceData.second.first;
 
         // Create a buffer large enouph to hold all of the instances for this material
-        buffer = {state.device().bufferAllocator(), insts.size() * insts[0].byteSize(), vk::BufferUsageBits::vertexBuffer | vk::BufferUsageBits::transferDst, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+        //  (occlusion culling reads it as a storage buffer)
+        buffer = {device->bufferAllocator(), insts.size() * insts[0].byteSize(), vk::BufferUsageBits::vertexBuffer | vk::BufferUsageBits::storageBuffer | vk::BufferUsageBits::transferDst, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
 
-        // Begin uploading the data to the buffer and add it to the list of running uploads
-        vpp::CommandBuffer cb = state.commandPool.allocate();
-        uint32_t waitID = state.fillStaging(buffer, insts, false, cb);
-        runningUploads.emplace_back(waitID, std::move(cb), state.device().queueSubmitter());
+        // Queue uploading the data to the buffer (along with everything else in the batch)
+        batch.upload(*device, buffer, insts, vk::PipelineStageBits::vertexInput | vk::PipelineStageBits::computeShader, vk::AccessBits::vertexAttributeRead | vk::AccessBits::shaderRead);
     }
+}
+
+template <typename it, typename bit>
+std::vector<Resource::Upload> _Mesh<it, bit>::uploadInstanceBuffers(bool wait){
+    UploadBatch batch;
+    uploadInstanceBuffers(batch);
+    std::vector<Resource::Upload> runningUploads = batch.flush();
 
     // If we should wait for this upload to finish, do so
     if(wait) return Resource::waitUploads(runningUploads);
@@ -83,29 +97,60 @@ std::vector<Resource::Upload> _Mesh<it, bit>::uploadInstanceBuffers(bool wait){
 }
 
 template <typename indexType, typename bit>
-void _Mesh<indexType, bit>::rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer) const {
+void _Mesh<indexType, bit>::rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer, uint32_t partition, uint32_t partitionCount, const GraphicsState& target) const {
+    if(&target.device() != device.get()) throw std::invalid_argument("Mesh '" + getName() + "' can only be rendered by states using the device it was created on.");
+
     for(auto it = instances.begin(); it != instances.end(); ++it) {
         // Reference the stored data elements
         const Ref<class Material>& material = it->first;
         const vpp::SubBuffer& instanceBuffer = it->second.first;
-        uint64_t instanceCount = it->second.second.size();
+        // Occlusion culling compacts the visible instances into one indirect draw, which the first partition draws
+        OcclusionCuller* culler = target.getOcclusionCuller();
+        bool culled = culler && hasBounds() && instanceBuffer.size();
+        if(culled && partition != 0) continue;
+
+        // Determine which range of the instances this partition is responsible for
+        uint64_t totalInstances = it->second.second.size();
+        uint64_t firstInstance = totalInstances * partition / partitionCount;
+        uint64_t instanceCount = totalInstances * (partition + 1) / partitionCount - firstInstance;
+        // Nothing to draw for this material in this partition
+        if(instanceCount == 0) continue;
 
         //Bind the material's pipeline
         if(!material->valid()) throw vk::VulkanError(vk::Result::errorInitializationFailed, "Can't record command buffer material: '" + material->getName() + "' is invalid.");
-        vk::cmdBindPipeline(renderCommandBuffer, vk::PipelineBindPoint::graphics, material->getPipeline());
+        if(!material->compatible(target)) throw std::invalid_argument("Material '" + material->getName() + "' was created for a render pass which isn't compatible with state " + str(target.id()) + "'s.");
+        // In the depth prepass, materials which don't take part in it are skipped
+        bool prepass = target.inDepthPrepass();
+        if(prepass && !material->getDepthPrepassPipeline().vkHandle()) continue;
+        // When shading is deferred, materials are only drawn in the subpass they were created for (G-buffer or lighting)
+        if(!prepass && target.hasDeferredShading() && material->getSubpass() != target.currentSubpass()) continue;
+
+        // Time how long the GPU spends drawing with this material
+        GPUProfiler::Scope scope(target.getGPUProfiler(), renderCommandBuffer, (prepass ? "prepass " : "material ") + material->getName());
+        vk::cmdBindPipeline(renderCommandBuffer, vk::PipelineBindPoint::graphics, prepass ? material->getDepthPrepassPipeline() : material->getPipeline());
 
         // Bind the vertex buffer
         vk::cmdBindVertexBuffers(renderCommandBuffer, /*firstBinding*/ 0, 1, vertexBuffer.buffer(), vertexBuffer.offset());
 
-        // Bind the instance buffer
-        vk::cmdBindVertexBuffers(renderCommandBuffer, /*firstBinding*/ 1, 1, instanceBuffer.buffer(), instanceBuffer.offset());
-
         // Bind the index buffer
         constexpr vk::IndexType vkIndexType = (sizeof(indexType) < 32 ? vk::IndexType::uint16 : vk::IndexType::uint32);
         vk::cmdBindIndexBuffer(renderCommandBuffer, indexBuffer.buffer(), indexBuffer.offset(), vkIndexType);
 
+        // Draw the instances which survived culling
+        if(culled){
+            const Material::Instance& first = it->second.second.front();
+            const OcclusionCuller::Batch& batch = culler->batch(this, material.get(), instanceBuffer, totalInstances, first.byteSize(),
+                offsetof(Material::Instance, transform), boundsMin, boundsMax, indexCount);
+            vk::cmdBindVertexBuffers(renderCommandBuffer, /*firstBinding*/ 1, 1, batch.visibleInstances.buffer(), batch.visibleInstances.offset());
+            OcclusionCuller::recordDraw(renderCommandBuffer, batch);
+            continue;
+        }
+
+        // Bind the instance buffer
+        vk::cmdBindVertexBuffers(renderCommandBuffer, /*firstBinding*/ 1, 1, instanceBuffer.buffer(), instanceBuffer.offset());
+
         // Draw
-        vk::cmdDrawIndexed(renderCommandBuffer, indexCount, /*instanceCount*/ instanceCount, /*firstIndex*/ 0, /*firstVertex*/ 0, /*firstInstance*/ 0);
+        vk::cmdDrawIndexed(renderCommandBuffer, indexCount, /*instanceCount*/ instanceCount, /*firstIndex*/ 0, /*firstVertex*/ 0, /*firstInstance*/ firstInstance);
     }
 }
 
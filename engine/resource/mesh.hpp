@@ -56,21 +56,35 @@ public:
     // };
 
 protected:
-    // Reference to a vulkan state to pull command buffers from
-    GraphicsState& state;
+    // The device the buffers were created on (kept alive as long as the mesh exists)
+    std::shared_ptr<VulkDevice> device;
     // BST holding all of the data for the instances of this mesh
     std::map<Ref<class Material>, std::pair<vpp::SubBuffer, std::vector<Material::Instance>>> instances;
     // Core Buffers
     vpp::SubBuffer vertexBuffer, indexBuffer;
     // Number of indices in the index buffer
     uint64_t indexCount;
+    // Untransformed bounding box of the vertices (min > max if unknown, in which case the mesh isn't culled)
+    glm::vec3 boundsMin = glm::vec3(1), boundsMax = glm::vec3(-1);
 
 public:
     _Mesh(GraphicsState&);
 
     /// Function which records the commands needed to render this mesh and its instances
     ///     to the provided command buffer.s
-    void rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer) const;
+    ///     <target> is the state being recorded, any state sharing the mesh's device can render it
+    ///     (as long as its render pass is compatible with the materials', see Material::compatible)
+    void rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer, const GraphicsState& target) const { rerecordCommandBuffer(renderCommandBuffer, 0, 1, target); }
+    /// Function which records the commands needed to render one partition of this mesh's
+    ///     instances (the instances of each material are split evenly between the partitions.)
+    ///     Used to spread the work across several secondary command buffers when recording in parallel
+    ///     If the target culls occlusion the instances are drawn indirectly by the first partition
+    void rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer, uint32_t partition, uint32_t partitionCount, const GraphicsState& target) const;
+
+    /// Returns true if the mesh's bounds are known (so its instances can be culled)
+    bool hasBounds() const { return glm::all(glm::lessThanEqual(boundsMin, boundsMax)); }
+    /// Gets the untransformed bounding box of the mesh
+    std::pair<glm::vec3, glm::vec3> getBounds() const { return {boundsMin, boundsMax}; }
 
     /// Function which adds an instance buffer to the gpu
     Material::Instance& addInstance(glm::mat4, Ref<class Material>&);
@@ -78,14 +92,19 @@ public:
     FORCE_INLINE Material::Instance& addInstance(glm::mat4 trans, const str& matName) { return addInstance(trans, ResourceManager::singleton()->get<class Material>(matName)); }
     FORCE_INLINE Material::Instance& addInstance(glm::mat4 trans, const str&& matName) { return addInstance(trans, matName); }
 
+    /// Function which queues the instance buffers to be uploaded to the GPU in the batch
+    void uploadInstanceBuffers(UploadBatch&);
     /// Function which uploads the instance buffers to the GPU
     std::vector<Resource::Upload> uploadInstanceBuffers(bool wait = true);
-    /// Function which uploads all of the data which this reference may need to send to the gpu
-    virtual std::vector<Resource::Upload> upload(bool wait = true){ return uploadInstanceBuffers(wait); }
+    /// Function which queues all of the data which this reference may need to send to the gpu in the batch
+    virtual void upload(UploadBatch& batch){ uploadInstanceBuffers(batch); }
+    using Resource::upload;
 
 public:
     static Ref<_Mesh> create(GraphicsState&, const str name = "");
     static Ref<_Mesh> create(GraphicsState&, std::vector<Vertex>& vertecies, std::vector<indexType>& indecies, const str name = "");
+    /// Creates a mesh whose vertex and index data is queued in the batch (it is submitted when the batch is flushed)
+    static Ref<_Mesh> create(GraphicsState&, std::vector<Vertex>& vertecies, std::vector<indexType>& indecies, UploadBatch& batch, const str name = "");
 
     static Ref<_Mesh> load(std::istream& file) { throw StateNotProvidedException("A GraphicsState must be provided when creating a mesh."); }
     FORCE_INLINE static Ref<_Mesh> load(std::istream&& file) { return load(file); }
@@ -0,0 +1,283 @@
+#include "particleSystem.hpp"
+#include "engine/vulkan/shader.hpp"
+#include "engine/compute.hpp"
+
+#include <cmath>
+#include <cstring>
+
+// Buffers shared by every stage (alive holds two lists of <capacity> indices, <parity> selects the current one)
+//  The vertex shader only reads them (writing requires vertexPipelineStoresAndAtomics)
+static const char* declarations = R"(
+#version 450
+#ifdef VERTEX
+#define ACCESS readonly
+#else
+#define ACCESS
+#endif
+struct Particle { vec4 position; vec4 velocity; };
+
+layout(std430, set = 0, binding = 0) ACCESS buffer Particles { Particle particles[]; };
+layout(std430, set = 0, binding = 1) ACCESS buffer Alive { uint alive[]; };
+layout(std430, set = 0, binding = 2) ACCESS buffer Dead { uint dead[]; };
+layout(std430, set = 0, binding = 3) ACCESS buffer Counters { uint aliveCount[2]; uint deadCount; uint emitCount; uint parity; };
+layout(std430, set = 0, binding = 4) ACCESS buffer Indirect { uvec4 emitArgs; uvec4 simulateArgs; uvec4 drawArgs; };
+layout(std140, set = 0, binding = 5) uniform Uniforms {
+    mat4 viewProjection;
+    vec4 cameraRight, cameraUp;
+    vec4 position, velocity, gravity;
+    vec4 colorStart, colorEnd;
+    vec2 lifetime, size;
+    uint emitCount, seed, capacity;
+    float deltaTime;
+} emitter;
+)";
+
+// Each step of the simulation is compiled from this source with the step's name defined
+static const char* computeShader = R"(
+#define GROUP_SIZE 64
+layout(local_size_x = GROUP_SIZE) in;
+
+// PCG hash, returns a random number in [0, 1)
+float random(inout uint state){
+    state = state * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return float((word >> 22u) ^ word) / 4294967296.0;
+}
+
+void main(){
+    uint i = gl_GlobalInvocationID.x;
+#if defined(BEGIN)
+    if(i > 0) return;
+    // Emit as many particles as there are dead particles to reuse
+    uint emit = min(emitter.emitCount, deadCount);
+    emitCount = emit;
+    aliveCount[1 - parity] = 0;
+    emitArgs = uvec4((emit + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1, 0);
+    simulateArgs = uvec4((aliveCount[parity] + emit + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1, 0);
+
+#elif defined(EMIT)
+    if(i >= emitCount) return;
+    uint index = dead[atomicAdd(deadCount, uint(-1)) - 1];
+
+    uint state = emitter.seed ^ (i * 1664525u);
+    // Uniformly distributed inside the unit sphere (a random direction, with the cube root of the radius keeping the density even)
+    float z = random(state) * 2 - 1, angle = random(state) * 6.28318530718;
+    vec3 direction = vec3(sqrt(1 - z * z) * vec2(cos(angle), sin(angle)), z);
+    vec3 offset = direction * pow(random(state), 1.0 / 3.0);
+    vec3 jitter = vec3(random(state), random(state), random(state)) * 2 - 1;
+    float life = mix(emitter.lifetime.x, emitter.lifetime.y, random(state));
+    particles[index].position = vec4(emitter.position.xyz + offset * emitter.position.w, life);
+    particles[index].velocity = vec4(emitter.velocity.xyz + jitter * emitter.velocity.w, life);
+
+    alive[parity * emitter.capacity + atomicAdd(aliveCount[parity], 1)] = index;
+
+#elif defined(SIMULATE)
+    if(i >= aliveCount[parity]) return;
+    uint index = alive[parity * emitter.capacity + i];
+    Particle p = particles[index];
+
+    p.position.w -= emitter.deltaTime;
+    if(p.position.w > 0){
+        // Survivors are compacted into the other list
+        p.velocity.xyz += emitter.gravity.xyz * emitter.deltaTime;
+        p.velocity.xyz *= max(1 - emitter.gravity.w * emitter.deltaTime, 0);
+        p.position.xyz += p.velocity.xyz * emitter.deltaTime;
+        particles[index] = p;
+        alive[(1 - parity) * emitter.capacity + atomicAdd(aliveCount[1 - parity], 1)] = index;
+    } else dead[atomicAdd(deadCount, 1)] = index;
+
+#elif defined(END)
+    if(i > 0) return;
+    // Draw the survivors, which are the current list from now on
+    drawArgs = uvec4(4, aliveCount[1 - parity], 0, 0);
+    parity = 1 - parity;
+#endif
+}
+)";
+
+// Expands each particle (instance) into a billboard facing the camera
+static const char* vertexShader = R"(
+layout(location = 0) out vec2 local;
+layout(location = 1) out vec4 tint;
+
+void main(){
+    Particle p = particles[alive[parity * emitter.capacity + gl_InstanceIndex]];
+    float age = clamp(1 - p.position.w / p.velocity.w, 0, 1);
+
+    local = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1) * 2 - 1;
+    float size = mix(emitter.size.x, emitter.size.y, age) / 2;
+    vec3 world = p.position.xyz + (emitter.cameraRight.xyz * local.x + emitter.cameraUp.xyz * local.y) * size;
+    gl_Position = emitter.viewProjection * vec4(world, 1);
+    tint = mix(emitter.colorStart, emitter.colorEnd, age);
+}
+)";
+
+// Particles are soft discs
+static const char* fragmentShader = R"(
+#version 450
+layout(location = 0) in vec2 local;
+layout(location = 1) in vec4 tint;
+layout(location = 0) out vec4 color;
+
+void main(){
+    color = vec4(tint.rgb, tint.a * smoothstep(1, 0.5, length(local)));
+}
+)";
+
+ParticleSystem::ParticleSystem(GraphicsState& state, uint32_t _capacity) : Resource(Resource::Type::ParticleSystem), device(state.sharedDevice()), capacity(_capacity) {
+    vpp::BufferAllocator& ba = device->bufferAllocator();
+    vk::BufferUsageFlags usage = vk::BufferUsageBits::storageBuffer | vk::BufferUsageBits::transferDst;
+    particles = {ba, capacity * sizeof(Particle), usage, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+    alive = {ba, 2 * capacity * sizeof(uint32_t), usage, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+    dead = {ba, capacity * sizeof(uint32_t), usage, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+    counters = {ba, 8 * sizeof(uint32_t), usage, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+    indirect = {ba, drawArgsOffset + sizeof(vk::DrawIndirectCommand), usage | vk::BufferUsageBits::indirectBuffer, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+
+    // Every stage sees the same buffers
+    vk::ShaderStageFlags stages = vk::ShaderStageBits::compute | vk::ShaderStageBits::vertex;
+    layout = {*device, {
+        {0, vk::DescriptorType::storageBuffer, 1, stages, nullptr},
+        {1, vk::DescriptorType::storageBuffer, 1, stages, nullptr},
+        {2, vk::DescriptorType::storageBuffer, 1, stages, nullptr},
+        {3, vk::DescriptorType::storageBuffer, 1, stages, nullptr},
+        {4, vk::DescriptorType::storageBuffer, 1, stages, nullptr},
+        {5, vk::DescriptorType::uniformBuffer, 1, stages, nullptr}}};
+
+    // Compile each step of the simulation
+    auto step = [&](const char* define){
+        GLSLShaderModule module(*device, str(declarations) + computeShader, vk::ShaderStageBits::compute, std::vector<str>{define});
+        return ComputeMaterial::create(state, module.createStageInfo(), nytl::make_span(layout.vkHandle()));
+    };
+    beginMaterial = step("BEGIN");
+    emitMaterial = step("EMIT");
+    simulateMaterial = step("SIMULATE");
+    endMaterial = step("END");
+
+    GLSLShaderModule vertex(*device, str(declarations) + vertexShader, vk::ShaderStageBits::vertex, std::vector<str>{"VERTEX"});
+    GLSLShaderModule fragment(*device, str(fragmentShader), vk::ShaderStageBits::fragment);
+
+    material = GraphicsMaterial::create(state);
+    GraphicsMaterial::CreateInfo info = material->begin({ std::vector<vpp::ShaderProgram::StageInfo>{
+        vertex.createStageInfo(),
+        fragment.createStageInfo()
+    } }, nytl::make_span(layout.vkHandle()));
+
+    // The particles are read from the storage buffers, so there are no vertex inputs
+    info.vertex.vertexBindingDescriptionCount = 0;
+    info.vertex.vertexAttributeDescriptionCount = 0;
+    info.assembly.topology = vk::PrimitiveTopology::triangleStrip;
+    info.rasterization.cullMode = vk::CullModeBits::none;
+
+    // Particles are tested against the scene's depth (if there is any) but don't write it, and are blended
+    info.depthStencil.depthWriteEnable = false;
+    static vk::PipelineColorBlendAttachmentState blend {true, vk::BlendFactor::srcAlpha, vk::BlendFactor::oneMinusSrcAlpha, vk::BlendOp::add,
+        vk::BlendFactor::one, vk::BlendFactor::oneMinusSrcAlpha, vk::BlendOp::add,
+        vk::ColorComponentBits::r | vk::ColorComponentBits::g | vk::ColorComponentBits::b | vk::ColorComponentBits::a};
+    info.blend.attachmentCount = 1;
+    info.blend.pAttachments = &blend;
+
+    // Transparent, so particles don't take part in the depth prepass
+    material->finalize(info, /*depthPrepass*/ false);
+}
+
+Resource::Ref<ParticleSystem> ParticleSystem::create(GraphicsState& state, uint32_t capacity, const str name){
+    // Create memory for the resource
+    ParticleSystem* _new = new ParticleSystem(state, capacity);
+    // Add a reference to the resource's memory to the ResourceManager and return a reference
+    auto out = ResourceManager::singleton()->add<ParticleSystem>(state, name, *_new);
+
+    // Every particle starts dead (frames wait for the copies to finish on the GPU, so there is no need to block here)
+    std::vector<uint32_t> deadIndices(capacity);
+    for(uint32_t i = 0; i < capacity; i++) deadIndices[i] = i;
+    std::vector<uint32_t> initialCounters = {/*alive*/ 0, 0, /*dead*/ capacity, /*emit*/ 0, /*parity*/ 0, 0, 0, 0};
+    std::vector<uint32_t> initialIndirect((drawArgsOffset + sizeof(vk::DrawIndirectCommand)) / sizeof(uint32_t), 0);
+
+    UploadBatch batch;
+    vk::AccessFlags access = vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite;
+    batch.upload(*out->device, out->dead, deadIndices, vk::PipelineStageBits::computeShader, access);
+    batch.upload(*out->device, out->counters, initialCounters, vk::PipelineStageBits::computeShader | vk::PipelineStageBits::vertexShader, access);
+    batch.upload(*out->device, out->indirect, initialIndirect, vk::PipelineStageBits::computeShader | vk::PipelineStageBits::drawIndirect, access | vk::AccessBits::indirectCommandRead);
+    batch.engine(*out->device).flush();
+
+    return out;
+}
+
+/// Sets the camera particles are drawn (as billboards facing it) with
+void ParticleSystem::setCamera(const glm::mat4& view, const glm::mat4& projection){
+    viewProjection = projection * view;
+    // The rows of the view matrix's rotation are the camera's axes in world space
+    cameraRight = glm::vec3(view[0][0], view[1][0], view[2][0]);
+    cameraUp = glm::vec3(view[0][1], view[1][1], view[2][1]);
+}
+
+/// Creates the uniforms and descriptors of the images (up to and including <image>) which don't have them yet
+void ParticleSystem::createImages(uint32_t last) const {
+    while(images.size() <= last){
+        Image& image = images.emplace_back();
+        // Written by the CPU every frame, so it lives in host visible memory which stays mapped
+        image.uniforms = {device->bufferAllocator(), sizeof(Uniforms), vk::BufferUsageBits::uniformBuffer, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+        image.map = image.uniforms.memoryMap();
+        // Until the image is simulated nothing is emitted (and time doesn't pass)
+        Uniforms uniforms = {};
+        uniforms.capacity = capacity;
+        std::memcpy(image.map.ptr(), &uniforms, sizeof(uniforms));
+
+        image.descriptors = device->descriptorAllocator().alloc(layout);
+        const vpp::SubBuffer* buffers[] = {&particles, &alive, &dead, &counters, &indirect, &image.uniforms};
+        vk::DescriptorBufferInfo bufferInfos[6];
+        vk::WriteDescriptorSet writes[6];
+        for(uint32_t b = 0; b < 6; b++){
+            bufferInfos[b] = {buffers[b]->buffer(), buffers[b]->offset(), buffers[b]->size()};
+            writes[b] = {image.descriptors, b, /*firstArrayElem*/ 0, 1, (b == 5 ? vk::DescriptorType::uniformBuffer : vk::DescriptorType::storageBuffer), /*imgInfo*/ nullptr, &bufferInfos[b]};
+        }
+        vk::updateDescriptorSets(*device, writes, {});
+    }
+}
+
+/// Writes the emitter's parameters and records emitting and simulating the particles for <deltaTime> seconds.
+void ParticleSystem::simulate(vpp::CommandBuffer& cb, uint32_t i, float deltaTime){
+    createImages(i);
+    Image& image = images[i];
+
+    // Only whole particles are emitted, the rest carries over
+    pendingEmission += emitter.rate * deltaTime;
+    uint32_t emitCount = (uint32_t) std::min<double>(std::floor(pendingEmission), capacity);
+    pendingEmission -= emitCount;
+
+    // The image's previous frame has finished, so its uniforms can be overwritten
+    Uniforms uniforms {viewProjection, glm::vec4(cameraRight, 0), glm::vec4(cameraUp, 0),
+        glm::vec4(emitter.position, emitter.spawnRadius), glm::vec4(emitter.velocity, emitter.velocityRandomness), glm::vec4(emitter.gravity, emitter.drag),
+        emitter.colorStart, emitter.colorEnd, {emitter.lifetimeMin, emitter.lifetimeMax}, {emitter.sizeStart, emitter.sizeEnd},
+        emitCount, seed++ * 2654435761u, capacity, deltaTime};
+    std::memcpy(image.map.ptr(), &uniforms, sizeof(uniforms));
+
+    // Earlier frames must be done drawing the particles before they are changed
+    vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::vertexShader | vk::PipelineStageBits::drawIndirect, vk::PipelineStageBits::computeShader, {}, {}, {}, {});
+
+    vk::DescriptorSet descriptors = image.descriptors;
+    vk::AccessFlags readWrite = vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite;
+    beginMaterial->recordDispatch(cb, 1, 1, 1, nytl::make_span(descriptors));
+    ComputeState::recordComputeBarrier(cb, vk::PipelineStageBits::computeShader | vk::PipelineStageBits::drawIndirect, readWrite | vk::AccessBits::indirectCommandRead);
+    emitMaterial->recordDispatchIndirect(cb, vpp::BufferSpan(indirect, sizeof(vk::DispatchIndirectCommand), emitArgsOffset), nytl::make_span(descriptors));
+    ComputeState::recordComputeBarrier(cb, vk::PipelineStageBits::computeShader, readWrite);
+    simulateMaterial->recordDispatchIndirect(cb, vpp::BufferSpan(indirect, sizeof(vk::DispatchIndirectCommand), simulateArgsOffset), nytl::make_span(descriptors));
+    ComputeState::recordComputeBarrier(cb, vk::PipelineStageBits::computeShader, readWrite);
+    endMaterial->recordDispatch(cb, 1, 1, 1, nytl::make_span(descriptors));
+    // The survivors are drawn by the image's commands
+    ComputeState::recordComputeBarrier(cb, vk::PipelineStageBits::computeShader | vk::PipelineStageBits::vertexShader | vk::PipelineStageBits::drawIndirect,
+        vk::AccessBits::shaderRead | vk::AccessBits::indirectCommandRead);
+}
+
+/// Function which records the commands needed to render the particles (of an image) to the provided command buffer.
+void ParticleSystem::rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer, uint32_t i, const GraphicsState& target) const {
+    if(!material->compatible(target)) throw std::invalid_argument("Particle system '" + getName() + "' can only be rendered by states on its device whose render pass is compatible with the one it was created for.");
+    if(target.inDepthPrepass() || target.inGBufferPass()) return;
+    createImages(i);
+
+    // Time how long the GPU spends drawing the particles
+    GPUProfiler::Scope scope(target.getGPUProfiler(), renderCommandBuffer, "particles " + getName());
+    vk::cmdBindPipeline(renderCommandBuffer, vk::PipelineBindPoint::graphics, material->getPipeline());
+    vk::cmdBindDescriptorSets(renderCommandBuffer, vk::PipelineBindPoint::graphics, material->getLayout(), 0, nytl::make_span(images[i].descriptors.vkHandle()), /*dynamicOffsets*/ {});
+    // The simulation writes the number of particles to draw
+    vk::cmdDrawIndirect(renderCommandBuffer, indirect.buffer(), indirect.offset() + drawArgsOffset, 1, sizeof(vk::DrawIndirectCommand));
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "engine/vulkan/state.hpp"
+#include "engine/math/math.hpp"
+
+#include "material.hpp"
+
+/// Particle system which is emitted, simulated, and drawn entirely on the GPU.
+///     Particles live in storage buffers along with a list of the dead particles and two lists of the living ones.
+///     Every frame compute shaders pop the emitted particles off the dead list, then simulate the living particles,
+///     compacting the survivors into the other alive list (and pushing the rest back onto the dead list) with
+///     atomic counters. The number of survivors becomes the instance count of an indirect draw, so the
+///     pre-recorded command buffers never change and the CPU only writes the emitter's parameters.
+///     The compute work is recorded into the frame's command buffer (see <simulate>), on the graphics queue
+class ParticleSystem: public Resource {
+public:
+    // Parameters particles are emitted and simulated with
+    struct Emitter {
+        // Center particles are spawned around, and the radius of the sphere they are spawned in
+        glm::vec3 position = glm::vec3(0);
+        float spawnRadius = 0;
+        // Initial velocity, and how much each axis of it is randomly varied by
+        glm::vec3 velocity = glm::vec3(0, 1, 0);
+        float velocityRandomness = 0.5;
+        // Acceleration applied to every particle, and the fraction of its velocity each particle loses per second
+        glm::vec3 gravity = glm::vec3(0, -9.81, 0);
+        float drag = 0;
+        // Color (and size) of particles when they are spawned and when they die
+        glm::vec4 colorStart = glm::vec4(1), colorEnd = glm::vec4(1, 1, 1, 0);
+        float sizeStart = 0.1, sizeEnd = 0.1;
+        // The range of lifetimes (in seconds) particles are randomly given
+        float lifetimeMin = 1, lifetimeMax = 2;
+        // The number of particles emitted per second
+        float rate = 0;
+    };
+
+protected:
+    // A particle as it is stored in the particle buffer (position.w is the remaining life, velocity.w the lifetime)
+    struct Particle {
+        glm::vec4 position, velocity;
+    };
+
+    // Uniforms read by the compute and vertex shaders (std140)
+    struct Uniforms {
+        glm::mat4 viewProjection;
+        glm::vec4 cameraRight, cameraUp;
+        glm::vec4 position, velocity, gravity;
+        glm::vec4 colorStart, colorEnd;
+        glm::vec2 lifetime, size;
+        uint32_t emitCount, seed, capacity;
+        float deltaTime;
+    };
+
+    // Data tracked for each render buffer
+    struct Image {
+        vpp::SubBuffer uniforms;
+        vpp::MemoryMapView map;
+        vpp::TrDs descriptors;
+    };
+
+    // The device the buffers were created on (kept alive as long as the particles exist)
+    std::shared_ptr<VulkDevice> device;
+    uint32_t capacity;
+
+    Emitter emitter;
+    glm::mat4 viewProjection = glm::mat4(1);
+    glm::vec3 cameraRight = glm::vec3(1, 0, 0), cameraUp = glm::vec3(0, 1, 0);
+    // Particles waiting to be emitted (fractions of particles carry over to the next frame)
+    double pendingEmission = 0;
+    uint32_t seed = 0;
+
+    // The particles, the lists of living (two, alternating each frame) and dead particles,
+    //  the counters, and the indirect dispatch/draw parameters
+    vpp::SubBuffer particles, alive, dead, counters, indirect;
+    vpp::TrDsLayout layout;
+    Resource::Ref<ComputeMaterial> beginMaterial, emitMaterial, simulateMaterial, endMaterial;
+    Resource::Ref<GraphicsMaterial> material;
+    // Images are created the first time they are simulated or drawn (see <createImages>)
+    mutable std::vector<Image> images;
+
+public:
+    // Offsets of the emission and simulation dispatch parameters, and the draw parameters, in the indirect buffer
+    static constexpr vk::DeviceSize emitArgsOffset = 0, simulateArgsOffset = 16, drawArgsOffset = 32;
+
+    ParticleSystem(GraphicsState&, uint32_t capacity);
+
+    /// Returns the parameters particles are emitted with, changes are applied from the next frame
+    Emitter& getEmitter() { return emitter; }
+    /// Returns the largest number of particles which can be alive at once
+    uint32_t getCapacity() const { return capacity; }
+    /// Emits a number of particles (on top of the emitter's rate) in the next frame
+    void burst(uint32_t count) { pendingEmission += count; }
+    /// Sets the camera particles are drawn (as billboards facing it) with
+    void setCamera(const glm::mat4& view, const glm::mat4& projection);
+
+    /// Writes the emitter's parameters and records emitting and simulating the particles for <deltaTime> seconds.
+    ///     Must be called from the state's custom frame recording steps (with the frame's image) every frame
+    void simulate(vpp::CommandBuffer& cb, uint32_t image, float deltaTime);
+    /// Function which records the commands needed to render the particles (of an image) to the provided command buffer.
+    ///     Must be recorded in the color subpass (nothing is recorded during the depth prepass or G-buffer subpass.)
+    ///     <target> is the state being recorded (its render pass must be compatible with the one the particles were created for)
+    void rerecordCommandBuffer(vpp::CommandBuffer& renderCommandBuffer, uint32_t image, const GraphicsState& target) const;
+
+public:
+    /// Creates a particle system with room for <capacity> particles (its buffers are initialized on the GPU)
+    static Ref<ParticleSystem> create(GraphicsState&, uint32_t capacity = 262'144, const str name = "");
+
+    static Ref<ParticleSystem> load(std::istream& file) { throw StateNotProvidedException("A GraphicsState must be provided when creating a particle system."); }
+    FORCE_INLINE static Ref<ParticleSystem> load(std::istream&& file) { return load(file); }
+    static Ref<ParticleSystem> load(GraphicsState&, std::istream& file) { throw std::runtime_error("Particle systems can't be loaded yet!"); }
+    FORCE_INLINE static Ref<ParticleSystem> load(GraphicsState& state, std::istream&& file) { return load(state, file); }
+
+protected:
+    /// Creates the uniforms and descriptors of the images (up to and including <image>) which don't have them yet
+    void createImages(uint32_t image) const;
+};
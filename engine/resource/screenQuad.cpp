@@ -0,0 +1,77 @@
+#include "screenQuad.hpp"
+#include "engine/vulkan/shader.hpp"
+
+// Expands each quad (instance) into a triangle strip in pixel space
+static const char* vertexShader = R"(
+#version 450
+layout(location = 0) in vec4 positionSize;
+layout(location = 1) in vec4 uvs;
+layout(location = 2) in vec4 color;
+layout(location = 3) in float rotation;
+layout(location = 4) in uint layer;
+
+layout(push_constant) uniform Screen { vec2 size; } screen;
+
+layout(location = 0) out vec3 uv;
+layout(location = 1) out vec4 tint;
+
+void main(){
+    vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+    vec2 local = (corner - 0.5) * positionSize.zw;
+    float s = sin(rotation), c = cos(rotation);
+    vec2 pixel = positionSize.xy + vec2(c * local.x - s * local.y, s * local.x + c * local.y);
+
+    // Vulkan's y axis points down, so the top left of the screen is (-1, -1)
+    gl_Position = vec4(pixel / screen.size * 2 - 1, 0, 1);
+    uv = vec3(mix(uvs.xy, uvs.zw, corner), layer);
+    tint = color;
+}
+)";
+
+/// Packs a color into RGBA8
+uint32_t ScreenQuad::packColor(glm::vec4 color){
+    glm::uvec4 bytes = glm::uvec4(glm::round(glm::clamp(color, 0.f, 1.f) * 255.f));
+    return bytes.r | (bytes.g << 8) | (bytes.b << 16) | (bytes.a << 24);
+}
+
+/// Creates a material which draws quads (instances bound to binding 0) over everything on the state's color subpass, blended in order.
+Resource::Ref<GraphicsMaterial> ScreenQuad::createMaterial(GraphicsState& state, const char* fragmentShader, nytl::Span<const vk::DescriptorSetLayout> uniformLayouts){
+    GLSLShaderModule vertex(state.device(), str(vertexShader), vk::ShaderStageBits::vertex);
+    GLSLShaderModule fragment(state.device(), str(fragmentShader), vk::ShaderStageBits::fragment);
+    vk::PushConstantRange constants {vk::ShaderStageBits::vertex, 0, sizeof(glm::vec2)};
+
+    Resource::Ref<GraphicsMaterial> material = GraphicsMaterial::create(state);
+    GraphicsMaterial::CreateInfo info = material->begin({ std::vector<vpp::ShaderProgram::StageInfo>{
+        vertex.createStageInfo(),
+        fragment.createStageInfo()
+    } }, uniformLayouts, nytl::make_span(constants));
+
+    // Every quad is an instance
+    static vk::VertexInputBindingDescription binding = getBindingDescription();
+    static auto attributes = getAttributeDescriptions();
+    info.vertex.vertexBindingDescriptionCount = 1;
+    info.vertex.pVertexBindingDescriptions = &binding;
+    info.vertex.vertexAttributeDescriptionCount = attributes.size();
+    info.vertex.pVertexAttributeDescriptions = attributes.data();
+    info.assembly.topology = vk::PrimitiveTopology::triangleStrip;
+    info.rasterization.cullMode = vk::CullModeBits::none;
+
+    // Quads are drawn over everything (in order) and blended
+    info.depthStencil.depthTestEnable = false;
+    info.depthStencil.depthWriteEnable = false;
+    static vk::PipelineColorBlendAttachmentState blend {true, vk::BlendFactor::srcAlpha, vk::BlendFactor::oneMinusSrcAlpha, vk::BlendOp::add,
+        vk::BlendFactor::one, vk::BlendFactor::oneMinusSrcAlpha, vk::BlendOp::add,
+        vk::ColorComponentBits::r | vk::ColorComponentBits::g | vk::ColorComponentBits::b | vk::ColorComponentBits::a};
+    info.blend.attachmentCount = 1;
+    info.blend.pAttachments = &blend;
+
+    // Transparent, so quads don't take part in the depth prepass
+    material->finalize(info, /*depthPrepass*/ false);
+    return material;
+}
+
+/// Records pushing the size of the state's swapchain to a material created by <createMaterial>
+void ScreenQuad::pushScreenSize(vk::CommandBuffer cb, const GraphicsMaterial& material, vk::Extent2D extent){
+    glm::vec2 screen = {extent.width, extent.height};
+    vk::cmdPushConstants(cb, material.getLayout(), vk::ShaderStageBits::vertex, 0, sizeof(screen), &screen);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "engine/vulkan/state.hpp"
+#include "engine/math/math.hpp"
+
+#include "material.hpp"
+
+/// A textured quad drawn in screen space (ex a sprite or a glyph) as it is stored in an instance buffer.
+///     Each quad is an instance of a 4 vertex triangle strip, drawn with a material created by <createMaterial>
+struct ScreenQuad {
+    // Position of the quad's center and its size (in pixels, the origin is the top left of the screen)
+    glm::vec2 position, size;
+    // The region of the texture array's layer the quad shows (min uv, max uv)
+    glm::vec4 uvs;
+    // Color multiplied with the texture (RGBA8, see <packColor>)
+    uint32_t color;
+    // Rotation around the center (in radians)
+    float rotation;
+    // Layer of the texture array the quad is read from
+    uint32_t layer;
+    uint32_t padding = 0;
+
+    static vk::VertexInputBindingDescription getBindingDescription(const uint32_t binding = 0){
+        return {binding, sizeof(ScreenQuad), vk::VertexInputRate::instance};
+    }
+
+    static std::array<vk::VertexInputAttributeDescription, 5> getAttributeDescriptions(const uint32_t binding = 0){
+        std::array<vk::VertexInputAttributeDescription, 5> out;
+
+        // Position and size are read as a single vec4
+        out[0] = {/*location*/ 0, binding, vk::Format::r32g32b32a32Sfloat, offsetof(ScreenQuad, position)};
+        out[1] = {/*location*/ 1, binding, vk::Format::r32g32b32a32Sfloat, offsetof(ScreenQuad, uvs)};
+        out[2] = {/*location*/ 2, binding, vk::Format::r8g8b8a8Unorm, offsetof(ScreenQuad, color)};
+        out[3] = {/*location*/ 3, binding, vk::Format::r32Sfloat, offsetof(ScreenQuad, rotation)};
+        out[4] = {/*location*/ 4, binding, vk::Format::r32Uint, offsetof(ScreenQuad, layer)};
+
+        return out;
+    }
+
+    /// Packs a color into RGBA8
+    static uint32_t packColor(glm::vec4 color);
+
+    /// Creates a material which draws quads (instances bound to binding 0) over everything on the state's color subpass, blended in order.
+    ///     The fragment shader receives the quad's uv and layer (vec3) at location 0 and its color at location 1.
+    ///     The screen size (vec2) must be pushed to the vertex shader before drawing (see <pushScreenSize>)
+    static Resource::Ref<GraphicsMaterial> createMaterial(GraphicsState& state, const char* fragmentShader, nytl::Span<const vk::DescriptorSetLayout> uniformLayouts = {});
+    /// Records pushing the size of the state's swapchain to a material created by <createMaterial>
+    static void pushScreenSize(vk::CommandBuffer cb, const GraphicsMaterial& material, vk::Extent2D extent);
+};
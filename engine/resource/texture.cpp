@@ -0,0 +1,329 @@
+#include "texture.hpp"
+
+#include <array>
+#include <cstring>
+
+/// Reads a value from the file, throwing if the file ends early
+template <typename T>
+static T read(std::istream& file){
+    T out;
+    if(!file.read((char*) &out, sizeof(out))) throw std::runtime_error("Unexpected end of texture file.");
+    return out;
+}
+
+/// Reads <size> bytes from the file onto the end of the data, returning the offset they were read to
+static size_t readInto(std::istream& file, std::vector<std::byte>& data, size_t size){
+    size_t offset = data.size();
+    data.resize(offset + size);
+    if(!file.read((char*) data.data() + offset, size)) throw std::runtime_error("Unexpected end of texture file.");
+    return offset;
+}
+
+/// Packs a four character code into a uint32 (as it is stored in a DDS file)
+static constexpr uint32_t fourCC(const char code[5]){
+    return uint32_t(code[0]) | (uint32_t(code[1]) << 8) | (uint32_t(code[2]) << 16) | (uint32_t(code[3]) << 24);
+}
+
+/// Returns the number of levels in a full mip chain
+static uint32_t fullMipChain(vk::Extent2D extent){
+    uint32_t levels = 1;
+    while((std::max(extent.width, extent.height) >> levels) > 0) levels++;
+    return levels;
+}
+
+/// Returns the number of bytes in a level of a single layer (0 if the format is unknown)
+static size_t levelSize(vk::Format format, vk::Extent2D extent, uint32_t level){
+    Texture::BlockInfo block = Texture::blockInfo(format);
+    if(!block.bytes) return 0;
+    uint32_t width = std::max(extent.width >> level, 1u), height = std::max(extent.height >> level, 1u);
+    return size_t((width + block.width - 1) / block.width) * ((height + block.height - 1) / block.height) * block.bytes;
+}
+
+Resource::Ref<Texture> Texture::create(VulkanState& state, const str name){
+    // Create memory for the resource
+    Texture* _new = new Texture(state);
+    // Add a reference to the resource's memory to the ResourceManager and return a reference
+    return ResourceManager::singleton()->add<Texture>(state, name, *_new);
+}
+
+Resource::Ref<Texture> Texture::create(VulkanState& state, vk::Format format, vk::Extent2D extent, nytl::span<const std::byte> data, bool generateMips, const str name){
+    // Copy the data into the image on the transfer queue
+    //  (frames wait for the copies to finish on the GPU, so there is no need to block here)
+    UploadBatch batch;
+    auto out = create(state, format, extent, data, generateMips, batch, name);
+    batch.engine(*out->device).flush();
+
+    return out;
+}
+
+Resource::Ref<Texture> Texture::create(VulkanState& state, vk::Format format, vk::Extent2D extent, nytl::span<const std::byte> data, bool generateMips, UploadBatch& batch, const str name){
+    auto out = create(state, name);
+    out->setData(format, extent, data, generateMips ? 0 : 1);
+    out->upload(batch);
+    return out;
+}
+
+/// Loads a KTX2 or DDS file (determined by its contents) and uploads it
+Resource::Ref<Texture> Texture::load(VulkanState& state, std::istream& file, const str name){
+    auto out = parse(state, file, name);
+
+    // Copy the data into the image (frames wait for the copies to finish on the GPU)
+    UploadBatch batch;
+    out->upload(batch);
+    batch.engine(*out->device).flush();
+    return out;
+}
+
+/// Creates a texture holding the data of a KTX2 or DDS file (determined by its contents) without uploading it
+Resource::Ref<Texture> Texture::parse(VulkanState& state, std::istream& file, const str name){
+    static const char ktx2Identifier[12] = {'\xAB', 'K', 'T', 'X', ' ', '2', '0', '\xBB', '\r', '\n', '\x1A', '\n'};
+
+    std::streampos start = file.tellg();
+    char magic[12] = {};
+    if(!file.read(magic, 4)) throw std::runtime_error("Failed to read texture file.");
+
+    bool dds = std::memcmp(magic, "DDS ", 4) == 0;
+    if(!dds && !(file.read(magic + 4, 8) && std::memcmp(magic, ktx2Identifier, sizeof(ktx2Identifier)) == 0))
+        throw std::runtime_error("Textures can only be loaded from KTX2 or DDS files.");
+
+    auto out = create(state, name);
+    if(dds) out->parseDDS(file);
+    else out->parseKTX2(file, start);
+    return out;
+}
+
+/// Sets the texture's data, with <levels> levels of <layers> layers (stored level after level, each level holding all of its layers.)
+void Texture::setData(vk::Format _format, vk::Extent2D _extent, nytl::span<const std::byte> data, uint32_t levels, uint32_t _layers, bool _cube){
+    if(blockInfo(_format).bytes == 0) throw std::invalid_argument("Texture '" + getName() + "': The sizes of the format's levels aren't known.");
+    if(_cube && _layers % 6) throw std::invalid_argument("Texture '" + getName() + "': Cube textures need 6 layers per cube.");
+
+    format = _format;
+    extent = _extent;
+    layers = std::max(_layers, 1u);
+    cube = _cube;
+    generateMips = levels == 0;
+    mipLevels = generateMips ? fullMipChain(extent) : levels;
+
+    regions.clear();
+    size_t offset = 0;
+    for(uint32_t level = 0; level < std::max(levels, 1u); level++){
+        size_t size = levelSize(format, extent, level) * layers;
+        regions.push_back({offset, size, level, 0, layers});
+        offset += size;
+    }
+    if(offset > data.size()) throw std::invalid_argument("Texture '" + getName() + "': " + str(data.size()) + " bytes provided, " + str(offset) + " needed.");
+    pending.assign(data.begin(), data.begin() + offset);
+}
+
+/// Function which queues the texture's pending data to be uploaded in the batch (creating its image if needed)
+void Texture::upload(UploadBatch& batch){
+    // Streamed textures are uploaded by their streamer
+    if(regions.empty() || streamed) return;
+    validateFormat();
+
+    createImage(image, view, 0);
+    uploadLevels(batch, image, 0);
+
+    // The staging ring took a copy, so the CPU side can be freed
+    pending = {};
+    regions.clear();
+}
+
+/// Creates an image (and a view of it) holding the levels from <base> on
+void Texture::createImage(vpp::Image& image, vpp::ImageView& view, uint32_t base) const {
+    vk::Extent2D baseExtent = levelExtent(base);
+    uint32_t levels = mipLevels - base;
+
+    vk::ImageUsageFlags usage = vk::ImageUsageBits::sampled | vk::ImageUsageBits::transferDst;
+    if(generateMips) usage |= vk::ImageUsageBits::transferSrc;
+    vk::ImageCreateInfo imageInfo {(cube ? vk::ImageCreateFlags(vk::ImageCreateBits::cubeCompatible) : vk::ImageCreateFlags{}), vk::ImageType::e2d, format, {baseExtent.width, baseExtent.height, 1},
+        levels, layers, vk::SampleCountBits::e1, vk::ImageTiling::optimal, usage, vk::SharingMode::exclusive, 0, nullptr, vk::ImageLayout::undefined};
+    image = {device->devMemAllocator(), imageInfo, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+
+    vk::ImageViewType viewType = cube ? (layers > 6 ? vk::ImageViewType::cubeArray : vk::ImageViewType::cube) : (layers > 1 ? vk::ImageViewType::e2dArray : vk::ImageViewType::e2d);
+    view = {*device, {/*flags*/ {}, image, viewType, format,
+        {vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity},
+        {vk::ImageAspectBits::color, 0, levels, 0, layers}}};
+}
+
+/// Queues copying the pending data of the levels from <base> on into an image created by <createImage>
+void Texture::uploadLevels(UploadBatch& batch, vk::Image image, uint32_t base) const {
+    std::vector<UploadEngine::ImageRegion> imageRegions;
+    for(const Region& region: regions){
+        if(region.level < base) continue;
+        vk::Extent2D size = levelExtent(region.level);
+        imageRegions.push_back({{pending.data() + region.offset, region.size}, {vk::ImageAspectBits::color, region.level - base, region.baseLayer, region.layerCount}, {size.width, size.height, 1}, blockInfo(format).height});
+    }
+    batch.uploadImage(*device, image, imageRegions, {vk::ImageAspectBits::color, 0, mipLevels - base, 0, layers}, generateMips, vk::ImageLayout::shaderReadOnlyOptimal,
+        vk::PipelineStageBits::vertexShader | vk::PipelineStageBits::fragmentShader | vk::PipelineStageBits::computeShader, vk::AccessBits::shaderRead);
+}
+
+/// Returns the number of bytes the level takes up (across every layer), only known while the data is on the CPU
+size_t Texture::levelBytes(uint32_t level) const {
+    size_t out = 0;
+    for(const Region& region: regions)
+        if(region.level == level) out += region.size;
+    return out;
+}
+
+/// Checks that the device can sample the format (and blit it if mips need to be generated)
+void Texture::validateFormat(){
+    vk::FormatFeatureFlags features = vk::getPhysicalDeviceFormatProperties(device->vkPhysicalDevice(), format).optimalTilingFeatures;
+    if(!(features & vk::FormatFeatureBits::sampledImage))
+        throw std::runtime_error("Texture '" + getName() + "': The device can't sample the texture's format (" + str(uint32_t(format)) + ").");
+
+    // Compressed formats can't be blitted to (and some uncompressed ones can't be filtered), fall back to a single level
+    vk::FormatFeatureFlags blit = vk::FormatFeatureBits::blitSrc | vk::FormatFeatureBits::blitDst | vk::FormatFeatureBits::sampledImageFilterLinear;
+    if(generateMips && (blockInfo(format).width != 1 || (features & blit) != blit)){
+        dlg_warn("Texture '" + getName() + "': Mips can't be generated for its format, only the first level will be used.");
+        generateMips = false;
+        mipLevels = 1;
+    }
+}
+
+/// Returns the info needed to write the texture to a combined image sampler descriptor.
+vk::DescriptorImageInfo Texture::descriptorInfo(vk::Sampler sampler) const {
+    if(!sampler) sampler = device->samplerCache().get(vk::Filter::linear, vk::SamplerAddressMode::repeat, /*maxAnisotropy*/ 16);
+    return {sampler, view, vk::ImageLayout::shaderReadOnlyOptimal};
+}
+
+/// Returns the block size of a format (only the formats textures can be loaded in are known)
+Texture::BlockInfo Texture::blockInfo(vk::Format format){
+    switch(format){
+    case vk::Format::bc1RgbUnormBlock: case vk::Format::bc1RgbSrgbBlock:
+    case vk::Format::bc1RgbaUnormBlock: case vk::Format::bc1RgbaSrgbBlock:
+    case vk::Format::bc4UnormBlock: case vk::Format::bc4SnormBlock:
+        return {4, 4, 8};
+    case vk::Format::bc2UnormBlock: case vk::Format::bc2SrgbBlock:
+    case vk::Format::bc3UnormBlock: case vk::Format::bc3SrgbBlock:
+    case vk::Format::bc5UnormBlock: case vk::Format::bc5SnormBlock:
+    case vk::Format::bc6hUfloatBlock: case vk::Format::bc6hSfloatBlock:
+    case vk::Format::bc7UnormBlock: case vk::Format::bc7SrgbBlock:
+        return {4, 4, 16};
+    case vk::Format::r8Unorm: return {1, 1, 1};
+    case vk::Format::r8g8Unorm: return {1, 1, 2};
+    case vk::Format::r8g8b8a8Unorm: case vk::Format::r8g8b8a8Srgb:
+    case vk::Format::b8g8r8a8Unorm: case vk::Format::b8g8r8a8Srgb:
+    case vk::Format::r32Sfloat:
+        return {1, 1, 4};
+    case vk::Format::r16g16b16a16Sfloat: return {1, 1, 8};
+    case vk::Format::r32g32b32a32Sfloat: return {1, 1, 16};
+    default: return {};
+    }
+}
+
+/// Parses a KTX2 file (after its identifier) into the texture's pending data
+void Texture::parseKTX2(std::istream& file, std::streampos start){
+    uint32_t vkFormat = read<uint32_t>(file), typeSize = read<uint32_t>(file);
+    uint32_t width = read<uint32_t>(file), height = read<uint32_t>(file), depth = read<uint32_t>(file);
+    uint32_t layerCount = read<uint32_t>(file), faceCount = read<uint32_t>(file), levelCount = read<uint32_t>(file);
+    uint32_t supercompression = read<uint32_t>(file);
+    (void) typeSize;
+
+    // Transcoding (ex Basis Universal) would need to happen on the CPU, the data must already be in a format the GPU can sample
+    if(supercompression != 0) throw std::runtime_error("Texture '" + getName() + "': Supercompressed KTX2 files aren't supported.");
+    if(vkFormat == 0) throw std::runtime_error("Texture '" + getName() + "': KTX2 files without a Vulkan format aren't supported.");
+    if(depth > 0) throw std::runtime_error("Texture '" + getName() + "': 3D textures aren't supported yet.");
+    if(faceCount != 1 && faceCount != 6) throw std::runtime_error("Texture '" + getName() + "': Invalid KTX2 face count.");
+
+    // Skip the data format descriptor, key/value data, and supercompression global data indices
+    file.ignore(4 * sizeof(uint32_t) + 2 * sizeof(uint64_t));
+
+    format = vk::Format(vkFormat);
+    extent = {width, std::max(height, 1u)};
+    cube = faceCount == 6;
+    layers = std::max(layerCount, 1u) * faceCount;
+    // A level count of 0 asks for the mip chain to be generated
+    generateMips = levelCount == 0;
+    mipLevels = generateMips ? fullMipChain(extent) : levelCount;
+
+    struct LevelIndex { uint64_t offset, length, uncompressedLength; };
+    std::vector<LevelIndex> levels;
+    for(uint32_t level = 0; level < std::max(levelCount, 1u); level++) levels.push_back(read<LevelIndex>(file));
+
+    // Each level holds all of its layers (and their faces), in the same order as the image's array layers
+    pending.clear();
+    regions.clear();
+    for(uint32_t level = 0; level < levels.size(); level++){
+        size_t expected = levelSize(format, extent, level) * layers;
+        if(expected && levels[level].length != expected)
+            throw std::runtime_error("Texture '" + getName() + "': KTX2 level " + str(level) + " is " + str(levels[level].length) + " bytes, expected " + str(expected) + ".");
+
+        file.seekg(start + std::streamoff(levels[level].offset));
+        size_t offset = readInto(file, pending, levels[level].length);
+        regions.push_back({offset, levels[level].length, level, 0, layers});
+    }
+}
+
+/// Parses a DDS file (after its magic number) into the texture's pending data
+void Texture::parseDDS(std::istream& file){
+    // Header fields (see DDS_HEADER and DDS_PIXELFORMAT)
+    enum { Size, Flags, Height, Width, PitchOrLinearSize, Depth, MipMapCount, PixelFlags = 19, PixelFourCC, PixelBitCount, PixelRMask, Caps2 = 27 };
+    std::array<uint32_t, 31> header = read<std::array<uint32_t, 31>>(file);
+    if(header[Size] != 124) throw std::runtime_error("Texture '" + getName() + "': Invalid DDS header.");
+
+    constexpr uint32_t DDSD_MIPMAPCOUNT = 0x20000, DDPF_FOURCC = 0x4, DDPF_RGB = 0x40, DDSCAPS2_CUBEMAP = 0x200, DDSCAPS2_VOLUME = 0x200000;
+    uint32_t arraySize = 1;
+    cube = header[Caps2] & DDSCAPS2_CUBEMAP;
+    bool volume = header[Caps2] & DDSCAPS2_VOLUME;
+
+    format = vk::Format::undefined;
+    if((header[PixelFlags] & DDPF_FOURCC) && header[PixelFourCC] == fourCC("DX10")){
+        // Extended header (see DDS_HEADER_DXT10), formats are given as DXGI_FORMATs
+        enum { DXGIFormat, ResourceDimension, MiscFlag, ArraySize, MiscFlags2 };
+        std::array<uint32_t, 5> dx10 = read<std::array<uint32_t, 5>>(file);
+        switch(dx10[DXGIFormat]){
+            case 28: format = vk::Format::r8g8b8a8Unorm; break;
+            case 29: format = vk::Format::r8g8b8a8Srgb; break;
+            case 71: format = vk::Format::bc1RgbaUnormBlock; break;
+            case 72: format = vk::Format::bc1RgbaSrgbBlock; break;
+            case 74: format = vk::Format::bc2UnormBlock; break;
+            case 75: format = vk::Format::bc2SrgbBlock; break;
+            case 77: format = vk::Format::bc3UnormBlock; break;
+            case 78: format = vk::Format::bc3SrgbBlock; break;
+            case 80: format = vk::Format::bc4UnormBlock; break;
+            case 81: format = vk::Format::bc4SnormBlock; break;
+            case 83: format = vk::Format::bc5UnormBlock; break;
+            case 84: format = vk::Format::bc5SnormBlock; break;
+            case 87: format = vk::Format::b8g8r8a8Unorm; break;
+            case 91: format = vk::Format::b8g8r8a8Srgb; break;
+            case 95: format = vk::Format::bc6hUfloatBlock; break;
+            case 96: format = vk::Format::bc6hSfloatBlock; break;
+            case 98: format = vk::Format::bc7UnormBlock; break;
+            case 99: format = vk::Format::bc7SrgbBlock; break;
+        }
+        arraySize = std::max(dx10[ArraySize], 1u);
+        cube = dx10[MiscFlag] & 0x4; // DDS_RESOURCE_MISC_TEXTURECUBE
+        volume = dx10[ResourceDimension] == 4; // DDS_DIMENSION_TEXTURE3D
+    } else if(header[PixelFlags] & DDPF_FOURCC){
+        uint32_t code = header[PixelFourCC];
+        if(code == fourCC("DXT1")) format = vk::Format::bc1RgbaUnormBlock;
+        else if(code == fourCC("DXT2") || code == fourCC("DXT3")) format = vk::Format::bc2UnormBlock;
+        else if(code == fourCC("DXT4") || code == fourCC("DXT5")) format = vk::Format::bc3UnormBlock;
+        else if(code == fourCC("ATI1") || code == fourCC("BC4U")) format = vk::Format::bc4UnormBlock;
+        else if(code == fourCC("BC4S")) format = vk::Format::bc4SnormBlock;
+        else if(code == fourCC("ATI2") || code == fourCC("BC5U")) format = vk::Format::bc5UnormBlock;
+        else if(code == fourCC("BC5S")) format = vk::Format::bc5SnormBlock;
+    } else if((header[PixelFlags] & DDPF_RGB) && header[PixelBitCount] == 32){
+        // The red mask determines the channel order
+        if(header[PixelRMask] == 0x000000ff) format = vk::Format::r8g8b8a8Unorm;
+        else if(header[PixelRMask] == 0x00ff0000) format = vk::Format::b8g8r8a8Unorm;
+    }
+    if(format == vk::Format::undefined) throw std::runtime_error("Texture '" + getName() + "': Unsupported DDS format.");
+    if(volume) throw std::runtime_error("Texture '" + getName() + "': 3D textures aren't supported yet.");
+
+    extent = {header[Width], std::max(header[Height], 1u)};
+    layers = arraySize * (cube ? 6 : 1);
+    mipLevels = (header[Flags] & DDSD_MIPMAPCOUNT) ? std::max(header[MipMapCount], 1u) : 1;
+    generateMips = false;
+
+    // DDS stores every level of a layer before moving on to the next layer
+    pending.clear();
+    regions.clear();
+    for(uint32_t layer = 0; layer < layers; layer++)
+        for(uint32_t level = 0; level < mipLevels; level++){
+            size_t size = levelSize(format, extent, level);
+            size_t offset = readInto(file, pending, size);
+            regions.push_back({offset, size, level, layer, 1});
+        }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "engine/vulkan/state.hpp"
+#include "engine/vulkan/sampler.hpp"
+
+#include "resource.hpp"
+
+/// Image which can be sampled by shaders.
+///     Block compressed (BCn) data is copied straight into a device local image without being decompressed,
+///     uncompressed data can have its mip chain generated on the GPU (by blitting each level from the one before it.)
+///     Textures can be loaded from KTX2 (without supercompression) and DDS files.
+///     The data is kept on the CPU until it is uploaded (ex by the ResourceManager) and is freed afterwards
+class Texture: public Resource {
+friend class TextureStreamer;
+public:
+    // The size of the blocks (in texels) and the number of bytes in each block of a format (all zero if the format is unknown)
+    struct BlockInfo {
+        uint32_t width = 0, height = 0, bytes = 0;
+    };
+
+protected:
+    // A range of the pending data which is copied into one level of some of the layers
+    struct Region {
+        size_t offset, size;
+        uint32_t level, baseLayer, layerCount;
+    };
+
+    // The device the image was created on (kept alive as long as the texture exists)
+    std::shared_ptr<VulkDevice> device;
+    vpp::Image image;
+    vpp::ImageView view;
+
+    vk::Format format = vk::Format::undefined;
+    vk::Extent2D extent = {};
+    uint32_t mipLevels = 0, layers = 0;
+    // The first level held by the image (levels before it aren't resident, see TextureStreamer)
+    uint32_t baseLevel = 0;
+    // True if the layers are the faces of cubes (6 per cube)
+    bool cube = false;
+
+    // Data waiting to be uploaded and the regions of it to copy
+    std::vector<std::byte> pending;
+    std::vector<Region> regions;
+    // True if the levels after the first should be generated once the first is uploaded
+    bool generateMips = false;
+    // True if a TextureStreamer decides which levels are resident (the data stays on the CPU)
+    bool streamed = false;
+
+public:
+    Texture(VulkanState& state) : Resource(Resource::Type::Texture), device(state.sharedDevice()) {}
+
+    /// Sets the texture's data, with <levels> levels of <layers> layers (stored level after level, each level holding all of its layers.)
+    ///     If <levels> is 0, only the first level is provided and the rest of the mip chain is generated on the GPU
+    ///     (which requires an uncompressed format which supports linear blits, otherwise the texture only has one level.)
+    ///     The image is (re)created when the data is uploaded, nothing may still be using the old image
+    void setData(vk::Format format, vk::Extent2D extent, nytl::span<const std::byte> data, uint32_t levels = 0, uint32_t layers = 1, bool cube = false);
+    /// Returns true if there is data waiting to be uploaded
+    bool hasPendingData() const { return !regions.empty(); }
+
+    /// Function which queues the texture's pending data to be uploaded in the batch (creating its image if needed)
+    virtual void upload(UploadBatch& batch);
+    using Resource::upload;
+
+    /// Returns true if the texture's image has been created
+    bool valid() const { return view.vkHandle(); }
+    const vpp::Image& getImage() const { return image; }
+    const vpp::ImageView& getView() const { return view; }
+    vk::Format getFormat() const { return format; }
+    vk::Extent2D getExtent() const { return extent; }
+    uint32_t getMipLevels() const { return mipLevels; }
+    uint32_t getLayers() const { return layers; }
+    bool isCube() const { return cube; }
+    /// Returns the first level which is resident on the GPU (the view's level 0)
+    uint32_t getResidentLevel() const { return baseLevel; }
+    /// Returns true if the texture is streamed by a TextureStreamer
+    bool isStreamed() const { return streamed; }
+    /// Returns the size of a level of the full mip chain
+    vk::Extent2D levelExtent(uint32_t level) const { return {std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u)}; }
+    /// Returns the number of bytes the level takes up (across every layer), only known while the data is on the CPU
+    size_t levelBytes(uint32_t level) const;
+
+    /// Returns the info needed to write the texture to a combined image sampler descriptor.
+    ///     If no sampler is provided, a trilinear (anisotropic if supported) repeating sampler from the device's cache is used
+    vk::DescriptorImageInfo descriptorInfo(vk::Sampler sampler = {}) const;
+
+    /// Returns the block size of a format (only the formats textures can be loaded in are known)
+    static BlockInfo blockInfo(vk::Format format);
+
+public:
+    static Ref<Texture> create(VulkanState&, const str name = "");
+    /// Creates a texture from a single level of tightly packed data, its mip chain is generated on the GPU if requested
+    static Ref<Texture> create(VulkanState&, vk::Format format, vk::Extent2D extent, nytl::span<const std::byte> data, bool generateMips = true, const str name = "");
+    /// Creates a texture whose data is queued in the batch (it is submitted when the batch is flushed)
+    static Ref<Texture> create(VulkanState&, vk::Format format, vk::Extent2D extent, nytl::span<const std::byte> data, bool generateMips, UploadBatch& batch, const str name = "");
+
+    static Ref<Texture> load(std::istream& file) { throw StateNotProvidedException("A VulkanState must be provided when loading a texture."); }
+    FORCE_INLINE static Ref<Texture> load(std::istream&& file) { return load(file); }
+    /// Loads a KTX2 or DDS file (determined by its contents) and uploads it
+    static Ref<Texture> load(VulkanState&, std::istream& file, const str name = "");
+    FORCE_INLINE static Ref<Texture> load(VulkanState& state, std::istream&& file, const str name = "") { return load(state, file, name); }
+
+protected:
+    /// Creates a texture holding the data of a KTX2 or DDS file (determined by its contents) without uploading it
+    static Ref<Texture> parse(VulkanState&, std::istream& file, const str name);
+    /// Parses a KTX2 file (after its identifier) into the texture's pending data, <start> is the position of the file's first byte
+    void parseKTX2(std::istream& file, std::streampos start);
+    /// Parses a DDS file (after its magic number) into the texture's pending data
+    void parseDDS(std::istream& file);
+    /// Checks that the device can sample the format (and blit it if mips need to be generated)
+    void validateFormat();
+    /// Creates an image (and a view of it) holding the levels from <base> on
+    void createImage(vpp::Image& image, vpp::ImageView& view, uint32_t base) const;
+    /// Queues copying the pending data of the levels from <base> on into an image created by <createImage>
+    void uploadLevels(UploadBatch& batch, vk::Image image, uint32_t base) const;
+};
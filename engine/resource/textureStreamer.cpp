@@ -0,0 +1,214 @@
+#include "textureStreamer.hpp"
+#include "engine/util/profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+/// Creates a streamer for textures rendered by the state
+TextureStreamer::TextureStreamer(VulkanState& _state, size_t _budget, uint32_t _tailSize, size_t _uploadBytesPerFrame)
+  : state(_state), device(_state.sharedDevice()), budget(_budget), tailSize(_tailSize), uploadBytesPerFrame(_uploadBytesPerFrame) {}
+
+/// Waits for anything still using the streamer's images to finish
+TextureStreamer::~TextureStreamer(){
+    bool loading = std::any_of(entries.begin(), entries.end(), [](auto& entry){ return entry.second.loading(); });
+    if(loading || !retired.empty()) device->waitIdle();
+}
+
+/// Starts streaming a texture whose data hasn't been uploaded yet (ex created by <load>), its mip tail is uploaded immediately.
+void TextureStreamer::add(Resource::Ref<Texture>& texture){
+    if(entries.find(texture.get()) != entries.end()) return;
+    if(!texture->hasPendingData() || texture->valid()) throw std::invalid_argument("Texture '" + texture->getName() + "' must be streamed before its data is uploaded.");
+    if(texture->generateMips) throw std::invalid_argument("Texture '" + texture->getName() + "' generates its mips, so they can't be streamed.");
+    if(texture->device != device) throw std::invalid_argument("Texture '" + texture->getName() + "' was created on a different device than the streamer.");
+
+    texture->validateFormat();
+    texture->streamed = true;
+    Entry& entry = entries.try_emplace(texture.get(), texture).first->second;
+
+    // The tail starts at the first level no larger than the tail size
+    entry.tailLevel = texture->mipLevels - 1;
+    for(uint32_t level = 0; level < texture->mipLevels; level++){
+        vk::Extent2D extent = texture->levelExtent(level);
+        if(std::max(extent.width, extent.height) <= tailSize){
+            entry.tailLevel = level;
+            break;
+        }
+    }
+    entry.desiredLevel = entry.targetLevel = entry.tailLevel;
+
+    // The tail is used straight away (frames wait for the copies to finish on the GPU)
+    UploadBatch batch;
+    texture->createImage(texture->image, texture->view, entry.tailLevel);
+    texture->uploadLevels(batch, texture->image, entry.tailLevel);
+    texture->baseLevel = entry.tailLevel;
+    batch.engine(*device).flush();
+}
+
+/// Loads a KTX2 or DDS file and starts streaming it
+Resource::Ref<Texture> TextureStreamer::load(std::istream& file, const str name){
+    auto out = Texture::parse(state, file, name);
+    add(out);
+    return out;
+}
+
+/// Stops streaming a texture, the levels which are resident stay resident
+void TextureStreamer::remove(const Texture& texture){
+    auto found = entries.find(&texture);
+    if(found == entries.end()) return;
+    Entry& entry = found->second;
+
+    // The image being uploaded can't be destroyed until the copies finish
+    if(entry.loading()) device->uploadEngine().wait(entry.uploadValue);
+
+    entry.texture->streamed = false;
+    entry.texture->pending = {};
+    entry.texture->regions.clear();
+    entries.erase(found);
+}
+
+/// Requests the texture be resident at a resolution suitable for covering <screenSize> pixels this frame
+void TextureStreamer::request(const Texture& texture, float screenSize){
+    auto found = entries.find(&texture);
+    if(found == entries.end()) return;
+    found->second.screenSize = std::max(found->second.screenSize, screenSize);
+}
+
+/// Returns the size (in pixels) of a sphere on screen (ex the bounds of the object a texture is applied to)
+float TextureStreamer::screenSize(glm::vec3 center, float radius, const glm::mat4& view, const glm::mat4& projection, float viewportHeight){
+    // The camera looks down -Z, if it is inside the sphere the sphere covers the screen
+    float depth = -(view * glm::vec4(center, 1)).z;
+    if(depth <= radius) return viewportHeight;
+    // The sphere's diameter in normalized device coordinates (which span 2 units) scaled to pixels
+    return radius * projection[1][1] / depth * viewportHeight;
+}
+
+/// Returns the number of bytes the levels from <base> on take up
+size_t TextureStreamer::residentBytes(const Texture& texture, uint32_t base){
+    size_t out = 0;
+    for(uint32_t level = base; level < texture.mipLevels; level++)
+        out += texture.levelBytes(level);
+    return out;
+}
+
+/// Creates an image holding the levels from <base> on and queues its upload
+void TextureStreamer::stream(Entry& entry, uint32_t base, UploadBatch& batch){
+    entry.texture->createImage(entry.image, entry.view, base);
+    entry.texture->uploadLevels(batch, entry.image, base);
+    entry.loadingLevel = base;
+}
+
+/// Destroys the retired images the state is finished with
+void TextureStreamer::collectRetired(){
+    if(state.timelineSemaphore()){
+        uint64_t completed = vk::getSemaphoreCounterValue(device->vkHandle(), state.timelineSemaphore());
+        while(!retired.empty() && retired.front().value <= completed) retired.pop_front();
+    } else
+        // Without a timeline, wait long enough for every frame in flight to finish
+        while(!retired.empty() && frame - retired.front().frame >= retireFrames) retired.pop_front();
+}
+
+/// Swaps in the images which finished uploading, picks which levels should be resident, and starts streaming them.
+void TextureStreamer::update(){
+    PROFILE_SCOPE("texture streaming");
+    frame++;
+    collectRetired();
+
+    Stats stats;
+    stats.textures = entries.size();
+    stats.budget = budget;
+
+    // Swap in the images whose uploads have finished
+    uint64_t completed = device->uploadEngine().completedValue();
+    for(auto& [key, entry]: entries){
+        if(!entry.loading() || entry.uploadValue > completed) continue;
+        Texture& texture = *entry.texture;
+        if(entry.loadingLevel < texture.baseLevel) stats.streamedIn++;
+        else stats.evicted++;
+
+        // Frames already submitted may still be sampling the old image
+        retired.push_back({std::move(texture.image), std::move(texture.view), state.submittedValue(), frame});
+        texture.image = std::move(entry.image);
+        texture.view = std::move(entry.view);
+        texture.baseLevel = entry.loadingLevel;
+        entry.image = {};
+        entry.view = {};
+        if(residencyCallback) residencyCallback(texture);
+    }
+
+    // Pick the level each texture needs (the mip whose texels are about the size of the screen's pixels)
+    std::vector<Entry*> order;
+    size_t total = 0;
+    for(auto& [key, entry]: entries){
+        Texture& texture = *entry.texture;
+        float size = std::max(texture.extent.width, texture.extent.height);
+        if(entry.screenSize <= 0) entry.desiredLevel = entry.tailLevel;
+        else if(entry.screenSize >= size) entry.desiredLevel = 0;
+        else entry.desiredLevel = std::min<uint32_t>(std::floor(std::log2(size / entry.screenSize)), entry.tailLevel);
+
+        // Levels which are already resident stay resident unless the budget is exceeded. A texture which is
+        //  being uploaded can't change until its upload finishes, and holds both of its images until then
+        if(entry.loading()){
+            entry.targetLevel = entry.loadingLevel;
+            total += residentBytes(texture, texture.baseLevel) + residentBytes(texture, entry.loadingLevel);
+        } else {
+            entry.targetLevel = std::min(entry.desiredLevel, texture.baseLevel);
+            total += residentBytes(texture, entry.targetLevel);
+        }
+        order.push_back(&entry);
+    }
+
+    // When over budget the levels which aren't needed are evicted first,
+    //  then the textures covering the least of the screen lose their largest levels
+    std::stable_sort(order.begin(), order.end(), [](const Entry* a, const Entry* b){ return a->screenSize < b->screenSize; });
+    for(bool needed: {false, true})
+        for(Entry* entry: order){
+            if(entry->loading()) continue;
+            uint32_t limit = needed ? entry->tailLevel : entry->desiredLevel;
+            while(total > budget && entry->targetLevel < limit){
+                total -= entry->texture->levelBytes(entry->targetLevel);
+                entry->targetLevel++;
+            }
+        }
+
+    UploadBatch batch;
+    std::vector<Entry*> queued;
+    size_t allowance = uploadBytesPerFrame;
+    // Queues uploading the levels from <level> on if the upload allowance permits,
+    //  a single image larger than the allowance can still upload (by itself) so it doesn't starve
+    auto upload = [&](Entry* entry, uint32_t level){
+        size_t bytes = residentBytes(*entry->texture, level);
+        if(bytes > allowance && allowance < uploadBytesPerFrame) return;
+        allowance -= std::min(allowance, bytes);
+        stream(*entry, level, batch);
+        queued.push_back(entry);
+    };
+
+    // Evict the levels which aren't needed (this creates a smaller image, so it also needs an upload)
+    for(Entry* entry: order)
+        if(!entry->loading() && entry->targetLevel > entry->texture->baseLevel)
+            upload(entry, entry->targetLevel);
+
+    // Stream in the levels of the textures covering the most of the screen first, as many as the remaining allowance permits
+    for(auto it = order.rbegin(); it != order.rend(); ++it){
+        Entry* entry = *it;
+        uint32_t base = entry->texture->baseLevel;
+        if(entry->loading() || entry->targetLevel >= base) continue;
+
+        uint32_t level = base - 1;
+        while(level > entry->targetLevel && residentBytes(*entry->texture, level - 1) <= allowance) level--;
+        upload(entry, level);
+    }
+
+    if(!queued.empty()){
+        uint64_t value = batch.engine(*device).flush();
+        for(Entry* entry: queued) entry->uploadValue = value;
+    }
+
+    for(auto& [key, entry]: entries){
+        stats.residentBytes += residentBytes(*entry.texture, entry.texture->baseLevel);
+        if(entry.loading()) stats.uploadingBytes += residentBytes(*entry.texture, entry.loadingLevel);
+        // Requests only last for a frame
+        entry.screenSize = 0;
+    }
+    lastFrame = stats;
+}
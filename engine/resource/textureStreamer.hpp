@@ -0,0 +1,127 @@
+#pragma once
+
+#include "texture.hpp"
+#include "engine/math/math.hpp"
+
+#include <deque>
+#include <functional>
+#include <map>
+
+/// Class which streams the mip levels of textures in and out of VRAM to stay within a budget.
+///     Only the small tail of each texture's mip chain (levels no larger than <tailSize>) is uploaded when it is added,
+///     every frame the levels each texture needs are picked from the screen size requested for it (see <request>)
+///     and the most needed levels are streamed in (limited to a number of bytes uploaded per frame) while the least needed
+///     are evicted once the resident levels (and the images still uploading) would exceed the budget. Textures not requested
+///     in a frame keep their resident levels until the budget needs them, and then fall back to their tail.
+///     Without sparse residency an image can't change the levels it holds, so changing residency creates a new image
+///     (uploading its levels from the CPU copy the streamer keeps), which is swapped in once its upload finishes on the
+///     transfer queue and the old image is destroyed once the frames using it finish. Anything holding the texture's view
+///     (ex descriptors) must be updated when its residency changes (see <setResidencyCallback>)
+class TextureStreamer {
+public:
+    // Residency statistics
+    struct Stats {
+        // The number of streamed textures, and the bytes which are resident, being uploaded, and allowed
+        size_t textures = 0, residentBytes = 0, uploadingBytes = 0, budget = 0;
+        // The number of textures which finished streaming in or were evicted (in the frame)
+        uint32_t streamedIn = 0, evicted = 0;
+
+        /// Returns the percentage of the budget the resident levels take up
+        double budgetPercent() const { return budget ? 100.0 * residentBytes / budget : 0; }
+    };
+
+protected:
+    // Streaming data tracked for each texture
+    struct Entry {
+        Resource::Ref<Texture> texture;
+        // The first level of the mip tail (always resident), and the first level the texture should have resident
+        uint32_t tailLevel = 0, desiredLevel = 0;
+        // The largest screen size (in pixels) requested this frame, and the first level picked to be resident this frame
+        float screenSize = 0;
+        uint32_t targetLevel = 0;
+
+        // Image being uploaded (swapped in once <uploadValue> completes) and the first level it holds
+        vpp::Image image;
+        vpp::ImageView view;
+        uint32_t loadingLevel = 0;
+        uint64_t uploadValue = 0;
+
+        Entry(Resource::Ref<Texture>& texture) : texture(texture) {}
+        /// Returns true if a new image is being uploaded
+        bool loading() const { return image.vkHandle(); }
+    };
+
+    // An image which is destroyed once the frames using it finish
+    struct Retired {
+        vpp::Image image;
+        vpp::ImageView view;
+        // The state's submission the image was last used by, and the frame it was retired (without timeline semaphores)
+        uint64_t value, frame;
+    };
+
+    VulkanState& state;
+    std::shared_ptr<VulkDevice> device;
+
+    std::map<const Texture*, Entry> entries;
+    std::deque<Retired> retired;
+
+    size_t budget;
+    uint32_t tailSize;
+    size_t uploadBytesPerFrame;
+    // The number of frames retired images are kept for when there is no timeline to check (must be more than the frames in flight)
+    uint32_t retireFrames = 4;
+
+    uint64_t frame = 0;
+    Stats lastFrame;
+    std::function<void (Texture&)> residencyCallback = {};
+
+public:
+    /// Creates a streamer for textures rendered by the state
+    ///     <budget> is the number of bytes the streamed textures may take up, <tailSize> the largest level (in texels) always kept resident,
+    ///     and <uploadBytesPerFrame> the number of bytes which may start uploading (streaming in or evicting) each frame
+    TextureStreamer(VulkanState& state, size_t budget = 256 * 1024 * 1024, uint32_t tailSize = 64, size_t uploadBytesPerFrame = 8 * 1024 * 1024);
+    /// Waits for anything still using the streamer's images to finish
+    ~TextureStreamer();
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    /// Starts streaming a texture whose data hasn't been uploaded yet (ex created by <load>), its mip tail is uploaded immediately.
+    ///     The texture's levels must all be provided (textures whose mips are generated can't be streamed)
+    void add(Resource::Ref<Texture>& texture);
+    /// Loads a KTX2 or DDS file and starts streaming it
+    Resource::Ref<Texture> load(std::istream& file, const str name = "");
+    FORCE_INLINE Resource::Ref<Texture> load(std::istream&& file, const str name = "") { return load(file, name); }
+    /// Stops streaming a texture, the levels which are resident stay resident
+    void remove(const Texture& texture);
+
+    /// Requests the texture be resident at a resolution suitable for covering <screenSize> pixels this frame
+    ///     (the largest request of the frame is used)
+    void request(const Texture& texture, float screenSize);
+    /// Returns the size (in pixels) of a sphere on screen (ex the bounds of the object a texture is applied to)
+    static float screenSize(glm::vec3 center, float radius, const glm::mat4& view, const glm::mat4& projection, float viewportHeight);
+
+    /// Swaps in the images which finished uploading, picks which levels should be resident, and starts streaming them.
+    ///     Should be called once per frame, after the frame's requests and before it is submitted
+    void update();
+
+    /// Sets the function called whenever a texture's view changes (after its residency changes.)
+    ///     The old view stays alive until the frames already submitted finish, but descriptors those frames use
+    ///     can't be updated while they are running (ex double buffer the descriptors, or rerecord the command buffers)
+    void setResidencyCallback(std::function<void (Texture&)> callback) { residencyCallback = callback; }
+    /// Sets the number of bytes the streamed textures may take up
+    void setBudget(size_t bytes) { budget = bytes; }
+    size_t getBudget() const { return budget; }
+    /// Sets the number of bytes which may start uploading (streaming in or evicting) each frame
+    void setUploadBytesPerFrame(size_t bytes) { uploadBytesPerFrame = bytes; }
+
+    /// Returns the statistics of the last update
+    const Stats& frameStats() const { return lastFrame; }
+
+protected:
+    /// Returns the number of bytes the levels from <base> on take up
+    static size_t residentBytes(const Texture& texture, uint32_t base);
+    /// Creates an image holding the levels from <base> on and queues its upload
+    void stream(Entry& entry, uint32_t base, UploadBatch& batch);
+    /// Destroys the retired images the state is finished with
+    void collectRetired();
+};
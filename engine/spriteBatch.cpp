@@ -0,0 +1,141 @@
+#include "spriteBatch.hpp"
+#include "util/profiler.hpp"
+
+#include <cstring>
+
+static const char* fragmentShader = R"(
+#version 450
+layout(set = 0, binding = 0) uniform sampler2DArray page;
+
+layout(location = 0) in vec3 uv;
+layout(location = 1) in vec4 tint;
+layout(location = 0) out vec4 color;
+
+void main(){
+    color = texture(page, uv) * tint;
+}
+)";
+
+/// Creates a sprite batch drawing up to <capacity> sprites a frame into the state's color subpass.
+SpriteBatch::SpriteBatch(GraphicsState& _state, uint32_t _capacity) : state(_state), device(_state.sharedDevice()), capacity(_capacity) {
+    pageLayout = {*device, {{0, vk::DescriptorType::combinedImageSampler, 1, vk::ShaderStageBits::fragment, nullptr}}};
+
+    material = ScreenQuad::createMaterial(state, fragmentShader, nytl::make_span(pageLayout.vkHandle()));
+}
+
+/// Adds a page sprites can be drawn from, returning its index.
+uint32_t SpriteBatch::addPage(Resource::Ref<Texture>& texture){
+    if(pages.size() >= maxPages) throw std::length_error("Sprite batches can't have more than " + str(maxPages) + " pages.");
+    if(!texture->valid() || texture->isStreamed()) throw std::invalid_argument("Texture '" + texture->getName() + "' must be uploaded (and not streamed) to be used as a sprite page.");
+
+    Page& page = pages.emplace_back(texture);
+    page.view = {*device, {/*flags*/ {}, texture->getImage(), vk::ImageViewType::e2dArray, texture->getFormat(),
+        {vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity},
+        {vk::ImageAspectBits::color, 0, texture->getMipLevels() - texture->getResidentLevel(), 0, texture->getLayers()}}};
+
+    page.descriptors = device->descriptorAllocator().alloc(pageLayout);
+    vk::DescriptorImageInfo imageInfo = texture->descriptorInfo(device->samplerCache().get(vk::Filter::linear, vk::SamplerAddressMode::clampToEdge));
+    imageInfo.imageView = page.view;
+    vk::WriteDescriptorSet write {page.descriptors, 0, 0, 1, vk::DescriptorType::combinedImageSampler, &imageInfo, nullptr, nullptr};
+    vk::updateDescriptorSets(*device, nytl::make_span(write), {});
+
+    return pages.size() - 1;
+}
+
+/// Removes every sprite (ex at the start of a frame)
+void SpriteBatch::clear(){
+    for(Page& page: pages) page.sprites.clear();
+}
+
+/// Creates the buffers of any images which don't have them yet
+void SpriteBatch::createImages(){
+    while(images.size() < state.renderBuffers.size()){
+        Image& image = images.emplace_back();
+        // Written by the CPU every frame, so they live in host visible memory which stays mapped
+        image.instances = {device->bufferAllocator(), capacity * sizeof(Sprite), vk::BufferUsageBits::vertexBuffer, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+        image.draws = {device->bufferAllocator(), maxPages * sizeof(vk::DrawIndirectCommand), vk::BufferUsageBits::indirectBuffer, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+        image.instanceMap = image.instances.memoryMap();
+        image.drawMap = image.draws.memoryMap();
+        std::memset(image.drawMap.ptr(), 0, image.draws.size());
+    }
+}
+
+/// Copies the frame's sprites into the image's buffers (and uploads any changes to rvg's objects.)
+bool SpriteBatch::update(uint32_t i){
+    PROFILE_SCOPE("sprites");
+    createImages();
+    Image& image = images[i];
+    Sprite* instances = (Sprite*) image.instanceMap.ptr();
+    vk::DrawIndirectCommand* draws = (vk::DrawIndirectCommand*) image.drawMap.ptr();
+
+    // Each page's sprites are packed one after another (indirect draws starting past the first instance are optional,
+    //  without them each page gets an equal slice of the buffer which the recorded commands bind)
+    Stats stats;
+    uint64_t written = 0;
+    uint32_t slice = pages.empty() ? 0 : capacity / pages.size();
+    for(uint32_t p = 0; p < pages.size(); p++){
+        std::vector<Sprite>& sprites = pages[p].sprites;
+        uint32_t first = device->drawIndirectFirstInstance ? written : p * slice;
+        uint32_t count = std::min<uint64_t>(sprites.size(), device->drawIndirectFirstInstance ? capacity - written : slice);
+        std::memcpy(instances + first, sprites.data(), count * sizeof(Sprite));
+        draws[p] = {/*vertexCount*/ 4, /*instanceCount*/ count, /*firstVertex*/ 0, /*firstInstance*/ device->drawIndirectFirstInstance ? first : 0};
+
+        written += count;
+        stats.dropped += sprites.size() - count;
+        if(count) stats.draws++;
+    }
+    stats.sprites = written;
+    if(stats.dropped) dlg_warn("Sprite batch capacity (" + str(capacity) + ") exceeded, " + str(stats.dropped) + " sprites dropped.");
+    lastFrame = stats;
+
+    // rvg uploads its changed objects itself, the frame must wait for those uploads
+    bool rerecord = false;
+    if(vector){
+        auto [changed, semaphore] = vector->upload();
+        if(semaphore) state.addWaitSemaphore(semaphore, vk::PipelineStageBits::allGraphics);
+        rerecord = changed;
+    }
+    return rerecord;
+}
+
+/// Records drawing the sprites (and any vector graphics) for an image, must be called inside the state's color subpass
+void SpriteBatch::record(vk::CommandBuffer cb, uint32_t i){
+    if(state.inDepthPrepass() || state.inGBufferPass()) return;
+    createImages();
+    Image& image = images[i];
+
+    if(!pages.empty()){
+        vk::cmdBindPipeline(cb, vk::PipelineBindPoint::graphics, material->getPipeline());
+        ScreenQuad::pushScreenSize(cb, *material, state.swapchainExtent());
+
+        // Without first instances each page's slice of the buffer is bound before its draw
+        uint32_t slice = capacity / pages.size();
+        vk::DeviceSize offset = image.instances.offset();
+        if(device->drawIndirectFirstInstance) vk::cmdBindVertexBuffers(cb, /*firstBinding*/ 0, 1, image.instances.buffer(), offset);
+        for(uint32_t p = 0; p < pages.size(); p++){
+            if(!device->drawIndirectFirstInstance){
+                offset = image.instances.offset() + vk::DeviceSize(p) * slice * sizeof(Sprite);
+                vk::cmdBindVertexBuffers(cb, /*firstBinding*/ 0, 1, image.instances.buffer(), offset);
+            }
+            vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::graphics, material->getLayout(), 0, nytl::make_span(pages[p].descriptors.vkHandle()), /*dynamicOffsets*/ {});
+            vk::cmdDrawIndirect(cb, image.draws.buffer(), image.draws.offset() + p * sizeof(vk::DrawIndirectCommand), 1, sizeof(vk::DrawIndirectCommand));
+        }
+    }
+
+    if(vector && vectorRecordingSteps){
+        vector->bindDefaults(cb);
+        vectorRecordingSteps(cb);
+    }
+}
+
+/// Returns the rvg context vector graphics drawn on top of the sprites are created with (created the first time it is needed)
+rvg::Context& SpriteBatch::vectorContext(){
+    if(!vector){
+        rvg::ContextSettings settings;
+        settings.renderPass = state.renderPass;
+        settings.subpass = state.colorSubpass();
+        settings.uploadQueueFamily = device->presentQueueExcept()->family();
+        vector = std::make_unique<rvg::Context>(*device, settings);
+    }
+    return *vector;
+}
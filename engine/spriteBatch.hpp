@@ -0,0 +1,107 @@
+#pragma once
+
+#include "vulkan/state.hpp"
+#include "resource/texture.hpp"
+#include "resource/material.hpp"
+#include "resource/screenQuad.hpp"
+#include "math/math.hpp"
+
+#include <rvg/context.hpp>
+#include <deque>
+
+/// Class which draws large numbers of textured quads (sprites/cards) in 2D on top of a GraphicsState's color subpass.
+///     Sprites are submitted every frame (between <clear> and the frame's <update>) and grouped by page, a texture
+///     (array) registered with <addPage>. When the image's frame starts they are copied into a persistently mapped
+///     per image instance buffer along with an indirect draw for each page, so the pre-recorded command buffers
+///     never change and every page is a single draw no matter how many sprites it holds.
+///     Pages are drawn in the order they were added (sprites within a page in the order they were submitted.)
+///     Vector graphics (ex UI) can be drawn with rvg after the sprites (see <vectorContext>)
+class SpriteBatch {
+public:
+    // A sprite as it is stored in the instance buffer
+    using Sprite = ScreenQuad;
+
+    // Statistics of the last update
+    struct Stats {
+        // The number of sprites drawn, dropped (because the capacity was exceeded), and the number of draws
+        uint64_t sprites = 0, dropped = 0, draws = 0;
+    };
+
+protected:
+    // A texture (array) and the sprites drawn from it this frame
+    struct Page {
+        Resource::Ref<Texture> texture;
+        // Array view of the texture (sprites always sample a 2D array)
+        vpp::ImageView view;
+        vpp::TrDs descriptors;
+        std::vector<Sprite> sprites;
+
+        Page(Resource::Ref<Texture>& texture) : texture(texture) {}
+    };
+
+    // Buffers written before each of an image's frames
+    struct Image {
+        vpp::SubBuffer instances, draws;
+        vpp::MemoryMapView instanceMap, drawMap;
+    };
+
+    GraphicsState& state;
+    std::shared_ptr<VulkDevice> device;
+    uint32_t capacity;
+
+    vpp::TrDsLayout pageLayout;
+    Resource::Ref<GraphicsMaterial> material;
+    // Pages never move once added (they own references and descriptors)
+    std::deque<Page> pages;
+    std::vector<Image> images;
+    Stats lastFrame;
+
+    // rvg context (created the first time it is needed) and the steps recording its shapes
+    std::unique_ptr<rvg::Context> vector;
+    std::function<void (vk::CommandBuffer)> vectorRecordingSteps = {};
+
+public:
+    /// Creates a sprite batch drawing up to <capacity> sprites a frame into the state's color subpass.
+    ///     Must be recreated if the state's render pass is recreated (ex depth is enabled)
+    SpriteBatch(GraphicsState& state, uint32_t capacity = 100'000);
+    SpriteBatch(const SpriteBatch&) = delete;
+    SpriteBatch& operator=(const SpriteBatch&) = delete;
+
+    // The largest number of pages (each image has room for this many indirect draws)
+    static constexpr uint32_t maxPages = 64;
+
+    /// Adds a page sprites can be drawn from, returning its index. The texture must already be uploaded (and not streamed.)
+    ///     Command buffers must be rerecorded when pages are added
+    uint32_t addPage(Resource::Ref<Texture>& texture);
+    /// Returns the number of pages
+    uint32_t pageCount() const { return pages.size(); }
+
+    /// Removes every sprite (ex at the start of a frame)
+    void clear();
+    /// Adds a sprite to the frame. Sprites past the capacity are dropped
+    void draw(uint32_t page, const Sprite& sprite) { pages[page].sprites.push_back(sprite); }
+    /// Adds a sprite to the frame, its <position> is the center and <uvs> the region (min uv, max uv) of the page's layer it shows
+    void draw(uint32_t page, glm::vec2 position, glm::vec2 size, glm::vec4 uvs = {0, 0, 1, 1}, uint32_t layer = 0, glm::vec4 color = glm::vec4(1), float rotation = 0)
+    { draw(page, Sprite{position, size, uvs, ScreenQuad::packColor(color), rotation, layer}); }
+
+    /// Copies the frame's sprites into the image's buffers (and uploads any changes to rvg's objects.)
+    ///     Must be called after the image's previous frame finished and before the frame is submitted (ex in the custom main loop steps.)
+    ///     Returns true if the command buffers need to be rerecorded (rvg may need to rerecord when its objects change)
+    bool update(uint32_t image);
+    /// Records drawing the sprites (and any vector graphics) for an image, must be called inside the state's color subpass
+    ///     (ex from the custom command recording steps, nothing is recorded during the depth prepass or G-buffer subpass)
+    void record(vk::CommandBuffer cb, uint32_t image);
+
+    /// Returns the rvg context vector graphics drawn on top of the sprites are created with (created the first time it is needed)
+    rvg::Context& vectorContext();
+    /// Sets the function recording the vector graphics (called with rvg's defaults bound.)
+    ///     Command buffers must be rerecorded when this is changed
+    void bindVectorRecordingSteps(std::function<void (vk::CommandBuffer)> steps) { vectorRecordingSteps = steps; }
+
+    /// Returns the statistics of the last update
+    const Stats& frameStats() const { return lastFrame; }
+
+protected:
+    /// Creates the buffers of any images which don't have them yet
+    void createImages();
+};
@@ -0,0 +1,121 @@
+/*
+    Class which paces frames to a target frame rate. Waiting is done by sleeping
+    until shortly before the frame's deadline and then spinning for the rest, so
+    frames start at consistent times without burning a core. Also keeps a rolling
+    window of frame times which jitter statistics are calculated from.
+    File: framePacer.hpp
+    Author: Joshua "Jdbener" Dahl
+*/
+#ifndef _FRAME_PACER_H_
+#define _FRAME_PACER_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <thread>
+#include <vector>
+
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Statistics of the recent frame times (in milliseconds)
+    struct Stats {
+        double avg = 0, min = 0, max = 0;
+        // Standard deviation of the frame times
+        double jitter = 0;
+        // 99th percentile frame time
+        double p99 = 0;
+        // The number of frames the statistics were calculated from
+        size_t samples = 0;
+    };
+
+private:
+    // Time between frames (zero if unlimited)
+    Clock::duration period = Clock::duration::zero();
+    // How long before the deadline we stop sleeping and start spinning (sleeps aren't precise)
+    Clock::duration spinThreshold = std::chrono::microseconds(1500);
+
+    // When the next frame should start
+    Clock::time_point deadline = {};
+    // When the last frame started
+    Clock::time_point lastFrame = {};
+
+    // Rolling window of frame times (in milliseconds)
+    std::deque<double> frameTimes;
+    size_t window;
+
+public:
+    /// Creates a pacer targeting the specified frame rate (0 = unlimited)
+    ///     Statistics are calculated from the last <window> frames
+    FramePacer(double targetFrameRate = 0, size_t _window = 240) : window(std::max<size_t>(_window, 1)) { setTargetFrameRate(targetFrameRate); }
+
+    /// Sets the frame rate frames are paced to (0 = unlimited)
+    void setTargetFrameRate(double fps){
+        if(fps <= 0) period = Clock::duration::zero();
+        else period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+        deadline = {};
+    }
+    /// Returns the frame rate frames are paced to (0 = unlimited)
+    double targetFrameRate() const {
+        if(period == Clock::duration::zero()) return 0;
+        return 1.0 / std::chrono::duration<double>(period).count();
+    }
+
+    /// Sets how long before a frame's deadline the pacer stops sleeping and begins spinning
+    void setSpinThreshold(Clock::duration threshold) { spinThreshold = threshold; }
+
+    /// Waits until the next frame should start (returns immediately if unlimited)
+    ///     and then records the frame's time
+    void wait(){
+        if(period != Clock::duration::zero()){
+            Clock::time_point now = Clock::now();
+            // Schedule from the previous deadline so that errors don't accumulate,
+            //  unless we have fallen more than a frame behind (then start over from now)
+            if(deadline == Clock::time_point{} || now - deadline > period) deadline = now;
+            else deadline += period;
+
+            // Sleep for most of the wait...
+            if(deadline - now > spinThreshold) std::this_thread::sleep_until(deadline - spinThreshold);
+            // And spin for the rest
+            while(Clock::now() < deadline) std::this_thread::yield();
+        }
+        mark();
+    }
+
+    /// Records the start of a frame without waiting
+    void mark(){
+        Clock::time_point now = Clock::now();
+        if(lastFrame != Clock::time_point{}){
+            frameTimes.push_back(std::chrono::duration<double, std::milli>(now - lastFrame).count());
+            if(frameTimes.size() > window) frameTimes.pop_front();
+        }
+        lastFrame = now;
+    }
+
+    /// Returns statistics of the recent frame times
+    Stats stats() const {
+        if(frameTimes.empty()) return {};
+
+        Stats out;
+        out.samples = frameTimes.size();
+        out.min = *std::min_element(frameTimes.begin(), frameTimes.end());
+        out.max = *std::max_element(frameTimes.begin(), frameTimes.end());
+        for(double time: frameTimes) out.avg += time;
+        out.avg /= frameTimes.size();
+
+        for(double time: frameTimes) out.jitter += (time - out.avg) * (time - out.avg);
+        out.jitter = std::sqrt(out.jitter / frameTimes.size());
+
+        std::vector<double> sorted(frameTimes.begin(), frameTimes.end());
+        size_t index = std::min(sorted.size() - 1, (size_t) std::ceil(sorted.size() * .99) - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        out.p99 = sorted[index];
+        return out;
+    }
+    /// Forgets the recorded frame times
+    void clearStats() { frameTimes.clear(); lastFrame = {}; }
+};
+
+#endif // _FRAME_PACER_H_
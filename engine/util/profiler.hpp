@@ -0,0 +1,189 @@
+/*
+    Low overhead hierarchical CPU profiler. Zones are recorded into per thread
+    buffers (which only their thread writes to) and can be exported in the
+    Chrome trace format (load the file in chrome://tracing or Perfetto.)
+    Instrumentation is done through the PROFILE_* macros which compile to
+    nothing unless PROFILING is enabled.
+    File: profiler.hpp
+    Author: Joshua "Jdbener" Dahl
+*/
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+// Enables the PROFILE_* macros (otherwise they compile to nothing)
+#ifndef PROFILING
+#define PROFILING 0
+#endif
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Profiler {
+public:
+    // A completed zone (times are in nanoseconds since the profiler's epoch)
+    struct Event {
+        const char* name;
+        uint64_t start, end;
+    };
+
+private:
+    // Events are stored in fixed size blocks so that recording never moves existing events
+    static constexpr size_t blockSize = 4096, maxBlocks = 1024;
+    using Block = std::array<Event, blockSize>;
+
+    // Buffer of events recorded by a single thread.
+    //  Only the owning thread writes to it, readers only look at the first <count> events
+    struct ThreadBuffer {
+        std::array<std::unique_ptr<Block>, maxBlocks> blocks;
+        std::atomic<size_t> count = 0;
+        uint32_t threadID;
+        std::string threadName;
+        // When the last frame marker on this thread was placed
+        uint64_t lastFrame = 0;
+
+        void push(const Event& event){
+            size_t index = count.load(std::memory_order_relaxed);
+            // Drop events once the buffer is full
+            if(index >= blockSize * maxBlocks) return;
+
+            std::unique_ptr<Block>& block = blocks[index / blockSize];
+            if(!block) block = std::make_unique<Block>();
+            (*block)[index % blockSize] = event;
+            // Publish the event to any readers
+            count.store(index + 1, std::memory_order_release);
+        }
+    };
+
+    // Every thread's buffer (buffers live until the program exits so exports can include finished threads)
+    inline static std::mutex buffersMutex;
+    inline static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    inline static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    /// Returns the calling thread's buffer (registering it the first time it is needed)
+    static ThreadBuffer& threadBuffer(){
+        thread_local ThreadBuffer* buffer = nullptr;
+        if(!buffer){
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffer = buffers.back().get();
+            buffer->threadID = buffers.size() - 1;
+        }
+        return *buffer;
+    }
+
+    /// Escapes a string so it can be placed in JSON
+    static std::string escape(const std::string& in){
+        std::string out;
+        for(char c: in){
+            if(c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out;
+    }
+
+public:
+    /// Returns the current time in nanoseconds since the profiler's epoch
+    static uint64_t now(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    /// RAII zone which records the time between its construction and destruction.
+    ///     Names must be string literals (only the pointer is stored)
+    class Zone {
+        const char* name;
+        uint64_t start;
+    public:
+        template <size_t N>
+        Zone(const char (&_name)[N]) : name(_name), start(now()) {}
+        ~Zone() { threadBuffer().push({name, start, now()}); }
+        Zone(const Zone&) = delete;
+        Zone& operator=(const Zone&) = delete;
+    };
+
+    /// Places a frame marker on the calling thread (recording the time since its last marker as a "Frame" zone)
+    static void frame(){
+        ThreadBuffer& buffer = threadBuffer();
+        uint64_t time = now();
+        if(buffer.lastFrame) buffer.push({"Frame", buffer.lastFrame, time});
+        buffer.lastFrame = time;
+    }
+
+    /// Names the calling thread in exported traces
+    static void setThreadName(std::string name){ threadBuffer().threadName = std::move(name); }
+
+    /// Returns the total number of events which have been recorded
+    static size_t eventCount(){
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        size_t out = 0;
+        for(auto& buffer: buffers) out += buffer->count.load(std::memory_order_acquire);
+        return out;
+    }
+
+    /// Forgets every recorded event.
+    ///     NOTE: no other thread may be recording while the events are cleared
+    static void clear(){
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        for(auto& buffer: buffers){
+            buffer->count.store(0, std::memory_order_release);
+            buffer->lastFrame = 0;
+        }
+    }
+
+    /// Writes every recorded event in the Chrome trace (JSON) format
+    static void writeChromeTrace(std::ostream& out){
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        for(auto& buffer: buffers){
+            if(!buffer->threadName.empty()){
+                out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->threadID
+                    << ",\"args\":{\"name\":\"" << escape(buffer->threadName) << "\"}}";
+                first = false;
+            }
+
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            for(size_t i = 0; i < count; i++){
+                const Event& event = (*buffer->blocks[i / blockSize])[i % blockSize];
+                // Chrome expects microseconds
+                out << (first ? "" : ",") << "\n{\"name\":\"" << escape(event.name) << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadID
+                    << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+    }
+    /// Writes every recorded event to the file in the Chrome trace (JSON) format
+    static bool writeChromeTrace(const std::string& path){
+        std::ofstream file(path);
+        if(!file) return false;
+        writeChromeTrace(file);
+        return true;
+    }
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#if PROFILING
+// Profiles the rest of the current scope under the provided (string literal) name
+#   define PROFILE_SCOPE(name) Profiler::Zone PROFILE_CONCAT(_profileZone, __LINE__)(name)
+// Profiles the rest of the current function
+#   define PROFILE_FUNCTION() PROFILE_SCOPE(__func__)
+// Marks the start of a new frame on the calling thread
+#   define PROFILE_FRAME() Profiler::frame()
+// Names the calling thread in exported traces
+#   define PROFILE_THREAD(name) Profiler::setThreadName(name)
+#else
+#   define PROFILE_SCOPE(name)
+#   define PROFILE_FUNCTION()
+#   define PROFILE_FRAME()
+#   define PROFILE_THREAD(name)
+#endif
+
+#endif // _PROFILER_H_
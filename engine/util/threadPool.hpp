@@ -0,0 +1,114 @@
+/*
+    Class which implements a simple pool of worker threads. Tasks are passed
+    the index of the worker executing them so that they can make use of per
+    thread resources (like command pools.)
+    File: threadPool.hpp
+    Author: Joshua "Jdbener" Dahl
+*/
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <vector>
+#include <deque>
+
+class ThreadPool {
+public:
+    // A task receives the index of the worker thread which is running it
+    using Task = std::function<void (size_t)>;
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<Task> tasks;
+
+    std::mutex mutex;
+    // Signaled when a task is added (or the pool is stopping)
+    std::condition_variable available;
+    // Signaled when the last running task finishes
+    std::condition_variable finished;
+    // Number of tasks which are queued or running
+    size_t pending = 0;
+    bool stopping = false;
+    // The first exception thrown by a task (rethrown by wait)
+    std::exception_ptr error = nullptr;
+
+public:
+    /// Creates a pool with the specified number of workers (defaults to one per core)
+    ThreadPool(size_t threadCount = std::thread::hardware_concurrency()){
+        if(threadCount == 0) threadCount = 1;
+        workers.reserve(threadCount);
+        for(size_t i = 0; i < threadCount; i++)
+            workers.emplace_back([this, i]{ workerLoop(i); });
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// Finishes any queued tasks and then joins all of the workers
+    ~ThreadPool(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        available.notify_all();
+        for(std::thread& worker: workers) worker.join();
+    }
+
+    /// Returns the number of worker threads
+    size_t size() const { return workers.size(); }
+
+    /// Queues a task to be run on one of the workers
+    void enqueue(Task task){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace_back(std::move(task));
+            pending++;
+        }
+        available.notify_one();
+    }
+
+    /// Blocks until every queued task has finished.
+    ///     Rethrows the first exception thrown by any of the tasks
+    void wait(){
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]{ return pending == 0; });
+
+        if(error){
+            std::exception_ptr toThrow = error;
+            error = nullptr;
+            std::rethrow_exception(toThrow);
+        }
+    }
+
+private:
+    // Loop each worker runs, pulling tasks off the queue until the pool is stopped
+    void workerLoop(size_t index){
+        while(true){
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                available.wait(lock, [this]{ return stopping || !tasks.empty(); });
+                if(tasks.empty()) return; // Only empty if we are stopping
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+
+            try {
+                task(index);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!error) error = std::current_exception();
+            }
+
+            // Mark the task as finished and wake anyone waiting if this was the last one
+            std::lock_guard<std::mutex> lock(mutex);
+            if(--pending == 0) finished.notify_all();
+        }
+    }
+};
+
+#endif // _THREAD_POOL_H_
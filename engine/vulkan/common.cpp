@@ -1,12 +1,17 @@
 #include "common.hpp"
+#include "upload.hpp"
+#include "sampler.hpp"
 #include "../window.hpp"
 
 vpp::Instance createInstance(str appName, uint32_t appVersion, std::vector<const char*> extraExtensions, std::vector<const char*> extraValidationLayers, const void* pNext){
+    return createHeadlessInstance(appName, appVersion, Window::requiredVulkanExtensions() + extraExtensions, extraValidationLayers, pNext);
+}
+
+vpp::Instance createHeadlessInstance(str appName, uint32_t appVersion, std::vector<const char*> extraExtensions, std::vector<const char*> extraValidationLayers, const void* pNext){
     vk::ApplicationInfo appInfo(appName, appVersion, "Delta Engine", ENGINE_VERSION, VK_API_VERSION_1_2);
 
     std::vector<const char*> layers = validateInstanceLayers(extraValidationLayers);
-    std::vector<const char*> extensions = validateInstanceExtensions(Window::requiredVulkanExtensions()
-        + extraExtensions);
+    std::vector<const char*> extensions = validateInstanceExtensions(extraExtensions);
 
     vk::InstanceCreateInfo info = {{}, &appInfo,
         /*Layer Count*/ (uint32_t) layers.size(),
@@ -59,3 +64,119 @@ std::vector<const char*> validateInstanceExtensions(std::vector<const char*> ext
     }
     return extensions;
 }
+
+/// Returns a queue from a family which supports transfers but not graphics.
+///     Prefers transfer only families, returns nullptr if there isn't one
+const vpp::Queue* VulkDevice::dedicatedTransferQueue() const {
+    const vpp::Queue* out = nullptr;
+    for(const auto& queue: queues()){
+        vk::QueueFlags flags = queue->properties().queueFlags;
+        // Compute queues implicitly support transfers
+        if(!(flags & (vk::QueueBits::transfer | vk::QueueBits::compute)) || (flags & vk::QueueBits::graphics)) continue;
+
+        if(!(flags & vk::QueueBits::compute)) return &*queue;
+        if(!out) out = &*queue;
+    }
+    return out;
+}
+
+/// Returns a queue from a family which supports compute but not graphics (nullptr if there isn't one)
+const vpp::Queue* VulkDevice::dedicatedComputeQueue() const {
+    for(const auto& queue: queues()){
+        vk::QueueFlags flags = queue->properties().queueFlags;
+        if((flags & vk::QueueBits::compute) && !(flags & vk::QueueBits::graphics)) return &*queue;
+    }
+    return nullptr;
+}
+
+/// Returns the engine used to upload data to buffers on this device (created the first time it is needed)
+UploadEngine& VulkDevice::uploadEngine() const {
+    if(!_uploadEngine) _uploadEngine = std::make_shared<UploadEngine>(*this);
+    return *_uploadEngine;
+}
+
+/// Returns the cache samplers on this device should be retrieved from (created the first time it is needed)
+SamplerCache& VulkDevice::samplerCache() const {
+    if(!_samplerCache) _samplerCache = std::make_shared<SamplerCache>(*this);
+    return *_samplerCache;
+}
+
+/// Creates a logical device on the "best" physical device (one able to present to the surface if provided.)
+///     Along with the graphics queue, a queue is requested from any dedicated transfer and compute families.
+///     Timeline semaphores, anisotropic filtering, and indirect first instances are enabled if the device supports them
+std::unique_ptr<VulkDevice> createDevice(vk::Instance instance, vk::SurfaceKHR surface, std::vector<const char*> extensions){
+    std::vector<vk::PhysicalDevice> physicalDevices = vk::enumeratePhysicalDevices(instance);
+    vk::PhysicalDevice pd = surface ? vpp::choose(physicalDevices, surface) : vpp::choose(physicalDevices);
+    if(!pd) throw vk::VulkanError(vk::Result::errorInitializationFailed, "Failed to find a suitable physical device!");
+
+    // Find the families we want queues from
+    std::vector<vk::QueueFamilyProperties> families = vk::getPhysicalDeviceQueueFamilyProperties(pd);
+    uint32_t graphics = UINT32_MAX, transfer = UINT32_MAX, compute = UINT32_MAX;
+    for(uint32_t i = 0; i < families.size(); i++){
+        vk::QueueFlags flags = families[i].queueFlags;
+        if(flags & vk::QueueBits::graphics){
+            // The graphics family also needs to be able to present
+            if(graphics == UINT32_MAX && (!surface || vk::getPhysicalDeviceSurfaceSupportKHR(pd, i, surface))) graphics = i;
+        } else if(flags & vk::QueueBits::compute){
+            if(compute == UINT32_MAX) compute = i;
+        } else if(flags & vk::QueueBits::transfer)
+            if(transfer == UINT32_MAX) transfer = i;
+    }
+    if(graphics == UINT32_MAX) throw vk::VulkanError(vk::Result::errorInitializationFailed, "Failed to find a graphics queue family!");
+
+    float priority = 1;
+    std::vector<vk::DeviceQueueCreateInfo> queueInfos;
+    for(uint32_t family: {graphics, transfer, compute})
+        if(family != UINT32_MAX) queueInfos.push_back({/*flags*/ {}, family, /*count*/ 1, &priority});
+
+    // Enable timeline semaphores (if available)
+    vk::PhysicalDeviceVulkan12Features supported12;
+    vk::PhysicalDeviceFeatures2 supported;
+    supported.pNext = &supported12;
+    vk::getPhysicalDeviceFeatures2(pd, supported);
+
+    vk::PhysicalDeviceVulkan12Features features12;
+    features12.timelineSemaphore = supported12.timelineSemaphore;
+    vk::PhysicalDeviceFeatures features;
+    features.samplerAnisotropy = supported.features.samplerAnisotropy;
+    features.drawIndirectFirstInstance = supported.features.drawIndirectFirstInstance;
+
+    if(surface) extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+    vk::DeviceCreateInfo info = {/*flags*/ {},
+        (uint32_t) queueInfos.size(), queueInfos.data(),
+        /*layers*/ 0, nullptr,
+        (uint32_t) extensions.size(), extensions.data()};
+    info.pNext = &features12;
+    info.pEnabledFeatures = &features;
+
+    auto device = std::make_unique<VulkDevice>(instance, pd, info);
+    device->timelineSemaphores = features12.timelineSemaphore;
+    device->samplerAnisotropy = features.samplerAnisotropy;
+    device->drawIndirectFirstInstance = features.drawIndirectFirstInstance;
+    dlg_info("Created device with " + str(queueInfos.size()) + " queue families" + (device->timelineSemaphores ? ", timeline semaphores enabled" : ""));
+    return device;
+}
+
+/// Returns the first of the candidate formats which supports the features with the specified tiling (undefined if none do)
+vk::Format findSupportedFormat(vk::PhysicalDevice pd, const std::vector<vk::Format>& candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features){
+    for(vk::Format format: candidates){
+        vk::FormatProperties properties = vk::getPhysicalDeviceFormatProperties(pd, format);
+        vk::FormatFeatureFlags supported = (tiling == vk::ImageTiling::linear ? properties.linearTilingFeatures : properties.optimalTilingFeatures);
+        if((supported & features) == features) return format;
+    }
+    return vk::Format::undefined;
+}
+
+/// Returns the most precise depth format which can be used as a depth attachment (undefined if none can)
+vk::Format findDepthFormat(vk::PhysicalDevice pd, bool requireStencil){
+    std::vector<vk::Format> candidates = {vk::Format::d32SfloatS8Uint, vk::Format::d24UnormS8Uint};
+    // Without stencil, a pure 32 bit float is preferred
+    if(!requireStencil) candidates.insert(candidates.begin(), vk::Format::d32Sfloat);
+    return findSupportedFormat(pd, candidates, vk::ImageTiling::optimal, vk::FormatFeatureBits::depthStencilAttachment);
+}
+
+/// Returns true if the (depth) format has a stencil component
+bool hasStencilComponent(vk::Format format){
+    return format == vk::Format::d32SfloatS8Uint || format == vk::Format::d24UnormS8Uint || format == vk::Format::d16UnormS8Uint || format == vk::Format::s8Uint;
+}
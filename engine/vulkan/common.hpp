@@ -6,23 +6,48 @@
 #include <vpp/vpp.hpp>
 
 vpp::Instance createInstance(str appName, uint32_t appVersion, std::vector<const char*> extraExtensions = {}, std::vector<const char*> extraValidationLayers = {}, const void* pNext = nullptr);
+/// Creates an instance without the extensions needed to present to windows (doesn't initialize GLFW)
+vpp::Instance createHeadlessInstance(str appName, uint32_t appVersion, std::vector<const char*> extraExtensions = {}, std::vector<const char*> extraValidationLayers = {}, const void* pNext = nullptr);
 vpp::Instance createDebugInstance(str appName, uint32_t appVersion, std::vector<const char*> extraExtensions = {}, std::vector<const char*> extraValidationLayers = {}, const void* pNext = nullptr);
 
 std::vector<const char*> validateInstanceLayers(std::vector<const char*> layers);
 std::vector<const char*> validateInstanceExtensions(std::vector<const char*> extensions);
 
+class UploadEngine;
+class SamplerCache;
+
 // Small utility to add some extra functionality to devices
 class VulkDevice: public vpp::Device {
+protected:
+    // Lazily created engine used to upload buffers (see <uploadEngine>)
+    mutable std::shared_ptr<UploadEngine> _uploadEngine = nullptr;
+    // Lazily created cache of samplers (see <samplerCache>)
+    mutable std::shared_ptr<SamplerCache> _samplerCache = nullptr;
+
+    // Device ID tracking (resources are keyed by the device they were created on)
+    inline static uint16_t nextID = 0;
+    uint16_t _id = nextID++;
+
 public:
     using vpp::Device::Device;
     //using vpp::Device::operator=;
 
+    /// Gets the id of this device
+    uint16_t id() const { return _id; }
+
+    // True if the device was created with timeline semaphores enabled
+    bool timelineSemaphores = false;
+    // True if the device was created with anisotropic filtering enabled
+    bool samplerAnisotropy = false;
+    // True if indirect draws may start at an instance other than 0
+    bool drawIndirectFirstInstance = false;
+
     void waitIdle() const { vk::deviceWaitIdle(vkHandle()); }
 
-    void waitForFence(vk::Fence fence, uint64_t timeout = UINT64_MAX) const { waitForFences(nytl::make_span(fence), false, timeout); }
-    void waitForFences(nytl::span<vk::Fence> fences, bool waitAll = true, uint64_t timeout = UINT64_MAX) const {
+    void waitForFence(vk::Fence fence, uint64_t timeout = UINT64_MAX, bool reset = true) const { waitForFences(nytl::make_span(fence), false, timeout, reset); }
+    void waitForFences(nytl::span<vk::Fence> fences, bool waitAll = true, uint64_t timeout = UINT64_MAX, bool reset = true) const {
         vk::waitForFences(vkHandle(), fences, (waitAll ? VK_TRUE : VK_FALSE), timeout);
-        vk::resetFences(vkHandle(), fences); // Reset the fence so that we don't just automatically bypass it
+        if(reset) vk::resetFences(vkHandle(), fences); // Reset the fence so that we don't just automatically bypass it
     }
 
 // Macro which defines how exception checking works
@@ -49,4 +74,28 @@ public:
     /// Returns the compute queue.
     ///     Throws a VulkanError if it can't be found
     const vpp::Queue* computeQueueExcept() const { exceptFunction(computeQueue); }
+    /// Returns a queue from a family which supports transfers but not graphics.
+    ///     Prefers transfer only families, returns nullptr if there isn't one
+    const vpp::Queue* dedicatedTransferQueue() const;
+    /// Returns a queue from a family which supports compute but not graphics (nullptr if there isn't one)
+    ///     Work submitted to it can run alongside rendering
+    const vpp::Queue* dedicatedComputeQueue() const;
+
+    /// Returns the engine used to upload data to buffers on this device (created the first time it is needed)
+    UploadEngine& uploadEngine() const;
+    /// Returns the cache samplers on this device should be retrieved from (created the first time it is needed)
+    SamplerCache& samplerCache() const;
 };
+
+/// Creates a logical device on the "best" physical device (one able to present to the surface if provided.)
+///     Along with the graphics queue, a queue is requested from any dedicated transfer and compute families.
+///     Timeline semaphores, anisotropic filtering, and indirect first instances are enabled if the device supports them
+std::unique_ptr<VulkDevice> createDevice(vk::Instance instance, vk::SurfaceKHR surface = {}, std::vector<const char*> extensions = {});
+
+/// Returns the first of the candidate formats which supports the features with the specified tiling (undefined if none do)
+vk::Format findSupportedFormat(vk::PhysicalDevice pd, const std::vector<vk::Format>& candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features);
+/// Returns the most precise depth format which can be used as a depth attachment (undefined if none can)
+///     If <requireStencil> is set only formats with a stencil component are considered
+vk::Format findDepthFormat(vk::PhysicalDevice pd, bool requireStencil = false);
+/// Returns true if the (depth) format has a stencil component
+bool hasStencilComponent(vk::Format format);
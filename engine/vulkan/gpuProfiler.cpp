@@ -0,0 +1,169 @@
+#include "gpuProfiler.hpp"
+
+#include <algorithm>
+
+/// Creates a profiler for work submitted to the specified queue family.
+GPUProfiler::GPUProfiler(const vpp::Device& _device, uint32_t queueFamily, uint32_t _maxScopes, size_t _window)
+  : device(_device), maxScopes(_maxScopes), window(std::max<size_t>(_window, 1)) {
+    std::vector<vk::QueueFamilyProperties> families = vk::getPhysicalDeviceQueueFamilyProperties(device.vkPhysicalDevice());
+    if(queueFamily < families.size() && families[queueFamily].timestampValidBits > 0)
+        timestampPeriod = vk::getPhysicalDeviceProperties(device.vkPhysicalDevice()).limits.timestampPeriod;
+    else dlg_warn("Queue family " + str(queueFamily) + " doesn't support timestamps, GPU profiling is disabled");
+}
+
+GPUProfiler::~GPUProfiler(){
+    for(Image& image: images)
+        if(image.pool) vk::destroyQueryPool(device.vkHandle(), image.pool);
+}
+
+/// Marks the start of recording the commands of an image into its primary command buffer.
+///     Collects any outstanding results, clears the image's scopes, and records a reset of its queries
+void GPUProfiler::beginRecording(vpp::CommandBuffer& cb, uint32_t image){
+    if(!supported()) return;
+
+    // Create query pools for any new images
+    if(image >= images.size()) images.resize(image + 1);
+    Image& data = images[image];
+    if(!data.pool) data.pool = vk::createQueryPool(device.vkHandle(), {/*flags*/ {}, vk::QueryType::timestamp, maxScopes * 2, /*pipelineStatistics*/ {}});
+
+    // Don't lose the results of the old recording
+    collect(image);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    data.scopes.clear();
+    data.submitted = false;
+    // Forget the command buffers of the old recording
+    for(auto it = commandBufferImages.begin(); it != commandBufferImages.end();)
+        if(it->second == image) it = commandBufferImages.erase(it);
+        else ++it;
+    commandBufferImages[cb.vkHandle()] = image;
+
+    vk::cmdResetQueryPool(cb, data.pool, 0, maxScopes * 2);
+}
+
+/// Associates a (secondary) command buffer with an image so scopes can be recorded into it
+void GPUProfiler::track(vk::CommandBuffer cb, uint32_t image){
+    if(!supported()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    commandBufferImages[cb] = image;
+}
+
+/// Writes the beginning timestamp of a scope, returns the index of its first query (UINT32_MAX if it wasn't recorded)
+uint32_t GPUProfiler::beginScope(vk::CommandBuffer cb, const str& name){
+    if(!supported()) return UINT32_MAX;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto image = commandBufferImages.find(cb);
+    if(image == commandBufferImages.end()){
+        dlg_warn("GPU profiler scope '" + name + "' recorded into a command buffer which isn't being tracked");
+        return UINT32_MAX;
+    }
+    Image& data = images[image->second];
+    if(data.scopes.size() >= maxScopes) return UINT32_MAX;
+
+    // Find (or register) the scope's ID
+    auto [id, inserted] = scopeIDs.emplace(name, scopeNames.size());
+    if(inserted){
+        scopeNames.push_back(name);
+        durations.emplace_back();
+    }
+
+    uint32_t query = data.scopes.size() * 2;
+    data.scopes.push_back(id->second);
+    vk::cmdWriteTimestamp(cb, vk::PipelineStageBits::topOfPipe, data.pool, query);
+    return query;
+}
+
+/// Writes the ending timestamp of a scope
+void GPUProfiler::endScope(vk::CommandBuffer cb, uint32_t query){
+    if(query == UINT32_MAX) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    vk::cmdWriteTimestamp(cb, vk::PipelineStageBits::bottomOfPipe, images[commandBufferImages[cb]].pool, query + 1);
+}
+
+/// Notes that the image's commands were submitted
+void GPUProfiler::submitted(uint32_t image){
+    if(image < images.size()) images[image].submitted = true;
+}
+
+/// Reads back the results of the image's last submission (if they are available)
+///     Should be called once the submission has finished
+void GPUProfiler::collect(uint32_t image){
+    if(image >= images.size()) return;
+    Image& data = images[image];
+    if(!data.submitted || data.scopes.empty()) return;
+
+    // Each query produces its value followed by its availability
+    uint32_t queryCount = data.scopes.size() * 2;
+    std::vector<uint64_t> results(queryCount * 2);
+    vk::getQueryPoolResults(device.vkHandle(), data.pool, 0, queryCount, results.size() * sizeof(results[0]), results.data(), 2 * sizeof(results[0]),
+        vk::QueryResultBits::e64 | vk::QueryResultBits::withAvailability);
+    data.submitted = false;
+
+    // Sum the time spent in each scope this frame
+    std::unordered_map<uint32_t, double> frameTimes;
+    for(size_t i = 0; i < data.scopes.size(); i++){
+        uint64_t* begin = &results[i * 4], *end = &results[i * 4 + 2];
+        // Skip any queries which didn't finish
+        if(!begin[1] || !end[1]) continue;
+        frameTimes[data.scopes[i]] += (end[0] - begin[0]) * timestampPeriod / 1000000.0;
+    }
+
+    // Add them to the rolling windows
+    for(auto [scope, time]: frameTimes){
+        durations[scope].push_back(time);
+        if(durations[scope].size() > window) durations[scope].pop_front();
+    }
+}
+
+/// Calculates the statistics of the scope with the specified ID
+GPUProfiler::Stats GPUProfiler::calculateStats(uint32_t scope) const {
+    const std::deque<double>& samples = durations[scope];
+    if(samples.empty()) return {};
+
+    Stats out {samples.front(), 0, samples.front(), samples.size()};
+    for(double sample: samples){
+        out.min = std::min(out.min, sample);
+        out.max = std::max(out.max, sample);
+        out.avg += sample;
+    }
+    out.avg /= samples.size();
+    return out;
+}
+
+/// Returns the rolling statistics of every scope
+std::map<str, GPUProfiler::Stats> GPUProfiler::stats() const {
+    std::map<str, Stats> out;
+    for(uint32_t i = 0; i < scopeNames.size(); i++)
+        out[scopeNames[i]] = calculateStats(i);
+    return out;
+}
+
+/// Returns the rolling statistics of a single scope
+GPUProfiler::Stats GPUProfiler::stats(const str& name) const {
+    auto id = scopeIDs.find(name);
+    if(id == scopeIDs.end()) return {};
+    return calculateStats(id->second);
+}
+
+/// Writes the statistics of every scope as CSV (scope,min_ms,avg_ms,max_ms,samples)
+void GPUProfiler::writeCSV(std::ostream& out) const {
+    out << "scope,min_ms,avg_ms,max_ms,samples\n";
+    for(auto& [name, stats]: stats())
+        out << '"' << name << "\"," << stats.min << ',' << stats.avg << ',' << stats.max << ',' << stats.samples << '\n';
+}
+
+/// Clears all of the collected statistics
+void GPUProfiler::clearStats(){
+    for(std::deque<double>& samples: durations) samples.clear();
+}
+
+
+GPUProfiler::Scope::Scope(GPUProfiler* _profiler, vk::CommandBuffer _cb, const str& name) : profiler(_profiler), cb(_cb) {
+    if(profiler) query = profiler->beginScope(cb, name);
+}
+
+GPUProfiler::Scope::~Scope(){
+    if(profiler) profiler->endScope(cb, query);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <deque>
+#include <mutex>
+#include <map>
+#include <unordered_map>
+
+/// Class which measures GPU time using timestamp queries.
+///     Since command buffers are pre-recorded, each render buffer (image) gets its own query pool.
+///     Scopes are placed while recording, and their results are read back (without stalling)
+///     the next time the image is rendered to, once its previous frame has finished.
+///     Each scope keeps a rolling window of per-frame durations (scopes with the same name
+///     recorded several times in a frame are summed.)
+class GPUProfiler {
+public:
+    // Rolling statistics of a scope (in milliseconds)
+    struct Stats {
+        double min = 0, avg = 0, max = 0;
+        // The number of frames the statistics were calculated from
+        size_t samples = 0;
+    };
+
+    /// RAII helper which times the commands recorded while it is alive
+    ///     (does nothing if the profiler is null or disabled)
+    class Scope {
+        GPUProfiler* profiler;
+        vk::CommandBuffer cb;
+        uint32_t query = UINT32_MAX;
+    public:
+        Scope(GPUProfiler* profiler, vk::CommandBuffer cb, const str& name);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+protected:
+    // Data tracked for each render buffer
+    struct Image {
+        vk::QueryPool pool = {};
+        // The scope each pair of queries belongs to (in order)
+        std::vector<uint32_t> scopes;
+        // True if the image's commands have been submitted since its results were last collected
+        bool submitted = false;
+    };
+
+    const vpp::Device& device;
+    // Nanoseconds per timestamp tick (0 if the queue doesn't support timestamps)
+    double timestampPeriod = 0;
+    uint32_t maxScopes;
+    size_t window;
+
+    std::vector<Image> images;
+    // The image each command buffer being recorded belongs to
+    std::unordered_map<vk::CommandBuffer, uint32_t> commandBufferImages;
+    // Protects the images and command buffer map (scopes may be recorded on several threads)
+    std::mutex mutex;
+
+    // Names of each scope (and the rolling durations of each)
+    std::vector<str> scopeNames;
+    std::unordered_map<std::string, uint32_t> scopeIDs;
+    std::vector<std::deque<double>> durations;
+
+public:
+    /// Creates a profiler for work submitted to the specified queue family.
+    ///     <maxScopes> limits the number of scopes recorded for each image,
+    ///     <window> is the number of frames the statistics are calculated over
+    GPUProfiler(const vpp::Device& device, uint32_t queueFamily, uint32_t maxScopes = 256, size_t window = 120);
+    ~GPUProfiler();
+    GPUProfiler(const GPUProfiler&) = delete;
+    GPUProfiler& operator=(const GPUProfiler&) = delete;
+
+    /// Returns true if the queue supports timestamps
+    bool supported() const { return timestampPeriod > 0; }
+
+    /// Marks the start of recording the commands of an image into its primary command buffer.
+    ///     Collects any outstanding results, clears the image's scopes, and records a reset of its queries
+    ///     (so it must be called before any secondary buffers for the image are recorded, and outside of a render pass)
+    void beginRecording(vpp::CommandBuffer& cb, uint32_t image);
+    /// Associates a (secondary) command buffer with an image so scopes can be recorded into it
+    void track(vk::CommandBuffer cb, uint32_t image);
+
+    /// Notes that the image's commands were submitted
+    void submitted(uint32_t image);
+    /// Reads back the results of the image's last submission (if they are available)
+    ///     Should be called once the submission has finished
+    void collect(uint32_t image);
+
+    /// Returns the rolling statistics of every scope
+    std::map<str, Stats> stats() const;
+    /// Returns the rolling statistics of a single scope
+    Stats stats(const str& name) const;
+    /// Writes the statistics of every scope as CSV (scope,min_ms,avg_ms,max_ms,samples)
+    void writeCSV(std::ostream& out) const;
+    /// Clears all of the collected statistics
+    void clearStats();
+
+protected:
+    /// Writes the beginning timestamp of a scope, returns the index of its first query (UINT32_MAX if it wasn't recorded)
+    uint32_t beginScope(vk::CommandBuffer cb, const str& name);
+    /// Writes the ending timestamp of a scope
+    void endScope(vk::CommandBuffer cb, uint32_t query);
+    /// Calculates the statistics of the scope with the specified ID
+    Stats calculateStats(uint32_t scope) const;
+};
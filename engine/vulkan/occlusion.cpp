@@ -0,0 +1,422 @@
+#include "occlusion.hpp"
+#include "shader.hpp"
+
+#include <algorithm>
+
+// Compute shader which reduces a depth buffer (or pyramid level) into the next level of the pyramid
+static const char* reduceShader = R"(
+#version 450
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D source;
+layout(binding = 1, r32f) uniform writeonly image2D destination;
+
+void main(){
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(destination);
+    if(any(greaterThanEqual(texel, size))) return;
+
+    // Each texel stores the farthest depth of the source texels it covers (3 per axis when the source has an odd size)
+    ivec2 sourceSize = textureSize(source, 0);
+    ivec2 begin = texel * sourceSize / size;
+    ivec2 end = min(((texel + 1) * sourceSize + size - 1) / size, sourceSize);
+    float farthest = 0;
+    for(int y = begin.y; y < end.y; y++)
+        for(int x = begin.x; x < end.x; x++)
+            farthest = max(farthest, texelFetch(source, ivec2(x, y), 0).r);
+    imageStore(destination, texel, vec4(farthest));
+}
+)";
+
+// Compute shader which tests each instance against the frustum and pyramid, compacting the visible ones
+static const char* cullShader = R"(
+#version 450
+layout(local_size_x = 64) in;
+
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 viewProjection;
+    mat4 previousViewProjection;
+    vec2 pyramidSize;
+    uint pyramidLevels;
+    uint historyValid;
+} frame;
+layout(set = 0, binding = 1) uniform sampler2D pyramid;
+layout(set = 0, binding = 2, std430) buffer Counters { uint tested; uint frustumCulled; uint occluded; } counters;
+
+layout(set = 1, binding = 0, std430) readonly buffer Source { uint source[]; };
+layout(set = 1, binding = 1, std430) writeonly buffer Visible { uint visible[]; };
+layout(set = 1, binding = 2, std430) buffer Draw { uint indexCount; uint instanceCount; uint firstIndex; int vertexOffset; uint firstInstance; } draw;
+
+// Instance layout (sizes in words) and untransformed bounds
+layout(push_constant) uniform Batch {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uint instanceCount;
+    uint stride;
+    uint transformOffset;
+} batch;
+
+// Returns true if the projected bounds are entirely behind the depth stored in the pyramid
+bool occluded(vec3 ndcMin, vec3 ndcMax){
+    vec2 uvMin = ndcMin.xy * 0.5 + 0.5, uvMax = ndcMax.xy * 0.5 + 0.5;
+    int lastLevel = int(frame.pyramidLevels) - 1;
+
+    // Pick the level where the bounds cover at most 2x2 texels
+    vec2 size = (uvMax - uvMin) * frame.pyramidSize;
+    int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1)))), 0, lastLevel);
+    ivec2 levelSize = textureSize(pyramid, level);
+    ivec2 lo = min(ivec2(uvMin * levelSize), levelSize - 1), hi = min(ivec2(uvMax * levelSize), levelSize - 1);
+    if(any(greaterThan(hi - lo, ivec2(1))) && level < lastLevel){
+        level++;
+        levelSize = textureSize(pyramid, level);
+        lo = min(ivec2(uvMin * levelSize), levelSize - 1);
+        hi = min(ivec2(uvMax * levelSize), levelSize - 1);
+    }
+
+    float farthest = max(max(texelFetch(pyramid, lo, level).r, texelFetch(pyramid, ivec2(hi.x, lo.y), level).r),
+        max(texelFetch(pyramid, ivec2(lo.x, hi.y), level).r, texelFetch(pyramid, hi, level).r));
+    return ndcMin.z > farthest;
+}
+
+void main(){
+    uint index = gl_GlobalInvocationID.x;
+    if(index >= batch.instanceCount) return;
+    atomicAdd(counters.tested, 1);
+
+    uint base = index * batch.stride;
+    mat4 transform;
+    for(int c = 0; c < 4; c++)
+        for(int r = 0; r < 4; r++)
+            transform[c][r] = uintBitsToFloat(source[base + batch.transformOffset + c * 4 + r]);
+
+    mat4 current = frame.viewProjection * transform;
+    mat4 previous = frame.previousViewProjection * transform;
+    uint outside = 63;
+    bool crossesNear = false;
+    vec3 ndcMin = vec3(1e30), ndcMax = vec3(-1e30);
+    for(int corner = 0; corner < 8; corner++){
+        vec4 position = vec4(mix(batch.boundsMin.xyz, batch.boundsMax.xyz, vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1)), 1);
+
+        // Track which frustum planes (of the current camera) every corner is outside of
+        vec4 clip = current * position;
+        uint planes = 0;
+        if(clip.x < -clip.w) planes |= 1;
+        if(clip.x > clip.w) planes |= 2;
+        if(clip.y < -clip.w) planes |= 4;
+        if(clip.y > clip.w) planes |= 8;
+        if(clip.z < 0) planes |= 16;
+        if(clip.z > clip.w) planes |= 32;
+        outside &= planes;
+
+        // Occlusion is tested where the bounds were when the pyramid was rendered
+        clip = previous * position;
+        if(clip.w <= 0) crossesNear = true;
+        else {
+            ndcMin = min(ndcMin, clip.xyz / clip.w);
+            ndcMax = max(ndcMax, clip.xyz / clip.w);
+        }
+    }
+    if(outside != 0){
+        atomicAdd(counters.frustumCulled, 1);
+        return;
+    }
+
+    // Without history, or if part of the bounds wasn't on screen in the previous frame, the instance is drawn
+    bool covered = frame.historyValid != 0 && !crossesNear && all(greaterThanEqual(ndcMin.xy, vec2(-1))) && all(lessThanEqual(ndcMax.xy, vec2(1)));
+    if(covered && occluded(ndcMin, ndcMax)){
+        atomicAdd(counters.occluded, 1);
+        return;
+    }
+
+    uint slot = atomicAdd(draw.instanceCount, 1);
+    for(uint i = 0; i < batch.stride; i++)
+        visible[slot * batch.stride + i] = source[base + i];
+}
+)";
+
+// Push constants of the culling shader
+struct BatchConstants {
+    glm::vec4 boundsMin, boundsMax;
+    uint32_t instanceCount, stride, transformOffset;
+};
+
+/// Creates a culler for work submitted to the specified queue family
+OcclusionCuller::OcclusionCuller(const vpp::Device& _device, uint32_t _queueFamily) : device(_device), queueFamily(_queueFamily) {
+    commandPool = {device, {(vk::CommandPoolCreateBits) VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, queueFamily}};
+
+    vk::SamplerCreateInfo samplerInfo;
+    samplerInfo.magFilter = samplerInfo.minFilter = vk::Filter::nearest;
+    samplerInfo.mipmapMode = vk::SamplerMipmapMode::nearest;
+    samplerInfo.addressModeU = samplerInfo.addressModeV = samplerInfo.addressModeW = vk::SamplerAddressMode::clampToEdge;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    sampler = {device, samplerInfo};
+
+    reduceLayout = {device, {
+        {0, vk::DescriptorType::combinedImageSampler, 1, vk::ShaderStageBits::compute, nullptr},
+        {1, vk::DescriptorType::storageImage, 1, vk::ShaderStageBits::compute, nullptr}}};
+    cullLayout = {device, {
+        {0, vk::DescriptorType::uniformBuffer, 1, vk::ShaderStageBits::compute, nullptr},
+        {1, vk::DescriptorType::combinedImageSampler, 1, vk::ShaderStageBits::compute, nullptr},
+        {2, vk::DescriptorType::storageBuffer, 1, vk::ShaderStageBits::compute, nullptr}}};
+    batchLayout = {device, {
+        {0, vk::DescriptorType::storageBuffer, 1, vk::ShaderStageBits::compute, nullptr},
+        {1, vk::DescriptorType::storageBuffer, 1, vk::ShaderStageBits::compute, nullptr},
+        {2, vk::DescriptorType::storageBuffer, 1, vk::ShaderStageBits::compute, nullptr}}};
+
+    // Creates a compute pipeline from the provided source
+    auto createPipeline = [&](const char* source, const vpp::PipelineLayout& layout){
+        GLSLShaderModule module(device, str(source), vk::ShaderStageBits::compute);
+        vpp::ShaderProgram::StageInfo stage = module.createStageInfo();
+        vk::ComputePipelineCreateInfo info;
+        info.stage = {/*flags*/ {}, stage.stage, stage.module, stage.entry.c_str(), stage.specialization};
+        info.layout = layout;
+        return vpp::Pipeline(device, info);
+    };
+
+    reducePipelineLayout = {device, nytl::make_span(reduceLayout.vkHandle()), {}};
+    reducePipeline = createPipeline(reduceShader, reducePipelineLayout);
+
+    vk::DescriptorSetLayout cullLayouts[] = {cullLayout.vkHandle(), batchLayout.vkHandle()};
+    vk::PushConstantRange constants {vk::ShaderStageBits::compute, 0, sizeof(BatchConstants)};
+    cullPipelineLayout = {device, cullLayouts, nytl::make_span(constants)};
+    cullPipeline = createPipeline(cullShader, cullPipelineLayout);
+}
+
+/// Recreates the pyramid and per image data to match the depth buffers.
+void OcclusionCuller::resize(vk::Extent2D extent, vk::Format _depthFormat, const std::vector<vk::Image>& depthImages){
+    depthFormat = _depthFormat;
+    pyramidExtent = {std::max((extent.width + 1) / 2, 1u), std::max((extent.height + 1) / 2, 1u)};
+    pyramidLevels = 1;
+    while((std::max(pyramidExtent.width, pyramidExtent.height) >> pyramidLevels) > 0) pyramidLevels++;
+    // The new pyramid hasn't been rendered to yet
+    historyValid = false;
+
+    vk::ImageCreateInfo imageInfo {/*flags*/ {}, vk::ImageType::e2d, vk::Format::r32Sfloat, {pyramidExtent.width, pyramidExtent.height, 1},
+        pyramidLevels, /*layers*/ 1, vk::SampleCountBits::e1, vk::ImageTiling::optimal, vk::ImageUsageBits::storage | vk::ImageUsageBits::sampled,
+        vk::SharingMode::exclusive, 0, nullptr, vk::ImageLayout::undefined};
+    pyramid = {device.devMemAllocator(), imageInfo, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+
+    // Creates a view of the pyramid's levels
+    auto createView = [&](vk::Image image, vk::Format format, vk::ImageAspectFlags aspect, uint32_t level, uint32_t levels){
+        return vpp::ImageView(device, {/*flags*/ {}, image, vk::ImageViewType::e2d, format,
+            {vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity},
+            {aspect, level, levels, 0, 1}});
+    };
+    pyramidView = createView(pyramid, vk::Format::r32Sfloat, vk::ImageAspectBits::color, 0, pyramidLevels);
+    levelViews.clear();
+    for(uint32_t level = 0; level < pyramidLevels; level++)
+        levelViews.push_back(createView(pyramid, vk::Format::r32Sfloat, vk::ImageAspectBits::color, level, 1));
+
+    // Points a reduction's descriptors at its source and destination
+    auto writeReduce = [&](vk::DescriptorSet set, vk::ImageView source, vk::ImageLayout sourceLayout, vk::ImageView destination){
+        vk::DescriptorImageInfo sourceInfo {sampler, source, sourceLayout};
+        vk::DescriptorImageInfo destinationInfo {{}, destination, vk::ImageLayout::general};
+        vk::WriteDescriptorSet writes[] = {
+            {set, 0, 0, 1, vk::DescriptorType::combinedImageSampler, &sourceInfo, nullptr, nullptr},
+            {set, 1, 0, 1, vk::DescriptorType::storageImage, &destinationInfo, nullptr, nullptr}};
+        vk::updateDescriptorSets(device, writes, {});
+    };
+    levelDescriptors.clear();
+    for(uint32_t level = 1; level < pyramidLevels; level++){
+        levelDescriptors.push_back(device.descriptorAllocator().alloc(reduceLayout));
+        writeReduce(levelDescriptors.back(), levelViews[level - 1], vk::ImageLayout::general, levelViews[level]);
+    }
+
+    images.resize(depthImages.size());
+    for(size_t i = 0; i < images.size(); i++){
+        Image& image = images[i];
+        // Only the depth aspect can be sampled
+        image.depthView = createView(depthImages[i], depthFormat, vk::ImageAspectBits::depth, 0, 1);
+        image.reduceDescriptors = device.descriptorAllocator().alloc(reduceLayout);
+        writeReduce(image.reduceDescriptors, image.depthView, vk::ImageLayout::shaderReadOnlyOptimal, levelViews[0]);
+
+        if(!image.uniforms.size()){
+            image.uniforms = {device.bufferAllocator(), sizeof(Uniforms), vk::BufferUsageBits::uniformBuffer, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+            image.counters = {device.bufferAllocator(), 3 * sizeof(uint32_t), vk::BufferUsageBits::storageBuffer | vk::BufferUsageBits::transferDst, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+            image.commandBuffer = {commandPool, vk::CommandBufferLevel::primary};
+        }
+        image.submitted = false;
+
+        image.cullDescriptors = device.descriptorAllocator().alloc(cullLayout);
+        vk::DescriptorBufferInfo uniformInfo {image.uniforms.buffer(), image.uniforms.offset(), image.uniforms.size()};
+        vk::DescriptorImageInfo pyramidInfo {sampler, pyramidView, vk::ImageLayout::general};
+        vk::DescriptorBufferInfo counterInfo {image.counters.buffer(), image.counters.offset(), image.counters.size()};
+        vk::WriteDescriptorSet writes[] = {
+            {image.cullDescriptors, 0, 0, 1, vk::DescriptorType::uniformBuffer, nullptr, &uniformInfo, nullptr},
+            {image.cullDescriptors, 1, 0, 1, vk::DescriptorType::combinedImageSampler, &pyramidInfo, nullptr, nullptr},
+            {image.cullDescriptors, 2, 0, 1, vk::DescriptorType::storageBuffer, nullptr, &counterInfo, nullptr}};
+        vk::updateDescriptorSets(device, writes, {});
+    }
+
+    // Move the pyramid into the general layout it is always used in
+    vpp::CommandBuffer cb = {commandPool, vk::CommandBufferLevel::primary};
+    vk::beginCommandBuffer(cb, {vk::CommandBufferUsageBits::oneTimeSubmit});
+    vk::ImageMemoryBarrier barrier {/*srcAccess*/ {}, vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite, vk::ImageLayout::undefined, vk::ImageLayout::general,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, pyramid, {vk::ImageAspectBits::color, 0, pyramidLevels, 0, 1}};
+    vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::topOfPipe, vk::PipelineStageBits::computeShader, {}, {}, {}, nytl::make_span(barrier));
+    vk::endCommandBuffer(cb);
+
+    vpp::Fence fence(device);
+    vk::SubmitInfo submit {0, nullptr, nullptr, 1, &cb.vkHandle(), 0, nullptr};
+    vk::queueSubmit(device.queue(queueFamily)->vkHandle(), nytl::make_span(submit), fence);
+    vk::waitForFences(device.vkHandle(), nytl::make_span(fence.vkHandle()), true, UINT64_MAX);
+}
+
+/// Returns the batch which culls the provided instances (creating it if needed) and marks it as drawn by the current recording.
+const OcclusionCuller::Batch& OcclusionCuller::batch(const void* owner, const void* material, const vpp::SubBuffer& instances, uint32_t instanceCount, uint32_t stride, uint32_t transformOffset,
+  glm::vec3 boundsMin, glm::vec3 boundsMax, uint32_t indexCount){
+    std::lock_guard<std::mutex> lock(mutex);
+    Batch& batch = batches[{owner, material, instances.buffer().vkHandle()}];
+    batch.used = true;
+    batch.boundsMin = boundsMin;
+    batch.boundsMax = boundsMax;
+    batch.indexCount = indexCount;
+
+    // Nothing else to do if the instances haven't changed
+    if(batch.source == instances.buffer().vkHandle() && batch.sourceOffset == instances.offset() && batch.sourceSize == instances.size()
+      && batch.instanceCount == instanceCount && batch.stride == stride && batch.transformOffset == transformOffset)
+        return batch;
+
+    batch.source = instances.buffer();
+    batch.sourceOffset = instances.offset();
+    batch.sourceSize = instances.size();
+    batch.instanceCount = instanceCount;
+    batch.stride = stride;
+    batch.transformOffset = transformOffset;
+
+    batch.visibleInstances = {device.bufferAllocator(), instances.size(), vk::BufferUsageBits::vertexBuffer | vk::BufferUsageBits::storageBuffer, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+    batch.drawCommand = {device.bufferAllocator(), sizeof(vk::DrawIndexedIndirectCommand),
+        vk::BufferUsageBits::indirectBuffer | vk::BufferUsageBits::storageBuffer | vk::BufferUsageBits::transferDst, (unsigned int) vk::MemoryPropertyBits::deviceLocal};
+
+    if(!batch.descriptors.vkHandle()) batch.descriptors = device.descriptorAllocator().alloc(batchLayout);
+    vk::DescriptorBufferInfo infos[] = {
+        {instances.buffer(), instances.offset(), instances.size()},
+        {batch.visibleInstances.buffer(), batch.visibleInstances.offset(), batch.visibleInstances.size()},
+        {batch.drawCommand.buffer(), batch.drawCommand.offset(), batch.drawCommand.size()}};
+    vk::WriteDescriptorSet writes[3];
+    for(uint32_t i = 0; i < 3; i++) writes[i] = {batch.descriptors, i, 0, 1, vk::DescriptorType::storageBuffer, nullptr, &infos[i], nullptr};
+    vk::updateDescriptorSets(device, writes, {});
+    return batch;
+}
+
+/// Records the indirect draw of a batch (its visible instances must be bound in place of the instance buffer)
+void OcclusionCuller::recordDraw(vk::CommandBuffer cb, const Batch& batch){
+    vk::cmdDrawIndexedIndirect(cb, batch.drawCommand.buffer(), batch.drawCommand.offset(), 1, sizeof(vk::DrawIndexedIndirectCommand));
+}
+
+/// Marks the start of recording, batches which aren't requested before <endRecording> are destroyed
+void OcclusionCuller::beginRecording(){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& [key, batch]: batches) batch.used = false;
+}
+
+/// Records the culling commands of every image
+void OcclusionCuller::endRecording(bool pyramid){
+    std::lock_guard<std::mutex> lock(mutex);
+    buildsPyramid = pyramid;
+
+    // Batches which weren't requested belong to meshes which are gone (or whose instances were reuploaded), free them
+    //  (the frames have finished by the time recording begins, so nothing still reads them)
+    for(auto it = batches.begin(); it != batches.end();)
+        if(!it->second.used) it = batches.erase(it);
+        else ++it;
+
+    for(Image& image: images){
+        vk::CommandBuffer cb = image.commandBuffer;
+        vk::beginCommandBuffer(cb, {});
+
+        // Wait for the previous frame to finish drawing from the buffers (and building the pyramid)
+        vk::MemoryBarrier previous {vk::AccessBits::shaderWrite, vk::AccessBits::transferWrite | vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite};
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::drawIndirect | vk::PipelineStageBits::vertexInput | vk::PipelineStageBits::computeShader,
+            vk::PipelineStageBits::transfer | vk::PipelineStageBits::computeShader, {}, nytl::make_span(previous), {}, {});
+
+        // Reset the counters and draws
+        vk::cmdFillBuffer(cb, image.counters.buffer(), image.counters.offset(), image.counters.size(), 0);
+        for(auto& [key, batch]: batches){
+            vk::DrawIndexedIndirectCommand draw {batch.indexCount, /*instanceCount*/ 0, /*firstIndex*/ 0, /*vertexOffset*/ 0, /*firstInstance*/ 0};
+            vk::cmdUpdateBuffer(cb, batch.drawCommand.buffer(), batch.drawCommand.offset(), sizeof(draw), &draw);
+        }
+        vk::MemoryBarrier reset {vk::AccessBits::transferWrite, vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite};
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, vk::PipelineStageBits::computeShader, {}, nytl::make_span(reset), {}, {});
+
+        vk::cmdBindPipeline(cb, vk::PipelineBindPoint::compute, cullPipeline);
+        vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::compute, cullPipelineLayout, 0, nytl::make_span(image.cullDescriptors.vkHandle()), {});
+        for(auto& [key, batch]: batches){
+            vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::compute, cullPipelineLayout, 1, nytl::make_span(batch.descriptors.vkHandle()), {});
+            BatchConstants constants {glm::vec4(batch.boundsMin, 1), glm::vec4(batch.boundsMax, 1), batch.instanceCount, batch.stride / 4, batch.transformOffset / 4};
+            vk::cmdPushConstants(cb, cullPipelineLayout, vk::ShaderStageBits::compute, 0, sizeof(constants), &constants);
+            vk::cmdDispatch(cb, (batch.instanceCount + 63) / 64, 1, 1);
+        }
+
+        // The draws read the results, and the counters are read by the host once the frame finishes
+        vk::MemoryBarrier results {vk::AccessBits::shaderWrite, vk::AccessBits::indirectCommandRead | vk::AccessBits::vertexAttributeRead | vk::AccessBits::hostRead};
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::computeShader, vk::PipelineStageBits::drawIndirect | vk::PipelineStageBits::vertexInput | vk::PipelineStageBits::host,
+            {}, nytl::make_span(results), {}, {});
+        vk::endCommandBuffer(cb);
+    }
+}
+
+/// Records building the depth pyramid from the image's depth buffer (outside of a render pass, after depth has been written)
+void OcclusionCuller::recordPyramid(vk::CommandBuffer cb, uint32_t i, vk::Image depth){
+    Image& image = images[i];
+    // Both aspects of depth/stencil images transition together
+    vk::ImageAspectFlags depthAspect = vk::ImageAspectBits::depth;
+    if(hasStencilComponent(depthFormat)) depthAspect |= vk::ImageAspectBits::stencil;
+
+    // The depth buffer is sampled once it has been written, and the pyramid is rewritten once the last culling finished reading it
+    vk::ImageMemoryBarrier barriers[] = {
+        {vk::AccessBits::depthStencilAttachmentWrite, vk::AccessBits::shaderRead, vk::ImageLayout::depthStencilAttachmentOptimal, vk::ImageLayout::shaderReadOnlyOptimal,
+            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, depth, {depthAspect, 0, 1, 0, 1}},
+        {vk::AccessBits::shaderRead, vk::AccessBits::shaderWrite, vk::ImageLayout::general, vk::ImageLayout::general,
+            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, pyramid, {vk::ImageAspectBits::color, 0, pyramidLevels, 0, 1}}};
+    vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::lateFragmentTests | vk::PipelineStageBits::computeShader, vk::PipelineStageBits::computeShader, {}, {}, {}, barriers);
+
+    vk::cmdBindPipeline(cb, vk::PipelineBindPoint::compute, reducePipeline);
+    for(uint32_t level = 0; level < pyramidLevels; level++){
+        // Each level reads the one before it
+        if(level > 0){
+            vk::ImageMemoryBarrier written {vk::AccessBits::shaderWrite, vk::AccessBits::shaderRead, vk::ImageLayout::general, vk::ImageLayout::general,
+                VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, pyramid, {vk::ImageAspectBits::color, level - 1, 1, 0, 1}};
+            vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::computeShader, vk::PipelineStageBits::computeShader, {}, {}, {}, nytl::make_span(written));
+        }
+
+        vk::DescriptorSet set = (level == 0 ? image.reduceDescriptors.vkHandle() : levelDescriptors[level - 1].vkHandle());
+        vk::cmdBindDescriptorSets(cb, vk::PipelineBindPoint::compute, reducePipelineLayout, 0, nytl::make_span(set), {});
+        uint32_t width = std::max(pyramidExtent.width >> level, 1u), height = std::max(pyramidExtent.height >> level, 1u);
+        vk::cmdDispatch(cb, (width + 7) / 8, (height + 7) / 8, 1);
+    }
+    // The next frame's culling waits for the writes before reading the pyramid
+}
+
+/// Writes the camera used to cull the image's next submission. Must be called once the image's previous frame finished
+void OcclusionCuller::update(uint32_t image){
+    Uniforms uniforms {viewProjection, previousViewProjection, {pyramidExtent.width, pyramidExtent.height}, pyramidLevels, historyValid};
+    vpp::MemoryMapView map = images[image].uniforms.memoryMap();
+    memcpy(map.ptr(), &uniforms, sizeof(uniforms));
+}
+
+/// Notes that the image's commands were submitted
+void OcclusionCuller::submitted(uint32_t image){
+    images[image].submitted = true;
+    // The next frame is tested against the pyramid this frame builds
+    if(buildsPyramid){
+        previousViewProjection = viewProjection;
+        historyValid = true;
+    }
+}
+
+/// Reads back the statistics of the image's last submission. Should be called once the submission has finished
+void OcclusionCuller::collect(uint32_t image){
+    if(image >= images.size() || !images[image].submitted) return;
+    images[image].submitted = false;
+
+    uint32_t counters[3];
+    vpp::MemoryMapView map = images[image].counters.memoryMap();
+    memcpy(counters, map.ptr(), sizeof(counters));
+
+    lastFrame = {counters[0], counters[1], counters[2], 1};
+    totals.tested += lastFrame.tested;
+    totals.frustumCulled += lastFrame.frustumCulled;
+    totals.occluded += lastFrame.occluded;
+    totals.frames++;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "common.hpp"
+#include "engine/math/math.hpp"
+
+#include <vpp/trackedDescriptor.hpp>
+#include <map>
+#include <mutex>
+
+/// Class which culls instances hidden behind other geometry using a hierarchical depth buffer (Hi-Z.)
+///     At the end of every frame the depth buffer is reduced (with compute) into a pyramid whose texels hold
+///     the farthest depth they cover. Before the next frame is rendered each instance's bounds are projected
+///     with the previous frame's camera and tested against the pyramid; visible instances are compacted into a
+///     buffer which is drawn with an indirect draw (so the pre-recorded command buffers never change.)
+///     Instances are drawn conservatively whenever there isn't enough information to prove they are hidden:
+///     if the history is invalid (first frame, resize, camera cut), or their bounds cross the near plane or
+///     leave the area the previous frame rendered (ex newly visible objects entering the view.)
+///     Since occlusion is tested against the previous frame, something revealed by a moving occluder can appear a frame late.
+///     The projection should map depth to [0, 1] with the far plane at 1
+class OcclusionCuller {
+public:
+    // Culling statistics
+    struct Stats {
+        // The number of instances tested, culled by the frustum, and culled by the depth pyramid
+        uint64_t tested = 0, frustumCulled = 0, occluded = 0;
+        // The number of frames the statistics were collected from
+        uint64_t frames = 0;
+
+        /// Returns the percentage of tested instances which were occluded
+        double occludedPercent() const { return tested ? 100.0 * occluded / tested : 0; }
+        /// Returns the percentage of tested instances which weren't drawn
+        double culledPercent() const { return tested ? 100.0 * (frustumCulled + occluded) / tested : 0; }
+    };
+
+    // A set of instances which are culled and then drawn with a single indirect draw
+    struct Batch {
+        // The instances which survived culling (bound in place of the instance buffer)
+        vpp::SubBuffer visibleInstances;
+        // The indirect draw command (its instance count is filled in by the culling)
+        vpp::SubBuffer drawCommand;
+
+    protected:
+        friend class OcclusionCuller;
+        // The instances being culled
+        vk::Buffer source = {};
+        vk::DeviceSize sourceOffset = 0, sourceSize = 0;
+        uint32_t instanceCount = 0, stride = 0, transformOffset = 0, indexCount = 0;
+        glm::vec3 boundsMin, boundsMax;
+        // Descriptors pointing at the buffers above
+        vpp::TrDs descriptors;
+        // True if the batch is drawn by the current recording
+        bool used = false;
+    };
+
+protected:
+    // Data tracked for each render buffer
+    struct Image {
+        // View of the depth buffer's depth aspect (sampled when building the pyramid)
+        vpp::ImageView depthView;
+        vpp::TrDs reduceDescriptors, cullDescriptors;
+        // Camera matrices (written before each submission) and the statistics counters (read once it finishes)
+        vpp::SubBuffer uniforms, counters;
+        // The culling commands, submitted before the image's rendering commands
+        vpp::CommandBuffer commandBuffer;
+        // True if the image's commands have been submitted since its statistics were last collected
+        bool submitted = false;
+    };
+
+    // Uniforms read by the culling shader
+    struct Uniforms {
+        glm::mat4 viewProjection, previousViewProjection;
+        glm::vec2 pyramidSize;
+        uint32_t pyramidLevels, historyValid;
+    };
+
+    const vpp::Device& device;
+    uint32_t queueFamily;
+    vpp::CommandPool commandPool;
+
+    // The depth pyramid (half the resolution of the depth buffer) and a view of each of its levels
+    vpp::Image pyramid;
+    vpp::ImageView pyramidView;
+    std::vector<vpp::ImageView> levelViews;
+    vk::Format depthFormat = vk::Format::undefined;
+    vk::Extent2D pyramidExtent = {};
+    uint32_t pyramidLevels = 0;
+    vpp::Sampler sampler;
+
+    vpp::TrDsLayout reduceLayout, cullLayout, batchLayout;
+    vpp::PipelineLayout reducePipelineLayout, cullPipelineLayout;
+    vpp::Pipeline reducePipeline, cullPipeline;
+    // Descriptors reducing each level of the pyramid into the next
+    std::vector<vpp::TrDs> levelDescriptors;
+
+    std::vector<Image> images;
+    // Batches keyed by the drawing object, its material, and the instance buffer
+    std::map<std::tuple<const void*, const void*, vk::Buffer>, Batch> batches;
+    // Protects the batches (meshes may be recorded on several threads)
+    std::mutex mutex;
+
+    // The current camera, and the camera the pyramid was built with
+    glm::mat4 viewProjection = glm::mat4(1), previousViewProjection = glm::mat4(1);
+    // True if a pyramid has been built (since the last resize or camera cut)
+    bool historyValid = false;
+    // True if the recorded commands build the pyramid
+    bool buildsPyramid = false;
+    Stats lastFrame, totals;
+
+public:
+    /// Creates a culler for work submitted to the specified queue family
+    OcclusionCuller(const vpp::Device& device, uint32_t queueFamily);
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    /// Recreates the pyramid and per image data to match the depth buffers.
+    ///     Nothing using the old resources may still be running
+    void resize(vk::Extent2D extent, vk::Format depthFormat, const std::vector<vk::Image>& depthImages);
+
+    /// Sets the camera used to cull the next frame (the view projection matrix used to render it)
+    void setViewProjection(const glm::mat4& viewProjection) { this->viewProjection = viewProjection; }
+    /// Discards the depth history (ex after a camera cut), the next frame is only frustum culled
+    void invalidateHistory() { historyValid = false; }
+
+    /// Returns the batch which culls the provided instances (creating it if needed) and marks it as drawn by the current recording.
+    ///     <owner> and <material> identify the batch, <stride> is the size of each instance and <transformOffset>
+    ///     the offset of its transform (in bytes), the bounds are the untransformed bounds of the drawn geometry
+    const Batch& batch(const void* owner, const void* material, const vpp::SubBuffer& instances, uint32_t instanceCount, uint32_t stride, uint32_t transformOffset,
+        glm::vec3 boundsMin, glm::vec3 boundsMax, uint32_t indexCount);
+    /// Records the indirect draw of a batch (its visible instances must be bound in place of the instance buffer)
+    static void recordDraw(vk::CommandBuffer cb, const Batch& batch);
+
+    /// Marks the start of recording, batches which aren't requested before <endRecording> are destroyed
+    void beginRecording();
+    /// Records the culling commands of every image
+    ///     <pyramid> marks whether the depth pyramid is built by the image's commands (see <recordPyramid>)
+    void endRecording(bool pyramid = true);
+    /// Records building the depth pyramid from the image's depth buffer (outside of a render pass, after depth has been written)
+    ///     The depth buffer is left in the shader read only layout
+    void recordPyramid(vk::CommandBuffer cb, uint32_t image, vk::Image depth);
+
+    /// Returns the command buffer which culls the batches for an image (submitted before the image's commands)
+    vk::CommandBuffer commandBuffer(uint32_t image) const { return images[image].commandBuffer.vkHandle(); }
+    /// Writes the camera used to cull the image's next submission. Must be called once the image's previous frame finished
+    void update(uint32_t image);
+    /// Notes that the image's commands were submitted
+    void submitted(uint32_t image);
+    /// Reads back the statistics of the image's last submission. Should be called once the submission has finished
+    void collect(uint32_t image);
+
+    /// Returns the statistics of the last collected frame
+    const Stats& frameStats() const { return lastFrame; }
+    /// Returns the statistics accumulated since they were last cleared
+    const Stats& stats() const { return totals; }
+    /// Clears the accumulated statistics
+    void clearStats() { totals = {}; }
+};
@@ -0,0 +1,698 @@
+#include "renderGraph.hpp"
+
+#include <algorithm>
+
+// Returns true if the format stores depth (and thus needs a depth aspect)
+static bool isDepthFormat(vk::Format format){
+    switch(format){
+    case vk::Format::d16Unorm:
+    case vk::Format::x8D24UnormPack32:
+    case vk::Format::d32Sfloat:
+    case vk::Format::d16UnormS8Uint:
+    case vk::Format::d24UnormS8Uint:
+    case vk::Format::d32SfloatS8Uint:
+        return true;
+    default: return false;
+    }
+}
+
+// Returns the aspects of an image with the provided format
+static vk::ImageAspectFlags aspectFor(vk::Format format){
+    switch(format){
+    case vk::Format::d16UnormS8Uint:
+    case vk::Format::d24UnormS8Uint:
+    case vk::Format::d32SfloatS8Uint:
+        return vk::ImageAspectBits::depth | vk::ImageAspectBits::stencil;
+    default: return isDepthFormat(format) ? vk::ImageAspectFlags(vk::ImageAspectBits::depth) : vk::ImageAspectFlags(vk::ImageAspectBits::color);
+    }
+}
+
+// Returns the layout an image needs to be in for the provided access
+static vk::ImageLayout layoutFor(RenderGraph::Access access, vk::Format format){
+    switch(access){
+    case RenderGraph::Access::ColorAttachment: return vk::ImageLayout::colorAttachmentOptimal;
+    case RenderGraph::Access::DepthAttachment: return vk::ImageLayout::depthStencilAttachmentOptimal;
+    case RenderGraph::Access::InputAttachment:
+    case RenderGraph::Access::Sampled:
+        return isDepthFormat(format) ? vk::ImageLayout::depthStencilReadOnlyOptimal : vk::ImageLayout::shaderReadOnlyOptimal;
+    default: return vk::ImageLayout::general;
+    }
+}
+
+// Returns the memory accesses performed by the provided access
+static vk::AccessFlags accessMaskFor(RenderGraph::Access access){
+    switch(access){
+    case RenderGraph::Access::ColorAttachment: return vk::AccessBits::colorAttachmentRead | vk::AccessBits::colorAttachmentWrite;
+    case RenderGraph::Access::DepthAttachment: return vk::AccessBits::depthStencilAttachmentRead | vk::AccessBits::depthStencilAttachmentWrite;
+    case RenderGraph::Access::InputAttachment: return vk::AccessBits::inputAttachmentRead;
+    case RenderGraph::Access::StorageWrite: return vk::AccessBits::shaderRead | vk::AccessBits::shaderWrite;
+    default: return vk::AccessBits::shaderRead;
+    }
+}
+
+// Returns the pipeline stages which perform the provided access
+static vk::PipelineStageFlags stageFor(RenderGraph::Access access, bool graphics){
+    switch(access){
+    case RenderGraph::Access::ColorAttachment: return vk::PipelineStageBits::colorAttachmentOutput;
+    case RenderGraph::Access::DepthAttachment: return vk::PipelineStageBits::earlyFragmentTests | vk::PipelineStageBits::lateFragmentTests;
+    case RenderGraph::Access::InputAttachment: return vk::PipelineStageBits::fragmentShader;
+    default: return graphics ? (vk::PipelineStageBits::vertexShader | vk::PipelineStageBits::fragmentShader) : vk::PipelineStageFlags(vk::PipelineStageBits::computeShader);
+    }
+}
+
+// Returns the image usage needed by the provided access
+static vk::ImageUsageFlags usageFor(RenderGraph::Access access){
+    switch(access){
+    case RenderGraph::Access::ColorAttachment: return vk::ImageUsageBits::colorAttachment;
+    case RenderGraph::Access::DepthAttachment: return vk::ImageUsageBits::depthStencilAttachment;
+    case RenderGraph::Access::InputAttachment: return vk::ImageUsageBits::inputAttachment;
+    case RenderGraph::Access::Sampled: return vk::ImageUsageBits::sampled;
+    default: return vk::ImageUsageBits::storage;
+    }
+}
+
+/*---------------------
+* PassBuilder
+---------------------*/
+
+// The pass renders to the image (clearing it first if a clear color is provided)
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::color(ResourceID id, std::optional<vk::ClearColorValue> clear){
+    std::optional<vk::ClearValue> value;
+    if(clear) { value = vk::ClearValue{}; value->color = *clear; }
+    graph.passes[pass].uses.push_back({id, Access::ColorAttachment, value});
+    return *this;
+}
+
+// The pass uses the image as its depth buffer (clearing it first if a clear value is provided)
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::depth(ResourceID id, std::optional<vk::ClearDepthStencilValue> clear){
+    std::optional<vk::ClearValue> value;
+    if(clear) { value = vk::ClearValue{}; value->depthStencil = *clear; }
+    graph.passes[pass].uses.push_back({id, Access::DepthAttachment, value});
+    return *this;
+}
+
+// The pass reads the image through an input attachment
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::input(ResourceID id){ graph.passes[pass].uses.push_back({id, Access::InputAttachment, {}}); return *this; }
+// The pass samples the image in its shaders
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sample(ResourceID id){ graph.passes[pass].uses.push_back({id, Access::Sampled, {}}); return *this; }
+// The pass reads/writes the image as a storage image
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::storageRead(ResourceID id){ graph.passes[pass].uses.push_back({id, Access::StorageRead, {}}); return *this; }
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::storageWrite(ResourceID id){ graph.passes[pass].uses.push_back({id, Access::StorageWrite, {}}); return *this; }
+// Marks the pass as having effects outside the graph
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::sideEffects(){ graph.passes[pass].sideEffects = true; return *this; }
+
+/*---------------------
+* RenderGraph
+---------------------*/
+
+// Creates an image whose memory is managed by (and may be aliased within) the graph
+RenderGraph::ResourceID RenderGraph::createImage(str name, ImageDesc desc){
+    Resource res;
+    res.name = name;
+    res.desc = desc;
+    resources.push_back(res);
+
+    compiled = false;
+    return resources.size() - 1;
+}
+
+// Imports an image which is created outside the graph (such as the swapchain's images).
+RenderGraph::ResourceID RenderGraph::importImage(str name, ImageDesc desc, vk::ImageLayout finalLayout){
+    ResourceID id = createImage(name, desc);
+    resources[id].imported = true;
+    resources[id].finalLayout = finalLayout;
+    return id;
+}
+
+// Binds the handles of an imported image, one pair for each variant (ex. swapchain image)
+void RenderGraph::bindImport(ResourceID id, std::vector<std::pair<vk::Image, vk::ImageView>> handles){
+    if(!resources.at(id).imported) throw std::invalid_argument("Render graph image '" + resources[id].name + "' isn't imported.");
+    resources[id].importedHandles = std::move(handles);
+}
+
+// Adds a pass to the graph, passes must be added in the order they should execute in
+RenderGraph::PassBuilder RenderGraph::addPass(str name, RecordFunction record, bool graphics){
+    Pass pass;
+    pass.name = name;
+    pass.graphics = graphics;
+    pass.record = std::move(record);
+    passes.push_back(std::move(pass));
+
+    compiled = false;
+    return {*this, (PassID) passes.size() - 1};
+}
+
+// Compiles the graph, creating all of the vulkan objects it needs
+void RenderGraph::compile(const vpp::Device& dev, vk::Extent2D extent){
+    reset();
+    device = &dev;
+    targetExtent = extent;
+
+    // Determine the size of each of the images
+    for(Resource& res: resources){
+        res.extent = (res.desc.extent.width && res.desc.extent.height) ? res.desc.extent : targetExtent;
+        res.usage = res.desc.extraUsage;
+    }
+
+    cullPasses();
+    buildSteps();
+    createImages();
+    buildBarriers();
+    createRenderPasses();
+
+    compiled = true;
+    auto [aliased, unaliased] = memoryUsage();
+    dlg_info("Compiled render graph: " + str(steps.size()) + " steps, " + str(barrierCount()) + " barriers, "
+        + str(aliased) + " bytes of transient memory (" + str(unaliased) + " without aliasing)");
+}
+
+// Marks the passes which contribute to an imported image (or have side effects) as alive
+void RenderGraph::cullPasses(){
+    // Imported images are the outputs of the graph
+    std::vector<bool> needed(resources.size(), false);
+    for(size_t i = 0; i < resources.size(); i++)
+        needed[i] = resources[i].imported;
+
+    // Walk backwards, a pass is needed if anything needed comes out of it
+    for(size_t p = passes.size(); p-- > 0;){
+        Pass& pass = passes[p];
+        pass.alive = pass.sideEffects;
+        for(Use& use: pass.uses)
+            if(use.writes() && needed[use.resource]) pass.alive = true;
+        if(!pass.alive) continue;
+
+        // Everything the pass reads is now needed (as is the previous contents of attachments it doesn't clear)
+        for(Use& use: pass.uses)
+            if(!use.writes() || (use.attachment() && !use.clear))
+                needed[use.resource] = true;
+    }
+
+    // Make sure nothing is read before it is written
+    std::vector<bool> written(resources.size(), false);
+    for(Pass& pass: passes){
+        if(!pass.alive) {
+            dlg_debug("Render graph pass '" + pass.name + "' culled");
+            continue;
+        }
+        for(Use& use: pass.uses){
+            if(!use.writes() && !written[use.resource] && !resources[use.resource].imported)
+                throw std::runtime_error("Render graph pass '" + pass.name + "' reads '" + resources[use.resource].name + "' before it is written.");
+            if(use.writes()) written[use.resource] = true;
+        }
+    }
+}
+
+// Groups the passes into steps, merging consecutive graphics passes into subpasses where possible
+void RenderGraph::buildSteps(){
+    int32_t current = -1;
+    for(PassID p = 0; p < passes.size(); p++){
+        Pass& pass = passes[p];
+        if(!pass.alive) continue;
+
+        // Determine the size of the area the pass renders to
+        vk::Extent2D extent = targetExtent;
+        bool hasAttachment = false;
+        for(Use& use: pass.uses) if(use.attachment()){
+            vk::Extent2D e = resources[use.resource].extent;
+            if(hasAttachment && (e.width != extent.width || e.height != extent.height))
+                throw std::runtime_error("Render graph pass '" + pass.name + "' has attachments of different sizes.");
+            extent = e;
+            hasAttachment = true;
+        }
+
+        // Determine if this pass can become another subpass of the current render pass
+        bool merge = pass.graphics && current >= 0 && steps[current].extent.width == extent.width && steps[current].extent.height == extent.height;
+        // Images read outside of attachments must be finished before the render pass begins
+        if(merge) for(Use& use: pass.uses)
+            if(!use.attachment()) for(PassID other: steps[current].passes)
+                for(Use& otherUse: passes[other].uses)
+                    if(otherUse.resource == use.resource && (otherUse.writes() || use.writes())) merge = false;
+
+        if(!merge){
+            steps.emplace_back();
+            current = steps.size() - 1;
+            steps[current].extent = extent;
+        }
+
+        pass.step = current;
+        pass.subpass = steps[current].passes.size();
+        steps[current].passes.push_back(p);
+
+        // Track the lifetimes and usages of the images
+        for(Use& use: pass.uses){
+            Resource& res = resources[use.resource];
+            res.firstUse = std::min<uint32_t>(res.firstUse, current);
+            res.lastUse = std::max<uint32_t>(res.lastUse, current);
+            res.usage |= usageFor(use.access);
+        }
+
+        // Non-graphics passes are always alone in their step
+        if(!pass.graphics) current = -1;
+    }
+}
+
+// Creates the transient images and aliases their memory where lifetimes don't overlap
+void RenderGraph::createImages(){
+    vk::Device dev = device->vkHandle();
+
+    // Process the images in the order they are first used
+    std::vector<ResourceID> order;
+    for(ResourceID id = 0; id < resources.size(); id++)
+        if(!resources[id].imported && resources[id].firstUse != UINT32_MAX)
+            order.push_back(id);
+    std::sort(order.begin(), order.end(), [this](ResourceID a, ResourceID b){ return resources[a].firstUse < resources[b].firstUse; });
+
+    for(ResourceID id: order){
+        Resource& res = resources[id];
+
+        vk::ImageCreateInfo info;
+        info.imageType = vk::ImageType::e2d;
+        info.format = res.desc.format;
+        info.extent = {res.extent.width, res.extent.height, 1};
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = vk::SampleCountBits::e1;
+        info.tiling = vk::ImageTiling::optimal;
+        info.usage = res.usage;
+        info.sharingMode = vk::SharingMode::exclusive;
+        info.initialLayout = vk::ImageLayout::undefined;
+        res.image = vk::createImage(dev, info);
+
+        vk::MemoryRequirements requirements = vk::getImageMemoryRequirements(dev, res.image);
+        res.memorySize = requirements.size;
+
+        // Find a block whose previous users are finished before this image is first used
+        for(uint32_t b = 0; b < blocks.size(); b++)
+            if(blocks[b].freeAfter < res.firstUse && (blocks[b].typeBits & requirements.memoryTypeBits)){
+                res.block = b;
+                break;
+            }
+        // Or create a new one
+        if(res.block == UINT32_MAX){
+            blocks.emplace_back();
+            res.block = blocks.size() - 1;
+        }
+
+        // Grow the block to fit this image (images are always bound at the start of the block so alignment is met)
+        MemoryBlock& block = blocks[res.block];
+        block.size = std::max(block.size, requirements.size);
+        block.typeBits &= requirements.memoryTypeBits;
+        block.freeAfter = res.lastUse;
+        block.users++;
+    }
+
+    // Allocate the blocks from device local memory
+    vk::PhysicalDeviceMemoryProperties properties = vk::getPhysicalDeviceMemoryProperties(device->vkPhysicalDevice());
+    for(MemoryBlock& block: blocks){
+        uint32_t type = UINT32_MAX;
+        for(uint32_t i = 0; i < properties.memoryTypeCount; i++)
+            if((block.typeBits & (1 << i)) && (properties.memoryTypes[i].propertyFlags & vk::MemoryPropertyBits::deviceLocal)){
+                type = i;
+                break;
+            }
+        if(type == UINT32_MAX) throw std::runtime_error("Failed to find device local memory for render graph images.");
+
+        block.memory = vk::allocateMemory(dev, {block.size, type});
+    }
+
+    // Bind the images and create their views
+    for(ResourceID id: order){
+        Resource& res = resources[id];
+        vk::bindImageMemory(dev, res.image, blocks[res.block].memory, 0);
+        res.view = vk::createImageView(dev, {/*flags*/ {}, res.image, vk::ImageViewType::e2d, res.desc.format,
+            {vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity},
+            {aspectFor(res.desc.format), 0, 1, 0, 1}});
+    }
+}
+
+// Determines the barriers needed before each step and the layouts attachments start and end render passes in
+void RenderGraph::buildBarriers(){
+    // Tracks the state each image was left in by the last step that used it
+    struct State {
+        vk::ImageLayout layout = vk::ImageLayout::undefined;
+        vk::AccessFlags access = {};
+        vk::PipelineStageFlags stage = {};
+        bool written = false;
+        bool used = false;
+    };
+    std::vector<State> states(resources.size());
+    // Aliased images need to wait for the previous occupant of their memory before their first use
+    auto aliased = [this](ResourceID id){ return !resources[id].imported && blocks[resources[id].block].users > 1; };
+
+    // The images (and their memory) are shared by every frame in flight, so the first use of an image
+    //  has to wait for its last use in the previous frame (which is the same as its last use in the graph)
+    std::vector<State> previousFrame(resources.size());
+    for(uint32_t s = 0; s < steps.size(); s++){
+        bool graphics = passes[steps[s].passes[0]].graphics;
+        for(PassID p: steps[s].passes) for(Use& use: passes[p].uses){
+            if(resources[use.resource].lastUse != s) continue;
+            State& last = previousFrame[use.resource];
+            last.layout = layoutFor(use.access, resources[use.resource].desc.format);
+            last.access |= accessMaskFor(use.access);
+            last.stage |= stageFor(use.access, graphics);
+            last.written |= use.writes();
+            last.used = true;
+        }
+    }
+    // Returns the stages and (write) accesses a first use needs to wait for
+    auto waitFor = [&](ResourceID id) -> std::pair<vk::PipelineStageFlags, vk::AccessFlags> {
+        std::pair<vk::PipelineStageFlags, vk::AccessFlags> out = {previousFrame[id].stage, previousFrame[id].written ? previousFrame[id].access : vk::AccessFlags{}};
+        // Aliased images also wait for every other image sharing their memory (in this or the previous frame)
+        if(aliased(id)) for(ResourceID other = 0; other < resources.size(); other++)
+            if(other != id && !resources[other].imported && resources[other].block == resources[id].block && previousFrame[other].used){
+                out.first |= previousFrame[other].stage;
+                if(previousFrame[other].written) out.second |= previousFrame[other].access;
+            }
+        return out;
+    };
+
+    for(uint32_t s = 0; s < steps.size(); s++){
+        Step& step = steps[s];
+        bool graphics = passes[step.passes[0]].graphics;
+
+        // The state each image is in at the end of this step
+        std::vector<std::optional<State>> after(resources.size());
+        for(PassID p: step.passes) for(Use& use: passes[p].uses){
+            Resource& res = resources[use.resource];
+            vk::ImageLayout layout = layoutFor(use.access, res.desc.format);
+            vk::AccessFlags access = accessMaskFor(use.access);
+            vk::PipelineStageFlags stage = stageFor(use.access, graphics);
+
+            // Only the first use in a step needs a barrier (subpass dependencies handle the rest)
+            if(!after[use.resource]){
+                State& prev = states[use.resource];
+                // Attachments which haven't been used (this frame) are transitioned by the render pass
+                //  (which waits for the previous frame with an external subpass dependency)
+                bool renderPassTransition = use.attachment() && !prev.used;
+                // Read after read in the same layout doesn't need a barrier
+                bool hazard = prev.written || use.writes() || prev.layout != layout;
+
+                if(!prev.used && (aliased(use.resource) || !renderPassTransition)){
+                    // The contents from the previous frame (or the previous occupant of the memory) are discarded
+                    auto [srcStage, srcAccess] = waitFor(use.resource);
+                    step.barriers.push_back({use.resource, vk::ImageLayout::undefined, layout, srcAccess, access, srcStage, stage});
+                } else if(hazard && !renderPassTransition)
+                    step.barriers.push_back({use.resource, prev.layout, layout, prev.written ? prev.access : vk::AccessFlags{},
+                        access, prev.stage, stage});
+                after[use.resource] = State{layout, access, stage, use.writes(), true};
+            } else {
+                after[use.resource]->layout = layout;
+                after[use.resource]->access |= access;
+                after[use.resource]->stage |= stage;
+                after[use.resource]->written |= use.writes();
+            }
+        }
+
+        // Record the layouts the attachments of the render pass start and end in
+        if(graphics) for(PassID p: step.passes) for(Use& use: passes[p].uses) if(use.attachment()){
+            if(std::find(step.attachments.begin(), step.attachments.end(), use.resource) != step.attachments.end()) continue;
+            step.attachments.push_back(use.resource);
+
+            // Start in the layout the barrier (if any) left the image in
+            vk::ImageLayout initial = (states[use.resource].used || aliased(use.resource)) ? layoutFor(use.access, resources[use.resource].desc.format) : vk::ImageLayout::undefined;
+            step.attachmentLayouts.push_back({initial, after[use.resource]->layout});
+        }
+
+        for(ResourceID id = 0; id < resources.size(); id++)
+            if(after[id]) states[id] = *after[id];
+    }
+
+    // Transition the imported images into their final layouts
+    for(ResourceID id = 0; id < resources.size(); id++){
+        Resource& res = resources[id];
+        if(!res.imported || !states[id].used || states[id].layout == res.finalLayout) continue;
+
+        // If the image was last used as an attachment, the render pass can transition it for free
+        Step& last = steps[res.lastUse];
+        auto found = std::find(last.attachments.begin(), last.attachments.end(), id);
+        if(found != last.attachments.end()) {
+            last.attachmentLayouts[found - last.attachments.begin()].second = res.finalLayout;
+            continue;
+        }
+
+        finalBarriers.push_back({id, states[id].layout, res.finalLayout, states[id].written ? states[id].access : vk::AccessFlags{},
+            {}, states[id].stage, vk::PipelineStageBits::bottomOfPipe});
+    }
+}
+
+// Creates the render passes (and framebuffers) for each of the graphics steps
+void RenderGraph::createRenderPasses(){
+    for(uint32_t s = 0; s < steps.size(); s++){
+        Step& step = steps[s];
+        if(!passes[step.passes[0]].graphics) continue;
+
+        // Returns the index of a resource in the attachment list
+        auto attachmentIndex = [&](ResourceID id) -> uint32_t { return std::find(step.attachments.begin(), step.attachments.end(), id) - step.attachments.begin(); };
+
+        // Describe the attachments
+        std::vector<vk::AttachmentDescription> attachments;
+        step.clearValues.resize(step.attachments.size());
+        for(uint32_t a = 0; a < step.attachments.size(); a++){
+            ResourceID id = step.attachments[a];
+            Resource& res = resources[id];
+
+            // Find the first use of the attachment in this step
+            const Use* first = nullptr;
+            for(PassID p: step.passes) for(Use& use: passes[p].uses)
+                if(!first && use.resource == id) first = &use;
+
+            // Clear if requested, load if there is something to load, otherwise we don't care
+            vk::AttachmentLoadOp load = vk::AttachmentLoadOp::dontCare;
+            if(first->clear) {
+                load = vk::AttachmentLoadOp::clear;
+                step.clearValues[a] = *first->clear;
+            } else if(res.firstUse < s) load = vk::AttachmentLoadOp::load;
+            // Only store if the contents are needed after this render pass
+            vk::AttachmentStoreOp store = (res.imported || res.lastUse > s) ? vk::AttachmentStoreOp::store : vk::AttachmentStoreOp::dontCare;
+
+            attachments.push_back({/*flags*/ {}, res.desc.format, vk::SampleCountBits::e1, load, store,
+                /*stencil*/ vk::AttachmentLoadOp::dontCare, vk::AttachmentStoreOp::dontCare,
+                step.attachmentLayouts[a].first, step.attachmentLayouts[a].second});
+        }
+
+        // Describe the subpasses (storage for the references needs to outlive the descriptions)
+        std::vector<std::vector<vk::AttachmentReference>> colors(step.passes.size()), inputs(step.passes.size());
+        std::vector<vk::AttachmentReference> depths(step.passes.size());
+        std::vector<std::vector<uint32_t>> preserves(step.passes.size());
+        std::vector<vk::SubpassDescription> subpasses;
+        for(uint32_t sp = 0; sp < step.passes.size(); sp++){
+            Pass& pass = passes[step.passes[sp]];
+            bool hasDepth = false;
+            for(Use& use: pass.uses){
+                vk::AttachmentReference ref{attachmentIndex(use.resource), layoutFor(use.access, resources[use.resource].desc.format)};
+                if(use.access == Access::ColorAttachment) colors[sp].push_back(ref);
+                else if(use.access == Access::DepthAttachment) { depths[sp] = ref; hasDepth = true; }
+                else if(use.access == Access::InputAttachment) inputs[sp].push_back(ref);
+            }
+
+            // Preserve attachments which are written before this subpass and read after it
+            for(uint32_t a = 0; a < step.attachments.size(); a++){
+                auto uses = [&](uint32_t subpass){
+                    for(Use& use: passes[step.passes[subpass]].uses) if(use.resource == step.attachments[a]) return true;
+                    return false;
+                };
+                if(uses(sp)) continue;
+                bool before = false, later = false;
+                for(uint32_t o = 0; o < sp; o++) before |= uses(o);
+                for(uint32_t o = sp + 1; o < step.passes.size(); o++) later |= uses(o);
+                if(before && later) preserves[sp].push_back(a);
+            }
+
+            subpasses.push_back({/*flags*/ {}, vk::PipelineBindPoint::graphics,
+                (uint32_t) inputs[sp].size(), inputs[sp].data(),
+                (uint32_t) colors[sp].size(), colors[sp].data(),
+                /*resolveAttachments*/ nullptr, hasDepth ? &depths[sp] : nullptr,
+                (uint32_t) preserves[sp].size(), preserves[sp].data()});
+        }
+
+        // Add a dependency between every pair of subpasses which share an attachment that one of them writes
+        std::vector<vk::SubpassDependency> dependencies;
+        for(uint32_t dst = 1; dst < step.passes.size(); dst++)
+            for(uint32_t src = 0; src < dst; src++){
+                vk::SubpassDependency dep {src, dst, {}, {}, {}, {}, vk::DependencyBits::byRegion};
+                for(Use& a: passes[step.passes[src]].uses) for(Use& b: passes[step.passes[dst]].uses)
+                    if(a.resource == b.resource && (a.writes() || b.writes())){
+                        dep.srcStageMask |= stageFor(a.access, true);
+                        dep.dstStageMask |= stageFor(b.access, true);
+                        dep.srcAccessMask |= accessMaskFor(a.access);
+                        dep.dstAccessMask |= accessMaskFor(b.access);
+                    }
+                if(dep.srcStageMask) dependencies.push_back(dep);
+            }
+
+        // The first use of an attachment waits for its last use in the previous frame (the images are shared by the frames in flight),
+        //  and its last use is made available to the next frame's first use
+        for(ResourceID id: step.attachments){
+            Resource& res = resources[id];
+            if(res.firstUse != s && res.lastUse != s) continue;
+            // Find the subpasses the attachment is first and last used in, along with how they use it
+            uint32_t first = UINT32_MAX, last = 0;
+            vk::PipelineStageFlags firstStage = {}, lastStage = {};
+            vk::AccessFlags firstAccess = {}, lastAccess = {};
+            for(uint32_t sp = 0; sp < step.passes.size(); sp++) for(Use& use: passes[step.passes[sp]].uses){
+                if(use.resource != id) continue;
+                if(first == UINT32_MAX || first == sp){
+                    first = sp;
+                    firstStage |= stageFor(use.access, true);
+                    firstAccess |= accessMaskFor(use.access);
+                }
+                if(last != sp) lastStage = {}, lastAccess = {};
+                last = sp;
+                lastStage |= stageFor(use.access, true);
+                if(use.writes()) lastAccess |= accessMaskFor(use.access);
+            }
+
+            if(res.firstUse == s){
+                auto [srcStage, srcAccess] = waitFor(id);
+                dependencies.push_back({VK_SUBPASS_EXTERNAL, first, srcStage, firstStage, srcAccess, firstAccess, /*flags*/ {}});
+            }
+            if(res.lastUse == s){
+                // Imported images are handed back to whatever uses them next (ex presentation, which waits on a semaphore)
+                vk::PipelineStageFlags dstStage = {};
+                vk::AccessFlags dstAccess = {};
+                if(!res.imported) for(PassID p: steps[res.firstUse].passes) for(Use& use: passes[p].uses)
+                    if(use.resource == id){
+                        dstStage |= stageFor(use.access, passes[p].graphics);
+                        dstAccess |= accessMaskFor(use.access);
+                    }
+                if(!dstStage) dstStage = vk::PipelineStageBits::bottomOfPipe;
+                dependencies.push_back({last, VK_SUBPASS_EXTERNAL, lastStage, dstStage, lastAccess, dstAccess, /*flags*/ {}});
+            }
+        }
+
+        step.renderPass = {*device, {/*flags*/ {},
+            (uint32_t) attachments.size(), attachments.data(),
+            (uint32_t) subpasses.size(), subpasses.data(),
+            (uint32_t) dependencies.size(), dependencies.data()}};
+
+        // Create a framebuffer for every variant of the imported images
+        size_t variants = 1;
+        for(ResourceID id: step.attachments)
+            if(resources[id].imported) variants = std::max(variants, resources[id].importedHandles.size());
+        for(size_t v = 0; v < variants; v++){
+            std::vector<vk::ImageView> views;
+            for(ResourceID id: step.attachments) views.push_back(view(id, v));
+            step.framebuffers.emplace_back(*device, vk::FramebufferCreateInfo{/*flags*/ {}, step.renderPass,
+                (uint32_t) views.size(), views.data(), step.extent.width, step.extent.height, /*layers*/ 1});
+        }
+    }
+}
+
+// Records the graph into the provided command buffer using the specified variant of the imported images
+void RenderGraph::execute(vpp::CommandBuffer& cb, uint32_t variant) const {
+    if(!compiled) throw std::runtime_error("Render graph must be compiled before it is executed.");
+
+    // Records a list of barriers as a single pipeline barrier
+    auto recordBarriers = [&](const std::vector<Barrier>& barriers){
+        if(barriers.empty()) return;
+
+        vk::PipelineStageFlags src = {}, dst = {};
+        std::vector<vk::ImageMemoryBarrier> imageBarriers;
+        for(const Barrier& b: barriers){
+            vk::ImageMemoryBarrier barrier;
+            barrier.srcAccessMask = b.srcAccess;
+            barrier.dstAccessMask = b.dstAccess;
+            barrier.oldLayout = b.oldLayout;
+            barrier.newLayout = b.newLayout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = image(b.resource, variant);
+            barrier.subresourceRange = {aspectFor(resources[b.resource].desc.format), 0, 1, 0, 1};
+            imageBarriers.push_back(barrier);
+
+            src |= b.srcStage;
+            dst |= b.dstStage;
+        }
+        vk::cmdPipelineBarrier(cb, src, dst, {}, {}, {}, imageBarriers);
+    };
+
+    for(const Step& step: steps){
+        recordBarriers(step.barriers);
+
+        // Non-graphics passes are simply recorded
+        if(!step.graphics()){
+            for(PassID p: step.passes) passes[p].record(cb, *this, p);
+            continue;
+        }
+
+        const vpp::Framebuffer& framebuffer = step.framebuffers[step.framebuffers.size() > 1 ? variant : 0];
+        vk::cmdBeginRenderPass(cb, {step.renderPass, framebuffer, {/*offset*/{0, 0}, step.extent},
+            (uint32_t) step.clearValues.size(), step.clearValues.data()}, vk::SubpassContents::eInline);
+
+        // Dynamic state is shared by all of the subpasses
+        vk::Viewport viewport{0, 0, (float) step.extent.width, (float) step.extent.height, 0, 1};
+        vk::Rect2D scissor{{0, 0}, step.extent};
+        vk::cmdSetViewport(cb, 0, 1, viewport);
+        vk::cmdSetScissor(cb, 0, 1, scissor);
+
+        for(size_t i = 0; i < step.passes.size(); i++){
+            if(i > 0) vk::cmdNextSubpass(cb, vk::SubpassContents::eInline);
+            passes[step.passes[i]].record(cb, *this, step.passes[i]);
+        }
+
+        vk::cmdEndRenderPass(cb);
+    }
+
+    recordBarriers(finalBarriers);
+}
+
+// Destroys all of the objects created while compiling
+void RenderGraph::reset(){
+    if(device){
+        vk::Device dev = device->vkHandle();
+        for(Resource& res: resources){
+            if(res.view) vk::destroyImageView(dev, res.view);
+            if(res.image) vk::destroyImage(dev, res.image);
+            res.view = {};
+            res.image = {};
+            res.block = UINT32_MAX;
+            res.firstUse = UINT32_MAX;
+            res.lastUse = 0;
+        }
+        for(MemoryBlock& block: blocks)
+            if(block.memory) vk::freeMemory(dev, block.memory);
+    }
+
+    steps.clear();
+    blocks.clear();
+    finalBarriers.clear();
+    compiled = false;
+}
+
+// Returns the render pass the specified pass is executed in (and the subpass index of the pass)
+std::pair<vk::RenderPass, uint32_t> RenderGraph::renderPass(PassID id) const {
+    const Pass& pass = passes.at(id);
+    if(!compiled || !pass.alive || !pass.graphics) return {{}, 0};
+    return {steps[pass.step].renderPass.vkHandle(), pass.subpass};
+}
+
+// Returns the handle of the image for the specified variant
+vk::Image RenderGraph::image(ResourceID id, uint32_t variant) const {
+    const Resource& res = resources.at(id);
+    if(!res.imported) return res.image;
+    if(res.importedHandles.empty()) throw std::runtime_error("Render graph image '" + res.name + "' was imported but never bound.");
+    return res.importedHandles.at(variant % res.importedHandles.size()).first;
+}
+
+// Returns the view of an image for the current variant
+vk::ImageView RenderGraph::view(ResourceID id, uint32_t variant) const {
+    const Resource& res = resources.at(id);
+    if(!res.imported) return res.view;
+    if(res.importedHandles.empty()) throw std::runtime_error("Render graph image '" + res.name + "' was imported but never bound.");
+    return res.importedHandles.at(variant % res.importedHandles.size()).second;
+}
+
+// Returns the number of bytes of device memory backing the graph's images, and how many bytes would have been needed without aliasing
+std::pair<vk::DeviceSize, vk::DeviceSize> RenderGraph::memoryUsage() const {
+    vk::DeviceSize aliased = 0, unaliased = 0;
+    for(const MemoryBlock& block: blocks) aliased += block.size;
+    for(const Resource& res: resources) unaliased += res.memorySize;
+    return {aliased, unaliased};
+}
+
+// Returns the number of barriers recorded each time the graph is executed
+size_t RenderGraph::barrierCount() const {
+    size_t count = finalBarriers.size();
+    for(const Step& step: steps) count += step.barriers.size();
+    return count;
+}
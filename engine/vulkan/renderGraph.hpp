@@ -0,0 +1,209 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <functional>
+#include <optional>
+
+/// Declarative description of the passes needed to render a frame.
+///     Passes declare which images they read and write, the graph then compiles into:
+///         - An execution order with passes which don't contribute to an imported image culled
+///         - Render passes where consecutive passes are merged into subpasses where possible
+///         - The minimal set of pipeline barriers and layout transitions between render passes
+///         - Shared memory for transient images whose lifetimes don't overlap
+///     Transient images are shared by every frame in flight, so each image's first use waits for its last use in the previous frame
+class RenderGraph {
+public:
+    // Handle identifying an image in the graph
+    using ResourceID = uint32_t;
+    // Handle identifying a pass in the graph
+    using PassID = uint32_t;
+
+    // The ways a pass can use an image
+    enum class Access { ColorAttachment, DepthAttachment, InputAttachment, Sampled, StorageRead, StorageWrite };
+
+    // Description of an image managed by the graph
+    struct ImageDesc {
+        vk::Format format = vk::Format::r8g8b8a8Unorm;
+        // An extent of 0x0 makes the image the same size as the graph's target
+        vk::Extent2D extent = {0, 0};
+        // Any usage beyond what the graph determines from the passes
+        vk::ImageUsageFlags extraUsage = {};
+    };
+
+    // Function which records the commands of a pass
+    using RecordFunction = std::function<void (vpp::CommandBuffer&, const RenderGraph&, PassID)>;
+
+    /// Utility returned when adding a pass to declare the images the pass uses
+    class PassBuilder {
+        RenderGraph& graph;
+        PassID pass;
+    public:
+        PassBuilder(RenderGraph& _graph, PassID _pass) : graph(_graph), pass(_pass) {}
+
+        /// The pass renders to the image (clearing it first if a clear color is provided)
+        PassBuilder& color(ResourceID, std::optional<vk::ClearColorValue> clear = {});
+        /// The pass uses the image as its depth buffer (clearing it first if a clear value is provided)
+        PassBuilder& depth(ResourceID, std::optional<vk::ClearDepthStencilValue> clear = {});
+        /// The pass reads the image through an input attachment (at the same pixel it is rendering)
+        PassBuilder& input(ResourceID);
+        /// The pass samples the image in its shaders
+        PassBuilder& sample(ResourceID);
+        /// The pass reads/writes the image as a storage image
+        PassBuilder& storageRead(ResourceID);
+        PassBuilder& storageWrite(ResourceID);
+        /// Marks the pass as having effects outside the graph (it will never be culled)
+        PassBuilder& sideEffects();
+
+        operator PassID() const { return pass; }
+    };
+
+protected:
+    // A use of an image by a pass
+    struct Use {
+        ResourceID resource;
+        Access access;
+        // Clear value (only valid for attachment writes)
+        std::optional<vk::ClearValue> clear;
+
+        bool writes() const { return access == Access::ColorAttachment || access == Access::DepthAttachment || access == Access::StorageWrite; }
+        bool attachment() const { return access == Access::ColorAttachment || access == Access::DepthAttachment || access == Access::InputAttachment; }
+    };
+
+    struct Pass {
+        str name;
+        // True if the pass draws (and thus needs to be in a render pass)
+        bool graphics;
+        bool sideEffects = false;
+        RecordFunction record;
+        std::vector<Use> uses;
+
+        // Filled in by compile
+        bool alive = false;
+        uint32_t step = 0, subpass = 0;
+    };
+
+    struct Resource {
+        str name;
+        ImageDesc desc;
+        bool imported = false;
+        // Layout imported images are left in at the end of the graph
+        vk::ImageLayout finalLayout = vk::ImageLayout::undefined;
+        // Per variant (swapchain image) handles of imported images
+        std::vector<std::pair<vk::Image, vk::ImageView>> importedHandles;
+
+        // Filled in by compile
+        vk::Extent2D extent;
+        vk::ImageUsageFlags usage;
+        // The first and last step which uses the image
+        uint32_t firstUse = UINT32_MAX, lastUse = 0;
+        vk::Image image = {};
+        vk::ImageView view = {};
+        // Memory block the image is bound to and the size it requires
+        uint32_t block = UINT32_MAX;
+        vk::DeviceSize memorySize = 0;
+    };
+
+    // A layout transition/memory dependency between two steps
+    struct Barrier {
+        ResourceID resource;
+        vk::ImageLayout oldLayout, newLayout;
+        vk::AccessFlags srcAccess, dstAccess;
+        vk::PipelineStageFlags srcStage, dstStage;
+    };
+
+    // A unit of execution: either a render pass containing one or more graphics passes, or a single non-graphics pass
+    struct Step {
+        std::vector<PassID> passes;
+        std::vector<Barrier> barriers;
+
+        // Render pass data (only valid for graphics steps)
+        vpp::RenderPass renderPass;
+        std::vector<ResourceID> attachments;
+        // Layout each attachment is in when the render pass begins and ends
+        std::vector<std::pair<vk::ImageLayout, vk::ImageLayout>> attachmentLayouts;
+        std::vector<vk::ClearValue> clearValues;
+        vk::Extent2D extent;
+        // Framebuffers for each variant of the imported images (a single framebuffer if the step uses no imports)
+        std::vector<vpp::Framebuffer> framebuffers;
+
+        bool graphics() const { return (bool) renderPass.vkHandle(); }
+    };
+
+    // Block of memory which transient images are aliased into
+    struct MemoryBlock {
+        vk::DeviceSize size = 0;
+        uint32_t typeBits = ~0u;
+        // The last step which uses the memory
+        uint32_t freeAfter = 0;
+        // The number of images aliased into the block
+        uint32_t users = 0;
+        vk::DeviceMemory memory = {};
+    };
+
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    std::vector<Step> steps;
+    std::vector<MemoryBlock> blocks;
+    // Barriers which transition imported images into their final layout
+    std::vector<Barrier> finalBarriers;
+
+    const vpp::Device* device = nullptr;
+    vk::Extent2D targetExtent;
+    bool compiled = false;
+
+public:
+    RenderGraph() = default;
+    ~RenderGraph() { reset(); }
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    /// Creates an image whose memory is managed by (and may be aliased within) the graph
+    ResourceID createImage(str name, ImageDesc desc);
+    /// Imports an image which is created outside the graph (such as the swapchain's images).
+    ///     The image is left in the specified layout once the graph finishes.
+    ///     The handles to use are bound with <bindImport>
+    ResourceID importImage(str name, ImageDesc desc, vk::ImageLayout finalLayout);
+    /// Binds the handles of an imported image, one pair for each variant (ex. swapchain image)
+    ///     Framebuffers are rebuilt the next time the graph is compiled
+    void bindImport(ResourceID, std::vector<std::pair<vk::Image, vk::ImageView>> handles);
+
+    /// Adds a pass to the graph, passes must be added in the order they should execute in
+    PassBuilder addPass(str name, RecordFunction record, bool graphics = true);
+
+    /// Compiles the graph, creating all of the vulkan objects it needs
+    ///     Must be recompiled when the target extent changes
+    void compile(const vpp::Device&, vk::Extent2D targetExtent);
+    /// Records the graph into the provided command buffer using the specified variant of the imported images
+    void execute(vpp::CommandBuffer&, uint32_t variant = 0) const;
+    /// Destroys all of the objects created while compiling
+    void reset();
+
+    /// Returns the render pass the specified pass is executed in (and the subpass index of the pass)
+    ///     Used when creating the pipelines a pass uses
+    std::pair<vk::RenderPass, uint32_t> renderPass(PassID) const;
+    /// Returns the view of an image for the current variant (valid after compilation)
+    vk::ImageView view(ResourceID, uint32_t variant = 0) const;
+    /// Returns the extent of an image (valid after compilation)
+    vk::Extent2D extent(ResourceID id) const { return resources.at(id).extent; }
+    /// Returns true if the pass survived culling
+    bool alive(PassID id) const { return passes.at(id).alive; }
+    /// Returns true if the graph has been compiled
+    bool isCompiled() const { return compiled; }
+
+    /// Returns the number of bytes of device memory backing the graph's images, and how many
+    ///     bytes would have been needed without aliasing
+    std::pair<vk::DeviceSize, vk::DeviceSize> memoryUsage() const;
+    /// Returns the number of barriers recorded each time the graph is executed
+    size_t barrierCount() const;
+
+protected:
+    void cullPasses();
+    void buildSteps();
+    void createImages();
+    void buildBarriers();
+    void createRenderPasses();
+
+    /// Returns the handle of the image for the specified variant
+    vk::Image image(ResourceID, uint32_t variant) const;
+};
@@ -0,0 +1,47 @@
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+/// Reinterprets a float as the bits of the key
+static uint32_t floatBits(float value){
+    uint32_t out;
+    std::memcpy(&out, &value, sizeof(out));
+    return out;
+}
+
+/// Returns a sampler matching the create info, creating it if one doesn't exist yet.
+vk::Sampler SamplerCache::get(vk::SamplerCreateInfo info){
+    // Anisotropy can only be requested if the feature was enabled
+    if(!device.samplerAnisotropy || info.maxAnisotropy <= 1){
+        info.anisotropyEnable = false;
+        info.maxAnisotropy = 1;
+    } else info.maxAnisotropy = std::min(info.maxAnisotropy, device.properties().limits.maxSamplerAnisotropy);
+    if(!info.compareEnable) info.compareOp = vk::CompareOp::never;
+
+    // Chained structures (ex reductions or YCbCr conversions) aren't part of the key
+    if(info.pNext) throw std::invalid_argument("Samplers with extension structures can't be cached.");
+
+    Key key = {(uint32_t) info.flags, (uint32_t) info.magFilter, (uint32_t) info.minFilter, (uint32_t) info.mipmapMode,
+        (uint32_t) info.addressModeU, (uint32_t) info.addressModeV, (uint32_t) info.addressModeW, floatBits(info.mipLodBias),
+        (uint32_t) info.anisotropyEnable, floatBits(info.maxAnisotropy), (uint32_t) info.compareEnable, (uint32_t) info.compareOp,
+        floatBits(info.minLod), floatBits(info.maxLod), (uint32_t) info.borderColor, (uint32_t) info.unnormalizedCoordinates};
+
+    std::scoped_lock lock(mutex);
+    auto found = samplers.find(key);
+    if(found == samplers.end()) found = samplers.emplace(key, vpp::Sampler{device, info}).first;
+    return found->second.vkHandle();
+}
+
+/// Returns a sampler with the same filter in every direction, the same address mode on every axis,
+///     and linear mip filtering (anisotropic if <maxAnisotropy> is greater than 1)
+vk::Sampler SamplerCache::get(vk::Filter filter, vk::SamplerAddressMode addressMode, float maxAnisotropy, float maxLod){
+    vk::SamplerCreateInfo info;
+    info.magFilter = info.minFilter = filter;
+    info.mipmapMode = (filter == vk::Filter::nearest ? vk::SamplerMipmapMode::nearest : vk::SamplerMipmapMode::linear);
+    info.addressModeU = info.addressModeV = info.addressModeW = addressMode;
+    info.anisotropyEnable = maxAnisotropy > 1;
+    info.maxAnisotropy = maxAnisotropy;
+    info.maxLod = maxLod;
+    return get(info);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <array>
+#include <map>
+#include <mutex>
+
+/// Cache which deduplicates samplers (devices only guarantee a few thousand samplers can exist at once.)
+///     Samplers are kept alive until the cache is destroyed, so the returned handles can be stored freely
+class SamplerCache {
+protected:
+    // The fields of a SamplerCreateInfo which make samplers unique
+    using Key = std::array<uint32_t, 16>;
+
+    const VulkDevice& device;
+    std::map<Key, vpp::Sampler> samplers;
+    // Protects the samplers (textures may be created on several threads)
+    std::mutex mutex;
+
+public:
+    SamplerCache(const VulkDevice& device) : device(device) {}
+    SamplerCache(const SamplerCache&) = delete;
+    SamplerCache& operator=(const SamplerCache&) = delete;
+
+    /// Returns a sampler matching the create info, creating it if one doesn't exist yet.
+    ///     Anisotropy is disabled if the device doesn't support it, and clamped to the device's limit if it does
+    vk::Sampler get(vk::SamplerCreateInfo info);
+    /// Returns a sampler with the same filter in every direction, the same address mode on every axis,
+    ///     and linear mip filtering (anisotropic if <maxAnisotropy> is greater than 1)
+    vk::Sampler get(vk::Filter filter = vk::Filter::linear, vk::SamplerAddressMode addressMode = vk::SamplerAddressMode::repeat, float maxAnisotropy = 1, float maxLod = VK_LOD_CLAMP_NONE);
+
+    /// Returns the number of unique samplers which have been created
+    size_t size() const { return samplers.size(); }
+};
@@ -1,8 +1,10 @@
 #include "shader.hpp"
 #include "common.hpp"
+#include "engine/util/profiler.hpp"
 
 #include <glslang/Public/ShaderLang.h>
 #include <glslang/SPIRV/GlslangToSpv.h>
+#include <spirv-tools/optimizer.hpp>
 #include "engine/vendor/glslang/DirStackFileIncluder.h"
 
 /// Loads the specified SPIR-V file and converts it into a shader module
@@ -101,6 +103,42 @@ void SPIRVShaderModule::saveHeader(str fileName) const {
 * GLSLShaderModule
 ---------------------*/
 
+// Default the optimization passes to the ones selected for this build
+GLSLShaderModule::Optimization GLSLShaderModule::optimization = (GLSLShaderModule::Optimization) SHADER_OPTIMIZATION;
+
+/// Runs the specified set of optimization passes over the provided SPIR-V
+///     Returns the original SPIR-V if optimization fails
+std::vector<uint32_t> GLSLShaderModule::optimize(const std::vector<uint32_t>& spirV, Optimization level){
+    if(level == Optimization::None) return spirV;
+    PROFILE_SCOPE("shader optimize");
+
+    spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_2);
+    // Forward any messages from the optimizer to our logger
+    optimizer.SetMessageConsumer([](spv_message_level_t severity, const char*, const spv_position_t& position, const char* message){
+        switch(severity){
+        case SPV_MSG_FATAL:
+        case SPV_MSG_INTERNAL_ERROR:
+        case SPV_MSG_ERROR: dlg_error("SPIR-V optimizer (word " + str(position.index) + "): " + str(message)); break;
+        case SPV_MSG_WARNING: dlg_warn("SPIR-V optimizer (word " + str(position.index) + "): " + str(message)); break;
+        default: dlg_debug("SPIR-V optimizer: " + str(message));
+        }
+    });
+
+    // Performance passes include inlining, dead code elimination and constant folding
+    if(level == Optimization::Performance) optimizer.RegisterPerformancePasses();
+    else optimizer.RegisterSizePasses();
+
+    std::vector<uint32_t> optimized;
+    if(!optimizer.Run(spirV.data(), spirV.size(), &optimized)){
+        dlg_error("SPIR-V optimization failed, using the unoptimized shader");
+        return spirV;
+    }
+
+    dlg_info("SPIR-V " + str(level == Optimization::Performance ? "performance" : "size") + " optimization: "
+        + str(spirV.size() * sizeof(uint32_t)) + " bytes -> " + str(optimized.size() * sizeof(uint32_t)) + " bytes");
+    return optimized;
+}
+
 // Compiles the specified GLSL into a SPIR-V based shader module
 ///     Saves the resulting binary array if the debugging mode is turned on
 GLSLShaderModule::GLSLShaderModule(const vpp::Device& dev, str sourceCode, vk::ShaderStageBits _stage, str _entryPoint)
@@ -116,10 +154,24 @@ GLSLShaderModule::GLSLShaderModule(const vpp::Device& dev, std::istream& sourceF
     compileShaderModule(dev, sourceCode, entryPoint);
 }
 
+// Compiles the specified GLSL with the provided defines injected before preprocessing
+///     Saves the resulting binary array if the debugging mode is turned on
+GLSLShaderModule::GLSLShaderModule(const vpp::Device& dev, str sourceCode, vk::ShaderStageBits _stage, const std::vector<str>& defines, str _entryPoint)
+  : stage(_stage), entryPoint(_entryPoint) {
+    // Convert the defines into a preamble (glslang places it after the #version directive)
+    str preamble;
+    for(const str& define: defines)
+        preamble += "#define " + define + "\n";
+
+    compileShaderModule(dev, sourceCode, entryPoint, preamble);
+}
+
 // Compiles the provided GLSL source code into a SPIR-V based vulkan shader module
 //  Saves the resulting binary array if the debugging mode is turned on
+//  Any provided preamble is injected into the source before it is preprocessed
 //  NOTE: Slightly modified from: https://forestsharp.com/glslang-cpp/
-void GLSLShaderModule::compileShaderModule(const vpp::Device& device, str sourceCode, str entryPoint){
+void GLSLShaderModule::compileShaderModule(const vpp::Device& device, str sourceCode, str entryPoint, str preamble){
+    PROFILE_SCOPE("shader compile");
     dlg_warn("Be sure to compile this shader to a SPIR-V binary before release! (This function should not be used in release builds!)");
 
     // TODO: Look at what all is in this monolithic beast
@@ -243,6 +295,7 @@ void GLSLShaderModule::compileShaderModule(const vpp::Device& device, str source
     glslang::TShader shader(stage);
     const char* sourceCString = sourceCode;
     shader.setStrings(&sourceCString, 1);
+    if(!preamble.empty()) shader.setPreamble(preamble.c_str());
     shader.setEnvInput(glslang::EShSource::EShSourceGlsl, stage, glslang::EShClient::EShClientVulkan, glslang::EShTargetVulkan_1_2);
     shader.setEnvClient(glslang::EShClient::EShClientVulkan, glslang::EShTargetClientVersion::EShTargetVulkan_1_2);
     shader.setEnvTarget(glslang::EShTargetLanguage::EShTargetSpv, glslang::EShTargetLanguageVersion::EShTargetSpv_1_5);
@@ -260,6 +313,8 @@ void GLSLShaderModule::compileShaderModule(const vpp::Device& device, str source
     }
     const char* preprocessedCString = preprocessedCode.c_str();
     shader.setStrings(&preprocessedCString, 1);
+    // The preamble has already been expanded into the preprocessed code
+    shader.setPreamble("");
 
     // Parse the shader
     if(!shader.parse(&DefaultTBuiltInResource, 100, false, messages)){
@@ -288,6 +343,8 @@ void GLSLShaderModule::compileShaderModule(const vpp::Device& device, str source
     std::vector<uint32_t> spirV;
 #endif // #if (DEBUG_SHADER_CODE == 1)
     glslang::GlslangToSpv(*program.getIntermediate(stage), spirV);
+    // Run the optimization passes selected for this build
+    if(optimization != Optimization::None) spirV = optimize(spirV, optimization);
 
     // Shrink the debug reflection object so that it is taking up as little space as possible.
 #if (DEBUG_SHADER_CODE == 1)
@@ -3,6 +3,12 @@
 // Disable this define or redefine this to 0 to remove extra code for saving shader binaries
 #define DEBUG_SHADER_CODE 1
 
+// Defines which SPIR-V optimization passes are run on shaders compiled from GLSL
+//  0 = none, 1 = performance, 2 = size (meson picks this based on the build type)
+#ifndef SHADER_OPTIMIZATION
+#define SHADER_OPTIMIZATION 1
+#endif
+
 #include "common.hpp"
 
 namespace vpp{
@@ -38,6 +44,12 @@ public:
 };
 
 class GLSLShaderModule: public SPIRVShaderModule {
+public:
+    // Sets of SPIR-V optimization passes which can be run after compilation
+    enum class Optimization { None = 0, Performance = 1, Size = 2 };
+    /// The passes run on every newly compiled shader (defaults to SHADER_OPTIMIZATION)
+    static Optimization optimization;
+
 private:
     vk::ShaderStageBits stage;
     str entryPoint;
@@ -48,9 +60,16 @@ public:
     GLSLShaderModule(const vpp::Device& dev, str sourceCode, vk::ShaderStageBits _stage, str entryPoint = u8"main");
     GLSLShaderModule(const vpp::Device& dev, std::istream& sourceFile, vk::ShaderStageBits _stage, str entryPoint = u8"main");
     GLSLShaderModule(const vpp::Device& dev, std::istream&& sourceFile, vk::ShaderStageBits _stage, str entryPoint = u8"main") : GLSLShaderModule(dev, sourceFile, _stage, entryPoint) {}
+    /// Compiles the provided source with each of the provided defines (in the form "NAME" or "NAME VALUE")
+    ///     injected before the source is preprocessed
+    GLSLShaderModule(const vpp::Device& dev, str sourceCode, vk::ShaderStageBits _stage, const std::vector<str>& defines, str entryPoint = u8"main");
 
     vpp::ShaderProgram::StageInfo createStageInfo() const { return SPIRVShaderModule::createStageInfo(stage, entryPoint); }
 
+    /// Runs the specified set of optimization passes over the provided SPIR-V
+    ///     Returns the original SPIR-V if optimization fails
+    static std::vector<uint32_t> optimize(const std::vector<uint32_t>& spirV, Optimization level = optimization);
+
 protected:
-    void compileShaderModule(const vpp::Device& device, str sourceCode, str entryPoint = "main");
+    void compileShaderModule(const vpp::Device& device, str sourceCode, str entryPoint = "main", str preamble = "");
 };
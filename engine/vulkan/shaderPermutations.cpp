@@ -0,0 +1,57 @@
+#include "shaderPermutations.hpp"
+
+// Initialize the global statistics
+GLSLShaderPermutations::Stats GLSLShaderPermutations::globalStats = {};
+
+/// Declares a source and the set of keywords which can be toggled on it
+GLSLShaderPermutations::GLSLShaderPermutations(const vpp::Device& dev, str _sourceCode, vk::ShaderStageBits _stage, std::vector<str> _keywords, str _entryPoint)
+  : device(dev), sourceCode(_sourceCode), stage(_stage), entryPoint(_entryPoint), keywords(std::move(_keywords)) {
+    // Each keyword needs its own bit in the mask
+    if(keywords.size() > sizeof(Mask) * 8)
+        throw std::out_of_range("A shader can't declare more than " + str(sizeof(Mask) * 8) + " keywords (" + str(keywords.size()) + " provided).");
+}
+
+/// Returns the bit representing the specified keyword
+///     Throws a std::out_of_range if the keyword wasn't declared
+GLSLShaderPermutations::Mask GLSLShaderPermutations::keyword(const str& name) const {
+    for(size_t i = 0; i < keywords.size(); i++)
+        if(keywords[i] == name)
+            return Mask(1) << i;
+
+    throw std::out_of_range("Shader keyword '" + name + "' was never declared.");
+}
+
+/// Returns the mask with all of the specified keywords enabled
+GLSLShaderPermutations::Mask GLSLShaderPermutations::mask(const std::vector<str>& names) const {
+    Mask out = 0;
+    for(const str& name: names)
+        out |= keyword(name);
+    return out;
+}
+
+/// Returns the variant with the keywords in the provided mask defined, compiling it if necessary
+const GLSLShaderModule& GLSLShaderPermutations::variant(Mask mask){
+    // Make sure the mask doesn't reference any undeclared keywords
+    if(keywords.size() < sizeof(Mask) * 8 && (mask >> keywords.size()))
+        throw std::out_of_range("Shader variant mask " + str::base(mask, 16) + " references undeclared keywords.");
+
+    // If the variant has already been compiled, reuse it
+    if(auto found = variants.find(mask); found != variants.end()){
+        stats.reused++;
+        globalStats.reused++;
+        return *found->second;
+    }
+
+    // Otherwise define every enabled keyword...
+    std::vector<str> defines;
+    for(size_t i = 0; i < keywords.size(); i++)
+        if(mask & (Mask(1) << i))
+            defines.push_back(keywords[i] + " 1");
+
+    // ... and compile the variant
+    dlg_debug("Compiling shader variant " + str::base(mask, 16) + " (" + str(variants.size() + 1) + " variants compiled for this source)");
+    auto [it, success] = variants.emplace(mask, std::make_unique<GLSLShaderModule>(device, sourceCode, stage, defines, entryPoint));
+    stats.compiled++;
+    globalStats.compiled++;
+    return *it->second;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "shader.hpp"
+
+#include <unordered_map>
+#include <memory>
+
+/// Class which manages the variants of a single GLSL source.
+///     Each keyword declared on the source is assigned a bit in a variant mask. When a
+///     variant is requested every keyword whose bit is set is #defined (as 1) before the
+///     source is preprocessed. Variants are compiled the first time they are requested
+///     and reused from then on.
+class GLSLShaderPermutations {
+public:
+    // Bitmask identifying a variant (bit n corresponds to keywords[n])
+    using Mask = uint64_t;
+
+    // Struct tracking how many variants had to be compiled vs how many requests were
+    //  satisfied by an already compiled variant
+    struct Stats {
+        uint64_t compiled = 0;
+        uint64_t reused = 0;
+
+        /// Returns the total number of variant requests
+        uint64_t requests() const { return compiled + reused; }
+    };
+
+protected:
+    // Device the variants are compiled for
+    const vpp::Device& device;
+    // Source all of the variants are generated from
+    str sourceCode;
+    vk::ShaderStageBits stage;
+    str entryPoint;
+    // Keywords which can be toggled on the source
+    std::vector<str> keywords;
+
+    // Memoized variants (stored as pointers so references handed out remain valid)
+    std::unordered_map<Mask, std::unique_ptr<GLSLShaderModule>> variants;
+    // Statistics for this source
+    Stats stats;
+    // Statistics accumulated across all sources
+    static Stats globalStats;
+
+public:
+    /// Declares a source and the set of keywords which can be toggled on it
+    GLSLShaderPermutations(const vpp::Device& dev, str sourceCode, vk::ShaderStageBits stage, std::vector<str> keywords, str entryPoint = u8"main");
+    GLSLShaderPermutations(const vpp::Device& dev, std::istream& sourceFile, vk::ShaderStageBits stage, std::vector<str> keywords, str entryPoint = u8"main")
+        : GLSLShaderPermutations(dev, str::stream(sourceFile), stage, std::move(keywords), entryPoint) {}
+    GLSLShaderPermutations(const vpp::Device& dev, std::istream&& sourceFile, vk::ShaderStageBits stage, std::vector<str> keywords, str entryPoint = u8"main")
+        : GLSLShaderPermutations(dev, sourceFile, stage, std::move(keywords), entryPoint) {}
+
+    /// Returns the bit representing the specified keyword
+    ///     Throws a std::out_of_range if the keyword wasn't declared
+    Mask keyword(const str& name) const;
+    /// Returns the mask with all of the specified keywords enabled
+    Mask mask(const std::vector<str>& names) const;
+
+    /// Returns the variant with the keywords in the provided mask defined, compiling it if necessary
+    const GLSLShaderModule& variant(Mask mask);
+    const GLSLShaderModule& variant(const std::vector<str>& names) { return variant(mask(names)); }
+    /// Returns the stage info of the specified variant, compiling it if necessary
+    vpp::ShaderProgram::StageInfo createStageInfo(Mask mask) { return variant(mask).createStageInfo(); }
+    vpp::ShaderProgram::StageInfo createStageInfo(const std::vector<str>& names) { return variant(names).createStageInfo(); }
+
+    /// Returns true if the specified variant has already been compiled
+    bool compiled(Mask mask) const { return variants.find(mask) != variants.end(); }
+    /// Returns the number of variants which are currently compiled
+    size_t variantCount() const { return variants.size(); }
+    /// Returns the declared keywords
+    const std::vector<str>& getKeywords() const { return keywords; }
+
+    /// Releases all of the compiled variants
+    ///     Any references to the variants are invalidated
+    void clear() { variants.clear(); }
+
+    /// Returns the compiled/reused statistics of this source
+    const Stats& getStats() const { return stats; }
+    /// Returns the compiled/reused statistics of every source
+    static const Stats& getGlobalStats() { return globalStats; }
+};
@@ -0,0 +1,63 @@
+#include "staging.hpp"
+
+/// Creates a ring with the specified capacity (in bytes) on the device
+StagingRing::StagingRing(const vpp::Device& device, vk::DeviceSize capacity) : _capacity(capacity) {
+    buffer = {device.bufferAllocator(), capacity, vk::BufferUsageBits::transferSrc, vk::MemoryPropertyBits::hostVisible | vk::MemoryPropertyBits::hostCoherent};
+    // The memory stays mapped for the lifetime of the ring
+    map = buffer.memoryMap();
+}
+
+/// Sub-allocates a region of the ring, returns an empty optional if there isn't enough free space
+///     (space is freed by calling <reclaim>.) Sizes larger than the <capacity> can never succeed
+std::optional<StagingRing::Allocation> StagingRing::allocate(vk::DeviceSize size, vk::DeviceSize alignment){
+    if(size == 0 || size > _capacity) return {};
+    if(alignment == 0) alignment = 1;
+    // Start from the beginning whenever nothing is in use
+    if(empty()) head = tail = 0;
+
+    // Alignment is relative to the start of the vulkan buffer (not the ring)
+    vk::DeviceSize base = buffer.offset();
+    auto align = [&](vk::DeviceSize offset){ return (base + offset + alignment - 1) / alignment * alignment - base; };
+
+    vk::DeviceSize offset = align(head);
+    // Free space is [head, end) and [0, tail)
+    if(head > tail || empty()){
+        if(offset + size > _capacity){
+            // Skip the space left at the end and wrap around to the front
+            offset = align(0);
+            if(offset + size > tail) return {};
+            wraps++;
+        }
+    // Free space is [head, tail) (the ring is full if they are equal)
+    } else if(head == tail || offset + size > tail)
+        return {};
+
+    head = offset + size;
+    pending = true;
+    allocations++;
+    return Allocation{buffer.buffer(), base + offset, size, map.ptr() + offset};
+}
+
+/// Marks every allocation made since the last call as in use until <value> completes.
+///     Values must increase with each call
+void StagingRing::retire(uint64_t value){
+    if(!pending) return;
+    retired.push_back({value, head});
+    pending = false;
+}
+
+/// Frees every region retired with a value less than or equal to <completed>
+void StagingRing::reclaim(uint64_t completed){
+    while(!retired.empty() && retired.front().value <= completed){
+        tail = retired.front().end;
+        retired.pop_front();
+    }
+    if(empty()) head = tail = 0;
+}
+
+/// Returns the number of bytes in use (including any padding skipped when wrapping)
+vk::DeviceSize StagingRing::used() const {
+    if(empty()) return 0;
+    if(head > tail) return head - tail;
+    return _capacity - tail + head;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <deque>
+#include <optional>
+
+/// Persistently mapped ring buffer which staging data is sub-allocated from.
+///     Allocations are handed out in order from the head of the ring, once the copies reading
+///     them have been submitted they are <retire>d with a value (ex. a timeline semaphore value)
+///     and are given back to the ring once <reclaim> is told that value has completed.
+class StagingRing {
+public:
+    // A region of the ring which data can be written to
+    struct Allocation {
+        vk::Buffer buffer;
+        // Offset of the region within <buffer> (to be used as the copy's source offset)
+        vk::DeviceSize offset, size;
+        // Mapped pointer to the start of the region
+        std::byte* data;
+    };
+
+protected:
+    // A range of the ring which is in use until <value> completes
+    struct Region {
+        uint64_t value;
+        vk::DeviceSize end;
+    };
+
+    vpp::SubBuffer buffer;
+    vpp::MemoryMapView map;
+    vk::DeviceSize _capacity;
+
+    // Allocations are made at the head and freed from the tail
+    vk::DeviceSize head = 0, tail = 0;
+    // True if anything has been allocated since the last call to <retire>
+    bool pending = false;
+    // Ranges which have been retired but haven't completed yet (oldest first)
+    std::deque<Region> retired;
+
+    // Statistics
+    uint64_t allocations = 0, wraps = 0;
+
+public:
+    /// Creates a ring with the specified capacity (in bytes) on the device
+    StagingRing(const vpp::Device& device, vk::DeviceSize capacity = 64 * 1024 * 1024);
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    /// Sub-allocates a region of the ring, returns an empty optional if there isn't enough free space
+    ///     (space is freed by calling <reclaim>.) Sizes larger than the <capacity> can never succeed
+    std::optional<Allocation> allocate(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+    /// Marks every allocation made since the last call as in use until <value> completes.
+    ///     Values must increase with each call
+    void retire(uint64_t value);
+    /// Frees every region retired with a value less than or equal to <completed>
+    void reclaim(uint64_t completed);
+
+    /// Returns the value of the oldest retired region (0 if there are none)
+    uint64_t oldestValue() const { return retired.empty() ? 0 : retired.front().value; }
+    /// Returns true if nothing has been allocated since the last call to <retire>
+    bool allRetired() const { return !pending; }
+    /// Returns true if nothing in the ring is in use
+    bool empty() const { return !pending && retired.empty(); }
+
+    /// Returns the size of the ring in bytes
+    vk::DeviceSize capacity() const { return _capacity; }
+    /// Returns the number of bytes in use (including any padding skipped when wrapping)
+    vk::DeviceSize used() const;
+    /// Returns the number of allocations made and the number of times the ring has wrapped
+    std::pair<uint64_t, uint64_t> stats() const { return {allocations, wraps}; }
+};
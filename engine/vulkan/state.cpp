@@ -1,5 +1,8 @@
 #include "state.hpp"
+#include "engine/util/profiler.hpp"
 #include <map>
+#include <algorithm>
+#include <optional>
 
 // Initialize the id list
 uint16_t VulkanState::nextID = 0;
@@ -12,6 +15,41 @@ void VulkanState::bindCustomCommandRecordingSteps(std::function<void (vpp::Comma
 };
 
 
+/// Creates the timeline semaphore (if the device supports them)
+void VulkanState::createTimeline(){
+    if(!device().timelineSemaphores) return;
+
+    vk::SemaphoreTypeCreateInfo typeInfo {vk::SemaphoreType::timeline, /*initialValue*/ submittedValue()};
+    vk::SemaphoreCreateInfo info;
+    info.pNext = &typeInfo;
+    timeline = {device(), info};
+}
+
+/// Makes every submission of this state wait (at <stage>) for the other state's submission <lag> submissions
+///     before its latest one. Requires timeline semaphores
+void VulkanState::addDependency(const VulkanState& other, vk::PipelineStageFlags stage, uint64_t lag){
+    if(&other.device() != &device()) throw std::invalid_argument("State " + str(id()) + ": Can only depend on states using the same device.");
+    if(!other.timelineSemaphore()) throw std::runtime_error("State " + str(id()) + ": Can't depend on state " + str(other.id()) + " without timeline semaphores.");
+    dependencies.push_back({&other, stage, lag});
+}
+
+/// Adds the waits for the dependencies (and their timeline values) to a submission
+///     Returns true if any waits were added
+bool VulkanState::addDependencyWaits(std::vector<vk::Semaphore>& semaphores, std::vector<vk::PipelineStageFlags>& stages, std::vector<uint64_t>& values) const {
+    bool added = false;
+    for(const TimelineDependency& dependency: dependencies){
+        // Nothing to wait for if the other state hasn't submitted enough yet
+        uint64_t submitted = dependency.state->submittedValue();
+        if(submitted <= dependency.lag) continue;
+
+        semaphores.push_back(dependency.state->timelineSemaphore());
+        stages.push_back(dependency.stage);
+        values.push_back(submitted - dependency.lag);
+        added = true;
+    }
+    return added;
+}
+
 /// Gets the width and height of the swapchain.
 ///     Requires <surface> already be set
 ///     If pd is omitted uses the one bound to the <swapchain>
@@ -74,16 +112,13 @@ vk::PresentModeKHR GraphicsState::swapchainPresentMode(vk::PhysicalDevice pd, bo
     if(!pd) pd = swapchain.vkPhysicalDevice();
     std::vector<vk::PresentModeKHR> modes = vk::getPhysicalDeviceSurfacePresentModesKHR(pd, surface.vkHandle());
 
-    // Default
+    // Default (always supported)
     vk::PresentModeKHR chosenMode = vk::PresentModeKHR::fifo;
 
-    // Choose the present mode we want if available
-    for(vk::PresentModeKHR& mode: modes)
-        // Mailbox will overwrite images in the presentation queue if we render too fast
-        if(mode == vk::PresentModeKHR::mailbox){
-            chosenMode = mode;
-            break;
-        }
+    // Choose the most preferred present mode which is available
+    //  (by default mailbox, which will overwrite images in the presentation queue if we render too fast)
+    auto preferred = std::find_first_of(presentModePreference.begin(), presentModePreference.end(), modes.begin(), modes.end());
+    if(preferred != presentModePreference.end()) chosenMode = *preferred;
 
     // Update cache
     cache[surface] = chosenMode;
@@ -139,6 +174,7 @@ vk::SwapchainCreateInfoKHR GraphicsState::swapchainProperties(const vk::Physical
 // Recreates the swapchain
 //  If a valid deviceInfo is passed in, the swapchain will be recreated with the new physical device
 //  If a special version of deviceInfo passed in from the constructor is found, it will let vpp pick a physical device
+//  If a shared device is passed in, the swapchain will be created on it
 //  If neither of these is the case, it will resize the swapchain to be the same size as the GLFW framebuffer
 //  Automatically recreates the render buffers when the swapchain is resized
 void GraphicsState::recreateSwapchain(DeviceCreateInfo deviceInfo, vk::Extent2D newSize){
@@ -148,60 +184,251 @@ void GraphicsState::recreateSwapchain(DeviceCreateInfo deviceInfo, vk::Extent2D
         _device = std::make_unique<VulkDevice>(surface.vkInstance(), deviceInfo.device, deviceInfo.info);
         swapchain = vpp::Swapchain(device(), swapchainProperties(device().vkPhysicalDevice(), surface.vkHandle()));
 
+    // We have been given a device which another state is already using
+    } else if(deviceInfo.valid == DeviceCreateInfo::SHARED){
+        dlg_info("State " + str(id()) + ": Creating swapchain on shared device " + str(deviceInfo.shared->id()));
+        // The device's queue must be able to present to our surface
+        if(!vk::getPhysicalDeviceSurfaceSupportKHR(deviceInfo.shared->vkPhysicalDevice(), deviceInfo.shared->presentQueueExcept()->family(), surface.vkHandle()))
+            throw vk::VulkanError(vk::Result::errorInitializationFailed, "State " + str(id()) + ": The shared device can't present to this state's surface.");
+        _device = deviceInfo.shared;
+        swapchain = vpp::Swapchain(device(), swapchainProperties(device().vkPhysicalDevice(), surface.vkHandle()));
+
     // We haven't been given a device, just pick the "best" one
     } else if(deviceInfo.valid == DeviceCreateInfo::NO_INITAL){
         dlg_info("State " + str(id()) + ": Creating swapchain, picking 'best' device.");
-        const vpp::Queue* present;
-        _device = std::make_unique<VulkDevice>(surface.vkInstance(), surface, present, std::vector<const char *>{VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME});
+        _device = createDevice(surface.vkInstance(), surface, {VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME});
         swapchain = vpp::Swapchain(device(), swapchainProperties(device().vkPhysicalDevice(), surface.vkHandle()));
 
     // We just need to resize the swapchain
     } else {
         dlg_info("State " + str(id()) + ": Resizing swapchain");
         vk::SwapchainCreateInfoKHR properties = swapchainProperties(device().vkPhysicalDevice(), surface.vkHandle(), swapchain.vkHandle());
-        swapchain.resize(newSize, properties);
+        // If the window manager lets us pick the size, use the requested one
+        if(newSize.width && newSize.height && vk::getPhysicalDeviceSurfaceCapabilitiesKHR(device().vkPhysicalDevice(), surface.vkHandle()).currentExtent.width == UINT32_MAX)
+            properties.imageExtent = newSize;
+
+        // Create the new swapchain from the old one, the old one lives until the frames presenting to it finish
+        vpp::Swapchain old = std::move(swapchain);
+        swapchain = {device(), properties};
+        retire(std::move(old));
 
         // Automatically recreate the render buffers
         recreateRenderBuffers();
     }
 }
 
+/// Sets the present modes to use in order of preference (the first one supported is used, falling back to fifo.)
+///     Recreates the swapchain (and rerecords the command buffers)
+void GraphicsState::setPresentModePreference(std::vector<vk::PresentModeKHR> modes){
+    presentModePreference = modes;
+    if(!swapchain.vkHandle()) return;
+
+    recreateSwapchain({}, swapchainExtent({}, true));
+    rerecordCommandBuffers();
+}
+
 /// Helper to create a simple graphics focused renderpass
+///     If depth is enabled a depth attachment is added (and a depth only subpass if there is a prepass)
+///     If shading is deferred the G-buffer attachments are added, along with a subpass writing them before the color subpass
 void GraphicsState::createGraphicsRenderPass(std::vector<vk::ImageLayout> _colorAttachments, std::vector<vk::ImageLayout> _inputAttachments){
-    vk::AttachmentDescription attachment {/*flags*/ {}, swapchainFormat().format, vk::SampleCountBits::e1, vk::AttachmentLoadOp::clear, vk::AttachmentStoreOp::store, vk::AttachmentLoadOp::dontCare, vk::AttachmentStoreOp::dontCare,
-        // Don't care what the pass looks like when we start, create a final pass suitable for screen presentation
-        vk::ImageLayout::undefined, vk::ImageLayout::presentSrcKHR};
+    if(!_inputAttachments.empty() && !hasDeferredShading())
+        throw std::invalid_argument("State " + str(id()) + ": Input attachments can only be read when deferred shading is enabled.");
+    if(_inputAttachments.size() > gBufferFormats.size())
+        throw std::invalid_argument("State " + str(id()) + ": More input attachment layouts provided than there are G-buffer attachments.");
+    // Remember the layouts so the render pass can be recreated when depth is toggled
+    renderPassColorLayouts = _colorAttachments;
+    renderPassInputLayouts = _inputAttachments;
+
+    std::vector<vk::AttachmentDescription> attachments;
+    attachments.push_back({/*flags*/ {}, swapchainFormat().format, vk::SampleCountBits::e1, vk::AttachmentLoadOp::clear, vk::AttachmentStoreOp::store, vk::AttachmentLoadOp::dontCare, vk::AttachmentStoreOp::dontCare,
+        // Don't care what the pass looks like when we start, create a final pass suitable for screen presentation (or readback)
+        vk::ImageLayout::undefined, targetFinalLayout});
 
     uint32_t i = 0;
     std::vector<vk::AttachmentReference> colorAttachments;
     for(vk::ImageLayout layout: _colorAttachments) colorAttachments.push_back({i++, layout});
-    std::vector<vk::AttachmentReference> inputAttachments;
-    for(vk::ImageLayout layout: _inputAttachments) inputAttachments.push_back({i++, layout});
 
-    vk::SubpassDescription subpass {/* flags */ {}, vk::PipelineBindPoint::graphics,
+    // The depth buffer is cleared every frame and its contents are discarded once the pass finishes
+    //  (unless the occlusion culler builds its pyramid from them)
+    vk::AttachmentReference depthAttachment {(uint32_t) attachments.size(), vk::ImageLayout::depthStencilAttachmentOptimal};
+    bool depth = depthFormat != vk::Format::undefined;
+    vk::AttachmentStoreOp depthStore = (occlusionCuller ? vk::AttachmentStoreOp::store : vk::AttachmentStoreOp::dontCare);
+    if(depth) attachments.push_back({/*flags*/ {}, depthFormat, vk::SampleCountBits::e1, vk::AttachmentLoadOp::clear, depthStore, vk::AttachmentLoadOp::clear, vk::AttachmentStoreOp::dontCare,
+        vk::ImageLayout::undefined, vk::ImageLayout::depthStencilAttachmentOptimal});
+
+    // The G-buffer is cleared, written by the G-buffer subpass, read by the color (lighting) subpass, and then discarded
+    //  (so it never needs to be written out to memory)
+    std::vector<vk::AttachmentReference> gBufferAttachments, inputAttachments;
+    for(uint32_t g = 0; g < gBufferFormats.size(); g++){
+        vk::ImageLayout inputLayout = (g < _inputAttachments.size() ? _inputAttachments[g] : vk::ImageLayout::shaderReadOnlyOptimal);
+        gBufferAttachments.push_back({(uint32_t) attachments.size(), vk::ImageLayout::colorAttachmentOptimal});
+        inputAttachments.push_back({(uint32_t) attachments.size(), inputLayout});
+        attachments.push_back({/*flags*/ {}, gBufferFormats[g], vk::SampleCountBits::e1, vk::AttachmentLoadOp::clear, vk::AttachmentStoreOp::dontCare, vk::AttachmentLoadOp::dontCare, vk::AttachmentStoreOp::dontCare,
+            vk::ImageLayout::undefined, inputLayout});
+    }
+    // The lighting subpass reads depth (to reconstruct positions) and can still test against it, so it is read only
+    vk::AttachmentReference depthInputAttachment {depthAttachment.attachment, vk::ImageLayout::depthStencilReadOnlyOptimal};
+    if(hasDeferredShading()) inputAttachments.push_back(depthInputAttachment);
+
+    std::vector<vk::SubpassDescription> subpasses;
+    std::vector<vk::SubpassDependency> dependencies;
+    // The prepass only writes depth
+    if(depth && depthPrepass){
+        subpasses.push_back({/* flags */ {}, vk::PipelineBindPoint::graphics,
+            /*inputAttachments*/ 0, nullptr, /*colorAttachments*/ 0, nullptr,
+            /*resolveAttachments*/ nullptr, &depthAttachment,
+            /*preserveAttachmentCount*/ 0, /*preserveAttachments*/ nullptr
+        });
+
+        // The main subpass tests against the depth written by the prepass
+        dependencies.push_back({/*src*/ 0, /*dst*/ 1,
+            vk::PipelineStageBits::earlyFragmentTests | vk::PipelineStageBits::lateFragmentTests, vk::PipelineStageBits::earlyFragmentTests | vk::PipelineStageBits::lateFragmentTests,
+            vk::AccessBits::depthStencilAttachmentWrite, vk::AccessBits::depthStencilAttachmentRead | vk::AccessBits::depthStencilAttachmentWrite, vk::DependencyBits::byRegion});
+    }
+    // The G-buffer subpass writes the G-buffer (and depth, unless the prepass already did)
+    if(hasDeferredShading()){
+        subpasses.push_back({/* flags */ {}, vk::PipelineBindPoint::graphics,
+            /*inputAttachments*/ 0, nullptr,
+            (uint32_t) gBufferAttachments.size(), gBufferAttachments.data(),
+            /*resolveAttachments*/ nullptr, &depthAttachment,
+            /*preserveAttachmentCount*/ 0, /*preserveAttachments*/ nullptr
+        });
+
+        // The lighting subpass reads the G-buffer (and depth) written by the G-buffer subpass at the same pixel
+        uint32_t gBuffer = subpasses.size() - 1;
+        dependencies.push_back({/*src*/ gBuffer, /*dst*/ gBuffer + 1,
+            vk::PipelineStageBits::colorAttachmentOutput | vk::PipelineStageBits::earlyFragmentTests | vk::PipelineStageBits::lateFragmentTests,
+            vk::PipelineStageBits::fragmentShader | vk::PipelineStageBits::earlyFragmentTests | vk::PipelineStageBits::lateFragmentTests,
+            vk::AccessBits::colorAttachmentWrite | vk::AccessBits::depthStencilAttachmentWrite,
+            vk::AccessBits::inputAttachmentRead | vk::AccessBits::depthStencilAttachmentRead, vk::DependencyBits::byRegion});
+        // Clearing the G-buffer must wait for the last frame using it to finish reading it
+        dependencies.push_back({VK_SUBPASS_EXTERNAL, /*dst*/ gBuffer,
+            vk::PipelineStageBits::fragmentShader, vk::PipelineStageBits::colorAttachmentOutput,
+            /*srcAccess*/ {}, vk::AccessBits::colorAttachmentWrite, /*flags*/ {}});
+    }
+    subpasses.push_back({/* flags */ {}, vk::PipelineBindPoint::graphics,
         (uint32_t) inputAttachments.size(), inputAttachments.data(),
         (uint32_t) colorAttachments.size(), colorAttachments.data(),
-        /*resolveAttachments*/ nullptr, /*DepthStencilAttachment*/ nullptr,
+        /*resolveAttachments*/ nullptr, /*DepthStencilAttachment*/ depth ? (hasDeferredShading() ? &depthInputAttachment : &depthAttachment) : nullptr,
         /*preserveAttachmentCount*/ 0, /*preserveAttachments*/ nullptr
-    };
+    });
+
+    // Clearing the depth buffer must wait for the last frame using it to finish testing against it
+    if(depth) dependencies.push_back({VK_SUBPASS_EXTERNAL, /*dst*/ 0,
+        vk::PipelineStageBits::earlyFragmentTests | vk::PipelineStageBits::lateFragmentTests, vk::PipelineStageBits::earlyFragmentTests | vk::PipelineStageBits::lateFragmentTests,
+        vk::AccessBits::depthStencilAttachmentWrite, vk::AccessBits::depthStencilAttachmentRead | vk::AccessBits::depthStencilAttachmentWrite, /*flags*/ {}});
 
     renderPass = {
         device(), {/*flags*/ {},
-        /* attachment*/ 1, &attachment,
-        /* subpass*/ 1, &subpass,
-        /* dependency */ 0, nullptr}
+        /* attachment*/ (uint32_t) attachments.size(), attachments.data(),
+        /* subpass*/ (uint32_t) subpasses.size(), subpasses.data(),
+        /* dependency */ (uint32_t) dependencies.size(), dependencies.data()}
     };
+    renderPassLayout = {swapchainFormat().format, depthFormat, (uint32_t) _colorAttachments.size(), gBufferFormats, depth && depthPrepass};
+}
+
+/// Enables (or disables) depth testing, creating a depth buffer for every render buffer.
+///     If <prepass> is set, the render pass begins with a subpass which only writes depth.
+///     Recreates the render pass and render buffers; materials must be recreated and command buffers rerecorded
+void GraphicsState::enableDepth(bool enable, bool prepass, bool requireStencil){
+    vk::Format format = vk::Format::undefined;
+    if(enable){
+        format = findDepthFormat(device().vkPhysicalDevice(), requireStencil);
+        if(format == vk::Format::undefined) throw std::runtime_error("State " + str(id()) + ": The device doesn't support any depth formats.");
+    }
+    if(format == depthFormat && (enable && prepass) == depthPrepass) return;
+
+    dlg_info("State " + str(id()) + ": " + (enable ? str("Enabling depth") + (prepass ? " with a prepass" : "") : str("Disabling depth")));
+    depthFormat = format;
+    depthPrepass = enable && prepass;
+    // Occlusion culling can't work without depth
+    if(!enable && occlusionCuller){
+        dlg_info("State " + str(id()) + ": Disabling occlusion culling along with depth");
+        occlusionCuller.reset();
+    }
+    // Neither can deferred shading
+    if(!enable && hasDeferredShading()){
+        dlg_info("State " + str(id()) + ": Disabling deferred shading along with depth");
+        gBufferFormats.clear();
+        renderPassInputLayouts.clear();
+    }
+
+    // Nothing needs to be rebuilt if the render pass hasn't been created yet
+    if(!renderPass.vkHandle()) return;
+    // Make sure nothing is still rendering with the old render pass (other states on the device can keep running)
+    waitForFrames();
+    createGraphicsRenderPass(renderPassColorLayouts, renderPassInputLayouts);
+    recreateRenderBuffers();
+}
+
+/// Enables (or disables) deferred shading. Requires depth to be enabled.
+///     Recreates the render pass and render buffers; materials must be recreated and command buffers rerecorded
+void GraphicsState::enableDeferredShading(bool enable, std::vector<vk::Format> formats){
+    if(!enable) formats.clear();
+    if(formats == gBufferFormats) return;
+    if(enable){
+        if(formats.empty()) throw std::invalid_argument("State " + str(id()) + ": Deferred shading requires at least one G-buffer attachment.");
+        if(depthFormat == vk::Format::undefined) throw std::runtime_error("State " + str(id()) + ": Deferred shading requires depth to be enabled.");
+        for(vk::Format format: formats){
+            vk::FormatProperties properties = vk::getPhysicalDeviceFormatProperties(device().vkPhysicalDevice(), format);
+            if(!(properties.optimalTilingFeatures & vk::FormatFeatureBits::colorAttachment))
+                throw std::runtime_error("State " + str(id()) + ": One of the G-buffer formats can't be rendered to.");
+        }
+    }
+
+    dlg_info("State " + str(id()) + ": " + (enable ? str("Enabling deferred shading with ") + str(formats.size()) + " G-buffer attachments" : str("Disabling deferred shading")));
+    gBufferFormats = formats;
+    // The old layouts were for the old G-buffer
+    renderPassInputLayouts.clear();
+
+    // Make sure nothing is still rendering with the old render pass (or reading the old G-buffer)
+    //  and free the old descriptors before their layout is replaced
+    if(renderPass.vkHandle()){
+        waitForFrames();
+        for(RenderBuffer& buffer: renderBuffers) buffer.gBufferDescriptors = {};
+    }
+
+    // The lighting subpass reads every G-buffer attachment, and then depth
+    gBufferLayout = {};
+    if(enable){
+        std::vector<vk::DescriptorSetLayoutBinding> bindings;
+        for(uint32_t b = 0; b <= gBufferFormats.size(); b++)
+            bindings.push_back({b, vk::DescriptorType::inputAttachment, 1, vk::ShaderStageBits::fragment, nullptr});
+        gBufferLayout = {device(), bindings};
+    }
+
+    // Nothing needs to be rebuilt if the render pass hasn't been created yet
+    if(!renderPass.vkHandle()) return;
+    createGraphicsRenderPass(renderPassColorLayouts, renderPassInputLayouts);
+    recreateRenderBuffers();
+}
+
+/// Returns the GLSL declaring the G-buffer's input attachments (as descriptor set <set>; gBuffer0, gBuffer1, ... and gBufferDepth)
+str GraphicsState::gBufferGLSL(uint32_t set) const {
+    str out;
+    uint32_t count = gBufferFormats.size();
+    for(uint32_t g = 0; g < count; g++)
+        out += "layout(input_attachment_index = " + str(g) + ", set = " + str(set) + ", binding = " + str(g) + ") uniform subpassInput gBuffer" + str(g) + ";\n";
+    if(count) out += "layout(input_attachment_index = " + str(count) + ", set = " + str(set) + ", binding = " + str(count) + ") uniform subpassInput gBufferDepth;\n";
+    return out;
 }
 
 /// Function which sets up all of the data stored in the <renderBuffers>
+///     (and the <frames> if the number of frames in flight changed)
 void GraphicsState::recreateRenderBuffers(){
-    // Wait for everything currently queued to finish rendering
-    device().waitIdle();
-    // Invalidate the recordings in our command pool
-    vk::resetCommandPool(device().vkDevice(), commandPool.vkHandle());
+    // Rather than waiting for the device to idle, the old buffers are destroyed once the frames using them finish
+    retire();
+
+    // Make sure there is the requested number of frames in flight
+    if(frames.size() != framesInFlight) recreateFrames();
+
+    // Transient attachments are placed in lazily allocated memory where the device has it
+    //  (on tile based GPUs it is never backed, as the attachments never leave tile memory)
+    unsigned int transientMemory = device().memoryTypeBits(vk::MemoryPropertyBits::lazilyAllocated);
+    if(!transientMemory) transientMemory = (unsigned int) vk::MemoryPropertyBits::deviceLocal;
 
     // Resize the list of buffers to match the list of images
-    std::vector<vk::Image> images = swapchain.images();
+    std::vector<vk::Image> images = targetImages();
     renderBuffers.resize(images.size());
 
     for(size_t i = 0; i < images.size(); i++){
@@ -216,72 +443,553 @@ void GraphicsState::recreateRenderBuffers(){
             {vk::ImageAspectBits::color, 0, 1, 0, 1}
         }};
 
-        // Recreate the framebuffer
+        // (Re)create the depth buffer (if depth is enabled)
         vk::Extent2D extent = swapchainExtent();
-        renderBuffers[i].framebuffer = { device(), {/*flags*/ {}, renderPass, 1, &renderBuffers[i].imageView.vkHandle(), extent.width, extent.height, /*layers*/ 1} };
+        std::vector<vk::ImageView> attachments = {renderBuffers[i].imageView.vkHandle()};
+        if(depthFormat != vk::Format::undefined){
+            vk::ImageAspectFlags aspect = vk::ImageAspectBits::depth;
+            if(hasStencilComponent(depthFormat)) aspect |= vk::ImageAspectBits::stencil;
+
+            // The occlusion culler samples the depth buffer to build its pyramid
+            vk::ImageUsageFlags usage = vk::ImageUsageBits::depthStencilAttachment;
+            if(occlusionCuller) usage |= vk::ImageUsageBits::sampled;
+            // The lighting subpass reads it as an input attachment, if nothing else needs it, it never leaves the render pass
+            unsigned int memory = (unsigned int) vk::MemoryPropertyBits::deviceLocal;
+            if(hasDeferredShading()){
+                usage |= vk::ImageUsageBits::inputAttachment;
+                if(!occlusionCuller){
+                    usage |= vk::ImageUsageBits::transientAttachment;
+                    memory = transientMemory;
+                }
+            }
+            vpp::ViewableImageCreateInfo info(depthFormat, aspect, extent, usage);
+            renderBuffers[i].depth = {device().devMemAllocator(), info, memory};
+            attachments.push_back(renderBuffers[i].depth.vkImageView());
+        } else renderBuffers[i].depth = {};
+
+        // (Re)create the G-buffer (if shading is deferred)
+        renderBuffers[i].gBuffer.clear();
+        renderBuffers[i].depthInputView = {};
+        if(hasDeferredShading()){
+            for(vk::Format format: gBufferFormats){
+                vpp::ViewableImageCreateInfo info(format, vk::ImageAspectBits::color, extent,
+                    vk::ImageUsageBits::colorAttachment | vk::ImageUsageBits::inputAttachment | vk::ImageUsageBits::transientAttachment);
+                renderBuffers[i].gBuffer.emplace_back(device().devMemAllocator(), info, transientMemory);
+                attachments.push_back(renderBuffers[i].gBuffer.back().vkImageView());
+            }
+
+            // Input attachments may only view the depth aspect
+            renderBuffers[i].depthInputView = {device(), {/*flags*/ {}, renderBuffers[i].depth.image(), vk::ImageViewType::e2d, depthFormat,
+                {vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity, vk::ComponentSwizzle::identity},
+                {vk::ImageAspectBits::depth, 0, 1, 0, 1}
+            }};
+
+            // Point the lighting subpass' descriptors at the new attachments
+            if(!renderBuffers[i].gBufferDescriptors.vkHandle()) renderBuffers[i].gBufferDescriptors = device().descriptorAllocator().alloc(gBufferLayout);
+            std::vector<vk::DescriptorImageInfo> imageInfos;
+            for(vpp::ViewableImage& image: renderBuffers[i].gBuffer) imageInfos.push_back({/*sampler*/ {}, image.vkImageView(), vk::ImageLayout::shaderReadOnlyOptimal});
+            for(uint32_t g = 0; g < renderPassInputLayouts.size(); g++) imageInfos[g].imageLayout = renderPassInputLayouts[g];
+            imageInfos.push_back({/*sampler*/ {}, renderBuffers[i].depthInputView.vkHandle(), vk::ImageLayout::depthStencilReadOnlyOptimal});
+            std::vector<vk::WriteDescriptorSet> writes;
+            for(uint32_t b = 0; b < imageInfos.size(); b++)
+                writes.push_back({renderBuffers[i].gBufferDescriptors, b, /*firstArrayElem*/ 0, 1, vk::DescriptorType::inputAttachment, &imageInfos[b], /*bufferInfo*/ nullptr});
+            vk::updateDescriptorSets(device(), writes, {});
+        } else renderBuffers[i].gBufferDescriptors = {};
+
+        // Recreate the framebuffer
+        renderBuffers[i].framebuffer = { device(), {/*flags*/ {}, renderPass, (uint32_t) attachments.size(), attachments.data(), extent.width, extent.height, /*layers*/ 1} };
 
         // Allocate a command buffer if one doesn't yet exist
         if(!renderBuffers[i].commandBuffer) renderBuffers[i].commandBuffer = {commandPool, vk::CommandBufferLevel::primary};
 
-        // Create a new semaphore if one doesn't yet exist
-        if(!renderBuffers[i].acquired){
-            renderBuffers[i].acquired = {device()};
-            renderBuffers[i].finished = {device()};
-            // Mark the fence as signaled so that we will bypass it on the first run
-            renderBuffers[i].fence = {device(), {vk::FenceCreateBits::signaled}};
+        // No frames have rendered to the new image yet
+        renderBuffers[i].inFlight = {};
+    }
+
+    // Rebuild the frame graph for the new images
+    //  (compiling replaces the graph's attachments, so the frames using them must finish first)
+    if(renderGraph && renderGraph->isCompiled()){
+        waitForFrames();
+        compileRenderGraph();
+    }
+
+    // Resize the depth pyramid to match (the frames culling against the old one must finish first)
+    if(occlusionCuller){
+        waitForFrames();
+        std::vector<vk::Image> depthImages;
+        for(RenderBuffer& buffer: renderBuffers) depthImages.push_back(buffer.depth.image());
+        occlusionCuller->resize(swapchainExtent(), depthFormat, depthImages);
+    }
+}
+
+/// Moves the render buffers (and the provided swapchain) into the retired list,
+///     they are destroyed once every frame submitted so far finishes
+void GraphicsState::retire(vpp::Swapchain oldSwapchain){
+    RetiredResources resources {std::move(oldSwapchain), std::move(threadCommandPools), std::move(renderBuffers), submittedFrames};
+    renderBuffers.clear();
+    threadCommandPools.clear();
+
+    // If nothing is still running the resources can be destroyed right away
+    if(completedFrames >= submittedFrames) return;
+    retired.push_back(std::move(resources));
+}
+
+/// Notes that the frame's last submission finished (its fence signaled), destroying any retired resources it was using
+void GraphicsState::frameFinished(FrameData& frame){
+    // Fences signal after every earlier submission on the queue, so everything up to this submission is finished
+    completedFrames = std::max(completedFrames, frame.submission);
+    while(!retired.empty() && retired.front().submission <= completedFrames)
+        retired.pop_front();
+}
+
+/// Waits for every submitted frame to finish (without waiting on other work on the device)
+void GraphicsState::waitForFrames(){
+    for(FrameData& frame: frames)
+        if(frame.submission > completedFrames){
+            device().waitForFence(frame.fence.vkHandle(), UINT64_MAX, /*reset*/ false);
+            frameFinished(frame);
+        }
+}
+
+/// Creates a frame graph for this state (replacing any existing one.)
+///     The swapchain's images are imported into the graph as <backbuffer>.
+RenderGraph& GraphicsState::createRenderGraph(){
+    renderGraph = std::make_unique<RenderGraph>();
+    backbufferID = renderGraph->importImage("backbuffer", {swapchainFormat().format}, targetFinalLayout);
+    return *renderGraph;
+}
+
+/// Binds the current swapchain images to the frame graph and compiles it.
+void GraphicsState::compileRenderGraph(){
+    if(!renderGraph) throw std::runtime_error("State " + str(id()) + ": Can't compile a frame graph which hasn't been created.");
+
+    std::vector<std::pair<vk::Image, vk::ImageView>> handles;
+    for(RenderBuffer& buffer: renderBuffers) handles.emplace_back(buffer.image, buffer.imageView.vkHandle());
+    renderGraph->bindImport(backbufferID, handles);
+    renderGraph->compile(device(), swapchainExtent());
+}
+
+/// Function which sets up all of the data stored in the <frames>
+void GraphicsState::recreateFrames(){
+    // Other states can wait on the frames through our timeline
+    if(!timeline.vkHandle()) createTimeline();
+
+    // Make sure none of the old frames are still in use
+    waitForFrames();
+    for(RenderBuffer& buffer: renderBuffers) buffer.inFlight = {};
+    completedFrames = submittedFrames;
+    retired.clear();
+
+    frames.clear();
+    frames.resize(framesInFlight);
+    for(FrameData& frame: frames){
+        // Each frame gets its own transient pool (on the queue frames are submitted to) so that
+        //  it can be reset without touching the other frames
+        frame.commandPool = {device(), {vk::CommandPoolCreateBits::transient, device().presentQueue()->family()}};
+        frame.commandBuffer = {frame.commandPool, vk::CommandBufferLevel::primary};
+
+        frame.acquired = {device()};
+        frame.finished = {device()};
+        // Mark the fence as signaled so that we will bypass it on the first run
+        frame.fence = {device(), {vk::FenceCreateBits::signaled}};
+    }
+}
+
+/// Sets the number of frames the CPU can run ahead of the GPU (typically 2)
+///     Independent of the number of images in the swapchain
+void GraphicsState::setFramesInFlight(uint32_t count){
+    if(count == 0) throw std::invalid_argument("State " + str(id()) + ": At least one frame must be in flight.");
+    if(count == framesInFlight && frames.size() == count) return;
+
+    framesInFlight = count;
+    // Only rebuild the frames if they have already been created
+    if(!frames.empty()) recreateFrames();
+}
+
+/// Enables (or disables) measuring GPU time with timestamp queries.
+///     Command buffers must be rerecorded when profiling is enabled (disabling rerecords them automatically)
+GPUProfiler* GraphicsState::enableGPUProfiling(bool enable){
+    if(!enable && gpuProfiler){
+        // The pre-recorded (and in flight) command buffers write to the profiler's query pools,
+        //  so the frames using them must finish and the buffers be rerecorded without them
+        waitForFrames();
+        gpuProfiler.reset();
+        if(!renderBuffers.empty()) rerecordCommandBuffers();
+    } else if(enable && !gpuProfiler) gpuProfiler = std::make_unique<GPUProfiler>(device(), device().presentQueue()->family());
+    return gpuProfiler.get();
+}
+
+/// Enables (or disables) Hi-Z occlusion culling. Requires depth to be enabled.
+///     Recreates the render pass and render buffers; command buffers must be rerecorded
+OcclusionCuller* GraphicsState::enableOcclusionCulling(bool enable){
+    if(enable == (occlusionCuller != nullptr)) return occlusionCuller.get();
+    if(enable){
+        if(depthFormat == vk::Format::undefined) throw std::runtime_error("State " + str(id()) + ": Occlusion culling requires depth to be enabled.");
+        vk::FormatProperties properties = vk::getPhysicalDeviceFormatProperties(device().vkPhysicalDevice(), depthFormat);
+        if(!(properties.optimalTilingFeatures & vk::FormatFeatureBits::sampledImage))
+            throw std::runtime_error("State " + str(id()) + ": The depth format can't be sampled, occlusion culling isn't supported.");
+    }
+
+    dlg_info("State " + str(id()) + ": " + (enable ? "Enabling" : "Disabling") + " occlusion culling");
+    // Make sure nothing is still rendering with the old render pass (or culling)
+    waitForFrames();
+    if(enable) occlusionCuller = std::make_unique<OcclusionCuller>(device(), device().presentQueue()->family());
+    else occlusionCuller.reset();
+
+    // The depth buffers need to be stored (and sampled) for the pyramid to be built from them
+    if(renderPass.vkHandle()){
+        createGraphicsRenderPass(renderPassColorLayouts, renderPassInputLayouts);
+        recreateRenderBuffers();
+    }
+    return occlusionCuller.get();
+}
+
+/// Switches command buffer recording into parallel mode.
+///     Draw work is split into <partitions> pieces which are recorded into secondary command
+///     buffers by a pool of <threads> workers (0 = one per core), each with its own command pools.
+///     Command buffers must be rerecorded when this is changed
+void GraphicsState::bindParallelCommandRecordingSteps(uint32_t partitions, std::function<void (vpp::CommandBuffer&, uint8_t, uint32_t)> _new, uint32_t threads){
+    if(partitions == 0) throw std::invalid_argument("State " + str(id()) + ": Parallel recording requires at least one partition.");
+    if(threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    customParallelRecordingSteps = _new;
+    recordingPartitions = partitions;
+
+    // (Re)create the workers if the number of threads changed
+    if(!recordingThreads || recordingThreads->size() != threads){
+        // The secondary buffers (and their pools) may still be executing in submitted frames
+        waitForFrames();
+        for(RenderBuffer& buffer: renderBuffers) buffer.secondaryCommandBuffers.clear();
+        // The pools are recreated the next time we record
+        threadCommandPools.clear();
+        recordingThreads = std::make_unique<ThreadPool>(threads);
+    }
+}
+
+/// Switches command buffer recording back to serially recording inline commands
+void GraphicsState::unbindParallelCommandRecordingSteps(){
+    customParallelRecordingSteps = {};
+    recordingPartitions = 0;
+    // The secondary buffers (and their pools) may still be executing in submitted frames
+    waitForFrames();
+    for(RenderBuffer& buffer: renderBuffers) buffer.secondaryCommandBuffers.clear();
+    threadCommandPools.clear();
+    recordingThreads.reset();
+}
+
+/// Records the secondary command buffers of every render buffer using the recording threads
+void GraphicsState::recordSecondaryCommandBuffers(){
+    // Every subpass gets its own set of partitions
+    uint32_t subpasses = colorSubpass() + 1;
+    // The old secondary buffers may still be executing in submitted frames, they must finish before they are freed
+    //  (after the swapchain is recreated the old ones were retired along with their render buffers and pools, so there is nothing to wait for)
+    bool replacing = std::any_of(renderBuffers.begin(), renderBuffers.end(), [](RenderBuffer& buffer){ return !buffer.secondaryCommandBuffers.empty(); });
+    if(replacing) waitForFrames();
+    // Free the old secondary buffers (before their pools are reset)
+    for(RenderBuffer& buffer: renderBuffers){
+        buffer.secondaryCommandBuffers.clear();
+        buffer.secondaryCommandBuffers.resize(recordingPartitions * subpasses);
+    }
+
+    // Make sure every thread has a pool for every render buffer
+    if(threadCommandPools.size() != recordingThreads->size() || threadCommandPools[0].size() != renderBuffers.size()){
+        threadCommandPools.clear();
+        threadCommandPools.resize(recordingThreads->size());
+        for(std::vector<vpp::CommandPool>& pools: threadCommandPools){
+            pools.resize(renderBuffers.size());
+            for(vpp::CommandPool& pool: pools)
+                pool = {device(), {/*flags*/ {}, commandPool.queueFamily()}};
         }
+    // Otherwise invalidate all of the previous recordings
+    } else for(std::vector<vpp::CommandPool>& pools: threadCommandPools)
+        for(vpp::CommandPool& pool: pools)
+            vk::resetCommandPool(device().vkDevice(), pool.vkHandle());
+
+    // Calculate the size and viewport (dynamic state isn't inherited by secondary buffers)
+    vk::Extent2D extent = swapchainExtent();
+    vk::Viewport viewport{0, 0, (float) extent.width, (float) extent.height, 0, 1};
+    vk::Rect2D scissor{{0, 0}, {extent.width, extent.height}};
+
+    // Record each subpass separately, so the recording steps can check which one they are recording
+    for(uint32_t subpass = 0; subpass < subpasses; subpass++){
+        recordingDepthPrepass = depthPrepass && subpass == 0;
+        recordingSubpass = subpass;
+
+        repeat(renderBuffers.size(), i)
+            for(uint32_t partition = 0; partition < recordingPartitions; partition++)
+                recordingThreads->enqueue([&, i, partition, subpass](size_t thread){
+                    PROFILE_SCOPE("record partition");
+                    RenderBuffer& buffer = renderBuffers[i];
+                    // Each thread records from its own pool for this image, so no synchronization is needed
+                    vpp::CommandBuffer cb = threadCommandPools[thread][i].allocate(vk::CommandBufferLevel::secondary);
+
+                    // The buffer will be executed inside of the render pass targeting this image's framebuffer
+                    vk::CommandBufferInheritanceInfo inheritance {renderPass, subpass, buffer.framebuffer, /*occlusionQuery*/ false, {}, {}};
+                    vk::beginCommandBuffer(cb, {vk::CommandBufferUsageBits::renderPassContinue, &inheritance});
+                    if(gpuProfiler) gpuProfiler->track(cb, i);
+                    vk::cmdSetViewport(cb, 0, 1, viewport);
+                    vk::cmdSetScissor(cb, 0, 1, scissor);
+
+                    customParallelRecordingSteps(cb, i, partition);
+
+                    vk::endCommandBuffer(cb);
+                    buffer.secondaryCommandBuffers[subpass * recordingPartitions + partition] = std::move(cb);
+                });
+
+        // Wait for all of the partitions to be recorded (rethrows any recording errors)
+        recordingThreads->wait();
     }
+    recordingDepthPrepass = false;
+    recordingSubpass = UINT32_MAX;
+}
+
+/// Records the commands of every subpass into the primary buffer of an image (the render pass must have begun)
+void GraphicsState::recordSubpasses(uint32_t i, bool parallel){
+    vpp::CommandBuffer& cb = renderBuffers[i].commandBuffer;
+    vk::Extent2D extent = swapchainExtent();
+    vk::Viewport viewport{0, 0, (float) extent.width, (float) extent.height, 0, 1};
+    vk::Rect2D scissor{{0, 0}, {extent.width, extent.height}};
+
+    for(uint32_t subpass = 0; subpass <= colorSubpass(); subpass++){
+        if(subpass > 0) vk::cmdNextSubpass(cb, (parallel ? vk::SubpassContents::secondaryCommandBuffers : vk::SubpassContents::eInline));
+        recordingDepthPrepass = depthPrepass && subpass == 0;
+        recordingSubpass = subpass;
+        // Only the secondary buffers can be timed when executing them (nothing else may be recorded into the subpass)
+        std::optional<GPUProfiler::Scope> scope;
+        if(!parallel) scope.emplace(gpuProfiler.get(), cb, recordingDepthPrepass ? "depth prepass" : (inGBufferPass() ? "g-buffer pass" : "color pass"));
+
+        // Execute the secondary buffers recorded for this image and subpass
+        if(parallel){
+            std::vector<vk::CommandBuffer> secondaries;
+            for(uint32_t partition = 0; partition < recordingPartitions; partition++)
+                secondaries.push_back(renderBuffers[i].secondaryCommandBuffers[subpass * recordingPartitions + partition].vkHandle());
+            vk::cmdExecuteCommands(cb, secondaries);
+            continue;
+        }
+
+        vk::cmdSetViewport(cb, 0, 1, viewport);
+        vk::cmdSetScissor(cb, 0, 1, scissor);
+
+        // Any custom bindings (like vertex buffers)
+        if(customCommandRecordingSteps) customCommandRecordingSteps(cb, i);
+    }
+    recordingDepthPrepass = false;
+    recordingSubpass = UINT32_MAX;
 }
 
 /// Function which records the command buffers
 ///     Is automatically called after a pipeline is bound
 bool GraphicsState::rerecordCommandBuffers(){
-    // Calculate the size and viewport
+    PROFILE_SCOPE("record");
+    // A frame graph which was created but not compiled would otherwise be silently replaced by the default render pass
+    if(renderGraph && !renderGraph->isCompiled())
+        throw std::runtime_error("State " + str(id()) + ": The frame graph must be compiled before the command buffers are recorded.");
     vk::Extent2D extent = swapchainExtent();
-    vk::Viewport viewport{0, 0, (float) extent.width, (float) extent.height, 0, 1};
-    vk::Rect2D scissor{{0, 0}, {extent.width, extent.height}};
-    // Specify the blank render color
-    vk::ClearValue clearValue = { { {0, 0, 0, 1} } }; // full opacity black
+    // Specify the blank render color (and clear the depth buffer to the far plane)
+    std::vector<vk::ClearValue> clearValues(1);
+    clearValues[0].color = {{0, 0, 0, 1}}; // full opacity black
+    if(depthFormat != vk::Format::undefined){
+        // The depth attachment follows the color attachment
+        clearValues.resize(2);
+        clearValues[1].depthStencil = {1, 0};
+    }
+    // Followed by the G-buffer (cleared to zero)
+    for(size_t g = 0; g < gBufferFormats.size(); g++)
+        clearValues.emplace_back().color = {{0, 0, 0, 0}};
+
+    // The culler's buffers and descriptors are updated while recording, so the frames using them must finish first
+    if(occlusionCuller){
+        waitForFrames();
+        occlusionCuller->beginRecording();
+    }
 
+    // Start recording every primary buffer first, so that the profiler resets each image's
+    //  queries before any (secondary) buffers record scopes for it
     repeat(renderBuffers.size(), i){
         vk::beginCommandBuffer(renderBuffers[i].commandBuffer, {});
-        defer(vk::endCommandBuffer(renderBuffers[i].commandBuffer);, be) // Stop recording at end of loop
+        if(gpuProfiler) gpuProfiler->beginRecording(renderBuffers[i].commandBuffer, i);
+    }
 
-        vk::cmdBeginRenderPass(renderBuffers[i].commandBuffer,
-            {renderPass, renderBuffers[i].framebuffer, {/*offset*/{0, 0}, extent}, 1, &clearValue}, vk::SubpassContents::eInline);
-        defer(vk::cmdEndRenderPass(renderBuffers[i].commandBuffer);, re) // End the render pass at end of loop
+    // If there is a frame graph, it describes everything which needs to be recorded
+    if(renderGraph){
+        repeat(renderBuffers.size(), i){
+            {
+                GPUProfiler::Scope scope(gpuProfiler.get(), renderBuffers[i].commandBuffer, "frame graph");
+                renderGraph->execute(renderBuffers[i].commandBuffer, i);
+            }
+            vk::endCommandBuffer(renderBuffers[i].commandBuffer);
+        }
+        // The graph owns the depth buffers, so instances are only frustum culled
+        if(occlusionCuller) occlusionCuller->endRecording(/*pyramid*/ false);
+        return true;
+    }
 
-        vk::cmdSetViewport(renderBuffers[i].commandBuffer, 0, 1, viewport);
-        vk::cmdSetScissor(renderBuffers[i].commandBuffer, 0, 1, scissor);
+    // Record all of the draw work in parallel first, the primary buffers then just execute it
+    bool parallel = recordingInParallel();
+    if(parallel) recordSecondaryCommandBuffers();
 
-        // Any custom bindings (like vertex buffers)
-        if(customCommandRecordingSteps) customCommandRecordingSteps(renderBuffers[i].commandBuffer, i);
+    repeat(renderBuffers.size(), i){
+        defer(vk::endCommandBuffer(renderBuffers[i].commandBuffer);, be) // Stop recording at end of loop
+        {
+            GPUProfiler::Scope scope(gpuProfiler.get(), renderBuffers[i].commandBuffer, "render pass");
+
+            vk::cmdBeginRenderPass(renderBuffers[i].commandBuffer,
+                {renderPass, renderBuffers[i].framebuffer, {/*offset*/{0, 0}, extent}, (uint32_t) clearValues.size(), clearValues.data()}, (parallel ? vk::SubpassContents::secondaryCommandBuffers : vk::SubpassContents::eInline));
+            defer(vk::cmdEndRenderPass(renderBuffers[i].commandBuffer);, re) // End the render pass at end of scope
+
+            // Record the depth prepass and G-buffer subpass (if there are ones) and the color subpass
+            recordSubpasses(i, parallel);
+        }
 
-        //vk::cmdDraw(renderBuffers[i].commandBuffer, /*vertCount*/ 3, /*instanceCount*/ 1, /*firstVertex*/ 0, /*firstInstance*/ 0);
+        // Build the depth pyramid the next frame is culled against
+        if(occlusionCuller){
+            GPUProfiler::Scope scope(gpuProfiler.get(), renderBuffers[i].commandBuffer, "depth pyramid");
+            occlusionCuller->recordPyramid(renderBuffers[i].commandBuffer, i, renderBuffers[i].depth.image());
+        }
     }
 
+    // Now that every batch drawn is known, record the culling which runs before each image
+    if(occlusionCuller) occlusionCuller->endRecording();
+
     // If we made it this far nothing went wrong
     return true;
 }
 
+/// Waits until no other frame is rendering to the image and marks the image as used by the frame
+void GraphicsState::waitForImage(FrameData& current, uint32_t i){
+    // Wait for any previous frame still rendering to this image to finish
+    if(renderBuffers[i].inFlight && renderBuffers[i].inFlight != current.fence.vkHandle())
+        device().waitForFence(renderBuffers[i].inFlight, UINT64_MAX, /*reset*/ false);
+    renderBuffers[i].inFlight = current.fence.vkHandle();
+
+    // The image's last frame has finished, so its timestamps (and culling statistics) can be read
+    if(gpuProfiler) gpuProfiler->collect(i);
+    if(occlusionCuller) occlusionCuller->collect(i);
+}
+
+/// Records the frame's command buffer and submits it along with the image's pre-recorded commands
+///     (followed by any extra command buffers.) Waits on the frame's acquired semaphore and
+///     signals its finished semaphore if there is a swapchain.
+void GraphicsState::submitFrame(FrameData& current, uint32_t f, uint32_t i, std::vector<vk::CommandBuffer> extraCommandBuffers){
+    PROFILE_SCOPE("submit");
+    // Buffers uploaded on the transfer queue need to be acquired by this queue before they are used
+    UploadEngine& uploads = device().uploadEngine();
+    bool acquireUploads = uploads.hasPendingAcquires();
+
+    // Record the commands specific to this frame (if there are any)
+    std::vector<vk::CommandBuffer> commandBuffers;
+    if(customFrameRecordingSteps || acquireUploads){
+        // Everything allocated from the frame's pool is finished with now that its fence has signaled
+        vk::resetCommandPool(device().vkDevice(), current.commandPool.vkHandle());
+        vk::beginCommandBuffer(current.commandBuffer, {vk::CommandBufferUsageBits::oneTimeSubmit});
+        if(acquireUploads) uploads.recordAcquires(current.commandBuffer);
+        if(customFrameRecordingSteps) customFrameRecordingSteps(current.commandBuffer, f, i);
+        vk::endCommandBuffer(current.commandBuffer);
+        commandBuffers.push_back(current.commandBuffer.vkHandle());
+    }
+    // Cull the instances before the image's commands draw them
+    if(occlusionCuller){
+        occlusionCuller->update(i);
+        commandBuffers.push_back(occlusionCuller->commandBuffer(i));
+    }
+    commandBuffers.push_back(renderBuffers[i].commandBuffer.vkHandle());
+    commandBuffers.insert(commandBuffers.end(), extraCommandBuffers.begin(), extraCommandBuffers.end());
+
+    // Without a swapchain there is nothing to wait for before rendering, or to signal for presentation
+    bool presenting = swapchain.vkHandle();
+    std::vector<vk::Semaphore> waitSemaphores;
+    std::vector<vk::PipelineStageFlags> waitStages;
+    std::vector<uint64_t> waitValues; // Ignored for binary semaphores
+    if(presenting){
+        waitSemaphores.push_back(current.acquired.vkHandle());
+        waitStages.push_back(vk::PipelineStageBits::colorAttachmentOutput);
+        waitValues.push_back(0);
+    }
+
+    // Wait for any uploads which the GPU hasn't finished yet
+    bool waitUploads = uploads.semaphore() && uploads.submittedValue() > uploads.completedValue();
+    if(waitUploads){
+        waitSemaphores.push_back(uploads.semaphore());
+        waitStages.push_back(vk::PipelineStageBits::allCommands);
+        waitValues.push_back(uploads.submittedValue());
+    }
+    // Wait for any work from other states (ex compute) this state depends on
+    bool waitDependencies = addDependencyWaits(waitSemaphores, waitStages, waitValues);
+    // Wait for any one off semaphores
+    for(auto& [semaphore, stage]: extraWaits){
+        waitSemaphores.push_back(semaphore);
+        waitStages.push_back(stage);
+        waitValues.push_back(0);
+    }
+    extraWaits.clear();
+
+    // Signal that the frame is ready to be presented (and advance our timeline)
+    uint64_t submission = submittedFrames + 1;
+    std::vector<vk::Semaphore> signalSemaphores;
+    std::vector<uint64_t> signalValues; // Ignored for binary semaphores
+    if(presenting){
+        signalSemaphores.push_back(current.finished.vkHandle());
+        signalValues.push_back(0);
+    }
+    if(timeline.vkHandle()){
+        signalSemaphores.push_back(timeline.vkHandle());
+        signalValues.push_back(submission);
+    }
+
+    vk::TimelineSemaphoreSubmitInfo timelineInfo;
+    timelineInfo.waitSemaphoreValueCount = waitValues.size();
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = signalValues.size();
+    timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+    vk::SubmitInfo submit {(uint32_t) waitSemaphores.size(), waitSemaphores.data(), waitStages.data(),
+        (uint32_t) commandBuffers.size(), commandBuffers.data(),
+        (uint32_t) signalSemaphores.size(), signalSemaphores.data()};
+    if(waitUploads || waitDependencies || timeline.vkHandle()) submit.pNext = &timelineInfo;
+
+    vk::resetFences(device().vkHandle(), nytl::make_span(current.fence.vkHandle()));
+    vk::queueSubmit(device().presentQueue()->vkHandle(), nytl::make_span(submit), current.fence.vkHandle());
+    current.submission = submittedFrames = submission;
+    if(gpuProfiler) gpuProfiler->submitted(i);
+    if(occlusionCuller) occlusionCuller->submitted(i);
+}
+
 /// Function to be called by the main loop every frame.
 ///     Implementation needs to handle the case where this object is no longer valid.
 ///     Automatically resizes the swapchain when it becomes outdated (ex window resized).
 bool GraphicsState::mainLoop(uint64_t frame){
+    {
+        PROFILE_SCOPE("pace");
+        // Wait until the next frame should start (if the frame rate is limited)
+        framePacer.wait();
+    }
+    PROFILE_FRAME();
     try{
-        // Get the next image in the render queue
-        uint32_t i = vk::acquireNextImageKHR(device().vkHandle(), swapchain.vkHandle(), /*timeout*/ UINT64_MAX, renderBuffers[frame % renderBuffers.size()].acquired.vkHandle(), {});
+        // Objects owned by this frame
+        uint32_t f = frame % frames.size();
+        FrameData& current = frames[f];
+
+        // Wait for the last submission using this frame's objects to finish
+        //  (the fence is only reset once we are sure we will submit work which signals it)
+        device().waitForFence(current.fence.vkHandle(), UINT64_MAX, /*reset*/ false);
+        frameFinished(current);
 
-        // Wait for any previous rendering tasks on this image to finish
-        device().waitForFence(renderBuffers[i].fence.vkHandle());
+        // Get the next image in the render queue
+        uint32_t i;
+        {
+            PROFILE_SCOPE("acquire");
+            i = vk::acquireNextImageKHR(device().vkHandle(), swapchain.vkHandle(), /*timeout*/ UINT64_MAX, current.acquired.vkHandle(), {});
+            // Wait for any previous frame still rendering to this image to finish
+            waitForImage(current, i);
+        }
 
         if(customMainLoopSteps) customMainLoopSteps(*this, i);
 
         // Render the image
-        vk::PipelineStageFlags waitStage = vk::PipelineStageBits::colorAttachmentOutput;
-        vk::queueSubmit(device().presentQueue()->vkHandle(), std::vector<vk::SubmitInfo>{ {1, &renderBuffers[frame % renderBuffers.size()].acquired.vkHandle(), &waitStage, 1, &renderBuffers[i].commandBuffer.vkHandle(), 1, &renderBuffers[i].finished.vkHandle() } }, renderBuffers[i].fence.vkHandle());
+        submitFrame(current, f, i);
         // Once the image has been rendered put it into the swapchain's buffer
-        vk::queuePresentKHR(device().presentQueue()->vkHandle(), {1, &renderBuffers[i].finished.vkHandle(), 1, &swapchain.vkHandle(), &i, nullptr});
+        PROFILE_SCOPE("present");
+        vk::queuePresentKHR(device().presentQueue()->vkHandle(), {1, &current.finished.vkHandle(), 1, &swapchain.vkHandle(), &i, nullptr});
 
         // Everything went fine
         return true;
@@ -289,6 +997,7 @@ bool GraphicsState::mainLoop(uint64_t frame){
         // If we have an error saying the swapchain is the wrong size, recreate it
         if (e.error == vk::Result::errorOutOfDateKHR) {
             dlg_info("State " + str(id()) + ": Swapchain out of date, recreating");
+            // Only the swapchain and per image resources are rebuilt, frames still in flight keep their (retired) resources
             recreateSwapchain();
             rerecordCommandBuffers();
         // If we have an error we haven't handled, throw it further up
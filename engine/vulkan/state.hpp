@@ -1,6 +1,12 @@
 #pragma once
 
 #include "common.hpp"
+#include "renderGraph.hpp"
+#include "upload.hpp"
+#include "gpuProfiler.hpp"
+#include "occlusion.hpp"
+#include "engine/util/threadPool.hpp"
+#include "engine/util/framePacer.hpp"
 
 // Exception which is thrown when a required VulkanState isn't provided
 struct StateNotProvidedException: public std::runtime_error{ using std::runtime_error::runtime_error; };
@@ -13,27 +19,42 @@ private:
     uint16_t _id;
 
 public:
-    // Struct storing the data needed for each framebuffer
+    // Struct storing a command buffer and the fence signaled when its submission finishes
     struct StateBuffer {
 		vpp::CommandBuffer commandBuffer;
         vpp::Fence fence;
 	};
 
+    // Struct storing a point on another state's timeline which this state's submissions wait for
+    struct TimelineDependency {
+        const VulkanState* state;
+        vk::PipelineStageFlags stage;
+        // How many submissions before the other state's latest one is waited for
+        uint64_t lag;
+    };
+
     // Struct used when (re)creating the swapchain from partial device information
+    //  (or from a device which is already in use by another state)
     struct DeviceCreateInfo {
-        enum Valid {NO, YES, NO_INITAL};
+        enum Valid {NO, YES, NO_INITAL, SHARED};
 
         Valid valid = NO;
         vk::DeviceCreateInfo info;
         vk::PhysicalDevice device;
+        std::shared_ptr<VulkDevice> shared = nullptr;
 
         DeviceCreateInfo() : valid(NO) {}
         DeviceCreateInfo(vk::DeviceCreateInfo _info, vk::PhysicalDevice _device) : valid(YES), info(_info), device(_device) {}
+        DeviceCreateInfo(std::shared_ptr<VulkDevice> _shared) : valid(_shared ? SHARED : NO), shared(_shared) {}
     };
 
 protected:
-    // Used to store the memory of the vulkan logical device we create for this window
-    std::unique_ptr<VulkDevice> _device = nullptr;
+    // The vulkan logical device this state renders with (may be shared with other states)
+    std::shared_ptr<VulkDevice> _device = nullptr;
+    // Timeline semaphore signaled with the number of each submission (null without timeline semaphore support)
+    vpp::Semaphore timeline;
+    // Timelines of other states which submissions must wait for
+    std::vector<TimelineDependency> dependencies;
     // Function pointer which stores a reference to extra command buffer recording steps
     std::function<void (vpp::CommandBuffer&, uint8_t)> customCommandRecordingSteps = {};
     std::function<void (VulkanState&, uint32_t)> customMainLoopSteps = {};
@@ -50,6 +71,10 @@ public:
     const uint16_t id() const { return _id; }
     /// Gets the device stored in this state
     const VulkDevice& device() const { return *_device; }
+    /// Gets a shared reference to the device stored in this state.
+    ///     Pass it (as the DeviceCreateInfo) when creating another state to render with the same device,
+    ///     which lets the states share resources (meshes, materials, etc...)
+    std::shared_ptr<VulkDevice> sharedDevice() const { return _device; }
 
     /// Set any custom steps which need to be recorded to the internal command buffer
     ///     The provided function will always be called right before the draw/compute call
@@ -58,6 +83,18 @@ public:
 
     void bindCustomMainLoopSteps(std::function<void (VulkanState&, uint32_t)> _new) {customMainLoopSteps = _new;}
 
+    /// Returns the semaphore signaled with the number of each submission (null without timeline semaphore support)
+    vk::Semaphore timelineSemaphore() const { return timeline.vkHandle(); }
+    /// Returns the number of submissions made (the value the timeline reaches once they all finish)
+    virtual uint64_t submittedValue() const = 0;
+    /// Makes every submission of this state wait (at <stage>) for the other state's submission <lag> submissions
+    ///     before its latest one (ex with a lag of 1 compute can overlap the previous frame's rendering,
+    ///     as long as the buffers it writes are double buffered.) Requires timeline semaphores,
+    ///     and the other state must outlive the dependency
+    void addDependency(const VulkanState& other, vk::PipelineStageFlags stage, uint64_t lag = 0);
+    /// Removes all of the dependencies on other states
+    void clearDependencies() { dependencies.clear(); }
+
     /// Function which records to the buffers.
     ///     Is automatically called after a pipeline is bound
     virtual bool rerecordCommandBuffers() = 0;
@@ -66,87 +103,175 @@ public:
     virtual bool mainLoop(uint64_t frame) = 0;
 
 
-    /// Copies the provided data into the given buffer through a staging buffer.
-    ///     Submits the operation on the device attached to the provided state.
+    /// Copies the provided data into the given buffer through the device's upload engine.
     ///     The input buffer must be marked as a vk::BufferUsageBits::transferDst.
     ///     If flagged to wait for the operation to finish, it will do so; otherwise
-    ///         it will return the submission ID for future synchronization.
-    ///     If a command buffer is provided, that buffer will be overwritten and used;
-    ///         otherwise a new buffer will be allocated and then destroyed.
-    ///     The provided command buffer will never be destroyed.
-    ///     If a command buffer is generated, the wait command will destroy it,
-    ///         non waiting will not. (This is a memory leak! Externally manage the buffer!)
+    ///         it will return the timeline value signaled once the copy finishes.
+    ///     NOTE: Submits a copy on its own, prefer queueing many copies in an <UploadBatch>
     template <typename T>
-    uint64_t fillStaging(vpp::BufferSpan buffer, nytl::span<T> data, const bool wait = true, std::optional<std::reference_wrapper<vpp::CommandBuffer>> cb = {}){
-        // Variable which stores the internal copy of the command buffer
-        vpp::CommandBuffer internalCB;
-
-        // At the end of the function, if we should release the command buffer (we
-        //  didn't create it and thus shouldn't destroy it), release it
-        // WARNING: WATCH THIS FOR BUGS
-        bool release = cb.has_value();
-        defer(if(release) internalCB.release();, cr);
-
-        // Create a command buffer if one wasn't provided
-        if(!cb) internalCB = commandPool.allocate(); // Invalid?
-        // Or create a copy which won't touch the original if one was provided
-        else internalCB = {cb->get().device(), cb->get().commandPool(), cb->get().vkHandle()};
-
-        // Record the command buffer
-        vk::beginCommandBuffer(internalCB, {});
-        vpp::SubBuffer stagingBuff = vpp::fillStaging(internalCB, buffer, nytl::span<std::byte>{(std::byte*) data.data(), data.size() * sizeof(data[0])});
-        vk::endCommandBuffer(internalCB);
-
-        // Add the buffer to the submission queue...
-        vpp::QueueSubmitter& submitter = device().queueSubmitter();
-        uint64_t out = submitter.add(internalCB);
-        // And submit it then wait for it to finish...
-        if(wait) return submitter.wait(out);
-
-        // Or just submit it
-        submitter.submit(out);
-        // And release the internal reference (it can't be freed since the queue is
-        //     running so just wait for the commandpool to clean it up.)
-        release = true;
+    uint64_t fillStaging(vpp::BufferSpan buffer, nytl::span<T> data, const bool wait = true){
+        UploadEngine& uploads = device().uploadEngine();
+        uploads.upload(buffer, nytl::span<const std::byte>{(const std::byte*) data.data(), data.size() * sizeof(data[0])});
+        uint64_t out = uploads.flush();
+
+        // Wait for the copy to finish (if requested)
+        if(wait) uploads.wait(out);
         return out;
     }
     template <typename T>
-    uint64_t fillStaging(vpp::BufferSpan buffer, std::vector<T>& data, const bool wait = true, std::optional<std::reference_wrapper<vpp::CommandBuffer>> cb = {})
-    { return fillStaging(buffer, nytl::span{data}, wait, std::move(cb)); }
+    uint64_t fillStaging(vpp::BufferSpan buffer, std::vector<T>& data, const bool wait = true)
+    { return fillStaging(buffer, nytl::span{data}, wait); }
+
+protected:
+    /// Creates the timeline semaphore (if the device supports them)
+    void createTimeline();
+    /// Adds the waits for the dependencies (and their timeline values) to a submission
+    ///     Returns true if any waits were added
+    bool addDependencyWaits(std::vector<vk::Semaphore>& semaphores, std::vector<vk::PipelineStageFlags>& stages, std::vector<uint64_t>& values) const;
 };
 
 /// Class which stores all of the variables needed to render to the screen
 class GraphicsState: public VulkanState {
 public:
-    struct RenderBuffer: public StateBuffer {
+    // Struct storing the data needed to render to each swapchain image
+    struct RenderBuffer {
         vk::Image image {};
 		vpp::ImageView imageView;
         //vpp::ViewableImage imageView;
 		vpp::Framebuffer framebuffer;
+        // Depth buffer rendered alongside the image (empty if depth is disabled)
+        vpp::ViewableImage depth;
+        // Transient G-buffer attachments, a depth only view of <depth>, and the descriptors
+        //  the lighting subpass reads them through (empty if deferred shading is disabled)
+        std::vector<vpp::ViewableImage> gBuffer;
+        vpp::ImageView depthInputView;
+        vpp::TrDs gBufferDescriptors;
+        // Pre-recorded rendering commands targeting this image
+        vpp::CommandBuffer commandBuffer;
+        // Secondary command buffers (one per partition and subpass) executed by <commandBuffer> when recording in parallel
+        std::vector<vpp::CommandBuffer> secondaryCommandBuffers;
+        // Fence of the frame currently rendering to this image (null if none)
+        vk::Fence inFlight {};
+    };
+    // Struct storing the data owned by each frame the CPU can have in flight
+    //  (the command buffer is allocated from the frame's transient pool and rerecorded every frame)
+    struct FrameData: public StateBuffer {
+        vpp::CommandPool commandPool;
 		vpp::Semaphore acquired, finished;
+        // Number of the frame's last submission (see <submittedFrames>)
+        uint64_t submission = 0;
+    };
+    // Struct storing resources which were replaced while frames may still be using them
+    //  (members are destroyed in reverse order, so the render buffers go before the pools and swapchain)
+    struct RetiredResources {
+        vpp::Swapchain swapchain;
+        std::vector<std::vector<vpp::CommandPool>> threadCommandPools;
+        std::vector<RenderBuffer> renderBuffers;
+        // The resources can be destroyed once this submission has finished
+        uint64_t submission;
     };
 public:
+    // The parts of the render pass which decide which pipelines can be used in it. Pipelines created for one render pass
+    //  can be used in any compatible one (ex the render pass of another state on the device with the same layout)
+    struct RenderPassLayout {
+        vk::Format colorFormat = vk::Format::undefined, depthFormat = vk::Format::undefined;
+        uint32_t colorAttachments = 0;
+        std::vector<vk::Format> gBufferFormats;
+        bool depthPrepass = false;
+
+        /// Returns the index of the subpass color is rendered in (the lighting subpass when shading is deferred)
+        uint32_t colorSubpass() const { return (depthPrepass ? 1 : 0) + (gBufferFormats.empty() ? 0 : 1); }
+        /// Returns the index of the subpass the G-buffer is written in
+        uint32_t gBufferSubpass() const { return depthPrepass ? 1 : 0; }
+
+        bool operator==(const RenderPassLayout& o) const {
+            return colorFormat == o.colorFormat && depthFormat == o.depthFormat && colorAttachments == o.colorAttachments
+                && gBufferFormats == o.gBufferFormats && depthPrepass == o.depthPrepass;
+        }
+        bool operator!=(const RenderPassLayout& o) const { return !(*this == o); }
+    };
+
     vpp::Surface surface;
     vpp::Swapchain swapchain;
     vpp::RenderPass renderPass;
     std::vector<RenderBuffer> renderBuffers;
+    std::vector<FrameData> frames;
+
+protected:
+    // The number of frames the CPU can record/submit before waiting on the GPU
+    uint32_t framesInFlight = 2;
+    // The number of frames which have been submitted, and the number known to have finished
+    uint64_t submittedFrames = 0, completedFrames = 0;
+    // Resources waiting for the frames using them to finish before they are destroyed (oldest first)
+    std::deque<RetiredResources> retired;
+    // The layout the render targets are left in once rendering finishes
+    vk::ImageLayout targetFinalLayout = vk::ImageLayout::presentSrcKHR;
+    // Function pointer which stores a reference to the steps recorded into each frame's command buffer
+    std::function<void (vpp::CommandBuffer&, uint32_t, uint32_t)> customFrameRecordingSteps = {};
+    // Binary semaphores (and the stages which wait on them) the next submission waits for
+    std::vector<std::pair<vk::Semaphore, vk::PipelineStageFlags>> extraWaits;
+
+    // Function pointer which stores a reference to the steps recorded for each partition when recording in parallel
+    std::function<void (vpp::CommandBuffer&, uint8_t, uint32_t)> customParallelRecordingSteps = {};
+    // The number of partitions draw work is split into when recording in parallel
+    uint32_t recordingPartitions = 0;
+    // Worker threads used to record secondary command buffers
+    std::unique_ptr<ThreadPool> recordingThreads;
+    // Command pools owned by each recording thread, one per render buffer [thread][image]
+    std::vector<std::vector<vpp::CommandPool>> threadCommandPools;
+
+    // Optional frame graph which replaces the single render pass when recording
+    std::unique_ptr<RenderGraph> renderGraph;
+    // ID of the swapchain images in the frame graph
+    RenderGraph::ResourceID backbufferID = 0;
+
+    // Optional timestamp profiler which measures the GPU time of each image's commands
+    std::unique_ptr<GPUProfiler> gpuProfiler;
+    // Optional Hi-Z culler which removes occluded instances before they are drawn
+    std::unique_ptr<OcclusionCuller> occlusionCuller;
+
+    // Format of the depth buffer (undefined if depth testing is disabled)
+    vk::Format depthFormat = vk::Format::undefined;
+    // True if the render pass begins with a subpass which only writes depth
+    bool depthPrepass = false;
+    // True while the depth prepass' commands are being recorded
+    bool recordingDepthPrepass = false;
+    // Index of the subpass whose commands are being recorded (UINT32_MAX when not recording)
+    uint32_t recordingSubpass = UINT32_MAX;
+    // Formats of the G-buffer attachments (empty if deferred shading is disabled)
+    std::vector<vk::Format> gBufferFormats;
+    // Layout of the descriptor set the lighting subpass reads the G-buffer (and depth) through
+    vpp::TrDsLayout gBufferLayout;
+    // Layouts of the attachments the render pass was created with (so it can be recreated)
+    std::vector<vk::ImageLayout> renderPassColorLayouts = {vk::ImageLayout::colorAttachmentOptimal}, renderPassInputLayouts;
+    // The layout of the render pass (as of its last creation)
+    RenderPassLayout renderPassLayout;
+
+    // Present modes in order of preference (the first one the surface supports is used, falling back to fifo)
+    std::vector<vk::PresentModeKHR> presentModePreference = {vk::PresentModeKHR::mailbox, vk::PresentModeKHR::fifo};
+    // Limits the rate frames are started at (and tracks frame time statistics)
+    FramePacer framePacer;
 
 protected:
     /// Creates a swapchain CreateInfo from the specified surface.
     ///     Requires <surface> already be set
     vk::SwapchainCreateInfoKHR swapchainProperties(const vk::PhysicalDevice pd, const vk::SurfaceKHR surface, vk::SwapchainKHR oldSwapchain = {});
+    /// Returns the images which are rendered to (one render buffer is created for each)
+    virtual std::vector<vk::Image> targetImages() { return swapchain.images(); }
 
 public:
     using VulkanState::VulkanState;
+    // The device may outlive the state (if it is shared), so make sure none of our frames are still using our resources
+    virtual ~GraphicsState() { if(_device) waitForFrames(); }
 
     /// Gets the width and height of the swapchain.
     ///     Requires <surface> already be set.
     ///     If pd is omitted uses the one bound to the <swapchain>
-    vk::Extent2D swapchainExtent(vk::PhysicalDevice pd = {}, bool ignoreCache = false);
+    virtual vk::Extent2D swapchainExtent(vk::PhysicalDevice pd = {}, bool ignoreCache = false);
     /// Gets the image format of the swapchain.
     ///     Requires <surface> already be set.
     ///     If pd is omitted uses the one bound to the <swapchain>
-    vk::SurfaceFormatKHR swapchainFormat(vk::PhysicalDevice pd = {}, bool ignoreCache = false);
+    virtual vk::SurfaceFormatKHR swapchainFormat(vk::PhysicalDevice pd = {}, bool ignoreCache = false);
     /// Gets the presentation mode of the swapchain.
     ///     Requires <surface> already be set.
     ///     If pd is omitted uses the one bound to the <swapchain>
@@ -156,21 +281,164 @@ public:
     ///     If pd is omitted uses the one bound to the <swapchain>
     uint32_t swapchainImageCount(vk::PhysicalDevice pd = {}, bool ignoreCache = false);
 
+    /// Sets the present modes to use in order of preference (the first one supported is used, falling back to fifo.)
+    ///     fifo waits for vertical blank, fifoRelaxed tears if a frame is late, mailbox replaces queued
+    ///     images without tearing, immediate never waits. Recreates the swapchain (and rerecords the command buffers)
+    void setPresentModePreference(std::vector<vk::PresentModeKHR> modes);
+    /// Limits the rate frames are rendered at (0 = unlimited)
+    void setFrameRateLimit(double fps) { framePacer.setTargetFrameRate(fps); }
+    /// Returns the pacer which limits the frame rate and tracks frame time statistics
+    FramePacer& getFramePacer() { return framePacer; }
+
     /// Recreates the swapchain.
     ///  If a valid deviceInfo is passed in, the swapchain will be recreated with the new physical device.
     ///  If a special version of deviceInfo passed in from the constructor is found, it will let vpp pick a physical device.
+    ///  If a shared device is passed in, the swapchain will be created on it (its present queue must support the surface.)
     ///  If neither of these is the case, it will resize the swapchain to be the same size as the GLFW framebuffer.
     ///  Automatically recreates the render buffers when the swapchain is resized.
     void recreateSwapchain(DeviceCreateInfo deviceInfo = {}, vk::Extent2D = {});
 
     /// Helper to create a simple graphics focused renderpass
+    ///     <inputAttachments> are the layouts the G-buffer attachments are read in by the lighting subpass
+    ///     (shaderReadOnlyOptimal if not provided), they can only be provided when deferred shading is enabled
     void createGraphicsRenderPass(std::vector<vk::ImageLayout> colorAttachments = {vk::ImageLayout::colorAttachmentOptimal}, std::vector<vk::ImageLayout> inputAttachments = {});
+    /// Returns the layout of the render pass, materials created for it can be drawn by any state whose render pass has the same layout
+    const RenderPassLayout& getRenderPassLayout() const { return renderPassLayout; }
+    /// Enables (or disables) depth testing, creating a depth buffer for every render buffer.
+    ///     If <prepass> is set, the render pass begins with a subpass which only writes depth,
+    ///     so that the main subpass only shades the closest fragment of each pixel.
+    ///     Disabling depth disables occlusion culling and deferred shading as well.
+    ///     Recreates the render pass and render buffers; materials must be recreated and command buffers rerecorded
+    void enableDepth(bool enable = true, bool prepass = false, bool requireStencil = false);
+    /// Returns the format of the depth buffers (undefined if depth testing is disabled)
+    vk::Format getDepthFormat() const { return depthFormat; }
+    /// Returns true if the render pass has a depth prepass
+    bool hasDepthPrepass() const { return depthPrepass; }
+    /// Returns true while the commands of the depth prepass are being recorded
+    ///     (the recording steps are called once for the prepass and once for the main subpass)
+    bool inDepthPrepass() const { return recordingDepthPrepass; }
+    /// Returns the index of the subpass color is rendered in (the lighting subpass when shading is deferred)
+    uint32_t colorSubpass() const { return (depthPrepass ? 1 : 0) + (hasDeferredShading() ? 1 : 0); }
+    /// Returns the index of the subpass being recorded (only valid while the recording steps are running)
+    uint32_t currentSubpass() const { return recordingSubpass; }
+    /// Returns true while the commands of the color subpass are being recorded
+    bool inColorSubpass() const { return recordingSubpass == colorSubpass(); }
+
+    /// Enables (or disables) deferred shading. Requires depth to be enabled.
+    ///     A G-buffer subpass, writing an attachment of each of the <gBufferFormats> (ex albedo and normals) along
+    ///     with depth, is added before the color subpass; which becomes a lighting subpass reading them back as input
+    ///     attachments (see <getGBufferLayout>), so every pixel is only shaded once. The G-buffer never leaves the
+    ///     render pass, so it is transient and lazily allocated (on tile based GPUs it never leaves tile memory.)
+    ///     Depth is read only in the lighting subpass, forward materials (ex transparent ones) may still test against it.
+    ///     Recreates the render pass and render buffers; materials must be recreated and command buffers rerecorded
+    void enableDeferredShading(bool enable = true, std::vector<vk::Format> gBufferFormats = {vk::Format::r8g8b8a8Unorm, vk::Format::r16g16b16a16Sfloat});
+    /// Returns true if shading is deferred
+    bool hasDeferredShading() const { return !gBufferFormats.empty(); }
+    /// Returns the formats of the G-buffer attachments (empty if shading isn't deferred)
+    const std::vector<vk::Format>& getGBufferFormats() const { return gBufferFormats; }
+    /// Returns the index of the subpass the G-buffer is written in
+    uint32_t gBufferSubpass() const { return depthPrepass ? 1 : 0; }
+    /// Returns true while the commands of the G-buffer subpass are being recorded
+    bool inGBufferPass() const { return hasDeferredShading() && recordingSubpass == gBufferSubpass(); }
+    /// Returns the layout of the descriptor set the lighting subpass reads the G-buffer through
+    ///     (an input attachment for each G-buffer attachment, followed by one for depth)
+    const vpp::TrDsLayout& getGBufferLayout() const { return gBufferLayout; }
+    /// Returns the descriptor set the lighting subpass reads an image's G-buffer through
+    vk::DescriptorSet getGBufferDescriptors(uint32_t image) const { return renderBuffers[image].gBufferDescriptors; }
+    /// Returns the GLSL declaring the G-buffer's input attachments (as descriptor set <set>; gBuffer0, gBuffer1, ... and gBufferDepth),
+    ///     to be placed after a lighting fragment shader's #version
+    str gBufferGLSL(uint32_t set = 0) const;
+
     /// Function which sets up all of the data stored in the <renderBuffers>
+    ///     (and the <frames> if the number of frames in flight changed)
     void recreateRenderBuffers();
+    /// Function which sets up all of the data stored in the <frames>
+    void recreateFrames();
+
+    /// Gets the number of frames the CPU can run ahead of the GPU
+    uint32_t getFramesInFlight() const { return framesInFlight; }
+    /// Returns the number of frames which have been submitted
+    uint64_t submittedValue() const override { return submittedFrames; }
+    /// Returns the number of frames which are known to have finished (updated as frames are waited on)
+    uint64_t completedValue() const { return completedFrames; }
+    /// Sets the number of frames the CPU can run ahead of the GPU (typically 2)
+    ///     Independent of the number of images in the swapchain
+    void setFramesInFlight(uint32_t count);
+
+    /// Set any custom steps which need to be recorded to the current frame's command buffer.
+    ///     The provided function is called every frame (with the frame and image index)
+    ///     and its commands are submitted before the image's pre-recorded commands.
+    void bindCustomFrameRecordingSteps(std::function<void (vpp::CommandBuffer&, uint32_t, uint32_t)> _new) { customFrameRecordingSteps = _new; }
+    /// Makes the next submitted frame wait (at <stage>) for a binary semaphore signaled by other work (ex another library's uploads)
+    void addWaitSemaphore(vk::Semaphore semaphore, vk::PipelineStageFlags stage) { extraWaits.push_back({semaphore, stage}); }
+
+    /// Switches command buffer recording into parallel mode.
+    ///     Draw work is split into <partitions> pieces which are recorded into secondary command
+    ///     buffers by a pool of <threads> workers (0 = one per core), each with its own command pools.
+    ///     The provided function is called with the secondary buffer, the image index, and the partition
+    ///     it should record; it replaces the custom command recording steps while bound.
+    ///     Command buffers must be rerecorded when this is changed
+    void bindParallelCommandRecordingSteps(uint32_t partitions, std::function<void (vpp::CommandBuffer&, uint8_t, uint32_t)> _new, uint32_t threads = 0);
+    /// Switches command buffer recording back to serially recording inline commands
+    void unbindParallelCommandRecordingSteps();
+    /// Returns true if command buffers are recorded in parallel
+    bool recordingInParallel() const { return customParallelRecordingSteps && recordingPartitions > 0; }
+
+    /// Creates a frame graph for this state (replacing any existing one.)
+    ///     The swapchain's images are imported into the graph as <backbuffer>.
+    ///     The graph is recorded instead of the state's render pass, it must be compiled before the command buffers are (re)recorded.
+    RenderGraph& createRenderGraph();
+    /// Returns the state's frame graph (or nullptr if one hasn't been created)
+    RenderGraph* getRenderGraph() { return renderGraph.get(); }
+    /// Returns the ID of the swapchain's images in the frame graph
+    RenderGraph::ResourceID backbuffer() const { return backbufferID; }
+    /// Binds the current swapchain images to the frame graph and compiles it.
+    ///     Automatically called when the render buffers are recreated
+    void compileRenderGraph();
+
+    /// Enables (or disables) measuring GPU time with timestamp queries.
+    ///     Scopes are placed around the render pass (or frame graph), and can be added
+    ///     while recording with a GPUProfiler::Scope. Returns the profiler (null if disabled)
+    ///     Command buffers must be rerecorded when profiling is enabled (disabling rerecords them automatically)
+    GPUProfiler* enableGPUProfiling(bool enable = true);
+    /// Returns the state's GPU profiler (or nullptr if profiling isn't enabled)
+    GPUProfiler* getGPUProfiler() const { return gpuProfiler.get(); }
+
+    /// Enables (or disables) Hi-Z occlusion culling. Requires depth to be enabled.
+    ///     Meshes with bounds are culled against a pyramid built from the previous frame's depth and drawn indirectly,
+    ///     the camera must be provided every frame with OcclusionCuller::setViewProjection. Returns the culler (null if disabled)
+    ///     Recreates the render pass and render buffers; command buffers must be rerecorded
+    OcclusionCuller* enableOcclusionCulling(bool enable = true);
+    /// Returns the state's occlusion culler (or nullptr if culling isn't enabled)
+    OcclusionCuller* getOcclusionCuller() const { return occlusionCuller.get(); }
 
     /// Function which records to the command buffers
     ///     Is automatically called after a pipeline is bound
     virtual bool rerecordCommandBuffers();
+
+protected:
+    /// Records the secondary command buffers of every render buffer using the recording threads
+    ///     (one set of partitions for each subpass)
+    void recordSecondaryCommandBuffers();
+    /// Records the commands of every subpass into the primary buffer of an image (the render pass must have begun)
+    void recordSubpasses(uint32_t image, bool parallel);
+
+    /// Moves the render buffers (and the provided swapchain) into the retired list,
+    ///     they are destroyed once every frame submitted so far finishes
+    void retire(vpp::Swapchain oldSwapchain = {});
+    /// Notes that the frame's last submission finished (its fence signaled), destroying any retired resources it was using
+    void frameFinished(FrameData& frame);
+    /// Waits for every submitted frame to finish (without waiting on other work on the device)
+    void waitForFrames();
+
+    /// Waits until no other frame is rendering to the image and marks the image as used by the frame
+    void waitForImage(FrameData& frame, uint32_t image);
+    /// Records the frame's command buffer and submits it along with the image's pre-recorded commands
+    ///     (followed by any extra command buffers.) Waits on the frame's acquired semaphore and
+    ///     signals its finished semaphore if there is a swapchain.
+    void submitFrame(FrameData& frame, uint32_t f, uint32_t image, std::vector<vk::CommandBuffer> extraCommandBuffers = {});
+
+public:
     /// Function to be called by the main loop every frame
     ///     Implementation needs to handle the case where this object is no longer valid
     ///     Automatically resizes the swapchain when it becomes outdated (ex window resized)
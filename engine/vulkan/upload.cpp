@@ -0,0 +1,348 @@
+#include "upload.hpp"
+#include "engine/util/profiler.hpp"
+
+#include <algorithm>
+
+/// Creates an upload engine on the device's dedicated transfer queue (if it has one.)
+///     Uploaded data will be consumed by the provided queue family (defaults to the present queue's)
+UploadEngine::UploadEngine(const VulkDevice& _device, uint32_t _dstFamily, vk::DeviceSize stagingCapacity)
+  : device(_device), dstFamily(_dstFamily), staging(_device, stagingCapacity) {
+    if(dstFamily == UINT32_MAX) dstFamily = device.presentQueueExcept()->family();
+
+    // Without timeline semaphores there is no cheap way for graphics to wait on the transfer queue
+    timelineSupported = device.timelineSemaphores;
+    queue = timelineSupported ? device.dedicatedTransferQueue() : nullptr;
+    if(!queue){
+        dlg_info("No dedicated transfer queue (or timeline semaphores) available, uploads will be submitted on the graphics queue");
+        queue = device.queue(dstFamily);
+    }
+
+    commandPool = {device, {vk::CommandPoolCreateBits::transient, queue->family()}};
+
+    if(timelineSupported){
+        vk::SemaphoreTypeCreateInfo typeInfo {vk::SemaphoreType::timeline, /*initialValue*/ 0};
+        vk::SemaphoreCreateInfo info;
+        info.pNext = &typeInfo;
+        timeline = vk::createSemaphore(device.vkHandle(), info);
+    }
+}
+
+UploadEngine::~UploadEngine(){
+    // Make sure nothing is still reading the staging buffers
+    if(lastSubmitted) wait(lastSubmitted);
+    if(timeline) vk::destroySemaphore(device.vkHandle(), timeline);
+}
+
+/// Queues a copy of the provided data into the buffer.
+void UploadEngine::upload(vpp::BufferSpan buffer, nytl::span<const std::byte> data, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess, uint32_t family){
+    if(data.empty()) return;
+    if(family == UINT32_MAX) family = dstFamily;
+    PROFILE_SCOPE("upload");
+
+    // Large uploads are split so that they can stream through the ring
+    vk::DeviceSize chunkSize = staging.capacity() / 4;
+    for(vk::DeviceSize offset = 0; offset < data.size(); offset += chunkSize){
+        vk::DeviceSize size = std::min<vk::DeviceSize>(chunkSize, data.size() - offset);
+
+        // Copy the data into the staging ring
+        StagingRing::Allocation allocation = allocateStaging(size);
+        memcpy(allocation.data, data.data() + offset, size);
+
+        // Start a new command buffer if we aren't already recording one
+        beginRecording();
+
+        vk::BufferCopy region {allocation.offset, buffer.offset() + offset, size};
+        vk::cmdCopyBuffer(recording, allocation.buffer, buffer.buffer(), nytl::make_span(region));
+    }
+    bytesUploaded += data.size();
+
+    // Describe the ownership transfer from the transfer family to the consuming family
+    vk::BufferMemoryBarrier barrier;
+    barrier.srcAccessMask = vk::AccessBits::transferWrite;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = queue->family() == family ? VK_QUEUE_FAMILY_IGNORED : queue->family();
+    barrier.dstQueueFamilyIndex = queue->family() == family ? VK_QUEUE_FAMILY_IGNORED : family;
+    barrier.buffer = buffer.buffer();
+    barrier.offset = buffer.offset();
+    barrier.size = data.size();
+    recordingAcquires.push_back({barrier, dstStage, family});
+}
+
+/// Queues copies of the provided regions into the image.
+///     If <generateMips> is set, the levels of the range after the first are blitted from it once the image is acquired
+void UploadEngine::uploadImage(vk::Image image, const std::vector<ImageRegion>& regions, vk::ImageSubresourceRange range, bool generateMips,
+  vk::ImageLayout finalLayout, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess){
+    if(regions.empty()) return;
+    PROFILE_SCOPE("upload image");
+
+    // The whole image is moved into the transfer destination layout (its old contents are discarded)
+    beginRecording();
+    vk::ImageMemoryBarrier toTransfer {/*srcAccess*/ {}, vk::AccessBits::transferWrite, vk::ImageLayout::undefined, vk::ImageLayout::transferDstOptimal,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image, range};
+    vk::cmdPipelineBarrier(recording, vk::PipelineStageBits::topOfPipe, vk::PipelineStageBits::transfer, {}, {}, {}, nytl::make_span(toTransfer));
+
+    // Copies tightly packed data into a part of the image through the staging ring
+    auto copyRegion = [&](nytl::span<const std::byte> data, vk::ImageSubresourceLayers subresource, vk::Offset3D offset, vk::Extent3D extent){
+        // The copy's source offset must be aligned to the texel (block) size, 16 covers every format
+        StagingRing::Allocation allocation = allocateStaging(data.size(), 16);
+        memcpy(allocation.data, data.data(), data.size());
+        // Allocating may have submitted the recording (the layout transition is already ahead of it in the queue)
+        beginRecording();
+
+        vk::BufferImageCopy copy {allocation.offset, /*rowLength*/ 0, /*imageHeight*/ 0, subresource, offset, extent};
+        vk::cmdCopyBufferToImage(recording, allocation.buffer, image, vk::ImageLayout::transferDstOptimal, nytl::make_span(copy));
+    };
+
+    // Large regions are split into rows (of blocks) so that they can stream through the ring, like buffers
+    vk::DeviceSize chunkSize = staging.capacity() / 4;
+    for(const ImageRegion& region: regions){
+        bytesUploaded += region.data.size();
+        if(region.data.size() <= chunkSize){
+            copyRegion(region.data, region.subresource, {0, 0, 0}, region.extent);
+            continue;
+        }
+
+        // The data is made of a slice for each layer (and depth), each holding the same number of tightly packed rows
+        uint32_t blockHeight = std::max(region.blockHeight, 1u);
+        uint32_t rows = (region.extent.height + blockHeight - 1) / blockHeight;
+        uint32_t slices = region.subresource.layerCount * region.extent.depth;
+        vk::DeviceSize rowBytes = region.data.size() / slices / rows;
+        // A row can't be split, so each must fit in the ring (along with its alignment padding)
+        if(rowBytes + 15 > staging.capacity())
+            throw std::runtime_error("Image row of " + str(rowBytes) + " bytes doesn't fit in the staging ring.");
+        uint32_t rowsPerChunk = (uint32_t) std::max<vk::DeviceSize>(chunkSize / rowBytes, 1);
+
+        for(uint32_t slice = 0; slice < slices; slice++)
+            for(uint32_t row = 0; row < rows; row += rowsPerChunk){
+                uint32_t count = std::min(rowsPerChunk, rows - row);
+                vk::ImageSubresourceLayers subresource = region.subresource;
+                subresource.baseArrayLayer += slice / region.extent.depth;
+                subresource.layerCount = 1;
+
+                uint32_t y = row * blockHeight;
+                vk::Offset3D offset {0, (int32_t) y, (int32_t) (slice % region.extent.depth)};
+                vk::Extent3D extent {region.extent.width, std::min(count * blockHeight, region.extent.height - y), 1};
+                vk::DeviceSize start = (vk::DeviceSize(slice) * rows + row) * rowBytes;
+                copyRegion({region.data.data() + start, count * rowBytes}, subresource, offset, extent);
+            }
+    }
+
+    // Describe the ownership transfer to the consuming family, generated mips are blitted while still in the transfer layout
+    uint32_t generateLevels = (generateMips && range.levelCount > 1 ? range.levelCount : 0);
+    vk::ImageMemoryBarrier barrier {vk::AccessBits::transferWrite, dstAccess, vk::ImageLayout::transferDstOptimal, (generateLevels ? vk::ImageLayout::transferDstOptimal : finalLayout),
+        queue->family() == dstFamily ? VK_QUEUE_FAMILY_IGNORED : queue->family(),
+        queue->family() == dstFamily ? VK_QUEUE_FAMILY_IGNORED : dstFamily, image, range};
+    if(generateLevels) barrier.dstAccessMask = vk::AccessBits::transferRead | vk::AccessBits::transferWrite;
+    recordingImageAcquires.push_back({barrier, dstStage, dstAccess, finalLayout, regions.front().extent, generateLevels});
+}
+
+/// Starts recording a new command buffer if one isn't already being recorded
+void UploadEngine::beginRecording(){
+    if(recording) return;
+    recording = commandPool.allocate();
+    vk::beginCommandBuffer(recording, {vk::CommandBufferUsageBits::oneTimeSubmit});
+}
+
+/// Allocates space from the staging ring, submitting the current recording and waiting
+///     for older submissions to finish if the ring is full (throws if it can't fit even once the ring is empty)
+StagingRing::Allocation UploadEngine::allocateStaging(vk::DeviceSize size, vk::DeviceSize alignment){
+    while(true){
+        if(std::optional<StagingRing::Allocation> allocation = staging.allocate(size, alignment))
+            return *allocation;
+
+        // Submit what we have recorded so far so that its space can be reclaimed...
+        if(!staging.allRetired()) flush();
+        // If nothing is using the ring the allocation (with its alignment padding) can never fit
+        else if(staging.empty())
+            throw std::runtime_error("Staging allocation of " + str(size) + " bytes (aligned to " + str(alignment) + ") doesn't fit in the staging ring of " + str(staging.capacity()) + " bytes.");
+        // Otherwise wait for the oldest submission still using the ring
+        else {
+            wait(staging.oldestValue());
+            collect();
+        }
+    }
+}
+
+/// Submits all of the queued copies.
+///     Returns the timeline value which will be signaled once they finish (0 if nothing was queued)
+uint64_t UploadEngine::flush(){
+    PROFILE_SCOPE("upload flush");
+    // Clean up anything which has finished while we are here
+    collect();
+    if(!recording) return 0;
+
+    // Release ownership of the buffers (only needed for the ones going to another family)
+    std::vector<vk::BufferMemoryBarrier> releases;
+    for(Acquire& acquire: recordingAcquires){
+        if(acquire.barrier.srcQueueFamilyIndex == VK_QUEUE_FAMILY_IGNORED) continue;
+        releases.push_back(acquire.barrier);
+        // The destination access is performed by the acquire
+        releases.back().dstAccessMask = {};
+    }
+    std::vector<vk::ImageMemoryBarrier> imageReleases;
+    for(ImageAcquire& acquire: recordingImageAcquires){
+        if(acquire.barrier.srcQueueFamilyIndex == VK_QUEUE_FAMILY_IGNORED) continue;
+        imageReleases.push_back(acquire.barrier);
+        imageReleases.back().dstAccessMask = {};
+    }
+    if(!releases.empty() || !imageReleases.empty())
+        vk::cmdPipelineBarrier(recording, vk::PipelineStageBits::transfer, vk::PipelineStageBits::bottomOfPipe, {}, {}, releases, imageReleases);
+    vk::endCommandBuffer(recording);
+
+    uint64_t value = ++lastSubmitted;
+    submissions++;
+
+    vk::SubmitInfo submit;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &recording.vkHandle();
+    if(timelineSupported){
+        // Signal the timeline with this submission's value
+        vk::TimelineSemaphoreSubmitInfo timelineInfo;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &value;
+        submit.pNext = &timelineInfo;
+        submit.signalSemaphoreCount = 1;
+        submit.pSignalSemaphores = &timeline;
+        vk::queueSubmit(queue->vkHandle(), nytl::make_span(submit), {});
+    } else {
+        // Otherwise block until the copies are finished
+        vpp::Fence fence(device);
+        vk::queueSubmit(queue->vkHandle(), nytl::make_span(submit), fence.vkHandle());
+        device.waitForFence(fence.vkHandle());
+    }
+
+    // The destination queues still need to acquire (or at least wait on) the buffers
+    for(Acquire& acquire: recordingAcquires) pendingAcquires.emplace_back(value, acquire);
+    recordingAcquires.clear();
+    for(ImageAcquire& acquire: recordingImageAcquires) pendingImageAcquires.emplace_back(value, acquire);
+    recordingImageAcquires.clear();
+
+    // The staging space can be reused once this submission finishes
+    staging.retire(value);
+    inFlight.push_back({value, std::move(recording)});
+    recording = {};
+    return value;
+}
+
+/// Returns the highest timeline value the GPU has finished
+uint64_t UploadEngine::completedValue() const {
+    // Without timelines every submission is finished by the time flush returns
+    if(!timelineSupported) return lastSubmitted;
+    return vk::getSemaphoreCounterValue(device.vkHandle(), timeline);
+}
+
+/// Blocks until the submission with the specified value has finished
+void UploadEngine::wait(uint64_t value) const {
+    if(!timelineSupported || value == 0) return;
+
+    vk::SemaphoreWaitInfo info;
+    info.semaphoreCount = 1;
+    info.pSemaphores = &timeline;
+    info.pValues = &value;
+    vk::waitSemaphores(device.vkHandle(), info, UINT64_MAX);
+}
+
+/// Returns true if there are buffers (or images) whose ownership still needs to be acquired by the family
+bool UploadEngine::hasPendingAcquires(uint32_t family) const {
+    if(family == UINT32_MAX) family = dstFamily;
+    // Images are always handed to the destination family
+    if(family == dstFamily && !pendingImageAcquires.empty()) return true;
+    return std::any_of(pendingAcquires.begin(), pendingAcquires.end(), [family](auto& pending){ return pending.second.family == family; });
+}
+
+/// Records the acquire half of the queue family ownership transfers to <family> into a command buffer
+///     which will run on that family.
+uint64_t UploadEngine::recordAcquires(vk::CommandBuffer cb, uint32_t family){
+    if(family == UINT32_MAX) family = dstFamily;
+    if(!hasPendingAcquires(family)) return 0;
+
+    // Acquires for other families stay pending until those families record them
+    auto others = std::stable_partition(pendingAcquires.begin(), pendingAcquires.end(), [family](auto& pending){ return pending.second.family == family; });
+    // Images are always handed to the destination family
+    std::vector<std::pair<uint64_t, ImageAcquire>> images;
+    if(family == dstFamily) images.swap(pendingImageAcquires);
+
+    uint64_t value = 0;
+    vk::PipelineStageFlags dstStages = {};
+    std::vector<vk::BufferMemoryBarrier> barriers;
+    for(auto it = pendingAcquires.begin(); it != others; it++){
+        auto& [submission, acquire] = *it;
+        barriers.push_back(acquire.barrier);
+        // The transfer queue already made the writes available
+        if(barriers.back().srcQueueFamilyIndex != VK_QUEUE_FAMILY_IGNORED) barriers.back().srcAccessMask = {};
+        dstStages |= acquire.dstStage;
+        value = std::max(value, submission);
+    }
+    std::vector<vk::ImageMemoryBarrier> imageBarriers;
+    for(auto& [submission, acquire]: images){
+        imageBarriers.push_back(acquire.barrier);
+        if(imageBarriers.back().srcQueueFamilyIndex != VK_QUEUE_FAMILY_IGNORED) imageBarriers.back().srcAccessMask = {};
+        dstStages |= (acquire.generateLevels ? vk::PipelineStageBits::transfer : acquire.dstStage);
+        value = std::max(value, submission);
+    }
+    vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, dstStages, {}, {}, barriers, imageBarriers);
+
+    // Fill the remaining levels of any images which need mips by blitting each level from the one before it
+    for(auto& [submission, acquire]: images){
+        if(!acquire.generateLevels) continue;
+        vk::Image image = acquire.barrier.image;
+        vk::ImageSubresourceRange range = acquire.barrier.subresourceRange;
+
+        vk::Extent3D extent = acquire.extent;
+        for(uint32_t level = range.baseMipLevel + 1; level < range.baseMipLevel + acquire.generateLevels; level++){
+            // The previous level becomes the blit's source
+            vk::ImageMemoryBarrier toSource {vk::AccessBits::transferWrite, vk::AccessBits::transferRead, vk::ImageLayout::transferDstOptimal, vk::ImageLayout::transferSrcOptimal,
+                VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image, {range.aspectMask, level - 1, 1, range.baseArrayLayer, range.layerCount}};
+            vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, vk::PipelineStageBits::transfer, {}, {}, {}, nytl::make_span(toSource));
+
+            vk::Extent3D next {std::max(extent.width / 2, 1u), std::max(extent.height / 2, 1u), std::max(extent.depth / 2, 1u)};
+            vk::ImageBlit blit;
+            blit.srcSubresource = {range.aspectMask, level - 1, range.baseArrayLayer, range.layerCount};
+            blit.srcOffsets[1] = {(int32_t) extent.width, (int32_t) extent.height, (int32_t) extent.depth};
+            blit.dstSubresource = {range.aspectMask, level, range.baseArrayLayer, range.layerCount};
+            blit.dstOffsets[1] = {(int32_t) next.width, (int32_t) next.height, (int32_t) next.depth};
+            vk::cmdBlitImage(cb, image, vk::ImageLayout::transferSrcOptimal, image, vk::ImageLayout::transferDstOptimal, nytl::make_span(blit), vk::Filter::linear);
+            extent = next;
+        }
+
+        // Every level but the last was a blit source
+        uint32_t last = range.baseMipLevel + acquire.generateLevels - 1;
+        vk::ImageMemoryBarrier toFinal[] = {
+            {vk::AccessBits::transferRead, acquire.dstAccess, vk::ImageLayout::transferSrcOptimal, acquire.finalLayout,
+                VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image, {range.aspectMask, range.baseMipLevel, acquire.generateLevels - 1, range.baseArrayLayer, range.layerCount}},
+            {vk::AccessBits::transferWrite, acquire.dstAccess, vk::ImageLayout::transferDstOptimal, acquire.finalLayout,
+                VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, image, {range.aspectMask, last, 1, range.baseArrayLayer, range.layerCount}}};
+        vk::cmdPipelineBarrier(cb, vk::PipelineStageBits::transfer, acquire.dstStage, {}, {}, {}, toFinal);
+    }
+
+    pendingAcquires.erase(pendingAcquires.begin(), others);
+    return value;
+}
+
+/// Frees the staging memory of every submission which has finished
+void UploadEngine::collect(){
+    uint64_t completed = completedValue();
+    while(!inFlight.empty() && inFlight.front().value <= completed)
+        inFlight.pop_front();
+    staging.reclaim(completed);
+}
+
+/// Returns the upload engine of the device (it will be flushed along with the batch)
+UploadEngine& UploadBatch::engine(const VulkDevice& device){
+    UploadEngine& engine = device.uploadEngine();
+    if(std::find(engines.begin(), engines.end(), &engine) == engines.end()) engines.push_back(&engine);
+    return engine;
+}
+
+/// Submits the copies queued on every engine.
+///     Frames rendered afterwards wait for the copies on the GPU, the returned tickets
+///     only need to be waited on if the CPU needs to know the copies have finished
+std::vector<UploadTicket> UploadBatch::flush(){
+    std::vector<UploadTicket> tickets;
+    for(UploadEngine* engine: engines)
+        if(uint64_t value = engine->flush())
+            tickets.emplace_back(*engine, value);
+
+    engines.clear();
+    return tickets;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "common.hpp"
+#include "staging.hpp"
+
+#include <deque>
+
+/// Class which records buffer uploads on the device's dedicated transfer queue.
+///     Copies are collected until <flush> submits them, signaling a timeline semaphore
+///     which graphics submissions wait on. Since the transfer and graphics queues belong
+///     to different families, ownership of every uploaded buffer is released by the transfer
+///     queue and then acquired on the graphics queue (see <recordAcquires>.) Buffers can instead
+///     be handed to another family (ex a dedicated compute queue's) which acquires them itself.
+///     If the device lacks timeline semaphores, uploads are submitted to the graphics queue
+///     and <flush> blocks until they finish.
+///     Images are copied the same way; transfer queues can't blit, so any mips which need to be
+///     generated are blitted on the destination queue when the image is acquired.
+///     Staging data is written into a persistently mapped <StagingRing>, uploads larger than
+///     a quarter of the ring are split into chunks which stream through it.
+class UploadEngine {
+public:
+    // A region of an image (one mip level of some of its layers) and the tightly packed data copied into it
+    struct ImageRegion {
+        nytl::span<const std::byte> data;
+        vk::ImageSubresourceLayers subresource;
+        vk::Extent3D extent;
+        // Height (in texels) of the format's blocks, regions too large to stage at once are split into rows of blocks
+        uint32_t blockHeight = 1;
+    };
+
+protected:
+    // Data tracked for each flushed submission until it finishes
+    struct Submission {
+        uint64_t value;
+        vpp::CommandBuffer commandBuffer;
+    };
+    // A buffer which needs to be acquired by the destination queue family
+    struct Acquire {
+        vk::BufferMemoryBarrier barrier;
+        vk::PipelineStageFlags dstStage;
+        // The family which acquires the buffer (even when it is the transfer queue's own)
+        uint32_t family;
+    };
+    // An image which needs to be acquired by the destination queue family (and possibly have its mips generated)
+    struct ImageAcquire {
+        vk::ImageMemoryBarrier barrier;
+        vk::PipelineStageFlags dstStage;
+        vk::AccessFlags dstAccess;
+        // The layout the image ends up in
+        vk::ImageLayout finalLayout;
+        // Size of the first level, and the number of levels to fill by blitting from it (0 if none)
+        vk::Extent3D extent;
+        uint32_t generateLevels;
+    };
+
+    const VulkDevice& device;
+    // Queue the copies are submitted to, and the family which consumes the uploaded data (unless another is requested)
+    const vpp::Queue* queue;
+    uint32_t dstFamily;
+    bool timelineSupported;
+
+    vpp::CommandPool commandPool;
+    // Ring the staging data is sub-allocated from
+    StagingRing staging;
+    // Timeline semaphore signaled with the value of each submission
+    vk::Semaphore timeline = {};
+    uint64_t lastSubmitted = 0;
+
+    // The command buffer currently being recorded
+    vpp::CommandBuffer recording;
+    std::vector<Acquire> recordingAcquires;
+    std::vector<ImageAcquire> recordingImageAcquires;
+
+    // Submissions which haven't been confirmed as finished
+    std::deque<Submission> inFlight;
+    // Acquire barriers (and the value they become valid at) which haven't been recorded on the destination queue
+    std::vector<std::pair<uint64_t, Acquire>> pendingAcquires;
+    std::vector<std::pair<uint64_t, ImageAcquire>> pendingImageAcquires;
+
+    // Statistics
+    uint64_t bytesUploaded = 0, submissions = 0;
+
+public:
+    /// Creates an upload engine on the device's dedicated transfer queue (if it has one.)
+    ///     Uploaded data will be consumed by the provided queue family (defaults to the present queue's)
+    UploadEngine(const VulkDevice& device, uint32_t dstFamily = UINT32_MAX, vk::DeviceSize stagingCapacity = 64 * 1024 * 1024);
+    ~UploadEngine();
+    UploadEngine(const UploadEngine&) = delete;
+    UploadEngine& operator=(const UploadEngine&) = delete;
+
+    /// Queues a copy of the provided data into the buffer.
+    ///     The buffer must be marked as a vk::BufferUsageBits::transferDst.
+    ///     The stage/access mask describe how the buffer will first be used once uploaded.
+    ///     Ownership is handed to <dstFamily> (defaults to the engine's destination family), which must record the acquire.
+    ///     The copy isn't submitted until <flush> is called (unless the staging ring fills up)
+    void upload(vpp::BufferSpan buffer, nytl::span<const std::byte> data,
+        vk::PipelineStageFlags dstStage = vk::PipelineStageBits::vertexInput, vk::AccessFlags dstAccess = vk::AccessBits::vertexAttributeRead | vk::AccessBits::indexRead, uint32_t dstFamily = UINT32_MAX);
+    template <typename T>
+    void upload(vpp::BufferSpan buffer, const std::vector<T>& data,
+      vk::PipelineStageFlags dstStage = vk::PipelineStageBits::vertexInput, vk::AccessFlags dstAccess = vk::AccessBits::vertexAttributeRead | vk::AccessBits::indexRead, uint32_t dstFamily = UINT32_MAX)
+    { upload(buffer, {(const std::byte*) data.data(), data.size() * sizeof(T)}, dstStage, dstAccess, dstFamily); }
+    /// Queues copies of the provided regions into the image.
+    ///     The image must be marked as a vk::ImageUsageBits::transferDst, <range> covers every level and layer which will be written.
+    ///     Regions larger than a quarter of the staging ring are split into rows (of blocks) which stream through it.
+    ///     If <generateMips> is set, the levels of the range after the first are blitted from it once the image is acquired
+    ///     (the image must also be a transferSrc and its format must support linear blits.)
+    ///     The image is left in <finalLayout>, ready to be used at the stage/access mask (by the engine's destination family)
+    void uploadImage(vk::Image image, const std::vector<ImageRegion>& regions, vk::ImageSubresourceRange range, bool generateMips = false,
+        vk::ImageLayout finalLayout = vk::ImageLayout::shaderReadOnlyOptimal, vk::PipelineStageFlags dstStage = vk::PipelineStageBits::fragmentShader, vk::AccessFlags dstAccess = vk::AccessBits::shaderRead);
+
+    /// Submits all of the queued copies.
+    ///     Returns the timeline value which will be signaled once they finish (0 if nothing was queued)
+    uint64_t flush();
+
+    /// Returns the highest timeline value the GPU has finished
+    uint64_t completedValue() const;
+    /// Returns the value signaled by the most recent submission
+    uint64_t submittedValue() const { return lastSubmitted; }
+    /// Returns true if the submission with the specified value has finished
+    bool finished(uint64_t value) const { return completedValue() >= value; }
+    /// Blocks until the submission with the specified value has finished
+    void wait(uint64_t value) const;
+    /// Returns the timeline semaphore graphics submissions should wait on (null if timelines aren't supported)
+    vk::Semaphore semaphore() const { return timeline; }
+
+    /// Returns the family uploads are handed to unless another is requested
+    uint32_t destinationFamily() const { return dstFamily; }
+    /// Returns true if there are buffers (or images) whose ownership still needs to be acquired by the family
+    ///     (defaults to the engine's destination family)
+    bool hasPendingAcquires(uint32_t family = UINT32_MAX) const;
+    /// Records the acquire half of the queue family ownership transfers to <family> (defaults to the engine's
+    ///     destination family) into a command buffer which will run on that family (followed by any mip generation,
+    ///     so the destination family must support graphics.) Acquires for other families are left pending.
+    ///     The submission must wait on <semaphore> with (at least) the returned value (0 if nothing was recorded.)
+    uint64_t recordAcquires(vk::CommandBuffer cb, uint32_t family = UINT32_MAX);
+
+    /// Frees the staging memory of every submission which has finished
+    void collect();
+    /// Returns the ring staging data is written to
+    const StagingRing& stagingRing() const { return staging; }
+
+    /// Returns the number of bytes uploaded and the number of queue submissions made
+    std::pair<uint64_t, uint64_t> stats() const { return {bytesUploaded, submissions}; }
+
+protected:
+    /// Allocates space from the staging ring, submitting the current recording and waiting
+    ///     for older submissions to finish if the ring is full (throws if it can't fit even once the ring is empty)
+    StagingRing::Allocation allocateStaging(vk::DeviceSize size, vk::DeviceSize alignment = 16);
+    /// Starts recording a new command buffer if one isn't already being recorded
+    void beginRecording();
+};
+
+/// Handle to a submitted upload which can be waited on.
+///     Waits for the upload to finish when destroyed (unless it has already been waited on)
+struct UploadTicket {
+    // The engine which submitted the upload and the timeline value signaled once it finishes (0 if invalid)
+    const UploadEngine* engine = nullptr;
+    uint64_t value = 0;
+
+    UploadTicket(const UploadEngine& _engine, uint64_t _value) : engine(&_engine), value(_value) {}
+    /// Move constructor marks the other ticket as invalid
+    UploadTicket(UploadTicket&& other) : engine(other.engine), value(other.value) { other.value = 0; }
+    UploadTicket(const UploadTicket&) = delete;
+    ~UploadTicket() { if(value) wait(); }
+
+    /// Returns true if the upload has finished
+    bool finished() const { return !value || engine->finished(value); }
+    /// Wait for the upload represented by this object to finish and mark it as invalidated
+    void wait() { engine->wait(value); value = 0; }
+};
+
+/// Collects the uploads of many resources so that they are submitted together.
+///     Copies are coalesced into the upload engine of each device they target, and <flush>
+///     submits each of those engines once (one command buffer and one submission per device.)
+class UploadBatch {
+protected:
+    // Engines which have had copies queued through this batch
+    std::vector<UploadEngine*> engines;
+
+public:
+    /// Returns the upload engine of the device (it will be flushed along with the batch)
+    UploadEngine& engine(const VulkDevice& device);
+
+    /// Queues a copy of the provided data into the buffer on the device
+    void upload(const VulkDevice& device, vpp::BufferSpan buffer, nytl::span<const std::byte> data,
+        vk::PipelineStageFlags dstStage = vk::PipelineStageBits::vertexInput, vk::AccessFlags dstAccess = vk::AccessBits::vertexAttributeRead | vk::AccessBits::indexRead, uint32_t dstFamily = UINT32_MAX)
+    { engine(device).upload(buffer, data, dstStage, dstAccess, dstFamily); }
+    template <typename T>
+    void upload(const VulkDevice& device, vpp::BufferSpan buffer, const std::vector<T>& data,
+      vk::PipelineStageFlags dstStage = vk::PipelineStageBits::vertexInput, vk::AccessFlags dstAccess = vk::AccessBits::vertexAttributeRead | vk::AccessBits::indexRead, uint32_t dstFamily = UINT32_MAX)
+    { engine(device).upload(buffer, data, dstStage, dstAccess, dstFamily); }
+    /// Queues copies of the provided regions into the image on the device (see UploadEngine::uploadImage)
+    void uploadImage(const VulkDevice& device, vk::Image image, const std::vector<UploadEngine::ImageRegion>& regions, vk::ImageSubresourceRange range, bool generateMips = false,
+        vk::ImageLayout finalLayout = vk::ImageLayout::shaderReadOnlyOptimal, vk::PipelineStageFlags dstStage = vk::PipelineStageBits::fragmentShader, vk::AccessFlags dstAccess = vk::AccessBits::shaderRead)
+    { engine(device).uploadImage(image, regions, range, generateMips, finalLayout, dstStage, dstAccess); }
+
+    /// Submits the copies queued on every engine.
+    ///     Frames rendered afterwards wait for the copies on the GPU, the returned tickets
+    ///     only need to be waited on if the CPU needs to know the copies have finished
+    std::vector<UploadTicket> flush();
+};
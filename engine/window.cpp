@@ -260,6 +260,14 @@ void Window::restore(){
     glfwRestoreWindow(window);
 }
 
+// Synchronizes rendering to the refresh rate of the monitor the window is (most) on
+void Window::syncToRefreshRate(){
+    if(!window) throw WindowNotFound(name);
+
+    setFrameRateLimit(getCurrentMonitor().videoMode()->refreshRate);
+    setPresentModePreference({vk::PresentModeKHR::fifoRelaxed, vk::PresentModeKHR::fifo});
+}
+
 // Recreates the swapchain
 void Window::recreateSwapchain(){
     if(!window) throw WindowNotFound(name);
@@ -46,6 +46,7 @@ protected:
 
 public:
     /// Creates a new window with an attached vulkan rendering surface
+    ///     Pass another state's sharedDevice() as the <deviceInfo> to render with the same device (and share its resources)
     Window(vpp::Instance&, int width = 800, int height = 600, str name = "Project Delta", GraphicsState::DeviceCreateInfo deviceInfo = {}, std::vector<std::pair<int, int>> windowCreationHints = {});
     ~Window();
 
@@ -94,6 +95,11 @@ public:
     /// Restores the window to its normal state if it is maximized or minimized
     void restore();
 
+    /// Synchronizes rendering to the refresh rate of the monitor the window is (most) on.
+    ///     Presents with fifo (relaxed if available, so late frames tear instead of waiting a whole refresh)
+    ///     and paces the CPU to the refresh rate so it doesn't queue frames ahead of the display (reducing latency)
+    void syncToRefreshRate();
+
     void recreateSwapchain();
     // Override to the main loop function which abandons the loop if the window has already been closed or minimized
     virtual bool mainLoop(uint64_t frame) { if(!window || pauseLoop) return false; return GraphicsState::mainLoop(frame); }
@@ -7,8 +7,6 @@
 #define SHADER_DEBUG 0
 #endif
 
-#include "engine/util/timer.h"
-
 #include "engine/window.hpp"
 #include "engine/resource/mesh.hpp"
 #include "engine/resource/material.hpp"
@@ -17,6 +15,7 @@
 #include "engine/math/transform.hpp"
 
 #include "engine/vulkan/shader.hpp"
+#include "engine/util/profiler.hpp"
 
 #include "vpp/trackedDescriptor.hpp"
 
@@ -153,7 +152,7 @@ int main(){
         vk::cmdBindDescriptorSets(buffer, vk::PipelineBindPoint::graphics, triangleMat->getLayout(), 0, nytl::make_span(uboDescriptorSets[i].vkHandle()), /*dynamicOffsets*/ {});
 
         // Bind all of the buffers needed to draw the mesh
-        triangle->rerecordCommandBuffer(buffer);
+        triangle->rerecordCommandBuffer(buffer, w);
     });
     w.rerecordCommandBuffers();
 
@@ -175,4 +174,9 @@ int main(){
     } while(!w.isClosed());
     // Wait for the window's device to idle before terminating the program!
     w.device().waitIdle();
+
+#if PROFILING
+    // Save the CPU profile so it can be inspected in chrome://tracing
+    Profiler::writeChromeTrace("profile.json");
+#endif
 }